@@ -0,0 +1,23 @@
+
+# CMake module to search for liburing library
+#
+# If it's found it sets URING_FOUND to TRUE
+# and following variables are set:
+#    URING_INCLUDE_DIR
+#    URING_LIBRARY
+
+FIND_PATH(URING_INCLUDE_DIR liburing.h 
+    /usr/local/include 
+    /usr/include
+    )
+
+FIND_LIBRARY(URING_LIBRARY NAMES liburing.so PATHS
+    /usr/lib/x86_64-linux-gnu/
+    /usr/local/lib 
+    /usr/lib
+    /usr/lib64
+    )
+
+
+INCLUDE( "FindPackageHandleStandardArgs" )
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( "Uring" DEFAULT_MSG URING_INCLUDE_DIR URING_LIBRARY )
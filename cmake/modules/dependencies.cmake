@@ -139,6 +139,18 @@ IF(CEPH_ENABLED)
     endif(NOT TARGET rados)
 ENDIF(CEPH_ENABLED)
 
+IF(IOURING_ENABLED)
+    if(NOT TARGET uring)
+        find_package(Uring)
+        if(URING_FOUND)
+            add_library(uring SHARED IMPORTED)
+            set_property(TARGET uring PROPERTY IMPORTED_LOCATION ${URING_LIBRARY})
+        else(URING_FOUND)
+            message(FATAL_ERROR "Cannot find extern library liburing")
+        endif(URING_FOUND)
+    endif(NOT TARGET uring)
+ENDIF(IOURING_ENABLED)
+
 # Statique
 
 if(UNITTEST_ENABLED)
@@ -44,6 +44,7 @@ class DataStream;
 #include <string>  // pour std::string
 #include <cstring> // pour memcpy
 #include <algorithm>
+#include <memory>
 
 #include <boost/log/trivial.hpp>
 
@@ -180,6 +181,12 @@ private:
     std::string type;
     std::string encoding;
     unsigned int length;
+
+    /**
+     * Détenteur de la donnée empruntée : si la source a été créée sans copie, #data n'est pas libéré
+     */
+    std::shared_ptr<void> owner;
+    bool borrowed;
     
 public:
     
@@ -193,6 +200,7 @@ public:
         type = t;
         encoding = e;
         length = 0;
+        borrowed = false;
     }
 
     /**
@@ -205,12 +213,26 @@ public:
         type = "";
         encoding = "";
         length = 0;
+        borrowed = false;
+    }
+
+    /**
+     * Constructeur sans copie : la donnée est empruntée et doit rester valide tant que la source est utilisée.
+     * @param o détenteur de la donnée (projection mémoire, autre source...), conservé jusqu'à la libération. Peut être vide si l'appelant garantit lui-même la durée de vie de la donnée
+     */
+    RawDataSource ( const uint8_t *dat, size_t dataS, std::shared_ptr<void> o, std::string t = "", std::string e = ""){
+        data_size = dataS;
+        data = (uint8_t*) dat;
+        owner = o;
+        type = t;
+        encoding = e;
+        length = 0;
+        borrowed = true;
     }
 
     /** Destructeur **/
     virtual ~RawDataSource() {
-        delete[] data;
-        data = 0;
+        release_data();
     }
 
     /** Implémentation de l'interface DataSource **/
@@ -224,9 +246,10 @@ public:
      * @return false
      */
     bool release_data() {
-        if (data)
+        if (data && ! borrowed)
           delete[] data;
         data = 0;
+        owner.reset();
         return true;
     }
 
@@ -57,6 +57,7 @@
 #include "rok4/image/Image.h"
 #include "rok4/enums/Format.h"
 #include "rok4/storage/Context.h"
+#include "rok4/utils/TileIndex.h"
 
 /**
  * \author Institut national de l'information géographique et forestière
@@ -127,6 +128,22 @@ private:
      */
     uint32_t *tiles_sizes;
 
+    /**
+     * \~french \brief Index des tuiles du niveau à compléter à la finalisation, optionnel
+     * \~english \brief Level's tiles index to fill when ending, optionnal
+     */
+    TileIndex* tile_index;
+    /**
+     * \~french \brief Colonne de la tuile supérieure gauche de l'image, dans le niveau
+     * \~english \brief Upper left tile column, in the level
+     */
+    int tile_index_col;
+    /**
+     * \~french \brief Ligne de la tuile supérieure gauche de l'image, dans le niveau
+     * \~english \brief Upper left tile row, in the level
+     */
+    int tile_index_row;
+
 
     /**
      * \~french \brief Écrit l'en-tête TIFF de l'image ROK4
@@ -575,6 +592,26 @@ public:
      */
     int write_image ( Image* pIn );
 
+    /**
+     * \~french
+     * \brief Précise l'index des tuiles du niveau dans lequel référencer les tuiles de cette dalle
+     * \details Les tuiles sont ajoutées à l'index lors de la finalisation de l'écriture. L'écriture de l'index reste à la charge de l'appelant (TileIndex::write), une fois toutes les dalles du niveau écrites.
+     * \param[in] ti index des tuiles du niveau
+     * \param[in] col colonne de la tuile supérieure gauche de la dalle
+     * \param[in] row ligne de la tuile supérieure gauche de la dalle
+     * \~english
+     * \brief Precise the level's tiles index in which this slab's tiles have to be referenced
+     * \details Tiles are added to the index when ending the writting. Caller have to write the index (TileIndex::write), once all level's slabs are written.
+     * \param[in] ti level's tiles index
+     * \param[in] col slab's upper left tile column
+     * \param[in] row slab's upper left tile row
+     */
+    void set_tile_index ( TileIndex* ti, int col, int row ) {
+        tile_index = ti;
+        tile_index_col = col;
+        tile_index_row = row;
+    }
+
     /**
      * \~french
      * \brief Ecrit une dalle ROK4 vecteur, à partir des tuiles PBF
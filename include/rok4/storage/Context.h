@@ -53,10 +53,17 @@
 #include <vector>
 #include <string.h>
 #include <sstream>
+#include <future>
+#include <memory>
+
+#include "rok4/storage/RetryPolicy.h"
 
 #define ROK4_OBJECT_READ_ATTEMPTS "ROK4_OBJECT_READ_ATTEMPTS"
 #define ROK4_OBJECT_WRITE_ATTEMPTS "ROK4_OBJECT_WRITE_ATTEMPTS"
 #define ROK4_OBJECT_ATTEMPTS_WAIT "ROK4_OBJECT_ATTEMPTS_WAIT"
+#define ROK4_OBJECT_WRITE_PART_SIZE "ROK4_OBJECT_WRITE_PART_SIZE"
+#define ROK4_OBJECT_HEDGE_PERCENTILE "ROK4_OBJECT_HEDGE_PERCENTILE"
+#define ROK4_OBJECT_HEDGE_MIN_DELAY "ROK4_OBJECT_HEDGE_MIN_DELAY"
 #define ROK4_NETWORK_TIMEOUT "ROK4_NETWORK_TIMEOUT"
 
 /**
@@ -120,6 +127,45 @@ void split_path(std::string path, ContextType::eContextType& type, std::string&
 
 }
 
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Portion d'objet à lire, pour les lectures groupées
+ * \details Le buffer #data doit être alloué par l'appelant et faire au moins #size octets. Après la lecture, #read_size contient la taille effectivement lue, ou un nombre négatif en cas d'erreur
+ * \~english
+ * \brief Object's range to read, for grouped readings
+ * \details Buffer #data have to be allocated by the caller and to be at least #size bytes long. After reading, #read_size contains the real read size, or a negative integer if an error occured
+ */
+struct ReadRange {
+    /**
+     * \~french \brief Nom de l'objet à lire
+     * \~english \brief Object's name to read
+     */
+    std::string name;
+    /**
+     * \~french \brief Buffer où stocker la donnée lue
+     * \~english \brief Buffer where to store read data
+     */
+    uint8_t* data;
+    /**
+     * \~french \brief À partir d'où on veut lire
+     * \~english \brief From where we want to read
+     */
+    int offset;
+    /**
+     * \~french \brief Nombre d'octet que l'on veut lire
+     * \~english \brief Number of bytes we want to read
+     */
+    int size;
+    /**
+     * \~french \brief Taille effectivement lue, négative en cas d'erreur
+     * \~english \brief Real read size, negative if an error occured
+     */
+    int read_size;
+
+    ReadRange(std::string n, uint8_t* d, int o, int s) : name(n), data(d), offset(o), size(s), read_size(-1) {}
+};
+
 /**
  * \author Institut national de l'information géographique et forestière
  * \~french
@@ -159,6 +205,34 @@ protected:
      */
     int waiting_time;
 
+    /**
+     * \~french \brief Politique de nouvelles tentatives : erreurs retentées, délais, échéance et disjoncteur
+     * \~english \brief Retry policy : retried errors, delays, deadline and breaker
+     */
+    std::shared_ptr<RetryPolicy> retry_policy;
+
+    /**
+     * \~french \brief Taille en octets des parties pour l'écriture d'un objet par morceaux
+     * \details 0 pour écrire les objets en une fois, à la fermeture
+     * \~english \brief Parts size in bytes, to write an object by pieces
+     * \details 0 to write objects at once, when closing
+     */
+    int part_size;
+
+    /**
+     * \~french \brief Percentile des durées de lecture au-delà duquel une lecture est doublée
+     * \details 0 pour ne pas doubler les lectures
+     * \~english \brief Reading durations percentile beyond which a reading is hedged
+     * \details 0 not to hedge readings
+     */
+    int hedge_percentile;
+
+    /**
+     * \~french \brief Délai minimal en millisecondes avant de doubler une lecture
+     * \~english \brief Minimal delay in milliseconds before hedging a reading
+     */
+    int hedge_min_delay;
+
     /**
      * \~french \brief Crée un objet Context
      * \~english \brief Create a Context object
@@ -176,6 +250,25 @@ public:
     void set_waiting_time (int t) {
         if (t < 0) t = 0;
         waiting_time = t;
+        retry_policy->set_delays(t * 1000, t * 1000);
+    }
+
+    /**
+     * \~french \brief Modifie la politique de nouvelles tentatives
+     * \details La politique peut être partagée par plusieurs contextes
+     * \~english \brief Change retry policy
+     * \details Policy can be shared by several contexts
+     */
+    void set_retry_policy (std::shared_ptr<RetryPolicy> p) {
+        if (p) retry_policy = p;
+    }
+
+    /**
+     * \~french \brief Donne la politique de nouvelles tentatives
+     * \~english \brief Get retry policy
+     */
+    std::shared_ptr<RetryPolicy> get_retry_policy () {
+        return retry_policy;
     }
 
     /**
@@ -196,6 +289,37 @@ public:
         write_attempts = a;
     }
 
+    /**
+     * \~french \brief Modifie la taille des parties pour l'écriture par morceaux
+     * \details Les contextes ayant une taille minimale de partie l'imposent
+     * \param[in] s Taille en octets, 0 pour désactiver l'écriture par morceaux
+     * \~english \brief Change parts size for writing by pieces
+     * \details Contexts with a minimal part size enforce it
+     * \param[in] s Size in bytes, 0 to disable writing by pieces
+     */
+    virtual void set_part_size (int s) {
+        if (s < 0) s = 0;
+        part_size = s;
+    }
+
+    /**
+     * \~french \brief Modifie la politique de doublement des lectures
+     * \details Une lecture pas terminée au bout du percentile voulu des durées des dernières lectures (et au moins du délai minimal) est doublée : la première réponse est utilisée, l'autre requête est annulée. Seuls les contextes objet utilisent cette politique
+     * \param[in] percentile Percentile entre 1 et 100, 0 pour désactiver le doublement
+     * \param[in] min_delay Délai minimal en millisecondes
+     * \~english \brief Change readings hedging policy
+     * \details A reading not done after the wanted percentile of the last readings durations (and at least the minimal delay) is hedged : the first response is used, the other request is cancelled. Only object contexts use this policy
+     * \param[in] percentile Percentile between 1 and 100, 0 to disable hedging
+     * \param[in] min_delay Minimal delay in milliseconds
+     */
+    void set_hedging (int percentile, int min_delay) {
+        if (percentile < 0) percentile = 0;
+        if (percentile > 100) percentile = 100;
+        if (min_delay < 0) min_delay = 0;
+        hedge_percentile = percentile;
+        hedge_min_delay = min_delay;
+    }
+
     /**
      * \~french \brief Modifie le nombre de tentative pour l'écriture et la lecture
      * \~english \brief Change attempts number for writtings and readings
@@ -220,6 +344,20 @@ public:
      */
     virtual bool exists(std::string name) = 0;
 
+    /**
+     * \~french \brief Précise si l'objet demandé existe, en distinguant une absence certaine d'une erreur
+     * \details Seule une réponse explicite du stockage (fichier inexistant, HTTP 404) permet de conclure à l'absence. Par défaut, une absence selon #exists n'est pas considérée comme certaine.
+     * \param[in] name Nom de l'objet dont on veut savoir l'existence
+     * \return 1 si l'objet existe, 0 s'il est absent de manière certaine, -1 si on ne peut pas conclure (erreur, stockage indisponible)
+     * \~english \brief Precise if provided object exists, distinguishing a definite absence from an error
+     * \details Only an explicit answer from the storage (no such file, HTTP 404) proves the absence. By default, an absence according to #exists is not considered definite.
+     * \param[in] name Object's name whose existence is asked
+     * \return 1 if the object exists, 0 if it is definitely missing, -1 if unknown (error, unavailable storage)
+     */
+    virtual int check_existence(std::string name) {
+        return exists(name) ? 1 : -1;
+    }
+
     /**
      * \~french \brief Précise si le contexte est connecté
      * \~english \brief Precise if context is connected
@@ -244,6 +382,56 @@ public:
      */
     virtual int read(uint8_t* data, int offset, int size, std::string name) = 0;
 
+    /**
+     * \~french \brief Récupère plusieurs portions de données, dans un ou plusieurs objets
+     * \details Chaque type de stockage sert les lectures le plus efficacement possible (regroupement de lectures contiguës, requêtes parallèles...). L'implémentation par défaut soumet toutes les lectures via #read_async, puis attend leur fin.
+     * \param[in,out] ranges Portions à lire, dont la taille effectivement lue est renseignée
+     * \return Vrai si toutes les portions ont pu être lues
+     * \~english \brief Get several data ranges, from one or several objects
+     * \details Each storage type serves readings as efficiently as possible (contiguous readings merging, parallel requests...). Default implementation submits all readings with #read_async, then waits for them.
+     * \param[in,out] ranges Ranges to read, whose real read size is filled
+     * \return True if all ranges have been read
+     */
+    virtual bool read_ranges(std::vector<ReadRange>& ranges);
+
+    /**
+     * \~french \brief Lance la récupération de la donnée dans l'objet, sans attendre sa fin
+     * \details L'implémentation par défaut fait la lecture de manière synchrone et retourne un résultat déjà disponible
+     * \param[in,out] data Buffer où stocker la donnée lue. Doit être initialisé, assez grand et le rester jusqu'à la disponibilité du résultat
+     * \param[in] offset À partir d'où on veut lire
+     * \param[in] size Nombre d'octet que l'on veut lire
+     * \param[in] name Nom de l'objet que l'on veut lire
+     * \return Taille effectivement lue (un nombre négatif en cas d'erreur), disponible à la fin de la lecture
+     * \~english \brief Start to get the data in the named object, without waiting for the end
+     * \details Default implementation reads synchronously and returns an already available result
+     * \param[in,out] data Buffer where to store read data. Have to be initialized, big enough and kept until the result is available
+     * \param[in] offset From where we want to read
+     * \param[in] size Number of bytes we want to read
+     * \param[in] name Object's name we want to read
+     * \return Real size of read data (negative integer if an error occured), available when reading is done
+     */
+    virtual std::future<int> read_async(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Donne accès à une portion de l'objet sans la copier
+     * \details Seuls les types de stockage pouvant exposer directement la donnée (projection mémoire des fichiers) l'implémentent. L'implémentation par défaut ne donne pas de vue : l'appelant doit alors faire une lecture classique.
+     * \param[out] owner Détenteur de la donnée pointée : la vue reste valide tant qu'il est conservé
+     * \param[in] offset À partir d'où on veut lire
+     * \param[in] size Nombre d'octet que l'on veut lire
+     * \param[in] name Nom de l'objet que l'on veut lire
+     * \return Pointeur vers les #size octets voulus, NULL si la vue n'est pas disponible
+     * \~english \brief Give access to an object range without copy
+     * \details Only storage types which can directly expose data (files memory mapping) implement it. Default implementation gives no view : caller have to do a classic reading.
+     * \param[out] owner Pointed data holder : view is valid while it is kept
+     * \param[in] offset From where we want to read
+     * \param[in] size Number of bytes we want to read
+     * \param[in] name Object's name we want to read
+     * \return Pointer to the #size wanted bytes, NULL if view is not available
+     */
+    virtual const uint8_t* read_view(std::shared_ptr<void>& owner, int offset, int size, std::string name) {
+        return NULL;
+    }
+
 
     /**
      * \~french \brief Récupère l'objet ou fichier en entier
@@ -345,6 +533,16 @@ public:
      */
     virtual void close_connection() = 0;
 
+    /**
+     * \~french \brief Retourne le contexte effectivement connecté au stockage
+     * \details Un contexte en décorant un autre (cache local par exemple) retourne le contexte décoré
+     * \~english \brief Return the context really connected to the storage
+     * \details A context decorating another one (local cache for example) returns the decorated context
+     */
+    virtual Context* get_origin() {
+        return this;
+    }
+
     /**
      * \~french \brief Destructeur
      * \~english \brief Destructor
@@ -0,0 +1,276 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file RetryPolicy.h
+ ** \~french
+ * \brief Définition de la classe RetryPolicy
+ ** \~english
+ * \brief Define classe RetryPolicy
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <chrono>
+
+#define ROK4_OBJECT_RETRY_BASE_DELAY "ROK4_OBJECT_RETRY_BASE_DELAY"
+#define ROK4_OBJECT_RETRY_MAX_DELAY "ROK4_OBJECT_RETRY_MAX_DELAY"
+#define ROK4_OBJECT_RETRY_DEADLINE "ROK4_OBJECT_RETRY_DEADLINE"
+#define ROK4_OBJECT_BREAKER_THRESHOLD "ROK4_OBJECT_BREAKER_THRESHOLD"
+#define ROK4_OBJECT_BREAKER_COOLDOWN "ROK4_OBJECT_BREAKER_COOLDOWN"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Politique de nouvelles tentatives des contextes objet
+ * \details Une politique décide, après l'échec d'une tentative, si une nouvelle tentative est faite et après quel délai :
+ * \li seules les erreurs transitoires sont retentées : erreur réseau, codes HTTP 5xx, 429 et 408. Les autres codes 4xx échouent immédiatement
+ * \li le délai, en millisecondes, suit un recul exponentiel avec gigue décorrélée : tiré au hasard entre le délai de base et trois fois le délai précédent, borné par le délai maximal
+ * \li une échéance optionnelle borne la durée totale d'une requête, nouvelles tentatives comprises
+ *
+ * Elle porte aussi un disjoncteur par cluster de stockage : après un nombre d'échecs transitoires consécutifs, les lectures sur ce cluster échouent immédiatement pendant un temps de repos. Une seule requête d'essai est ensuite autorisée : sa réussite referme le disjoncteur. L'état des disjoncteurs est partagé par tous les contextes.
+ *
+ * Les valeurs par défaut sont lues dans les variables d'environnement. Sans ROK4_OBJECT_RETRY_BASE_DELAY, le délai est constant et vaut ROK4_OBJECT_ATTEMPTS_WAIT secondes, comme auparavant.
+ *
+ * Les méthodes de décision sont virtuelles, pour pouvoir fournir une autre politique à un contexte (Context::set_retry_policy).
+ * \~english
+ * \brief Object contexts retry policy
+ * \details After a failed attempt, a policy decides whether a new attempt is made and after which delay :
+ * \li only transient errors are retried : network error, HTTP codes 5xx, 429 and 408. Other 4xx codes fail at once
+ * \li delay, in milliseconds, follows an exponential backoff with decorrelated jitter : randomly picked between base delay and three times the previous delay, bounded by maximal delay
+ * \li an optional deadline bounds a request's total duration, retries included
+ *
+ * It holds a circuit breaker per storage cluster too : after a number of consecutive transient failures, readings on this cluster fail at once during a cooldown. Only one trial request is then allowed : its success closes the breaker. Breakers state is shared by all contexts.
+ *
+ * Default values are read from environment variables. Without ROK4_OBJECT_RETRY_BASE_DELAY, delay is constant and equals ROK4_OBJECT_ATTEMPTS_WAIT seconds, as before.
+ *
+ * Decision methods are virtual, to provide another policy to a context (Context::set_retry_policy).
+ */
+class RetryPolicy {
+
+public:
+
+    /**
+     * \~french \brief État des tentatives d'une requête
+     * \~english \brief Request's attempts state
+     */
+    struct State {
+        /**
+         * \~french \brief Début de la première tentative
+         * \~english \brief First attempt start
+         */
+        std::chrono::steady_clock::time_point start;
+        /**
+         * \~french \brief Dernier délai utilisé, en millisecondes
+         * \~english \brief Last used delay, in milliseconds
+         */
+        int delay;
+
+        State() : start(std::chrono::steady_clock::now()), delay(0) {}
+    };
+
+protected:
+
+    /**
+     * \~french \brief Délai minimal entre deux tentatives, en millisecondes
+     * \~english \brief Minimal delay between two attempts, in milliseconds
+     */
+    int base_delay;
+
+    /**
+     * \~french \brief Délai maximal entre deux tentatives, en millisecondes
+     * \~english \brief Maximal delay between two attempts, in milliseconds
+     */
+    int max_delay;
+
+    /**
+     * \~french \brief Durée maximale d'une requête, nouvelles tentatives comprises, en millisecondes
+     * \details 0 pour ne pas limiter la durée
+     * \~english \brief Request's maximal duration, retries included, in milliseconds
+     * \details 0 not to bound duration
+     */
+    int deadline;
+
+    /**
+     * \~french \brief Nombre d'échecs transitoires consécutifs ouvrant le disjoncteur d'un cluster
+     * \details 0 pour désactiver le disjoncteur
+     * \~english \brief Consecutive transient failures number opening a cluster's breaker
+     * \details 0 to disable breaker
+     */
+    int breaker_threshold;
+
+    /**
+     * \~french \brief Temps de repos d'un disjoncteur ouvert, en millisecondes
+     * \~english \brief Open breaker cooldown, in milliseconds
+     */
+    int breaker_cooldown;
+
+    /**
+     * \~french \brief État du disjoncteur d'un cluster
+     * \~english \brief Cluster's breaker state
+     */
+    struct Breaker {
+        int failures;
+        std::chrono::steady_clock::time_point open_until;
+
+        Breaker() : failures(0) {}
+    };
+
+    /**
+     * \~french \brief Disjoncteurs, par cluster
+     * \~english \brief Breakers, by cluster
+     */
+    static std::map<std::string, Breaker> breakers;
+
+    /**
+     * \~french \brief Exclusion mutuelle sur les disjoncteurs
+     * \~english \brief Mutual exclusion for breakers
+     */
+    static std::mutex mtx;
+
+public:
+
+    /**
+     * \~french \brief Crée une politique à partir des variables d'environnement
+     * \~english \brief Create a policy from environment variables
+     */
+    RetryPolicy ();
+
+    /**
+     * \~french \brief Crée une politique
+     * \param[in] base Délai minimal en millisecondes
+     * \param[in] max Délai maximal en millisecondes
+     * \param[in] d Durée maximale d'une requête en millisecondes, 0 pour ne pas la limiter
+     * \param[in] threshold Nombre d'échecs ouvrant le disjoncteur, 0 pour le désactiver
+     * \param[in] cooldown Temps de repos du disjoncteur en millisecondes
+     * \~english \brief Create a policy
+     * \param[in] base Minimal delay in milliseconds
+     * \param[in] max Maximal delay in milliseconds
+     * \param[in] d Request's maximal duration in milliseconds, 0 not to bound it
+     * \param[in] threshold Failures number opening the breaker, 0 to disable it
+     * \param[in] cooldown Breaker cooldown in milliseconds
+     */
+    RetryPolicy (int base, int max, int d, int threshold = 0, int cooldown = 5000);
+
+    /**
+     * \~french \brief Modifie les délais entre deux tentatives
+     * \~english \brief Change delays between two attempts
+     */
+    void set_delays (int base, int max) {
+        if (base < 0) base = 0;
+        if (max < base) max = base;
+        base_delay = base;
+        max_delay = max;
+    }
+
+    /**
+     * \~french \brief Modifie la durée maximale d'une requête
+     * \~english \brief Change request's maximal duration
+     */
+    void set_deadline (int d) {
+        if (d < 0) d = 0;
+        deadline = d;
+    }
+
+    /**
+     * \~french \brief Précise si un échec est transitoire et peut être retenté
+     * \param[in] http_code Code HTTP de la réponse, 0 pour une erreur réseau (pas de réponse)
+     * \~english \brief Precise if a failure is transient and can be retried
+     * \param[in] http_code Response HTTP code, 0 for a network error (no response)
+     */
+    virtual bool is_retryable (long http_code);
+
+    /**
+     * \~french \brief Calcule le délai avant la prochaine tentative
+     * \details Gigue décorrélée : tirage entre le délai de base et trois fois le délai précédent, borné par le délai maximal. Le délai est mémorisé dans l'état
+     * \~english \brief Compute the delay before the next attempt
+     * \details Decorrelated jitter : picked between base delay and three times the previous one, bounded by maximal delay. Delay is stored in the state
+     */
+    virtual int get_delay (State& state);
+
+    /**
+     * \~french \brief Décide d'une nouvelle tentative après un échec
+     * \param[in] attempt Numéro de la tentative échouée (à partir de 1)
+     * \param[in] attempts Nombre maximal de tentatives
+     * \param[in] http_code Code HTTP de la réponse, 0 pour une erreur réseau
+     * \param[in,out] state État des tentatives de la requête
+     * \return Délai en millisecondes avant la nouvelle tentative, -1 s'il n'y en a pas (échec définitif, tentatives épuisées ou échéance dépassée)
+     * \~english \brief Decide a new attempt after a failure
+     * \param[in] attempt Failed attempt number (from 1)
+     * \param[in] attempts Maximal attempts number
+     * \param[in] http_code Response HTTP code, 0 for a network error
+     * \param[in,out] state Request's attempts state
+     * \return Delay in milliseconds before the new attempt, -1 if there is none (permanent failure, no more attempts or deadline exceeded)
+     */
+    int next_delay (int attempt, int attempts, long http_code, State& state);
+
+    /**
+     * \~french \brief Précise si une requête peut être envoyée au cluster
+     * \details Faux si le disjoncteur du cluster est ouvert. À la fin du temps de repos, une seule requête d'essai est autorisée
+     * \~english \brief Precise if a request can be sent to the cluster
+     * \details False if the cluster's breaker is open. At the end of the cooldown, only one trial request is allowed
+     */
+    bool is_available (std::string cluster);
+
+    /**
+     * \~french \brief Enregistre le résultat d'une requête vers un cluster
+     * \param[in] cluster Identifiant du cluster
+     * \param[in] http_code Code HTTP de la réponse, 0 pour une erreur réseau
+     * \param[in] success La requête a-t-elle réussi
+     * \~english \brief Record a request result to a cluster
+     * \param[in] cluster Cluster identifier
+     * \param[in] http_code Response HTTP code, 0 for a network error
+     * \param[in] success Did the request succeed
+     */
+    void record (std::string cluster, long http_code, bool success);
+
+    /**
+     * \~french \brief Referme tous les disjoncteurs
+     * \~english \brief Close all breakers
+     */
+    static void reset_breakers ();
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    virtual ~RetryPolicy ();
+};
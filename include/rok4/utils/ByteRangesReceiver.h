@@ -0,0 +1,201 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file ByteRangesReceiver.h
+ ** \~french
+ * \brief Définition de la classe ByteRangesReceiver
+ ** \~english
+ * \brief Define classe ByteRangesReceiver
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "rok4/storage/Context.h"
+
+#define ROK4_BYTE_RANGES_MAX_LINE 4096
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Réception d'une réponse HTTP à une requête multi-portions (Range: bytes=a-b,c-d,...)
+ * \details Les données reçues sont copiées au fil de l'eau dans les buffers des portions demandées, sans stocker la réponse complète. Trois formes de réponse sont gérées :
+ * \li 206 multipart/byteranges : chaque partie est placée selon son en-tête Content-Range
+ * \li 206 en une seule partie (portions fusionnées par le serveur) : le corps est placé selon l'en-tête Content-Range de la réponse
+ * \li 200 : le serveur a ignoré l'en-tête Range, le corps est l'objet complet
+ *
+ * Les en-têtes et le corps sont transmis via #header_callback et #data_callback, à donner à libcurl.
+ * \~english
+ * \brief HTTP response receiving, for a multi-range request (Range: bytes=a-b,c-d,...)
+ * \details Received data are copied on the fly into the wanted ranges' buffers, without storing the whole response. Three response forms are handled :
+ * \li 206 multipart/byteranges : each part is placed according to its Content-Range header
+ * \li 206 with one part (ranges merged by the server) : body is placed according to the response Content-Range header
+ * \li 200 : server ignored the Range header, body is the whole object
+ *
+ * Headers and body are provided with #header_callback and #data_callback, to give to libcurl.
+ */
+class ByteRangesReceiver {
+
+private:
+
+    /**
+     * \~french \brief Étapes de lecture du corps de la réponse
+     * \~english \brief Response body reading steps
+     */
+    enum State {
+        SINGLE,
+        BOUNDARY,
+        PART_HEADERS,
+        PART_DATA,
+        DONE,
+        FAILED
+    };
+
+    /**
+     * \~french \brief Portions à lire, par offset croissant
+     * \~english \brief Ranges to read, by increasing offset
+     */
+    std::vector<ReadRange*> ranges;
+
+    /**
+     * \~french \brief Nombre d'octets reçus pour chaque portion
+     * \~english \brief Received bytes count for each range
+     */
+    std::vector<int> received;
+
+    /**
+     * \~french \brief Étape courante
+     * \~english \brief Current step
+     */
+    State state;
+
+    /**
+     * \~french \brief Séparateur des parties, vide si la réponse n'est pas multipart
+     * \~english \brief Parts boundary, empty if response is not multipart
+     */
+    std::string boundary;
+
+    /**
+     * \~french \brief Position dans l'objet du prochain octet reçu
+     * \~english \brief Next received byte position in the object
+     */
+    int64_t position;
+
+    /**
+     * \~french \brief Nombre d'octets restant à recevoir dans la partie courante
+     * \~english \brief Bytes count to receive in the current part
+     */
+    int64_t remaining;
+
+    /**
+     * \~french \brief Ligne en cours de lecture (séparateur ou en-tête de partie)
+     * \~english \brief Line being read (boundary or part header)
+     */
+    std::string line;
+
+    /**
+     * \~french \brief Copie des octets reçus dans les portions qu'ils recouvrent
+     * \~english \brief Copy received bytes into ranges they overlap
+     */
+    void copy (const char* data, size_t size);
+
+    /**
+     * \~french \brief Traite une ligne complète du corps multipart
+     * \~english \brief Process a complete multipart body line
+     */
+    void process_line ();
+
+public:
+
+    /**
+     * \~french \brief Constructeur
+     * \param[in] ranges Portions à lire, d'un même objet. Elles sont triées par offset croissant
+     * \~english \brief Constructor
+     * \param[in] ranges Ranges to read, from the same object. They are sorted by increasing offset
+     */
+    ByteRangesReceiver (std::vector<ReadRange*> ranges);
+
+    /**
+     * \~french \brief Construit la valeur de l'en-tête Range pour les portions
+     * \~english \brief Build the Range header value for ranges
+     */
+    std::string get_range_header ();
+
+    /**
+     * \~french \brief Traite une ligne d'en-tête de la réponse
+     * \details Une ligne de statut (HTTP/...) réinitialise la réception : redirections et réponses intermédiaires sont ainsi ignorées
+     * \~english \brief Process a response header line
+     * \details A status line (HTTP/...) resets receiving : redirections and intermediate responses are ignored
+     */
+    void add_header (std::string header);
+
+    /**
+     * \~french \brief Traite une partie du corps de la réponse
+     * \return Faux si le corps est mal formé
+     * \~english \brief Process a response body part
+     * \return False if body is malformed
+     */
+    bool receive (const char* data, size_t size);
+
+    /**
+     * \~french \brief Renseigne la taille lue de chaque portion
+     * \details Une portion qui n'a pas été entièrement reçue est en erreur (taille lue négative), y compris si elle dépasse la fin de l'objet : c'est alors la lecture seule de la portion qui donne sa taille réelle.
+     * \return Vrai si toutes les portions ont été lues
+     * \~english \brief Fill each range's read size
+     * \details A range not entirely received is in error (negative read size), even if it goes beyond the object's end : reading the range alone then gives its real size.
+     * \return True if all ranges have been read
+     */
+    bool finish ();
+
+    /**
+     * \~french \brief Fonction de lecture des en-têtes pour libcurl (CURLOPT_HEADERFUNCTION)
+     * \~english \brief Headers reading function for libcurl (CURLOPT_HEADERFUNCTION)
+     */
+    static size_t header_callback (char* data, size_t size, size_t nmemb, void* receiver);
+
+    /**
+     * \~french \brief Fonction de lecture du corps pour libcurl (CURLOPT_WRITEFUNCTION)
+     * \details Un corps mal formé interrompt le transfert
+     * \~english \brief Body reading function for libcurl (CURLOPT_WRITEFUNCTION)
+     * \details A malformed body stops the transfer
+     */
+    static size_t data_callback (char* data, size_t size, size_t nmemb, void* receiver);
+};
@@ -0,0 +1,236 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file CurlLoop.h
+ ** \~french
+ * \brief Définition de la classe CurlLoop
+ ** \~english
+ * \brief Define classe CurlLoop
+ */
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <curl/curl.h>
+#include <boost/log/trivial.hpp>
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Boucle d'évènements curl, partagée par tous les threads
+ * \details Les requêtes sont soumises par n'importe quel thread, avec une fonction appelée à la fin de la requête. Elles sont exécutées en parallèle par un unique thread, démarré à la première soumission, sur un objet curl multiple (dont le cache de connexions est ainsi partagé).
+ *
+ * Les fonctions de fin de requête sont appelées dans le thread de la boucle : elles doivent être rapides et ne pas attendre d'autre requête. Elles peuvent soumettre de nouvelles requêtes (nouvelle tentative par exemple).
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Curl event loop, shared by all threads
+ * \details Requests are submitted by any thread, with a function called when the request is done. They are performed in parallel by a single thread, started with the first submission, on a curl multi object (so connection cache is shared).
+ *
+ * Completion functions are called in the loop's thread : they have to be fast and not to wait for another request. They can submit new requests (a new attempt for example).
+ *
+ * This class is supposed to be used without instance
+ */
+class CurlLoop {
+
+public:
+
+    /**
+     * \~french \brief Fonction appelée à la fin d'une requête, avec le code retour curl
+     * \details La requête a été retirée de la boucle : la fonction est responsable de l'objet curl (nettoyage ou nouvelle soumission)
+     * \~english \brief Function called when a request is done, with the curl code
+     * \details Request is removed from the loop : function is responsible for the curl object (clean or new submission)
+     */
+    typedef std::function<void(CURLcode)> Callback;
+
+private:
+
+    /**
+     * \~french \brief Requête en attente d'ajout à la boucle
+     * \~english \brief Request waiting to be added to the loop
+     */
+    struct Submission {
+        uint64_t id;
+        CURL* handle;
+        Callback callback;
+    };
+
+    /**
+     * \~french \brief Requête en cours dans la boucle
+     * \~english \brief Request running in the loop
+     */
+    struct Running {
+        uint64_t id;
+        Callback callback;
+    };
+
+    /**
+     * \~french \brief Objet curl multiple de la boucle
+     * \~english \brief Loop's curl multi object
+     */
+    static CURLM* multi;
+
+    /**
+     * \~french \brief Thread exécutant la boucle
+     * \~english \brief Loop's thread
+     */
+    static std::thread loop;
+
+    /**
+     * \~french \brief La boucle doit-elle s'arrêter
+     * \~english \brief Does the loop have to stop
+     */
+    static bool stopping;
+
+    /**
+     * \~french \brief Requêtes soumises, pas encore ajoutées à la boucle
+     * \details La clé est l'instant à partir duquel la requête peut être lancée
+     * \~english \brief Submitted requests, not yet added to the loop
+     * \details Key is the time from which request can be performed
+     */
+    static std::multimap<std::chrono::steady_clock::time_point, Submission> pending;
+
+    /**
+     * \~french \brief Requêtes en cours, avec leur fonction de fin
+     * \details Uniquement manipulé par le thread de la boucle
+     * \~english \brief Running requests, with their completion function
+     * \details Only used by the loop's thread
+     */
+    static std::map<CURL*, Running> running;
+
+    /**
+     * \~french \brief Identifiants des requêtes en cours dont l'annulation a été demandée par un autre thread que celui de la boucle
+     * \details Les requêtes sont identifiées par leur numéro de soumission et non par leur objet curl, qui peut avoir été libéré puis réalloué à une autre requête avant le prochain tour de boucle
+     * \~english \brief Identifiers of running requests whose cancellation was asked by another thread than the loop's one
+     * \details Requests are identified by their submission number and not by their curl object, which could have been freed then reallocated to another request before the next loop turn
+     */
+    static std::vector<uint64_t> cancelled;
+
+    /**
+     * \~french \brief Dernier identifiant de soumission attribué
+     * \~english \brief Last given submission identifier
+     */
+    static uint64_t last_id;
+
+    /**
+     * \~french \brief Exclusion mutuelle sur les requêtes en attente et l'état de la boucle
+     * \~english \brief Mutual exclusion for waiting requests and loop state
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Fonction exécutée par le thread de la boucle
+     * \~english \brief Loop's thread function
+     */
+    static void run();
+
+    /**
+     * \~french \brief Retire une requête en cours de la boucle et appelle sa fonction de fin
+     * \details Uniquement appelé par le thread de la boucle. Rien n'est fait si la requête n'est pas en cours
+     * \~english \brief Remove a running request from the loop and call its completion function
+     * \details Only called by the loop's thread. Nothing is done if request is not running
+     */
+    static void abort_running(uint64_t id);
+
+    /**
+     * \~french \brief Arrête la boucle à la fin du programme, avant la destruction de son thread
+     * \~english \brief Stop the loop at program end, before its thread destruction
+     */
+    static struct Stopper {
+        ~Stopper() { CurlLoop::stop(); }
+    } stopper;
+
+    /**
+     * \~french
+     * \brief Constructeur
+     * \~english
+     * \brief Constructeur
+     */
+    CurlLoop(){};
+
+public:
+
+    /**
+     * \~french \brief Soumet une requête à la boucle
+     * \details La boucle est démarrée si elle ne l'est pas. Si elle est en cours d'arrêt, la fonction de fin est appelée directement avec le code CURLE_ABORTED_BY_CALLBACK.
+     * \param[in] handle Objet curl préparé, qui ne doit pas être utilisé avant l'appel de la fonction de fin
+     * \param[in] callback Fonction appelée à la fin de la requête
+     * \param[in] delay Délai avant le lancement de la requête, en millisecondes
+     * \return Identifiant de la soumission, à utiliser pour l'annuler (0 si la boucle est en cours d'arrêt)
+     * \~english \brief Submit a request to the loop
+     * \details Loop is started if needed. If it is stopping, completion function is directly called with CURLE_ABORTED_BY_CALLBACK code.
+     * \param[in] handle Prepared curl object, not to use before the completion function call
+     * \param[in] callback Function called when the request is done
+     * \param[in] delay Delay before the request is performed, in milliseconds
+     * \return Submission identifier, to use to cancel it (0 if the loop is stopping)
+     */
+    static uint64_t submit(CURL* handle, Callback callback, int delay = 0);
+
+    /**
+     * \~french \brief Annule une requête soumise
+     * \details Sa fonction de fin est appelée avec le code CURLE_ABORTED_BY_CALLBACK. Appelée depuis une fonction de fin (thread de la boucle), l'annulation est immédiate : la requête annulée ne reçoit plus de donnée. Depuis un autre thread, une requête en cours est annulée au prochain tour de boucle. Rien n'est fait si la requête est déjà terminée, même si son objet curl a depuis été réutilisé par une autre requête.
+     * \param[in] id Identifiant de soumission de la requête à annuler
+     * \~english \brief Cancel a submitted request
+     * \details Its completion function is called with CURLE_ABORTED_BY_CALLBACK code. Called from a completion function (loop's thread), cancellation is immediate : cancelled request does not receive data anymore. From another thread, a running request is cancelled at the next loop turn. Nothing is done if request is already done, even if its curl object has since been reused by another request.
+     * \param[in] id Submission identifier of the request to cancel
+     */
+    static void cancel(uint64_t id);
+
+    /**
+     * \~french \brief Arrête la boucle
+     * \details Les requêtes en attente ou en cours sont interrompues : leur fonction de fin est appelée avec le code CURLE_ABORTED_BY_CALLBACK. Appelée automatiquement à la fin du programme.
+     * \~english \brief Stop the loop
+     * \details Waiting or running requests are interrupted : their completion function is called with CURLE_ABORTED_BY_CALLBACK code. Automatically called at program end.
+     */
+    static void stop();
+
+    /**
+     * \~french
+     * \brief Destructeur
+     * \~english
+     * \brief Destructor
+     */
+    ~CurlLoop();
+};
@@ -37,28 +37,138 @@
 
 #pragma once
 
-#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
 #include <thread>
 #include <curl/curl.h>
 #include <boost/log/trivial.hpp>
 
+#define ROK4_CURL_TCP_KEEPALIVE "ROK4_CURL_TCP_KEEPALIVE"
+#define ROK4_CURL_MAX_HOST_CONNECTIONS "ROK4_CURL_MAX_HOST_CONNECTIONS"
+#define ROK4_CURL_HTTP_VERSION "ROK4_CURL_HTTP_VERSION"
+
 /**
  * \author Institut national de l'information géographique et forestière
  * \~french
  * \brief Création d'un pool d'environnement Curl
  * \details Cette classe est prévue pour être utilisée sans instance
+ *
+ * Chaque thread dispose de son propre objet Curl, stocké localement au thread. Tous les objets partagent le cache DNS et les sessions TLS, afin qu'un nouveau thread n'ait pas à refaire une négociation TLS complète. Les connexions ne sont pas partagées, libcurl ne le permettant pas entre threads concurrents : chaque objet réutilise les siennes, et les requêtes asynchrones celles de la boucle curl (CurlLoop).
+ *
+ * Variables d'environnement :
+ * \li ROK4_CURL_TCP_KEEPALIVE : active les sondes TCP keep-alive (SO_KEEPALIVE) sur les connexions, pour détecter les connexions mortes et les garder ouvertes à travers les équipements réseau. La valeur est le délai en secondes d'inactivité avant la première sonde, puis l'intervalle entre les sondes. 0 (défaut) pour ne pas en envoyer. Sans rapport avec le keep-alive HTTP : les connexions sont toujours réutilisées
+ * \li ROK4_CURL_MAX_HOST_CONNECTIONS : nombre maximal de connexions simultanées vers un même hôte pour les requêtes asynchrones. 0 (défaut) pour ne pas limiter
+ * \li ROK4_CURL_HTTP_VERSION : version HTTP à utiliser. "1.1", "2" (HTTP/2 négocié en TLS, HTTP/1.1 sinon) ou "2-prior-knowledge" (HTTP/2 sans négociation, y compris sans TLS). Comportement par défaut de libcurl si non fourni
+ * \~english
+ * \brief Curl environment pool
+ * \details This class is intended to be used without instance
+ *
+ * Each thread owns its curl object, stored as thread local. All objects share DNS cache and TLS sessions, so that a new thread does not have to run a full TLS handshake. Connections are not shared, libcurl not allowing it between concurrent threads : each object reuses its own ones, and asynchronous requests the curl loop's ones (CurlLoop).
+ *
+ * Environment variables :
+ * \li ROK4_CURL_TCP_KEEPALIVE : enable TCP keep-alive probes (SO_KEEPALIVE) on connections, to detect dead connections and keep them open through network devices. Value is the idle delay in seconds before the first probe, then the interval between probes. 0 (default) to send none. Not related to HTTP keep-alive : connections are always reused
+ * \li ROK4_CURL_MAX_HOST_CONNECTIONS : maximum simultaneous connections to a same host for asynchronous requests. 0 (default) for no limit
+ * \li ROK4_CURL_HTTP_VERSION : HTTP version to use. "1.1", "2" (HTTP/2 negotiated over TLS, HTTP/1.1 otherwise) or "2-prior-knowledge" (HTTP/2 without negotiation, even without TLS). libcurl default behaviour if not provided
  */
 class CurlPool {  
 
 private:
 
     /**
-     * \~french \brief Annuaire des objet Curl
-     * \details La clé est l'identifiant du thread
-     * \~english \brief Curl object book
-     * \details Key is the thread's ID
+     * \~french \brief Objet Curl du thread courant
+     * \details Nettoyé et retiré de l'annuaire à la fin du thread
+     * \~english \brief Current thread's curl object
+     * \details Cleaned and removed from the book when thread ends
+     */
+    struct ThreadCurl {
+        CURL* handle;
+        unsigned int generation;
+
+        ThreadCurl() : handle(NULL), generation(0) {}
+        ~ThreadCurl();
+    };
+
+    /**
+     * \~french \brief Objet Curl du thread appelant
+     * \~english \brief Calling thread's curl object
+     */
+    static thread_local ThreadCurl local;
+
+    /**
+     * \~french \brief Annuaire des objets Curl de tous les threads
+     * \details Utilisé uniquement pour compter et nettoyer les objets, protégé par #mtx
+     * \~english \brief Book of all threads' curl objects
+     * \details Only used to count and clean objects, protected by #mtx
+     */
+    static std::set<CURL*> pool;
+
+    /**
+     * \~french \brief Génération de l'annuaire, incrémentée à chaque nettoyage
+     * \details Un objet local d'une génération antérieure a été nettoyé et doit être recréé
+     * \~english \brief Book generation, incremented by each cleaning
+     * \details A local object from an older generation has been cleaned and has to be created again
+     */
+    static std::atomic<unsigned int> generation;
+
+    /**
+     * \~french \brief Partage du cache DNS et des sessions TLS
+     * \~english \brief DNS cache and TLS sessions share
+     */
+    static CURLSH* share;
+
+    /**
+     * \~french \brief Verrous du partage, un par type de données
+     * \~english \brief Share locks, one per data type
+     */
+    static std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+    /**
+     * \~french \brief Exclusion mutuelle pour l'annuaire et la création du partage
+     * \~english \brief Mutual exclusion for book and share creation
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Délai d'inactivité en secondes avant la première sonde TCP keep-alive, et intervalle entre les sondes. 0 pour ne pas en envoyer
+     * \~english \brief Idle delay in seconds before the first TCP keep-alive probe, and interval between probes. 0 to send none
+     */
+    static int tcp_keepalive;
+
+    /**
+     * \~french \brief Nombre maximal de connexions simultanées par hôte, 0 pour ne pas limiter
+     * \~english \brief Maximum simultaneous connections per host, 0 for no limit
+     */
+    static int max_host_connections;
+
+    /**
+     * \~french \brief Version HTTP demandée (CURL_HTTP_VERSION_*), CURL_HTTP_VERSION_NONE pour le comportement par défaut de libcurl
+     * \~english \brief Wanted HTTP version (CURL_HTTP_VERSION_*), CURL_HTTP_VERSION_NONE for libcurl default behaviour
+     */
+    static std::atomic<long> http_version;
+
+    /**
+     * \~french \brief Lit la version HTTP demandée dans la variable d'environnement
+     * \~english \brief Read wanted HTTP version from environment variable
+     */
+    static long http_version_from_env();
+
+    /**
+     * \~french \brief Verrouille une donnée partagée, pour libcurl (CURLSHOPT_LOCKFUNC)
+     * \~english \brief Lock shared data, for libcurl (CURLSHOPT_LOCKFUNC)
      */
-    static std::map<pthread_t, CURL*> pool;
+    static void lock_share(CURL* /* handle */, curl_lock_data data, curl_lock_access /* access */, void* /* userptr */);
+    /**
+     * \~french \brief Déverrouille une donnée partagée, pour libcurl (CURLSHOPT_UNLOCKFUNC)
+     * \~english \brief Unlock shared data, for libcurl (CURLSHOPT_UNLOCKFUNC)
+     */
+    static void unlock_share(CURL* /* handle */, curl_lock_data data, void* /* userptr */);
+
+    /**
+     * \~french \brief Applique les options communes à un objet Curl fraîchement réinitialisé
+     * \~english \brief Apply common options to a freshly reset curl object
+     */
+    static void apply_options(CURL* curl);
 
     /**
      * \~french
@@ -80,12 +190,68 @@ public:
 
     /**
      * \~french \brief Retourne un objet Curl propre au thread appelant
-     * \details Si il n'existe pas encore d'objet curl pour ce tread, on le crée et on l'initialise
+     * \details Si il n'existe pas encore d'objet curl pour ce tread, on le crée et on l'initialise. L'objet est réinitialisé à chaque appel, puis rattaché au partage commun.
      * \~english \brief Get the curl object specific to the calling thread
-     * \details If curl object doesn't exist for this thread, it is created and initialized
+     * \details If curl object doesn't exist for this thread, it is created and initialized. Object is reset on each call, then attached to the common share.
      */
     static CURL* get_curl_env(); 
 
+    /**
+     * \~french \brief Retourne le nombre d'objets curl dans l'annuaire
+     * \~english \brief Get the number of curl objects in the book
+     */
+    static int get_curls_count ();
+
+    /**
+     * \~french \brief Retourne le nombre maximal de connexions simultanées par hôte
+     * \details À appliquer aux gestionnaires de requêtes multiples (CURLMOPT_MAX_HOST_CONNECTIONS). 0 pour ne pas limiter
+     * \~english \brief Get the maximum simultaneous connections per host
+     * \details To apply to multi handles (CURLMOPT_MAX_HOST_CONNECTIONS). 0 for no limit
+     */
+    static int get_max_host_connections ();
+
+    /**
+     * \~french \brief Indique si HTTP/2 est demandé
+     * \details Les requêtes vers un même hôte peuvent alors être multiplexées sur une seule connexion
+     * \~english \brief Tell if HTTP/2 is wanted
+     * \details Requests to the same host can then be multiplexed on a single connection
+     */
+    static bool is_http2 ();
+
+    /**
+     * \~french \brief Applique la version HTTP demandée à un objet Curl
+     * \param[in] curl Objet Curl à configurer
+     * \param[in] multiplexed L'objet sera exécuté par un objet curl multiple : en HTTP/2, il attend alors une connexion multiplexable plutôt que d'en ouvrir une nouvelle
+     * \~english \brief Apply wanted HTTP version to a curl object
+     * \param[in] curl Curl object to configure
+     * \param[in] multiplexed Object will be performed by a curl multi object : with HTTP/2, it waits for a connection to multiplex on rather than opening a new one
+     */
+    static void set_http_version (CURL* curl, bool multiplexed);
+
+    /**
+     * \~french \brief Interprète une version HTTP au format de ROK4_CURL_HTTP_VERSION
+     * \details HTTP/1.1 est retenu si HTTP/2 est demandé mais non supporté par libcurl
+     * \param[in] value Valeur à interpréter, éventuellement NULL
+     * \param[in] features Fonctionnalités de libcurl (curl_version_info)
+     * \return Version HTTP (CURL_HTTP_VERSION_*), CURL_HTTP_VERSION_NONE si la valeur est absente ou inconnue
+     * \~english \brief Parse an HTTP version in the ROK4_CURL_HTTP_VERSION format
+     * \details HTTP/1.1 is chosen if HTTP/2 is wanted but not supported by libcurl
+     * \param[in] value Value to parse, possibly NULL
+     * \param[in] features libcurl features (curl_version_info)
+     * \return HTTP version (CURL_HTTP_VERSION_*), CURL_HTTP_VERSION_NONE if value is missing or unknown
+     */
+    static long parse_http_version (const char* value, int features);
+
+    /**
+     * \~french \brief Remplace la version HTTP lue dans l'environnement
+     * \details Ne concerne que les objets Curl configurés ensuite
+     * \param[in] version Version HTTP (CURL_HTTP_VERSION_*)
+     * \~english \brief Replace the HTTP version read from environment
+     * \details Only applies to curl objects configured afterwards
+     * \param[in] version HTTP version (CURL_HTTP_VERSION_*)
+     */
+    static void set_http_version (long version);
+
     /**
      * \~french \brief Affiche le nombre d'objet curl dans l'annuaire
      * \~english \brief Print the number of curl objects in the book
@@ -94,7 +260,9 @@ public:
 
     /**
      * \~french \brief Nettoie tous les objets curl dans l'annuaire et le vide
+     * \details Les threads encore actifs recréeront leur objet au prochain appel à #get_curl_env
      * \~english \brief Clean all curl objects in the book and empty it
+     * \details Still running threads will create their object again on next #get_curl_env call
      */
     static void clean_curls (); 
 
@@ -0,0 +1,260 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file DecodedTileCache.h
+ ** \~french
+ * \brief Définition de la classe DecodedTileCache
+ ** \~english
+ * \brief Define classe DecodedTileCache
+ */
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <ctime>
+#include <stdint.h>
+
+#include "rok4/utils/ShardedLruCache.h"
+
+class Level;
+
+/**
+ * \~french \brief Variable d'environnement donnant la mémoire maximale en octets occupée par les tuiles décodées en cache
+ * \~english \brief Environment variable for the maximal memory in bytes used by cached decoded tiles
+ */
+#define ROK4_DECODED_TILE_CACHE_MEMORY "ROK4_DECODED_TILE_CACHE_MEMORY"
+
+/**
+ * \~french \brief Variable d'environnement donnant la durée de validité en secondes d'une tuile décodée en cache
+ * \~english \brief Environment variable for a cached decoded tile validity in seconds
+ */
+#define ROK4_DECODED_TILE_CACHE_VALIDITY "ROK4_DECODED_TILE_CACHE_VALIDITY"
+
+/**
+ * \~french \brief Nombre de partitions du cache des tuiles décodées
+ * \~english \brief Decoded tile cache shards number
+ */
+#define ROK4_DECODED_TILE_CACHE_SHARDS 16
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Tuile décodée en cache
+ * \details La donnée brute est partagée avec les images qui la lisent : elle reste valide tant qu'elles la détiennent, même si la tuile est sortie du cache
+ * \~english
+ * \brief Cached decoded tile
+ * \details Raw data is shared with images reading it : it stays valid while they hold it, even if tile has been removed from cache
+ */
+struct DecodedTileElement {
+    /**
+     * \~french \brief Donnée brute de la tuile
+     * \~english \brief Tile's raw data
+     */
+    std::unique_ptr<uint8_t[]> data;
+    /**
+     * \~french \brief Taille de la donnée
+     * \~english \brief Data size
+     */
+    size_t size;
+    /**
+     * \~french \brief Date de décodage
+     * \~english \brief Decoding date
+     */
+    std::time_t date;
+    /**
+     * \~french \brief Niveau de la tuile
+     * \~english \brief Tile's level
+     */
+    Level* level;
+
+    DecodedTileElement(uint8_t* d, size_t s, Level* l) : data(d), size(s), date(std::time(NULL)), level(l) {}
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Cache mémoire des tuiles décodées
+ * \details Les tuiles sont identifiées par leur niveau et leurs indices (colonne, ligne). Les requêtes WMS de clients tuilés se recouvrent et demandent les mêmes tuiles sources : le décodage (JPEG, PNG, Deflate...) n'est alors fait qu'une fois. Le cache est borné en mémoire occupée, partitionné selon la clé, et les tuiles les moins récemment utilisées sortent en premier.
+ *
+ * Comme pour le cache des index, une tuile n'est plus servie au-delà de #validity secondes, pour que les mises à jour des pyramides soient visibles. Les tuiles d'un niveau sont retirées à sa destruction.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Decoded tiles memory cache
+ * \details Tiles are identified by their level and indices (column, row). WMS requests from tiled clients overlap and ask for the same source tiles : decoding (JPEG, PNG, Deflate...) is done only once. Cache is limited in used memory, sharded according to the key, and least recently used tiles are evicted first.
+ *
+ * As for the index cache, a tile is no more served after #validity seconds, for pyramids' updates to be visible. Level's tiles are removed when it is destroyed.
+ *
+ * This class is supposed to be used without instance
+ */
+class DecodedTileCache {
+
+private:
+
+    /**
+     * \~french \brief Tuiles décodées en cache, les moins récemment utilisées sortant en premier
+     * \details Mémoire maximale lue dans la variable d'environnement #ROK4_DECODED_TILE_CACHE_MEMORY, 0 par défaut : pas de cache. Durée de validité lue dans la variable d'environnement #ROK4_DECODED_TILE_CACHE_VALIDITY, 300 secondes par défaut comme pour le cache des index
+     * \~english \brief Cached decoded tiles, least recently used ones being evicted first
+     * \details Maximal memory read from environment variable #ROK4_DECODED_TILE_CACHE_MEMORY, default value : 0, no cache. Validity read from environment variable #ROK4_DECODED_TILE_CACHE_VALIDITY, default value : 300 seconds as for the index cache
+     */
+    static ShardedLruCache<std::string, DecodedTileElement, ROK4_DECODED_TILE_CACHE_SHARDS> cache;
+
+    /**
+     * \~french \brief Clé identifiant une tuile
+     * \~english \brief Key identifying a tile
+     */
+    static std::string key(Level* level, int col, int row);
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructeur
+     */
+    DecodedTileCache();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~DecodedTileCache();
+
+    /** \~french
+     * \brief Définit la mémoire maximale occupée par les tuiles décodées en cache
+     * \param[in] b mémoire en octets, 0 pour désactiver le cache
+     ** \~english
+     * \brief Define maximal memory used by cached decoded tiles
+     * \param[in] b memory in bytes, 0 to disable cache
+     */
+    static void set_memory_budget(size_t b);
+
+    /** \~french
+     * \brief Définit la durée de validité des tuiles décodées en cache
+     * \param[in] v durée en secondes
+     ** \~english
+     * \brief Define cached decoded tiles validity
+     * \param[in] v validity, in seconds
+     */
+    static void set_validity(int v);
+
+    /** \~french
+     * \brief Le cache est-il actif
+     ** \~english
+     * \brief Is cache enabled
+     */
+    static bool is_enabled() {
+        return cache.is_enabled();
+    }
+
+    /** \~french
+     * \brief Récupère une tuile décodée en cache
+     * \param[in] level niveau de la tuile
+     * \param[in] col colonne de la tuile
+     * \param[in] row ligne de la tuile
+     * \return la tuile, un pointeur nul si absente ou périmée
+     ** \~english
+     * \brief Get a cached decoded tile
+     * \param[in] level tile's level
+     * \param[in] col tile's column
+     * \param[in] row tile's row
+     * \return tile, a null pointer if missing or expired
+     */
+    static std::shared_ptr<DecodedTileElement> get_tile(Level* level, int col, int row);
+
+    /** \~french
+     * \brief Ajoute une tuile décodée au cache
+     * \details Le cache prend possession de la donnée, qu'il conserve la tuile ou non (tuile plus grande que la mémoire d'une partition) : l'appelant doit utiliser l'élément retourné pour garder la donnée.
+     * \param[in] level niveau de la tuile
+     * \param[in] col colonne de la tuile
+     * \param[in] row ligne de la tuile
+     * \param[in] data donnée brute, allouée avec new[]
+     * \param[in] size taille de la donnée
+     * \return l'élément détenant la donnée
+     ** \~english
+     * \brief Add a decoded tile to the cache
+     * \details Cache takes data ownership, whether it keeps the tile or not (tile bigger than a shard memory) : caller have to use returned element to keep data.
+     * \param[in] level tile's level
+     * \param[in] col tile's column
+     * \param[in] row tile's row
+     * \param[in] data raw data, allocated with new[]
+     * \param[in] size data size
+     * \return element holding data
+     */
+    static std::shared_ptr<DecodedTileElement> add_tile(Level* level, int col, int row, uint8_t* data, size_t size);
+
+    /** \~french
+     * \brief Retire du cache toutes les tuiles d'un niveau
+     * \param[in] level niveau
+     ** \~english
+     * \brief Remove all level's tiles from the cache
+     * \param[in] level level
+     */
+    static void clean_level(Level* level);
+
+    /** \~french
+     * \brief Nombre de tuiles trouvées dans le cache depuis le démarrage
+     ** \~english
+     * \brief Tiles found in the cache since start
+     */
+    static long get_hits() {
+        return cache.get_hits();
+    }
+
+    /** \~french
+     * \brief Nombre de tuiles absentes du cache depuis le démarrage
+     ** \~english
+     * \brief Tiles missing in the cache since start
+     */
+    static long get_misses() {
+        return cache.get_misses();
+    }
+
+    /** \~french
+     * \brief Mémoire occupée par les tuiles décodées en cache, en octets
+     ** \~english
+     * \brief Memory used by cached decoded tiles, in bytes
+     */
+    static size_t get_memory();
+
+    /**
+     * \~french \brief Vide le cache et remet les compteurs à zéro
+     * \~english \brief Empty the cache and reset counters
+     */
+    static void clean_tiles();
+};
@@ -0,0 +1,257 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file FileDescriptorCache.h
+ ** \~french
+ * \brief Définition de la classe FileDescriptorCache
+ ** \~english
+ * \brief Define classe FileDescriptorCache
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <atomic>
+#include <sys/types.h>
+
+/**
+ * \~french \brief Variable d'environnement donnant le nombre maximal de descripteurs de fichier gardés ouverts
+ * \~english \brief Environment variable for the maximal number of file descriptors kept open
+ */
+#define ROK4_FILE_DESCRIPTORS_CACHE_SIZE "ROK4_FILE_DESCRIPTORS_CACHE_SIZE"
+
+/**
+ * \~french \brief Variable d'environnement donnant le délai en secondes avant de vérifier qu'un descripteur en cache correspond toujours au fichier
+ * \~english \brief Environment variable for the delay in seconds before checking a cached descriptor still matches the file
+ */
+#define ROK4_FILE_DESCRIPTORS_CACHE_VALIDITY "ROK4_FILE_DESCRIPTORS_CACHE_VALIDITY"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Descripteur de fichier ouvert en lecture
+ * \details Le fichier est fermé à la destruction de l'objet, c'est-à-dire quand il n'est plus en cache ni utilisé
+ * \~english
+ * \brief File descriptor opened for reading
+ * \details File is closed when object is destroyed, that is to say when it is neither cached nor used
+ */
+class FileDescriptor {
+
+public:
+
+    /**
+     * \~french \brief Descripteur système
+     * \~english \brief System descriptor
+     */
+    int fd;
+
+    /**
+     * \~french \brief Périphérique du fichier ouvert
+     * \~english \brief Opened file's device
+     */
+    dev_t device;
+
+    /**
+     * \~french \brief Inode du fichier ouvert
+     * \~english \brief Opened file's inode
+     */
+    ino_t inode;
+
+    /**
+     * \~french \brief Date de la dernière vérification du fichier
+     * \details Peut être mise à jour par n'importe quel thread utilisant le descripteur
+     * \~english \brief Last file check date
+     * \details Can be updated by any thread using the descriptor
+     */
+    std::atomic<std::time_t> checked;
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructor
+     */
+    FileDescriptor(int f, dev_t d, ino_t i) : fd(f), device(d), inode(i), checked(std::time(NULL)) {}
+
+    /**
+     * \~french \brief Destructeur, ferme le fichier
+     * \~english \brief Destructor, close the file
+     */
+    ~FileDescriptor();
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Création d'un cache des descripteurs de fichier ouverts en lecture
+ * \details Les descripteurs sont gardés ouverts et réutilisés pour les lectures suivantes du même fichier (index puis tuiles d'une dalle), ce qui évite l'ouverture et la fermeture du fichier à chaque lecture. Le cache est borné en nombre de descripteurs, les moins récemment utilisés sont fermés en premier.
+ *
+ * Après #validity secondes, le fichier est de nouveau consulté (stat) : s'il a été supprimé ou remplacé (changement d'inode), le descripteur est abandonné et le fichier rouvert.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Cache of file descriptors opened for reading
+ * \details Descriptors are kept open and reused for next reads of the same file (index then tiles of a slab), to avoid opening and closing the file for each read. Cache is limited in descriptors number, least recently used ones are closed first.
+ *
+ * After #validity seconds, file is checked again (stat) : if it has been removed or replaced (inode change), descriptor is dropped and file is opened again.
+ *
+ * This class is supposed to be used without instance
+ */
+class FileDescriptorCache {
+
+private:
+
+    /**
+     * \~french \brief Liste des chemins en cache, du plus récemment utilisé au plus ancien
+     * \~english \brief Cached paths list, from the most recently used to the oldest
+     */
+    static std::list<std::string> lru;
+
+    /**
+     * \~french \brief Descripteurs en cache, avec leur position dans #lru
+     * \~english \brief Cached descriptors, with their position in #lru
+     */
+    static std::unordered_map<std::string, std::pair<std::shared_ptr<FileDescriptor>, std::list<std::string>::iterator> > map;
+
+    /**
+     * \~french \brief Nombre maximal de descripteurs en cache
+     * \details Lu dans la variable d'environnement #ROK4_FILE_DESCRIPTORS_CACHE_SIZE, 100 par défaut. 0 désactive le cache
+     * \~english \brief Maximal number of cached descriptors
+     * \details Read from environment variable #ROK4_FILE_DESCRIPTORS_CACHE_SIZE, default value : 100. 0 disables the cache
+     */
+    static int size;
+
+    /**
+     * \~french \brief Délai en secondes avant de vérifier de nouveau le fichier d'un descripteur
+     * \details Lu dans la variable d'environnement #ROK4_FILE_DESCRIPTORS_CACHE_VALIDITY, 10 par défaut
+     * \~english \brief Delay in seconds before checking again a descriptor's file
+     * \details Read from environment variable #ROK4_FILE_DESCRIPTORS_CACHE_VALIDITY, default value : 10
+     */
+    static int validity;
+
+    /**
+     * \~french \brief Exclusion mutuelle
+     * \details Pour éviter les modifications concurrentes du cache des descripteurs
+     * \~english \brief Mutual exclusion
+     * \details To avoid concurrent descriptors cache updates
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Ouvre un fichier en lecture
+     * \param[in] path chemin du fichier
+     * \return le descripteur, NULL en cas d'erreur
+     * \~english \brief Open a file for reading
+     * \param[in] path file path
+     * \return descriptor, NULL if error
+     */
+    static std::shared_ptr<FileDescriptor> open_descriptor(std::string path);
+
+    /**
+     * \~french \brief Ajoute un descripteur en tête du cache, en fermant les plus anciens si nécessaire
+     * \details L'exclusion mutuelle doit être détenue
+     * \~english \brief Add a descriptor at the cache head, closing the oldest ones if needed
+     * \details Mutual exclusion have to be held
+     */
+    static void insert(std::string path, std::shared_ptr<FileDescriptor> fd);
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructeur
+     */
+    FileDescriptorCache();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~FileDescriptorCache();
+
+    /** \~french
+     * \brief Définit la taille du cache
+     * \param[in] s nombre maximal de descripteurs ouverts, 0 pour désactiver le cache
+     ** \~english
+     * \brief Define cache size
+     * \param[in] s maximal number of opened descriptors, 0 to disable cache
+     */
+    static void set_size(int s);
+
+    /** \~french
+     * \brief Définit le délai de vérification des fichiers
+     * \param[in] v délai en secondes
+     ** \~english
+     * \brief Define files check delay
+     * \param[in] v delay, in seconds
+     */
+    static void set_validity(int v);
+
+    /** \~french
+     * \brief Récupère un descripteur ouvert en lecture sur le fichier
+     * \details Le descripteur reste utilisable tant que le pointeur est détenu, même s'il est sorti du cache entre temps. Il ne doit être utilisé qu'avec des lectures positionnées (pread, preadv) car il peut être partagé entre plusieurs threads.
+     * \param[in] path chemin du fichier
+     * \return le descripteur, NULL si le fichier ne peut être ouvert
+     ** \~english
+     * \brief Get a descriptor opened for reading on the file
+     * \details Descriptor can be used while the pointer is held, even if it has been removed from the cache in the meantime. It must only be used with positioned reads (pread, preadv) because it can be shared between threads.
+     * \param[in] path file path
+     * \return descriptor, NULL if file cannot be opened
+     */
+    static std::shared_ptr<FileDescriptor> get_descriptor(std::string path);
+
+    /** \~french
+     * \brief Retire le descripteur d'un fichier du cache
+     * \details À appeler quand le fichier est modifié ou supprimé
+     * \param[in] path chemin du fichier
+     ** \~english
+     * \brief Remove a file's descriptor from the cache
+     * \details To call when file is modified or removed
+     * \param[in] path file path
+     */
+    static void invalidate(std::string path);
+
+    /**
+     * \~french \brief Retire tous les descripteurs du cache
+     * \~english \brief Remove all descriptors from the cache
+     */
+    static void clean_descriptors();
+};
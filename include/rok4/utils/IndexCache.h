@@ -49,56 +49,315 @@
 #include <boost/log/trivial.hpp>
 #include <map>
 #include <list>
+#include <vector>
 #include <unordered_map>
 #include <string.h>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
 
 #include "rok4/utils/IndexElement.h"
 #include "rok4/storage/Context.h"
 
+/**
+ * \~french \brief Nombre de partitions du cache des index
+ * \~english \brief Index cache's shards number
+ */
+#define ROK4_INDEX_CACHE_SHARDS 64
+
+/**
+ * \~french \brief Nombre minimal d'éléments par partition, quand le cache est limité en nombre d'éléments : un petit cache utilise moins de partitions
+ * \~english \brief Minimal elements number per shard, when cache is limited in elements number : a small cache uses less shards
+ */
+#define ROK4_INDEX_CACHE_MIN_SHARD_SIZE 16
+
+/**
+ * \~french \brief Nombre de compartiments d'une partition du cache des index
+ * \~english \brief Index cache shard's buckets number
+ */
+#define ROK4_INDEX_CACHE_BUCKETS 256
+
+/**
+ * \~french \brief Signature des fichiers d'instantané du cache des index
+ * \~english \brief Index cache snapshot files signature
+ */
+#define ROK4_INDEX_CACHE_SNAPSHOT_SIGNATURE "ROK4IDX1"
+
+/**
+ * \~french \brief Nombre maximal de tuiles d'un élément d'instantané, au-delà le fichier est considéré corrompu
+ * \~english \brief Maximal tiles number of a snapshot element, beyond file is considered corrupted
+ */
+#define ROK4_INDEX_CACHE_SNAPSHOT_MAX_TILES 16777216
+
 /**
  * \author Institut national de l'information géographique et forestière
  * \~french
  * \brief Création d'un cache des index de dalle
- * \details Cette classe est prévue pour être utilisée sans instance
+ * \details Le cache est partitionné selon la clé, et chaque partition est découpée en compartiments. Chaque compartiment publie son contenu sous forme d'un instantané immuable : les lectures ne prennent aucun verrou, elles récupèrent l'instantané courant du compartiment de la clé et le consultent. Les ajouts et retraits copient uniquement le compartiment concerné, le modifient puis publient le nouvel instantané ; ils sont sérialisés par partition, qui tient l'ordre d'ajout de ses éléments.
+ *
+ * Les instantanés sont publiés par des pointeurs atomiques simples, lus sans verrou. Un instantané remplacé n'est libéré qu'après une période de grâce : chaque lecture s'enregistre auprès d'un des deux compteurs de lecteurs de la partition, choisi par l'époque courante ; l'écrivain change deux fois d'époque et attend à chaque fois que le compteur quitté soit vide. Seuls les écrivains attendent, les lectures ne bloquent jamais. Les éléments, partagés entre instantanés, sont libérés avec le dernier qui les contient ou la dernière lecture qui les utilise.
+ *
+ * La taille du cache (ou son budget mémoire) est répartie entre les partitions, dont la somme des limites ne dépasse jamais la limite globale.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Slab indexes cache
+ * \details Cache is sharded according to the key, and each shard is split in buckets. Each bucket publishes its content as an immutable snapshot : lookups take no lock, they get the current snapshot of the key's bucket and consult it. Additions and removals only copy the involved bucket, update it then publish the new snapshot ; they are serialized per shard, which keeps its elements' addition order.
+ *
+ * Snapshots are published through plain atomic pointers, read without lock. A replaced snapshot is only freed after a grace period : each lookup registers with one of the shard's two readers counters, chosen by the current epoch ; the writer switches epoch twice and each time waits for the left counter to be empty. Only writers wait, lookups never block. Elements, shared between snapshots, are freed with the last one containing them or the last lookup using them.
+ *
+ * Cache size (or its memory budget) is split between shards, whose limits' sum never exceeds the global limit.
+ *
+ * This class is supposed to be used without instance
  */
 class IndexCache {  
 
 private:
 
     /**
-     * \~french \brief Liste des éléments en cache
-     * \~english \brief Cache elements list
+     * \~french \brief Éléments d'un compartiment, par clé, immuables une fois publiés
+     * \~english \brief Bucket's elements, by key, immutable once published
+     */
+    typedef std::vector<std::pair<std::string, std::shared_ptr<const IndexElement> > > Bucket;
+
+    /**
+     * \~french \brief Clés par ordre d'ajout, la plus récente en tête, avec la mémoire occupée par leur élément
+     * \~english \brief Keys by addition order, the most recent first, with the memory used by their element
+     */
+    typedef std::list<std::pair<std::string, size_t> > Order;
+
+    /**
+     * \~french \brief Partition du cache
+     * \~english \brief Cache shard
+     */
+    struct Shard {
+        /**
+         * \~french \brief Compartiments, chacun lu et remplacé atomiquement, NULL si vide
+         * \~english \brief Buckets, each one atomically read and replaced, NULL if empty
+         */
+        std::atomic<const Bucket*> buckets[ROK4_INDEX_CACHE_BUCKETS];
+        /**
+         * \~french \brief Époque courante, dont la parité désigne le compteur de lecteurs des nouvelles lectures
+         * \~english \brief Current epoch, whose parity gives the readers counter of new lookups
+         */
+        std::atomic<unsigned int> epoch;
+        /**
+         * \~french \brief Nombre de lectures en cours, pour chaque parité d'époque
+         * \~english \brief Running lookups number, for each epoch parity
+         */
+        std::atomic<int> readers[2];
+        /**
+         * \~french \brief Compartiments remplacés, à libérer après une période de grâce
+         * \~english \brief Replaced buckets, to free after a grace period
+         */
+        std::vector<const Bucket*> retired;
+        /**
+         * \~french \brief Ordre d'ajout des éléments de la partition
+         * \~english \brief Addition order of shard's elements
+         */
+        Order order;
+        /**
+         * \~french \brief Position de chaque clé dans l'ordre d'ajout
+         * \~english \brief Each key's position in addition order
+         */
+        std::unordered_map<std::string, Order::iterator> positions;
+        /**
+         * \~french \brief Mémoire occupée par les éléments de la partition, en octets
+         * \~english \brief Memory used by shard's elements, in bytes
+         */
+        size_t memory;
+        /**
+         * \~french \brief Exclusion mutuelle entre les modifications de la partition
+         * \details Protège l'ordre, les positions, la mémoire, le remplacement des compartiments et leur libération
+         * \~english \brief Mutual exclusion between shard's updates
+         * \details Protects order, positions, memory, buckets replacement and freeing
+         */
+        std::mutex mtx;
+
+        Shard() : epoch(0), memory(0) {
+            for (int b = 0; b < ROK4_INDEX_CACHE_BUCKETS; b++) buckets[b] = NULL;
+            readers[0] = 0;
+            readers[1] = 0;
+        }
+        ~Shard() {
+            for (int b = 0; b < ROK4_INDEX_CACHE_BUCKETS; b++) delete buckets[b].load();
+            for (int r = 0; r < retired.size(); r++) delete retired.at(r);
+        }
+    };
+
+    /**
+     * \~french \brief Partitions du cache
+     * \~english \brief Cache shards
      */
-    static std::list<IndexElement *> cache;
+    static Shard shards[ROK4_INDEX_CACHE_SHARDS];
+
     /**
-     * \~french \brief Map d'index des éléments du cache
-     * \~english \brief Cache element index map
+     * \~french \brief Nombre de partitions utilisées
+     * \details Toutes les partitions avec un budget mémoire, une partition pour #ROK4_INDEX_CACHE_MIN_SHARD_SIZE éléments sinon
+     * \~english \brief Used shards number
+     * \details All shards with a memory budget, one shard for #ROK4_INDEX_CACHE_MIN_SHARD_SIZE elements otherwise
      */
-    static std::unordered_map<std::string, std::list<IndexElement *>::iterator> map;
+    static std::atomic<int> shards_count;
+
     /**
      * \~french \brief Taille du cache en nombre d'élément
-     * \details 100 par défaut
+     * \details 100 par défaut. Chaque partition en contient au plus une part égale, la somme des parts valant la taille
      * \~english \brief Cache size
-     * \details Default value : 100
+     * \details Default value : 100. Each shard contains at most an equal part, parts' sum being the size
      */
-    static int size;
+    static std::atomic<int> size;
     /**
      * \~french \brief Durée de validité en seconde d'un élément du cache
      * \details 300 par défaut (5 minutes)
      * \~english \brief Cache element's validity period, in seconds
      * \details Default value : 300 (5 minutes)
      */
-    static int validity;
+    static std::atomic<int> validity;
+    /**
+     * \~french \brief Durée de validité en seconde d'un élément négatif (dalle absente)
+     * \details 60 par défaut. Plus courte que #validity, une dalle absente pouvant être créée par une mise à jour de la pyramide
+     * \~english \brief Negative element's (missing slab) validity period, in seconds
+     * \details Default value : 60. Shorter than #validity, a missing slab being possibly created by a pyramid update
+     */
+    static std::atomic<int> missing_validity;
+    /**
+     * \~french \brief Budget mémoire du cache, en octets
+     * \details 0 par défaut : le cache est limité en nombre d'éléments (#size). Sinon, le cache est limité par la mémoire occupée par les index, quelle que soit leur taille
+     * \~english \brief Cache memory budget, in bytes
+     * \details Default value : 0, cache is limited in elements number (#size). Otherwise, cache is limited by memory used by indexes, whatever their size
+     */
+    static std::atomic<size_t> memory_budget;
+
+    /**
+     * \~french \brief Délai en secondes pendant lequel un élément périmé est encore servi, le temps d'être rafraîchi
+     * \details 0 par défaut : un élément périmé n'est plus servi et l'index est relu lors de la demande
+     * \~english \brief Delay in seconds during which an expired element is still served, while it is refreshed
+     * \details Default value : 0, an expired element is no more served and the index is read again during the request
+     */
+    static std::atomic<int> stale_validity;
+    /**
+     * \~french \brief Nombre minimal de demandes servies par un élément périmé pour qu'il soit rafraîchi en tâche de fond
+     * \details 10 par défaut. Les éléments moins demandés expirent normalement
+     * \~english \brief Minimal number of requests served by an expired element to be refreshed in background
+     * \details Default value : 10. Elements less requested expire normally
+     */
+    static std::atomic<int> refresh_hits;
+
+    /**
+     * \~french \brief Rafraîchissement d'un index à faire en tâche de fond
+     * \~english \brief Index refresh to do in background
+     */
+    struct RefreshTask {
+        std::string key;
+        Context* context;
+        std::string name;
+        int tiles_number;
+    };
 
     /**
-     * \~french \brief Exclusion mutuelle
-     * \details Pour éviter les modifications concurrentes du cache des index
-     * \~english \brief Mutual exclusion
-     * \details To avoid concurrent index cache updates
+     * \~french \brief Thread de rafraîchissement des index, démarré au premier rafraîchissement demandé
+     * \~english \brief Indexes refresh thread, started with the first asked refresh
      */
-    static std::mutex mtx;
+    static std::thread refresher;
+    /**
+     * \~french \brief Rafraîchissements en attente
+     * \~english \brief Waiting refreshes
+     */
+    static std::deque<RefreshTask> refresh_queue;
+    /**
+     * \~french \brief Le thread de rafraîchissement doit-il s'arrêter
+     * \~english \brief Does the refresh thread have to stop
+     */
+    static bool refresh_stopping;
+    /**
+     * \~french \brief Exclusion mutuelle sur les rafraîchissements en attente et l'état du thread
+     * \~english \brief Mutual exclusion for waiting refreshes and thread state
+     */
+    static std::mutex refresh_mtx;
+    /**
+     * \~french \brief Réveil du thread de rafraîchissement
+     * \~english \brief Refresh thread wake up
+     */
+    static std::condition_variable refresh_cv;
+
+    /**
+     * \~french \brief Arrête le thread de rafraîchissement à la fin du programme, avant sa destruction
+     * \~english \brief Stop the refresh thread at program end, before its destruction
+     */
+    static struct Stopper {
+        ~Stopper() { IndexCache::stop_refresher(); }
+    } stopper;
+
+    /**
+     * \~french \brief Demande le rafraîchissement d'un élément en tâche de fond
+     * \~english \brief Ask for an element refresh in background
+     */
+    static void schedule_refresh(const std::string& key, const IndexElement* elem);
+
+    /**
+     * \~french \brief Fonction exécutée par le thread de rafraîchissement
+     * \~english \brief Refresh thread's function
+     */
+    static void run_refresher();
+
+    /**
+     * \~french \brief Relit l'index d'une dalle et remplace l'élément du cache
+     * \details La dalle de donnée est relue directement : le changement de cible d'une dalle symbolique n'est pris en compte qu'à la péremption définitive de l'élément
+     * \~english \brief Read again a slab index and replace the cache element
+     * \details Data slab is directly read : a symbolic slab's target change is only taken into account when element definitely expires
+     */
+    static void refresh(const RefreshTask& task);
+
+    /**
+     * \~french \brief Ajoute un élément dans la partition de sa clé, en retirant les plus anciens si nécessaire
+     * \~english \brief Add an element in its key's shard, removing the oldest ones if needed
+     */
+    static void add_element(std::string key, std::shared_ptr<const IndexElement> elem);
+
+    /**
+     * \~french \brief Partition d'une clé
+     * \~english \brief Key's shard
+     */
+    static Shard& get_shard(size_t hash);
+
+    /**
+     * \~french \brief Compartiment d'une clé dans sa partition
+     * \~english \brief Key's bucket in its shard
+     */
+    static std::atomic<const Bucket*>& get_bucket(Shard& shard, size_t hash);
+
+    /**
+     * \~french \brief Recherche sans verrou de l'élément d'une clé
+     * \~english \brief Lock-free search of a key's element
+     */
+    static std::shared_ptr<const IndexElement> find_element(const std::string& key);
+
+    /**
+     * \~french \brief Remplace l'élément d'une clé dans son compartiment, en publiant une copie modifiée du compartiment
+     * \details Le verrou de la partition doit être détenu
+     * \param[in] elem Nouvel élément, NULL pour retirer la clé
+     * \~english \brief Replace a key's element in its bucket, publishing an updated copy of the bucket
+     * \details Shard's lock has to be held
+     * \param[in] elem New element, NULL to remove the key
+     */
+    static void set_element(Shard& shard, const std::string& key, std::shared_ptr<const IndexElement> elem);
+
+    /**
+     * \~french \brief Libère les compartiments remplacés de la partition, une fois terminées les lectures qui pouvaient les utiliser
+     * \details Le verrou de la partition doit être détenu. Attend, sans bloquer les nouvelles lectures, la fin des lectures en cours
+     * \~english \brief Free shard's replaced buckets, once lookups which could use them are over
+     * \details Shard's lock has to be held. Waits, without blocking new lookups, for running lookups to end
+     */
+    static void reclaim(Shard& shard);
+
+    /**
+     * \~french \brief Adapte le nombre de partitions utilisées à la limite du cache, en vidant le cache s'il change
+     * \~english \brief Adapt used shards number to cache limit, emptying the cache if it changes
+     */
+    static void update_shards_count();
 
     /**
      * \~french
@@ -120,9 +379,11 @@ public:
 
     /** \~french
      * \brief Définit la taille du cache
+     * \details Le cache est vidé si le nombre de partitions utilisées change : la taille est à définir avant utilisation
      * \param[in] s taille du cache
      ** \~english
      * \brief Define cache size
+     * \details Cache is emptied if used shards number changes : size has to be defined before use
      * \param[in] s cache size
      */
     static void setCacheSize(int s);
@@ -136,6 +397,54 @@ public:
      */
     static void set_validity(int v);
 
+    /** \~french
+     * \brief Définit la durée de validité des éléments négatifs (dalles absentes)
+     * \param[in] v durée de validité, en secondes
+     ** \~english
+     * \brief Define negative elements (missing slabs) validity
+     * \param[in] v validity, in seconds
+     */
+    static void set_missing_validity(int v);
+
+    /** \~french
+     * \brief Définit le délai pendant lequel un élément périmé est encore servi
+     * \details Pendant ce délai, les éléments périmés assez demandés (#refresh_hits) sont rafraîchis en tâche de fond et remplacés dans le cache, sans que les demandes n'attendent la relecture de l'index. Le thread de rafraîchissement est arrêté par StoragePool::clean_storages avant la suppression des contextes de stockage, et automatiquement à la fin du programme. Une application supprimant elle-même ses contextes doit d'abord appeler #stop_refresher.
+     * \param[in] v délai en secondes, 0 pour désactiver
+     ** \~english
+     * \brief Define delay during which an expired element is still served
+     * \details During this delay, expired elements requested enough (#refresh_hits) are refreshed in background and replaced in the cache, without requests waiting for the index reading. Refresh thread is stopped by StoragePool::clean_storages before storage contexts deletion, and automatically at program end. An application deleting its own contexts has to call #stop_refresher first.
+     * \param[in] v delay in seconds, 0 to disable
+     */
+    static void set_stale_validity(int v);
+
+    /** \~french
+     * \brief Définit le nombre minimal de demandes pour rafraîchir un élément en tâche de fond
+     * \param[in] h nombre de demandes servies par l'élément
+     ** \~english
+     * \brief Define minimal requests number to refresh an element in background
+     * \param[in] h requests number served by the element
+     */
+    static void set_refresh_hits(int h);
+
+    /**
+     * \~french \brief Arrête le thread de rafraîchissement, en abandonnant les rafraîchissements en attente
+     * \details Attend la fin du rafraîchissement en cours. Le thread est redémarré par le prochain rafraîchissement demandé.
+     * \~english \brief Stop the refresh thread, giving up waiting refreshes
+     * \details Wait for the running refresh. The thread is started again by the next asked refresh.
+     */
+    static void stop_refresher();
+
+    /** \~french
+     * \brief Définit le budget mémoire du cache
+     * \details Si non nul, remplace la limite en nombre d'éléments. Le cache est vidé si le nombre de partitions utilisées change
+     * \param[in] b budget en octets, 0 pour limiter en nombre d'éléments
+     ** \~english
+     * \brief Define cache memory budget
+     * \details If not null, replaces the elements number limit. Cache is emptied if used shards number changes
+     * \param[in] b budget in bytes, 0 to limit elements number
+     */
+    static void set_memory_budget(size_t b);
+
     /** \~french
      * \brief Ajoute un élément au cache
      * \param[in] origin_slab_name nom d'interrogation de la dalle
@@ -155,6 +464,17 @@ public:
      */
     static void add_slab_infos(std::string origin_slab_name, Context* data_context, std::string data_slab_name, int tiles_number, uint8_t* offsets, uint8_t* sizes);
 
+    /** \~french
+     * \brief Mémorise l'absence d'une dalle
+     * \details Les demandes suivantes sur cette dalle sont résolues sans la relire, pendant #missing_validity secondes
+     * \param[in] origin_slab_name nom d'interrogation de la dalle
+     ** \~english
+     * \brief Memorize a slab absence
+     * \details Next requests on this slab are resolved without reading it, during #missing_validity seconds
+     * \param[in] origin_slab_name Slab request name
+     */
+    static void add_missing_slab(std::string origin_slab_name);
+
     /** \~french
      * \brief Demande un élément du cache
      * \param[in] key nom d'interrogation de la dalle
@@ -163,6 +483,7 @@ public:
      * \param[out] data_slab_name nom de la dalle contenant les données
      * \param[out] offset offset de la tuile
      * \param[out] size taille de la tuile
+     * \param[out] missing si fourni, précise si la dalle est connue comme absente (la réponse est alors fausse)
      ** \~english
      * \brief Ask element from cache
      * \param[in] key Slab request name
@@ -171,8 +492,37 @@ public:
      * \param[out] data_slab_name Real data slab
      * \param[out] offset tile's offset
      * \param[out] size tile's size
+     * \param[out] missing if provided, precise if slab is known as missing (answer is then false)
+     */
+    static bool get_slab_infos(std::string key, int tile_number, Context** data_context, std::string* data_slab_name, uint32_t* offset, uint32_t* size, bool* missing = NULL);
+
+    /** \~french
+     * \brief Enregistre les éléments du cache dans un fichier local
+     * \details Pour chaque élément sont écrits la clé, le type et le contenant du contexte de stockage de la dalle de donnée, le nom de cette dalle (cible résolue d'une dalle symbolique), la date d'ajout, le nombre de demandes servies et les offsets et tailles des tuiles. Les éléments négatifs et ceux dont le contexte n'est pas dans le StoragePool ne sont pas enregistrés. Le fichier est écrit à côté puis renommé, pour ne jamais laisser d'instantané partiel.
+     * \param[in] path chemin du fichier
+     * \param[in] min_hits nombre minimal de demandes servies par un élément pour qu'il soit enregistré
+     * \return Nombre d'éléments enregistrés, un nombre négatif en cas d'erreur
+     ** \~english
+     * \brief Save cache elements in a local file
+     * \details For each element are written the key, the type and the tray of the data slab storage context, this slab name (resolved target of a symbolic slab), the addition date, the served requests number and tiles' offsets and sizes. Negative elements and those whose context is not in the StoragePool are not saved. File is written aside then renamed, never to leave a partial snapshot.
+     * \param[in] path file path
+     * \param[in] min_hits minimal served requests number for an element to be saved
+     * \return Saved elements number, negative integer if error
+     */
+    static int save_snapshot(std::string path, int min_hits = 0);
+
+    /** \~french
+     * \brief Charge dans le cache les éléments d'un instantané
+     * \details Les contextes de stockage sont récupérés ou créés via le StoragePool. Les éléments gardent leur date d'ajout d'origine : leur validité est vérifiée lors des demandes, comme pour les autres éléments (et ils peuvent être rafraîchis en tâche de fond). Ceux déjà définitivement périmés ne sont pas chargés.
+     * \param[in] path chemin du fichier
+     * \return Nombre d'éléments chargés, un nombre négatif en cas d'erreur
+     ** \~english
+     * \brief Load snapshot elements in the cache
+     * \details Storage contexts are got or created with the StoragePool. Elements keep their original addition date : their validity is checked during requests, as for other elements (and they can be refreshed in background). Those already definitely expired are not loaded.
+     * \param[in] path file path
+     * \return Loaded elements number, negative integer if error
      */
-    static bool get_slab_infos(std::string key, int tile_number, Context** data_context, std::string* data_slab_name, uint32_t* offset, uint32_t* size);
+    static int load_snapshot(std::string path);
 
     /**
      * \~french \brief Nettoie tous les objets dans le cache
@@ -47,6 +47,9 @@
 
 #include <boost/log/trivial.hpp>
 #include <vector>
+#include <memory>
+#include <ctime>
+#include <atomic>
 #include <string.h>
 
 #include "rok4/storage/Context.h"
@@ -55,6 +58,10 @@
  * \author Institut national de l'information géographique et forestière
  * \~french
  * \brief Élément du cache des index de dalle
+ * \details Les offsets et tailles des tuiles sont stockés dans un unique bloc contigu, alternés par tuile. Un élément peut aussi mémoriser l'absence de la dalle (élément négatif), sans tuiles.
+ * \~english
+ * \brief Slab index cache element
+ * \details Tiles' offsets and sizes are stored in one contiguous block, alternating per tile. An element can also memorize the slab absence (negative element), without tiles.
  */
 class IndexElement {
 friend class IndexCache;
@@ -65,11 +72,6 @@ protected:
      * \~english \brief Cache date
      */
     std::time_t date;
-    /**
-     * \~french \brief Clé sous laquelle l'élément est enregistré dans le cache
-     * \~english \brief Cache key
-     */
-    std::string key;
     /**
      * \~french \brief Nom de la dalle dans laquelle lire la donnée
      * \~english \brief Data slab to read
@@ -81,32 +83,100 @@ protected:
      */
     Context* context;
     /**
-     * \~french \brief Offsets des tuiles dans la dalle
-     * \~english \brief Tiles' offsets
+     * \~french \brief La dalle est-elle absente
+     * \~english \brief Is the slab missing
+     */
+    bool missing;
+    /**
+     * \~french \brief Nombre de tuiles dans la dalle
+     * \~english \brief Tiles number in the slab
+     */
+    int tiles_number;
+    /**
+     * \~french \brief Offsets et tailles des tuiles dans la dalle
+     * \details Pour la tuile i : offset en 2i, taille en 2i+1
+     * \~english \brief Tiles' offsets and sizes
+     * \details For tile i : offset at 2i, size at 2i+1
+     */
+    std::unique_ptr<uint32_t[]> tiles;
+    /**
+     * \~french \brief Nombre de demandes servies par l'élément
+     * \details Seuls les éléments assez demandés sont rafraîchis en tâche de fond
+     * \~english \brief Number of requests served by the element
+     * \details Only elements requested enough are refreshed in background
      */
-    std::vector<uint32_t> offsets;
+    mutable std::atomic<uint32_t> hits;
     /**
-     * \~french \brief Tailles des tuiles dans la dalle
-     * \~english \brief Tiles' sizes
+     * \~french \brief Un rafraîchissement de l'élément a-t-il été demandé
+     * \~english \brief Has an element refresh been asked
      */
-    std::vector<uint32_t> sizes;
+    mutable std::atomic<bool> refreshing;
 
     /** \~french
      * \brief Constructeur
-     * \param[in] k clé d'enregistrement dans le cache
-     * \param[in] s nom de la dalle
      * \param[in] c contexte de stockage de la dalle
+     * \param[in] n nom de la dalle
      * \param[in] tiles_number nombre de tuiles dans la dalles
      * \param[in] os offsets bruts des tuiles 
      * \param[in] ss tailles brutes des tuiles
      ** \~english
      * \brief Constructor
-     * \param[in] k cache key
-     * \param[in] s data slab name
      * \param[in] c data slab storage context
+     * \param[in] n data slab name
      * \param[in] tiles_number tiles number
      * \param[in] os raw tiles' offsets
      * \param[in] ss raw tiles' sizes
      */
-    IndexElement(std::string k, Context* c, std::string n, int tiles_number, uint8_t* os, uint8_t* ss);
-};
\ No newline at end of file
+    IndexElement(Context* c, std::string n, int tiles_number, uint8_t* os, uint8_t* ss);
+
+    /** \~french
+     * \brief Constructeur d'un élément dont les tuiles seront renseignées directement
+     * \details Utilisé pour le rechargement d'un instantané du cache : #tiles est alloué mais pas rempli
+     * \param[in] c contexte de stockage de la dalle
+     * \param[in] n nom de la dalle
+     * \param[in] tiles_number nombre de tuiles dans la dalles
+     * \param[in] d date d'enregistrement d'origine dans le cache
+     ** \~english
+     * \brief Constructor of an element whose tiles will be directly filled
+     * \details Used to reload a cache snapshot : #tiles is allocated but not filled
+     * \param[in] c data slab storage context
+     * \param[in] n data slab name
+     * \param[in] tiles_number tiles number
+     * \param[in] d original cache date
+     */
+    IndexElement(Context* c, std::string n, int tiles_number, std::time_t d);
+
+    /** \~french
+     * \brief Constructeur d'un élément négatif, pour une dalle absente
+     ** \~english
+     * \brief Negative element constructor, for a missing slab
+     */
+    IndexElement();
+
+    /** \~french
+     * \brief Offset d'une tuile
+     ** \~english
+     * \brief Tile's offset
+     */
+    uint32_t get_offset(int i) const {
+        return tiles[2 * i];
+    }
+
+    /** \~french
+     * \brief Taille d'une tuile
+     ** \~english
+     * \brief Tile's size
+     */
+    uint32_t get_size(int i) const {
+        return tiles[2 * i + 1];
+    }
+
+    /** \~french
+     * \brief Estimation de la mémoire occupée par l'élément, en octets
+     ** \~english
+     * \brief Estimated memory used by element, in bytes
+     */
+    size_t get_memory_size() const {
+        return sizeof(IndexElement) + name.capacity() + 2 * sizeof(uint32_t) * tiles_number;
+    }
+};
@@ -0,0 +1,158 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file LatencyTracker.h
+ ** \~french
+ * \brief Définition de la classe LatencyTracker
+ ** \~english
+ * \brief Define classe LatencyTracker
+ */
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+
+#define ROK4_LATENCY_TRACKER_CAPACITY 512
+#define ROK4_LATENCY_TRACKER_MIN_SAMPLES 32
+#define ROK4_LATENCY_TRACKER_REFRESH 16
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Suivi des durées des dernières requêtes
+ * \details Les durées sont conservées dans un tampon circulaire (les ROK4_LATENCY_TRACKER_CAPACITY dernières). Un percentile n'est donné qu'à partir de ROK4_LATENCY_TRACKER_MIN_SAMPLES mesures, et n'est recalculé que toutes les ROK4_LATENCY_TRACKER_REFRESH nouvelles mesures.
+ *
+ * Utilisé par les contextes objet pour déterminer le délai au bout duquel une lecture est doublée.
+ * \~english
+ * \brief Last requests durations tracking
+ * \details Durations are stored in a circular buffer (the ROK4_LATENCY_TRACKER_CAPACITY last ones). A percentile is only given from ROK4_LATENCY_TRACKER_MIN_SAMPLES measures, and is only computed again every ROK4_LATENCY_TRACKER_REFRESH new measures.
+ *
+ * Used by object contexts to determine the delay after which a reading is hedged.
+ */
+class LatencyTracker {
+
+private:
+
+    /**
+     * \~french \brief Durées mesurées, en millisecondes
+     * \~english \brief Measured durations, in milliseconds
+     */
+    std::vector<int> samples;
+
+    /**
+     * \~french \brief Position de la prochaine mesure dans le tampon
+     * \~english \brief Next measure position in the buffer
+     */
+    int next;
+
+    /**
+     * \~french \brief Nombre de mesures depuis le dernier calcul du percentile
+     * \~english \brief Measures number since the last percentile computing
+     */
+    int since_computing;
+
+    /**
+     * \~french \brief Dernier percentile demandé
+     * \~english \brief Last asked percentile
+     */
+    int computed_percentile;
+
+    /**
+     * \~french \brief Valeur calculée du dernier percentile demandé, -1 si pas encore calculée
+     * \~english \brief Computed value of the last asked percentile, -1 if not yet computed
+     */
+    int computed_value;
+
+    /**
+     * \~french \brief Exclusion mutuelle
+     * \~english \brief Mutual exclusion
+     */
+    std::mutex mtx;
+
+public:
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructor
+     */
+    LatencyTracker ();
+
+    /**
+     * \~french \brief Ajoute une mesure
+     * \param[in] duration Durée de la requête, en millisecondes
+     * \~english \brief Add a measure
+     * \param[in] duration Request's duration, in milliseconds
+     */
+    void add (int duration);
+
+    /**
+     * \~french \brief Donne un percentile des dernières durées mesurées
+     * \param[in] percentile Percentile voulu, entre 1 et 100
+     * \return Durée en millisecondes, -1 s'il n'y a pas assez de mesures
+     * \~english \brief Get a percentile of the last measured durations
+     * \param[in] percentile Wanted percentile, between 1 and 100
+     * \return Duration in milliseconds, -1 if there is not enough measures
+     */
+    int get_percentile (int percentile);
+
+    /**
+     * \~french \brief Donne le délai au bout duquel une lecture est doublée
+     * \param[in] percentile Percentile des durées, 0 si les lectures ne sont pas doublées
+     * \param[in] min_delay Délai minimal en millisecondes
+     * \return Délai en millisecondes, -1 si la lecture ne doit pas être doublée (doublement désactivé ou pas assez de mesures)
+     * \~english \brief Get the delay after which a reading is hedged
+     * \param[in] percentile Durations percentile, 0 if readings are not hedged
+     * \param[in] min_delay Minimal delay in milliseconds
+     * \return Delay in milliseconds, -1 if reading have not to be hedged (disabled hedging or not enough measures)
+     */
+    int get_hedge_delay (int percentile, int min_delay);
+
+    /**
+     * \~french \brief Donne le nombre de mesures conservées
+     * \~english \brief Get the stored measures number
+     */
+    int get_count ();
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~LatencyTracker ();
+};
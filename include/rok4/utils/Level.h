@@ -53,6 +53,7 @@ class Level;
 #include "rok4/utils/Configuration.h"
 #include "rok4/utils/Level.h"
 #include "rok4/utils/Table.h"
+#include "rok4/utils/TileIndex.h"
 
 /**
  */
@@ -67,6 +68,7 @@ private:
     std::string racine;
     Context* context;
     int path_depth; // used only for file context
+    std::shared_ptr<TileIndex> tile_index; // index des tuiles du niveau, optionnel
 
     // Format de stockage
     Rok4Format::eFormat format; // format d'image des tuiles
@@ -87,6 +89,30 @@ private:
     DataSource* get_encoded_tile ( int x, int y );
     DataSource* get_decoded_tile ( int x, int y );
 
+    /**
+     * Décode une tuile dont la donnée a déjà été lue (ou sera lue à la demande)
+     * Renvoie 0 si la tuile est absente ou illisible, la source encodée est alors supprimée
+     */
+    DataSource* decode_tile ( DataSource* encoded_data );
+
+    /**
+     * Renvoie la tuile x, y décodée si elle est dans le cache des tuiles décodées, NULL sinon
+     * La source renvoyée partage la donnée du cache, sans copie
+     */
+    DataSource* get_cached_decoded_tile ( int x, int y );
+
+    /**
+     * Confie la tuile x, y décodée au cache des tuiles décodées (si actif)
+     * Renvoie une source partageant la donnée du cache, la source décodée est alors supprimée
+     */
+    DataSource* cache_decoded_tile ( DataSource* decoded_data, int x, int y );
+
+    /**
+     * Construit l'image (découpée par left, top, right et bottom) de la tuile x, y à partir de sa donnée décodée
+     * Sans donnée, une image de nodata est renvoyée, ou NULL si null_for_nodata
+     */
+    Image* tile_to_image ( DataSource* ds, int x, int y, int left, int top, int right, int bottom, bool null_for_nodata );
+
 protected:
     /**
      * Renvoie une image de taille width, height
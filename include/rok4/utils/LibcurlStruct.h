@@ -54,15 +54,30 @@
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <curl/curl.h>
+#include <boost/log/trivial.hpp>
 
 struct HeaderStruct {
     char* url;
     char* token;
+    /**
+     * \~french \brief Durée de validité restante du jeton en secondes (X-Auth-Token-Expires), -1 si inconnue
+     * \~english \brief Token remaining validity in seconds (X-Auth-Token-Expires), -1 if unknown
+     */
+    int expires;
 
     HeaderStruct()
     {
         url = 0;
         token = 0;
+        expires = -1;
     }
 
     ~HeaderStruct()
@@ -83,6 +98,66 @@ struct DataStruct {
     }
 };
 
+/**
+ * \~french \brief Buffer de destination, de taille connue, pour la réception de données
+ * \details Des données reçues au delà de la capacité interrompent le transfert, ce qui est signalé via #overflow
+ * \~english \brief Destination buffer, with known size, to receive data
+ * \details Data received beyond capacity abort the transfer, which is notified with #overflow
+ */
+struct BufferStruct {
+    uint8_t* data;
+    size_t capacity;
+    size_t size;
+    bool overflow;
+
+    BufferStruct(uint8_t* d, size_t c) : data(d), capacity(c), size(0), overflow(false) {}
+};
+
+/**
+ * \~french \brief État d'une lecture doublée : requête principale (indice 0) et requête doublée (indice 1)
+ * \details La requête principale reçoit les données dans le buffer de l'appelant, la requête doublée dans #hedge_data. Les objets curl sont préparés avant toute soumission, l'état n'est ensuite manipulé que par les fonctions de fin, dans le thread de la boucle curl, hormis les identifiants de soumission (#ids), écrits par le thread appelant sous #ids_mtx
+ * \~english \brief Hedged reading state : main request (index 0) and hedged request (index 1)
+ * \details Main request receives data in the caller's buffer, hedged request in #hedge_data. Curl objects are prepared before any submission, state is then only used by completion functions, in the curl loop's thread, except submission identifiers (#ids), written by the calling thread under #ids_mtx
+ */
+struct HedgedReadStruct {
+    CURL* handles[2];
+    uint64_t ids[2];
+    std::mutex ids_mtx;
+    struct curl_slist* lists[2];
+    BufferStruct* buffers[2];
+    std::vector<uint8_t> hedge_data;
+    std::chrono::steady_clock::time_point start;
+    bool finished[2];
+    bool done;
+    int failures;
+
+    HedgedReadStruct(size_t c) : hedge_data(c), start(std::chrono::steady_clock::now()), done(false), failures(0) {
+        ids[0] = 0;
+        ids[1] = 0;
+        finished[0] = false;
+        finished[1] = false;
+    }
+
+    /**
+     * \~french \brief Identifiant de soumission d'une requête
+     * \details Attend la fin des soumissions : une requête terminée avant la soumission de l'autre doit pouvoir l'annuler
+     * \~english \brief Submission identifier of a request
+     * \details Wait for the end of submissions : a request done before the other one's submission has to be able to cancel it
+     */
+    uint64_t get_id(int i) {
+        std::lock_guard<std::mutex> lock(ids_mtx);
+        return ids[i];
+    }
+
+    /**
+     * \~french \brief Durée écoulée depuis la soumission de la requête principale, en millisecondes
+     * \~english \brief Elapsed time since the main request submission, in milliseconds
+     */
+    int elapsed() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
 
 static size_t header_callback(char *buffer, size_t nitems, size_t size, void *userp) {
 
@@ -95,6 +170,11 @@ static size_t header_callback(char *buffer, size_t nitems, size_t size, void *us
         hdr->url[realsize - 15 - 2] = '\0';
     }
 
+    else if (! strncasecmp ( buffer,"X-Auth-Token-Expires: ", 22)) {
+        std::string value(buffer + 22, realsize - 22);
+        hdr->expires = atoi(value.c_str());
+    }
+
     else if (! strncasecmp ( buffer,"X-Auth-Token: ", 14)) {
         hdr->token = (char*) malloc(realsize);
         strncpy(hdr->token, buffer, realsize - 2);
@@ -111,6 +191,19 @@ static size_t header_callback(char *buffer, size_t nitems, size_t size, void *us
     return realsize;
 }
 
+static size_t etag_callback(char *buffer, size_t nitems, size_t size, void *userp) {
+
+    size_t realsize = size * nitems;
+    std::string* etag = (std::string*) userp;
+
+    if (realsize > 8 && ! strncasecmp ( buffer,"ETag: ", 6)) {
+        // On enlève le retour chariot final
+        etag->assign(buffer + 6, realsize - 6 - 2);
+    }
+
+    return realsize;
+}
+
 static size_t data_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
 
@@ -131,6 +224,36 @@ static size_t data_callback(void *contents, size_t size, size_t nmemb, void *use
     return realsize;
 }
 
+static size_t buffer_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+
+    struct BufferStruct *buf = (struct BufferStruct *)userp;
+
+    if (buf->size + realsize > buf->capacity) {
+        // Réponse plus grande que demandé : le transfert est interrompu (CURLE_WRITE_ERROR)
+        buf->overflow = true;
+        size_t copied = buf->capacity - buf->size;
+        memcpy(buf->data + buf->size, contents, copied);
+        buf->size += copied;
+        return 0;
+    }
+
+    memcpy(buf->data + buf->size, contents, realsize);
+    buf->size += realsize;
+
+    return realsize;
+}
+
+/**
+ * \~french \brief Durée totale de la dernière requête d'un objet curl, en millisecondes
+ * \~english \brief Total duration of the curl object's last request, in milliseconds
+ */
+static int get_duration(CURL* curl) {
+    double seconds = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &seconds);
+    return (int) (seconds * 1000);
+}
+
 static bool get_ssl_no_verify() {
     return getenv(ROK4_SSL_NO_VERIFY) != NULL;
 }
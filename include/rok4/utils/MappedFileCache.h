@@ -0,0 +1,268 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file MappedFileCache.h
+ ** \~french
+ * \brief Définition de la classe MappedFileCache
+ ** \~english
+ * \brief Define classe MappedFileCache
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <atomic>
+#include <sys/types.h>
+
+/**
+ * \~french \brief Variable d'environnement donnant le nombre maximal de fichiers projetés en mémoire. 0 (par défaut) désactive la projection
+ * \~english \brief Environment variable for the maximal number of memory mapped files. 0 (default) disables mapping
+ */
+#define ROK4_FILE_MAPPINGS_CACHE_SIZE "ROK4_FILE_MAPPINGS_CACHE_SIZE"
+
+/**
+ * \~french \brief Variable d'environnement donnant le délai en secondes avant de vérifier qu'une projection en cache correspond toujours au fichier
+ * \~english \brief Environment variable for the delay in seconds before checking a cached mapping still matches the file
+ */
+#define ROK4_FILE_MAPPINGS_CACHE_VALIDITY "ROK4_FILE_MAPPINGS_CACHE_VALIDITY"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Fichier entier projeté en mémoire, en lecture seule
+ * \details La projection est supprimée à la destruction de l'objet, c'est-à-dire quand elle n'est plus en cache ni utilisée
+ * \~english
+ * \brief Whole file mapped in memory, read only
+ * \details Mapping is removed when object is destroyed, that is to say when it is neither cached nor used
+ */
+class MappedFile {
+
+public:
+
+    /**
+     * \~french \brief Début de la projection
+     * \~english \brief Mapping start
+     */
+    const uint8_t* data;
+
+    /**
+     * \~french \brief Taille du fichier projeté
+     * \~english \brief Mapped file size
+     */
+    size_t size;
+
+    /**
+     * \~french \brief Périphérique du fichier projeté
+     * \~english \brief Mapped file's device
+     */
+    dev_t device;
+
+    /**
+     * \~french \brief Inode du fichier projeté
+     * \~english \brief Mapped file's inode
+     */
+    ino_t inode;
+
+    /**
+     * \~french \brief Date de la dernière vérification du fichier
+     * \details Peut être mise à jour par n'importe quel thread utilisant la projection
+     * \~english \brief Last file check date
+     * \details Can be updated by any thread using the mapping
+     */
+    std::atomic<std::time_t> checked;
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructor
+     */
+    MappedFile(const uint8_t* d, size_t s, dev_t dev, ino_t i) : data(d), size(s), device(dev), inode(i), checked(std::time(NULL)) {}
+
+    /**
+     * \~french \brief Destructeur, supprime la projection
+     * \~english \brief Destructor, remove the mapping
+     */
+    ~MappedFile();
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Création d'un cache de fichiers projetés en mémoire (mmap)
+ * \details Les dalles sont projetées en entier et en lecture seule : les tuiles sont alors accessibles sans copie, directement dans le cache de pages du système. Le cache est borné en nombre de fichiers projetés, les moins récemment utilisés sont supprimés en premier. Une projection reste valide tant qu'un pointeur vers elle est détenu.
+ *
+ * Après #validity secondes, le fichier est de nouveau consulté (stat) : s'il a été supprimé, remplacé (changement d'inode) ou si sa taille a changé, il est projeté de nouveau.
+ *
+ * Un fichier projeté ne doit pas être tronqué sur place : un accès au-delà de sa nouvelle fin provoquerait une erreur de bus. Les mises à jour doivent passer par un nouveau fichier, renommé à la place de l'ancien.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Cache of memory mapped files (mmap)
+ * \details Slabs are entirely mapped, read only : tiles are then available without copy, directly in the system page cache. Cache is limited in mapped files number, least recently used ones are removed first. A mapping is valid while a pointer to it is held.
+ *
+ * After #validity seconds, file is checked again (stat) : if it has been removed, replaced (inode change) or if its size changed, it is mapped again.
+ *
+ * A mapped file must not be truncated in place : an access beyond its new end would raise a bus error. Updates have to be done with a new file, renamed over the old one.
+ *
+ * This class is supposed to be used without instance
+ */
+class MappedFileCache {
+
+private:
+
+    /**
+     * \~french \brief Liste des chemins en cache, du plus récemment utilisé au plus ancien
+     * \~english \brief Cached paths list, from the most recently used to the oldest
+     */
+    static std::list<std::string> lru;
+
+    /**
+     * \~french \brief Projections en cache, avec leur position dans #lru
+     * \~english \brief Cached mappings, with their position in #lru
+     */
+    static std::unordered_map<std::string, std::pair<std::shared_ptr<MappedFile>, std::list<std::string>::iterator> > map;
+
+    /**
+     * \~french \brief Nombre maximal de fichiers projetés
+     * \details Lu dans la variable d'environnement #ROK4_FILE_MAPPINGS_CACHE_SIZE, 0 par défaut (pas de projection)
+     * \~english \brief Maximal number of mapped files
+     * \details Read from environment variable #ROK4_FILE_MAPPINGS_CACHE_SIZE, default value : 0 (no mapping)
+     */
+    static int size;
+
+    /**
+     * \~french \brief Délai en secondes avant de vérifier de nouveau le fichier d'une projection
+     * \details Lu dans la variable d'environnement #ROK4_FILE_MAPPINGS_CACHE_VALIDITY, 10 par défaut
+     * \~english \brief Delay in seconds before checking again a mapping's file
+     * \details Read from environment variable #ROK4_FILE_MAPPINGS_CACHE_VALIDITY, default value : 10
+     */
+    static int validity;
+
+    /**
+     * \~french \brief Exclusion mutuelle
+     * \details Pour éviter les modifications concurrentes du cache des projections
+     * \~english \brief Mutual exclusion
+     * \details To avoid concurrent mappings cache updates
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Projette un fichier en mémoire
+     * \param[in] path chemin du fichier
+     * \return la projection, NULL en cas d'erreur ou si le fichier est vide
+     * \~english \brief Map a file in memory
+     * \param[in] path file path
+     * \return mapping, NULL if error or if file is empty
+     */
+    static std::shared_ptr<MappedFile> map_file(std::string path);
+
+    /**
+     * \~french
+     * \brief Constructeur
+     * \~english
+     * \brief Constructeur
+     */
+    MappedFileCache();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~MappedFileCache();
+
+    /** \~french
+     * \brief Définit la taille du cache
+     * \param[in] s nombre maximal de fichiers projetés, 0 pour désactiver la projection
+     ** \~english
+     * \brief Define cache size
+     * \param[in] s maximal number of mapped files, 0 to disable mapping
+     */
+    static void set_size(int s);
+
+    /** \~french
+     * \brief Définit le délai de vérification des fichiers
+     * \param[in] v délai en secondes
+     ** \~english
+     * \brief Define files check delay
+     * \param[in] v delay, in seconds
+     */
+    static void set_validity(int v);
+
+    /**
+     * \~french \brief La projection des fichiers est-elle activée
+     * \~english \brief Is file mapping enabled
+     */
+    static bool is_enabled() {
+        return size > 0;
+    }
+
+    /** \~french
+     * \brief Récupère la projection en mémoire du fichier
+     * \param[in] path chemin du fichier
+     * \return la projection, NULL si le fichier ne peut être projeté ou si la projection est désactivée
+     ** \~english
+     * \brief Get the file's memory mapping
+     * \param[in] path file path
+     * \return mapping, NULL if file cannot be mapped or if mapping is disabled
+     */
+    static std::shared_ptr<MappedFile> get_mapping(std::string path);
+
+    /** \~french
+     * \brief Retire la projection d'un fichier du cache
+     * \details À appeler quand le fichier est modifié ou supprimé
+     * \param[in] path chemin du fichier
+     ** \~english
+     * \brief Remove a file's mapping from the cache
+     * \details To call when file is modified or removed
+     * \param[in] path file path
+     */
+    static void invalidate(std::string path);
+
+    /**
+     * \~french \brief Retire toutes les projections du cache
+     * \~english \brief Remove all mappings from the cache
+     */
+    static void clean_mappings();
+};
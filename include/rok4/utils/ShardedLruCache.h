@@ -0,0 +1,431 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file ShardedLruCache.h
+ ** \~french
+ * \brief Définition de la classe générique ShardedLruCache
+ ** \~english
+ * \brief Define generic classe ShardedLruCache
+ */
+
+#pragma once
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <atomic>
+#include <functional>
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Politique d'admission par défaut : toute nouvelle entrée est admise et les moins récemment utilisées sortent
+ * \~english
+ * \brief Default admission policy : every new entry comes in and least recently used ones are evicted
+ */
+struct LruAdmission {
+    /**
+     * \~french \brief Compte un accès à une clé
+     * \~english \brief Count an access to a key
+     */
+    void record_access(size_t /* hash */) {}
+    /**
+     * \~french \brief Le candidat peut-il faire sortir la victime
+     * \~english \brief Can candidate evict victim
+     */
+    bool admit(size_t /* candidate */, size_t /* victim */) { return true; }
+    /**
+     * \~french \brief Oublie les accès comptés
+     * \~english \brief Forget counted accesses
+     */
+    void clear() {}
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Cache mémoire partitionné, ordonné par dernière utilisation
+ * \details Le cache est borné en mémoire occupée et partitionné selon le hash de la clé, chaque partition ayant son propre verrou. Les éléments sont partagés avec les appelants : ils restent valides tant qu'ils sont détenus, même sortis du cache. Un élément n'est plus servi au-delà de #validity secondes.
+ *
+ * Quand une partition est pleine, la politique d'admission décide si le nouvel élément peut faire sortir les moins récemment utilisés. Les éléments périmés sortent toujours.
+ *
+ * Les éléments doivent exposer leur taille en octets (\b size) et leur date de création (\b date). La politique d'admission est instanciée dans chaque partition et appelée sous son verrou : voir #LruAdmission.
+ * \~english
+ * \brief Sharded memory cache, ordered by last use
+ * \details Cache is limited in used memory and sharded according to the key's hash, each shard having its own lock. Elements are shared with callers : they stay valid while they are held, even out of the cache. An element is no more served after #validity seconds.
+ *
+ * When a shard is full, the admission policy decides whether the new element can evict the least recently used ones. Expired elements are always evicted.
+ *
+ * Elements have to expose their size in bytes (\b size) and their creation date (\b date). Admission policy is instanciated in each shard and called under its lock : see #LruAdmission.
+ */
+template<typename Key, typename Element, int SHARDS, typename Admission = LruAdmission>
+class ShardedLruCache {
+
+private:
+
+    /**
+     * \~french \brief Partition du cache
+     * \~english \brief Cache shard
+     */
+    struct Shard {
+        /**
+         * \~french \brief Clés des éléments, du plus récemment utilisé au plus ancien
+         * \~english \brief Elements' keys, from the most recently used to the oldest
+         */
+        std::list<Key> lru;
+        /**
+         * \~french \brief Éléments en cache, avec leur position dans #lru
+         * \~english \brief Cached elements, with their position in #lru
+         */
+        std::unordered_map<Key, std::pair<std::shared_ptr<Element>, typename std::list<Key>::iterator> > elements;
+        /**
+         * \~french \brief Mémoire occupée par les éléments de la partition, en octets
+         * \~english \brief Memory used by shard's elements, in bytes
+         */
+        size_t memory;
+        /**
+         * \~french \brief État de la politique d'admission
+         * \~english \brief Admission policy state
+         */
+        Admission admission;
+        /**
+         * \~french \brief Exclusion mutuelle
+         * \~english \brief Mutual exclusion
+         */
+        std::mutex mtx;
+
+        Shard() : memory(0) {}
+    };
+
+    /**
+     * \~french \brief Partitions du cache
+     * \~english \brief Cache shards
+     */
+    Shard shards[SHARDS];
+
+    /**
+     * \~french \brief Mémoire maximale occupée par les éléments en cache, en octets
+     * \details 0 : pas de cache. Répartie équitablement entre les partitions
+     * \~english \brief Maximal memory used by cached elements, in bytes
+     * \details 0 : no cache. Equally shared between shards
+     */
+    std::atomic<size_t> memory_budget;
+
+    /**
+     * \~french \brief Durée de validité en secondes d'un élément en cache
+     * \~english \brief Cached element validity, in seconds
+     */
+    std::atomic<int> validity;
+
+    /**
+     * \~french \brief Nombre d'éléments trouvés dans le cache
+     * \~english \brief Elements found in the cache
+     */
+    std::atomic<long> hits;
+
+    /**
+     * \~french \brief Nombre d'éléments absents du cache
+     * \~english \brief Elements missing in the cache
+     */
+    std::atomic<long> misses;
+
+    /**
+     * \~french \brief Partition d'un hash de clé
+     * \~english \brief Key hash's shard
+     */
+    Shard& get_shard(size_t hash) {
+        return shards[hash % SHARDS];
+    }
+
+    /**
+     * \~french \brief Supprime un élément de la partition
+     * \details L'exclusion mutuelle de la partition doit être détenue
+     * \~english \brief Remove an element from the shard
+     * \details Shard's mutual exclusion have to be held
+     */
+    void remove(Shard& shard, const Key& key);
+
+public:
+
+    /** \~french
+     * \brief Constructeur
+     * \param[in] b mémoire maximale en octets, 0 pour désactiver le cache
+     * \param[in] v durée de validité en secondes
+     ** \~english
+     * \brief Constructor
+     * \param[in] b maximal memory in bytes, 0 to disable cache
+     * \param[in] v validity, in seconds
+     */
+    ShardedLruCache(size_t b, int v) : memory_budget(b), validity(v), hits(0), misses(0) {}
+
+    /** \~french
+     * \brief Définit la mémoire maximale occupée par les éléments en cache
+     * \param[in] b mémoire en octets, 0 pour désactiver le cache
+     ** \~english
+     * \brief Define maximal memory used by cached elements
+     * \param[in] b memory in bytes, 0 to disable cache
+     */
+    void set_memory_budget(size_t b) {
+        memory_budget = b;
+    }
+
+    /** \~french
+     * \brief Définit la durée de validité des éléments en cache
+     * \param[in] v durée en secondes
+     ** \~english
+     * \brief Define cached elements validity
+     * \param[in] v validity, in seconds
+     */
+    void set_validity(int v) {
+        validity = v;
+    }
+
+    /** \~french
+     * \brief Le cache est-il actif
+     ** \~english
+     * \brief Is cache enabled
+     */
+    bool is_enabled() {
+        return memory_budget > 0;
+    }
+
+    /** \~french
+     * \brief Récupère un élément en cache
+     * \details L'accès est compté par la politique d'admission, que l'élément soit en cache ou non. Un élément périmé est retiré.
+     * \param[in] key clé de l'élément
+     * \return l'élément, un pointeur nul si absent ou périmé
+     ** \~english
+     * \brief Get a cached element
+     * \details Access is counted by the admission policy, whether element is cached or not. An expired element is removed.
+     * \param[in] key element's key
+     * \return element, a null pointer if missing or expired
+     */
+    std::shared_ptr<Element> get(const Key& key);
+
+    /** \~french
+     * \brief Propose un élément au cache
+     * \details L'élément n'est pas conservé s'il est vide, plus grand que la mémoire d'une partition, ou refusé par la politique d'admission. Un élément déjà en cache pour cette clé est remplacé sans consulter la politique d'admission
+     * \param[in] key clé de l'élément
+     * \param[in] elem élément
+     * \return Vrai si l'élément est conservé
+     ** \~english
+     * \brief Offer an element to the cache
+     * \details Element is not kept if it is empty, bigger than a shard memory, or refused by the admission policy. An element already cached for this key is replaced without asking the admission policy
+     * \param[in] key element's key
+     * \param[in] elem element
+     * \return True if element is kept
+     */
+    bool add(const Key& key, std::shared_ptr<Element> elem);
+
+    /** \~french
+     * \brief Retire du cache les éléments vérifiant un prédicat
+     * \param[in] predicate fonction appelée sous le verrou de chaque partition
+     ** \~english
+     * \brief Remove from the cache elements matching a predicate
+     * \param[in] predicate function called under each shard's lock
+     */
+    void remove_if(std::function<bool(const Element&)> predicate);
+
+    /** \~french
+     * \brief Nombre d'éléments trouvés dans le cache depuis le démarrage
+     ** \~english
+     * \brief Elements found in the cache since start
+     */
+    long get_hits() {
+        return hits;
+    }
+
+    /** \~french
+     * \brief Nombre d'éléments absents du cache depuis le démarrage
+     ** \~english
+     * \brief Elements missing in the cache since start
+     */
+    long get_misses() {
+        return misses;
+    }
+
+    /** \~french
+     * \brief Mémoire occupée par les éléments en cache, en octets
+     ** \~english
+     * \brief Memory used by cached elements, in bytes
+     */
+    size_t get_memory();
+
+    /**
+     * \~french \brief Vide le cache, oublie les accès comptés et remet les compteurs à zéro
+     * \~english \brief Empty the cache, forget counted accesses and reset counters
+     */
+    void clean();
+};
+
+/*****************************************************************************************************/
+/******************************************** DEFINITIONS ********************************************/
+/*****************************************************************************************************/
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+void ShardedLruCache<Key, Element, SHARDS, Admission>::remove(Shard& shard, const Key& key) {
+    typename std::unordered_map<Key, std::pair<std::shared_ptr<Element>, typename std::list<Key>::iterator> >::iterator it = shard.elements.find(key);
+    if (it == shard.elements.end()) return;
+    shard.memory -= it->second.first->size;
+    shard.lru.erase(it->second.second);
+    shard.elements.erase(it);
+}
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+std::shared_ptr<Element> ShardedLruCache<Key, Element, SHARDS, Admission>::get(const Key& key) {
+    if (! is_enabled()) {
+        return std::shared_ptr<Element>();
+    }
+
+    size_t hash = std::hash<Key>()(key);
+    Shard& shard = get_shard(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.admission.record_access(hash);
+
+    typename std::unordered_map<Key, std::pair<std::shared_ptr<Element>, typename std::list<Key>::iterator> >::iterator it = shard.elements.find(key);
+    if (it == shard.elements.end()) {
+        misses++;
+        return std::shared_ptr<Element>();
+    }
+
+    if (std::time(NULL) - it->second.first->date > validity) {
+        // Élément périmé : l'appelant le recalculera
+        remove(shard, key);
+        misses++;
+        return std::shared_ptr<Element>();
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+    hits++;
+    return it->second.first;
+}
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+bool ShardedLruCache<Key, Element, SHARDS, Admission>::add(const Key& key, std::shared_ptr<Element> elem) {
+    size_t shard_budget = memory_budget / SHARDS;
+    if (elem->size == 0 || elem->size > shard_budget) {
+        return false;
+    }
+
+    size_t hash = std::hash<Key>()(key);
+    Shard& shard = get_shard(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+
+    typename std::unordered_map<Key, std::pair<std::shared_ptr<Element>, typename std::list<Key>::iterator> >::iterator it = shard.elements.find(key);
+    if (it != shard.elements.end()) {
+        // Élément déjà en cache : remplacé sur place, sans passer par l'admission qui pourrait le refuser et perdre l'ancien
+        shard.memory = shard.memory - it->second.first->size + elem->size;
+        it->second.first = elem;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+
+        // Le nouvel élément, en tête, tient dans la partition : seuls les moins récents sont retirés
+        while (shard.memory > shard_budget) {
+            remove(shard, shard.lru.back());
+        }
+        return true;
+    }
+
+    std::vector<Key> victims;
+    if (shard.memory + elem->size > shard_budget) {
+        std::time_t now = std::time(NULL);
+        size_t freed = 0;
+        typename std::list<Key>::reverse_iterator rit;
+        for (rit = shard.lru.rbegin(); rit != shard.lru.rend() && shard.memory - freed + elem->size > shard_budget; ++rit) {
+            std::shared_ptr<Element>& victim = shard.elements[*rit].first;
+            bool expired = (now - victim->date > validity);
+            if (! expired && ! shard.admission.admit(hash, std::hash<Key>()(*rit))) {
+                return false;
+            }
+            freed += victim->size;
+            victims.push_back(*rit);
+        }
+    }
+
+    for (int i = 0; i < victims.size(); i++) {
+        remove(shard, victims.at(i));
+    }
+
+    shard.lru.push_front(key);
+    shard.elements.insert(std::make_pair(key, std::make_pair(elem, shard.lru.begin())));
+    shard.memory += elem->size;
+
+    return true;
+}
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+void ShardedLruCache<Key, Element, SHARDS, Admission>::remove_if(std::function<bool(const Element&)> predicate) {
+    for (int i = 0; i < SHARDS; i++) {
+        std::lock_guard<std::mutex> lock(shards[i].mtx);
+        std::vector<Key> to_remove;
+        typename std::unordered_map<Key, std::pair<std::shared_ptr<Element>, typename std::list<Key>::iterator> >::iterator it;
+        for (it = shards[i].elements.begin(); it != shards[i].elements.end(); ++it) {
+            if (predicate(*(it->second.first))) to_remove.push_back(it->first);
+        }
+        for (int j = 0; j < to_remove.size(); j++) {
+            remove(shards[i], to_remove.at(j));
+        }
+    }
+}
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+size_t ShardedLruCache<Key, Element, SHARDS, Admission>::get_memory() {
+    size_t memory = 0;
+    for (int i = 0; i < SHARDS; i++) {
+        std::lock_guard<std::mutex> lock(shards[i].mtx);
+        memory += shards[i].memory;
+    }
+    return memory;
+}
+
+template<typename Key, typename Element, int SHARDS, typename Admission>
+void ShardedLruCache<Key, Element, SHARDS, Admission>::clean() {
+    for (int i = 0; i < SHARDS; i++) {
+        std::lock_guard<std::mutex> lock(shards[i].mtx);
+        shards[i].lru.clear();
+        shards[i].elements.clear();
+        shards[i].memory = 0;
+        shards[i].admission.clear();
+    }
+    hits = 0;
+    misses = 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file SingleFlight.h
+ ** \~french
+ * \brief Définition de la classe SingleFlight
+ ** \~english
+ * \brief Define classe SingleFlight
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <atomic>
+
+#include "rok4/storage/Context.h"
+
+/**
+ * \~french \brief Variable d'environnement activant (1, par défaut) ou non (0) la mise en commun des lectures identiques concurrentes
+ * \~english \brief Environment variable enabling (1, default) or not (0) concurrent identical reads sharing
+ */
+#define ROK4_SINGLE_FLIGHT_READS "ROK4_SINGLE_FLIGHT_READS"
+
+/**
+ * \~french \brief Nombre de partitions des lectures en cours
+ * \~english \brief In-flight reads' shards number
+ */
+#define ROK4_SINGLE_FLIGHT_SHARDS 16
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Lecture en cours, partagée entre le thread qui l'effectue et ceux qui en attendent le résultat
+ * \~english
+ * \brief In-flight read, shared between the thread doing it and the ones waiting for its result
+ */
+struct Flight {
+    /**
+     * \~french \brief Nombre de threads en attente du résultat
+     * \~english \brief Number of threads waiting for the result
+     */
+    int followers;
+    /**
+     * \~french \brief Lecture terminée
+     * \~english \brief Read done
+     */
+    bool done;
+    /**
+     * \~french \brief Taille lue, négative en cas d'erreur
+     * \~english \brief Read size, negative if error
+     */
+    int read_size;
+    /**
+     * \~french \brief Copie de la donnée lue, uniquement s'il y a des threads en attente
+     * \~english \brief Read data copy, only if threads are waiting
+     */
+    std::vector<uint8_t> data;
+
+    Flight() : followers(0), done(false), read_size(-1) {}
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Mise en commun des lectures identiques concurrentes
+ * \details Quand plusieurs threads veulent lire en même temps la même portion (contexte, objet, offset, taille), par exemple l'index d'une dalle très demandée à l'expiration du cache ou au démarrage, seul le premier effectue la lecture. Les suivants attendent son résultat et en reçoivent une copie.
+ *
+ * Le thread qui effectue des lectures publie leurs résultats avant d'attendre ceux des lectures des autres threads, ce qui exclut tout interblocage.
+ *
+ * Les lectures en cours sont réparties en partitions selon leur clé, chacune avec son exclusion mutuelle et son signal de fin : des lectures sans rapport ne se disputent pas un même verrou et ne réveillent pas les threads qui ne les attendent pas. Les lectures de fichiers (FILECONTEXT), rapides et déjà mises en commun par le cache de pages du système, ne sont pas concernées.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Concurrent identical reads sharing
+ * \details When several threads want to read the same range (context, object, offset, size) at the same time, for example a popular slab's index when cache expires or at startup, only the first one does the read. Following ones wait for its result and get a copy.
+ *
+ * Thread doing reads publishes their results before waiting for other threads' reads, so no deadlock can occur.
+ *
+ * In-flight reads are split into shards according to their key, each one with its mutual exclusion and end signal : unrelated reads do not contend for a same lock and do not wake up threads not waiting for them. File reads (FILECONTEXT), fast and already shared by the system page cache, are not concerned.
+ *
+ * This class is supposed to be used without instance
+ */
+class SingleFlight {
+
+private:
+
+    /**
+     * \~french \brief Partition des lectures en cours
+     * \~english \brief In-flight reads shard
+     */
+    struct Shard {
+        /**
+         * \~french \brief Lectures en cours, par clé
+         * \~english \brief In-flight reads, by key
+         */
+        std::unordered_map<std::string, std::shared_ptr<Flight> > flights;
+        /**
+         * \~french \brief Exclusion mutuelle, protégeant #flights et le contenu de ses lectures
+         * \~english \brief Mutual exclusion, protecting #flights and its reads content
+         */
+        std::mutex mtx;
+        /**
+         * \~french \brief Signal de fin d'une lecture de la partition
+         * \~english \brief Shard's read end signal
+         */
+        std::condition_variable cv;
+    };
+
+    /**
+     * \~french \brief Partitions des lectures en cours
+     * \~english \brief In-flight reads shards
+     */
+    static Shard shards[ROK4_SINGLE_FLIGHT_SHARDS];
+
+    /**
+     * \~french \brief Partition d'une clé
+     * \~english \brief Key's shard
+     */
+    static Shard& get_shard(const std::string& k) {
+        return shards[std::hash<std::string>()(k) % ROK4_SINGLE_FLIGHT_SHARDS];
+    }
+
+    /**
+     * \~french \brief Mise en commun active
+     * \details Lu dans la variable d'environnement #ROK4_SINGLE_FLIGHT_READS, actif par défaut
+     * \~english \brief Sharing enabled
+     * \details Read from environment variable #ROK4_SINGLE_FLIGHT_READS, enabled by default
+     */
+    static std::atomic<bool> enabled;
+
+    /**
+     * \~french \brief Nombre de lectures évitées grâce à la mise en commun
+     * \~english \brief Number of reads avoided thanks to sharing
+     */
+    static std::atomic<long> shared_count;
+
+    /**
+     * \~french \brief Clé identifiant une portion à lire
+     * \~english \brief Key identifying a range to read
+     */
+    static std::string key(Context* context, ReadRange& range);
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructeur
+     */
+    SingleFlight();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~SingleFlight();
+
+    /** \~french
+     * \brief Active ou désactive la mise en commun
+     ** \~english
+     * \brief Enable or disable sharing
+     */
+    static void set_enabled(bool e) {
+        enabled = e;
+    }
+
+    /** \~french
+     * \brief Nombre de lectures évitées depuis le démarrage
+     ** \~english
+     * \brief Number of avoided reads since start
+     */
+    static long get_shared_count() {
+        return shared_count;
+    }
+
+    /** \~french
+     * \brief Lit plusieurs portions, en mettant en commun celles déjà en cours de lecture par un autre thread
+     * \details Même contrat que Context::read_ranges : chaque portion reçoit sa donnée dans son buffer et sa taille lue dans read_size. Les lectures de fichiers sont directement confiées au contexte.
+     * \param[in] context contexte de stockage
+     * \param[in,out] ranges portions à lire
+     * \return VRAI si toutes les portions ont été lues sans erreur, FAUX sinon
+     ** \~english
+     * \brief Read several ranges, sharing those already being read by another thread
+     * \details Same contract as Context::read_ranges : each range gets its data in its buffer and its read size in read_size. File reads are directly given to the context.
+     * \param[in] context storage context
+     * \param[in,out] ranges ranges to read
+     * \return TRUE if all ranges have been read without error, FALSE otherwise
+     */
+    static bool read_ranges(Context* context, std::vector<ReadRange>& ranges);
+};
@@ -0,0 +1,282 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file SlabPrefixCache.h
+ ** \~french
+ * \brief Définition de la classe SlabPrefixCache
+ ** \~english
+ * \brief Define classe SlabPrefixCache
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <atomic>
+#include <stdint.h>
+
+#include "rok4/storage/Context.h"
+
+/**
+ * \~french \brief Variable d'environnement donnant la taille en octets du début de dalle lu lors de la lecture de l'index
+ * \~english \brief Environment variable for the size in bytes of the slab's beginning read with the index
+ */
+#define ROK4_SLAB_PREFIX_SIZE "ROK4_SLAB_PREFIX_SIZE"
+
+/**
+ * \~french \brief Variable d'environnement donnant la durée de validité en secondes d'un début de dalle en cache
+ * \~english \brief Environment variable for a cached slab's beginning validity in seconds
+ */
+#define ROK4_SLAB_PREFIX_VALIDITY "ROK4_SLAB_PREFIX_VALIDITY"
+
+/**
+ * \~french \brief Variable d'environnement donnant le nombre maximal de débuts de dalle en cache
+ * \~english \brief Environment variable for the maximal count of cached slabs' beginnings
+ */
+#define ROK4_SLAB_PREFIX_COUNT "ROK4_SLAB_PREFIX_COUNT"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Début d'une dalle, lu avec son en-tête et son index
+ * \details La donnée est partagée avec les sources dont la tuile y est contenue : elle reste valide tant qu'elles la détiennent, même si le début de dalle est sorti du cache
+ * \~english
+ * \brief Slab's beginning, read with its header and index
+ * \details Data is shared with sources whose tile is inside : it stays valid while they hold it, even if slab's beginning has been removed from cache
+ */
+struct SlabPrefix {
+    /**
+     * \~french \brief Premiers octets de la dalle
+     * \~english \brief Slab's first bytes
+     */
+    std::unique_ptr<uint8_t[]> data;
+    /**
+     * \~french \brief Nombre d'octets lus
+     * \~english \brief Read bytes count
+     */
+    size_t size;
+    /**
+     * \~french \brief Date de lecture de la donnée
+     * \~english \brief Data read date
+     */
+    std::time_t date;
+
+    SlabPrefix(uint8_t* d, size_t s) : data(d), size(s), date(std::time(NULL)) {}
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Cache de courte durée des débuts de dalle
+ * \details Pour le stockage objet, lire l'index d'une dalle absente du cache des index (IndexCache) puis ses tuiles coûte deux allers-retours. Lorsque la taille de lecture spéculative (#prefix_size) est définie, StoreDataSource lit en une fois le début de la dalle, qui contient l'en-tête, l'index et le plus souvent les premières tuiles. Ce début est conservé ici quelques secondes : les lectures de tuiles qu'il contient, pour la même requête ou les suivantes, sont servies sans nouvelle lecture.
+ *
+ * Le cache est borné en nombre de débuts de dalle (ordonnés par dernière utilisation) et en durée de validité.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Short-lived cache of slabs' beginnings
+ * \details For object storage, reading the index of a slab missing from the index cache (IndexCache) then its tiles costs two round-trips. When speculative reading size (#prefix_size) is defined, StoreDataSource reads the slab's beginning at once, which contains the header, the index and most often the first tiles. This beginning is kept here a few seconds : readings of tiles inside it, for the same request or the next ones, are served without new reading.
+ *
+ * Cache is limited in slabs' beginnings count (ordered by last use) and in validity.
+ *
+ * This class is supposed to be used without instance
+ */
+class SlabPrefixCache {
+
+private:
+
+    /**
+     * \~french \brief Clés des débuts de dalle, du plus récemment utilisé au plus ancien
+     * \~english \brief Slabs' beginnings keys, from the most recently used to the oldest
+     */
+    static std::list<std::string> lru;
+
+    /**
+     * \~french \brief Débuts de dalle en cache, avec leur position dans #lru
+     * \~english \brief Cached slabs' beginnings, with their position in #lru
+     */
+    static std::unordered_map<std::string, std::pair<std::shared_ptr<SlabPrefix>, std::list<std::string>::iterator> > prefixes;
+
+    /**
+     * \~french \brief Exclusion mutuelle
+     * \~english \brief Mutual exclusion
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Taille en octets du début de dalle lu avec l'index
+     * \details Lue dans la variable d'environnement #ROK4_SLAB_PREFIX_SIZE, 0 par défaut : seuls l'en-tête et l'index sont lus. Si elle est inférieure à la taille de l'en-tête et de l'index, elle n'est pas utilisée
+     * \~english \brief Size in bytes of the slab's beginning read with the index
+     * \details Read from environment variable #ROK4_SLAB_PREFIX_SIZE, default value : 0, only header and index are read. If it's lower than header and index size, it is not used
+     */
+    static std::atomic<int> prefix_size;
+
+    /**
+     * \~french \brief Durée de validité en secondes d'un début de dalle en cache
+     * \details Lue dans la variable d'environnement #ROK4_SLAB_PREFIX_VALIDITY, 10 par défaut
+     * \~english \brief Cached slab's beginning validity, in seconds
+     * \details Read from environment variable #ROK4_SLAB_PREFIX_VALIDITY, default value : 10
+     */
+    static std::atomic<int> validity;
+
+    /**
+     * \~french \brief Nombre maximal de débuts de dalle en cache
+     * \details Lu dans la variable d'environnement #ROK4_SLAB_PREFIX_COUNT, 64 par défaut
+     * \~english \brief Maximal count of cached slabs' beginnings
+     * \details Read from environment variable #ROK4_SLAB_PREFIX_COUNT, default value : 64
+     */
+    static std::atomic<int> capacity;
+
+    /**
+     * \~french \brief Clé identifiant une dalle
+     * \~english \brief Key identifying a slab
+     */
+    static std::string key(Context* context, std::string name);
+
+    /**
+     * \~french \brief Supprime un début de dalle du cache
+     * \details L'exclusion mutuelle doit être détenue
+     * \~english \brief Remove a slab's beginning from the cache
+     * \details Mutual exclusion have to be held
+     */
+    static void remove(std::string key);
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructeur
+     */
+    SlabPrefixCache();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~SlabPrefixCache();
+
+    /** \~french
+     * \brief Définit la taille du début de dalle lu avec l'index
+     * \param[in] s taille en octets, 0 pour ne lire que l'en-tête et l'index
+     ** \~english
+     * \brief Define size of the slab's beginning read with the index
+     * \param[in] s size in bytes, 0 to read only header and index
+     */
+    static void set_prefix_size(int s);
+
+    /** \~french
+     * \brief Définit la durée de validité des débuts de dalle en cache
+     * \param[in] v durée en secondes
+     ** \~english
+     * \brief Define cached slabs' beginnings validity
+     * \param[in] v validity, in seconds
+     */
+    static void set_validity(int v);
+
+    /** \~french
+     * \brief Définit le nombre maximal de débuts de dalle en cache
+     * \param[in] c nombre de débuts de dalle
+     ** \~english
+     * \brief Define maximal count of cached slabs' beginnings
+     * \param[in] c slabs' beginnings count
+     */
+    static void set_capacity(int c);
+
+    /** \~french
+     * \brief Taille du début de dalle à lire pour un index
+     * \param[in] context contexte de stockage de la dalle
+     * \param[in] header_index_size taille de l'en-tête et de l'index
+     * \return la taille à lire, au moins celle de l'en-tête et de l'index. La lecture n'est élargie que pour le stockage objet
+     ** \~english
+     * \brief Size of the slab's beginning to read for an index
+     * \param[in] context slab's storage context
+     * \param[in] header_index_size header and index size
+     * \return size to read, at least header and index size. Reading is enlarged only for object storage
+     */
+    static int get_read_size(Context* context, int header_index_size);
+
+    /** \~french
+     * \brief Récupère le début d'une dalle
+     * \param[in] context contexte de stockage de la dalle
+     * \param[in] name nom de la dalle
+     * \return le début de la dalle, un pointeur nul si absent ou périmé
+     ** \~english
+     * \brief Get a slab's beginning
+     * \param[in] context slab's storage context
+     * \param[in] name slab's name
+     * \return slab's beginning, a null pointer if missing or expired
+     */
+    static std::shared_ptr<SlabPrefix> get_prefix(Context* context, std::string name);
+
+    /** \~french
+     * \brief Ajoute le début d'une dalle au cache
+     * \details Le cache prend possession de la donnée : l'appelant doit utiliser l'élément retourné pour garder la donnée.
+     * \param[in] context contexte de stockage de la dalle
+     * \param[in] name nom de la dalle
+     * \param[in] data donnée lue, allouée avec new[]
+     * \param[in] data_size taille de la donnée lue
+     * \return l'élément détenant la donnée
+     ** \~english
+     * \brief Add a slab's beginning to the cache
+     * \details Cache takes data ownership : caller have to use returned element to keep data.
+     * \param[in] context slab's storage context
+     * \param[in] name slab's name
+     * \param[in] data read data, allocated with new[]
+     * \param[in] data_size read data size
+     * \return element holding data
+     */
+    static std::shared_ptr<SlabPrefix> add_prefix(Context* context, std::string name, uint8_t* data, size_t data_size);
+
+    /** \~french
+     * \brief Nombre de débuts de dalle en cache
+     ** \~english
+     * \brief Count of cached slabs' beginnings
+     */
+    static int get_count();
+
+    /** \~french
+     * \brief Vide le cache
+     ** \~english
+     * \brief Empty the cache
+     */
+    static void clean_prefixes();
+};
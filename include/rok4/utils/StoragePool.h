@@ -37,6 +37,11 @@
 
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+
 #include "rok4/utils/StyleBook.h"
 #include "rok4/storage/Context.h"
 
@@ -49,6 +54,13 @@
  * \~french
  * \brief Création d'un pool de contextes de stockage
  * \details Cette classe est prévue pour être utilisée sans instance
+ *
+ * L'annuaire est publié comme un instantané immuable : les recherches se font sans verrou, sur l'instantané courant. Un ajout copie l'annuaire, le complète puis publie le nouvel instantané. Quand plusieurs threads demandent en même temps un contexte absent, un seul le crée et le connecte, les autres attendent ce résultat.
+ * \~english
+ * \brief Storage contexts pool
+ * \details This class is intended to be used without instance
+ *
+ * Book is published as an immutable snapshot : lookups take no lock, on the current snapshot. An addition copies the book, completes it then publishes the new snapshot. When several threads ask for the same missing context at the same time, only one creates and connects it, the others wait for this result.
  */
 class StoragePool {
 
@@ -63,12 +75,32 @@ private:
     StoragePool();
 
     /**
-     * \~french \brief Annuaire de contextes
+     * \~french \brief Annuaire de contextes, instantané courant lu et remplacé atomiquement
      * \details La clé est une paire composée du type de stockage et du contenant du contexte
-     * \~english \brief Book of contexts
+     * \~english \brief Book of contexts, current snapshot atomically read and replaced
      * \details Key is a pair composed of type of storage and the context's bucket
      */
-    static std::map<std::pair<ContextType::eContextType,std::string>,Context*> pool;
+    static std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > pool;
+
+    /**
+     * \~french \brief Contextes en cours de création, avec le résultat attendu par les autres demandeurs
+     * \~english \brief Contexts being created, with the result waited by other requesters
+     */
+    static std::map<std::pair<ContextType::eContextType,std::string>,std::shared_future<Context*> > creating;
+
+    /**
+     * \~french \brief Exclusion mutuelle pour les ajouts à l'annuaire et les créations en cours
+     * \~english \brief Mutual exclusion for book additions and pending creations
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Crée et connecte un contexte de stockage
+     * \return Le contexte connecté, NULL en cas d'échec
+     * \~english \brief Create and connect a storage context
+     * \return Connected context, NULL if failure
+     */
+    static Context* create_context(ContextType::eContextType type, std::string tray);
 
 
 public:
@@ -83,13 +115,13 @@ public:
     /**
      * \~french
      * \brief Récupère un contexte de stockage
-     * \details Si un contexte existe déjà pour ce nom de contenant, on ne crée pas de nouveau contexte et on retourne celui déjà existant. Le nouveau contexte n'est pas connecté.
+     * \details Si un contexte existe déjà pour ce nom de contenant, on ne crée pas de nouveau contexte et on retourne celui déjà existant. Le nouveau contexte est connecté. Un seul contexte est créé par contenant, même si plusieurs threads le demandent en même temps.
      * \param[in] type type de stockage pour lequel on veut créer un contexte
      * \param[in] tray Nom du contenant pour lequel on veut créer un contexte
      * \param[in] reference_context Contexte de stockage de référence
 
      * \brief Get a context storage
-     * \details If a context already exists for this tray's name, we don't create a new one and the existing is returned. New context is not connected.
+     * \details If a context already exists for this tray's name, we don't create a new one and the existing is returned. New context is connected. Only one context is created per tray, even if several threads ask for it at the same time.
      * \param[in] type Storage Type for which context is created
      * \param[in] tray Tray's name for which context is created
      * \param[in] reference_context Reference storage context
@@ -113,12 +145,12 @@ public:
     static void get_storages_count (int& file_count, int& s3_count, int& ceph_count, int& swift_count); 
 
     /**
-     * \~french \brief Obtient l'annuaire de contextes
-     * \details La clé est une paire composée du type de stockage et du contenant du contexte
-     * \~english \brief Get book of contexts
-     * \details Key is a pair composed of type of storage and the context's bucket
+     * \~french \brief Obtient l'instantané courant de l'annuaire de contextes
+     * \details La clé est une paire composée du type de stockage et du contenant du contexte. L'instantané n'est pas modifié par les ajouts ultérieurs.
+     * \~english \brief Get current snapshot of the book of contexts
+     * \details Key is a pair composed of type of storage and the context's bucket. Snapshot is not modified by later additions.
      */
-    static std::map<std::pair<ContextType::eContextType,std::string>,Context*> get_pool();
+    static std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > get_pool();
 
     /**
      * \~french
@@ -130,7 +162,9 @@ public:
 
     /**
      * \~french \brief Nettoie tous les contextes de stockage dans l'annuaire et le vide
+     * \details Le rafraîchissement des index en tâche de fond (IndexCache) est d'abord arrêté. Aucun autre thread ne doit encore utiliser les contextes
      * \~english \brief Clean all storage context objects in the book and empty it
+     * \details Background index refresh (IndexCache) is stopped first. No other thread has still to use contexts
      */
     static void clean_storages ();
 };
\ No newline at end of file
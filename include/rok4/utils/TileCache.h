@@ -0,0 +1,306 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file TileCache.h
+ ** \~french
+ * \brief Définition de la classe TileCache
+ ** \~english
+ * \brief Define classe TileCache
+ */
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <ctime>
+#include <stdint.h>
+
+#include "rok4/storage/Context.h"
+#include "rok4/utils/ShardedLruCache.h"
+
+/**
+ * \~french \brief Variable d'environnement donnant la mémoire maximale en octets occupée par les tuiles en cache
+ * \~english \brief Environment variable for the maximal memory in bytes used by cached tiles
+ */
+#define ROK4_TILE_CACHE_MEMORY "ROK4_TILE_CACHE_MEMORY"
+
+/**
+ * \~french \brief Variable d'environnement donnant la durée de validité en secondes d'une tuile en cache
+ * \~english \brief Environment variable for a cached tile validity in seconds
+ */
+#define ROK4_TILE_CACHE_VALIDITY "ROK4_TILE_CACHE_VALIDITY"
+
+/**
+ * \~french \brief Nombre de partitions du cache des tuiles
+ * \~english \brief Tile cache shards number
+ */
+#define ROK4_TILE_CACHE_SHARDS 16
+
+/**
+ * \~french \brief Nombre de compteurs par ligne de l'esquisse de fréquence d'une partition (puissance de 2)
+ * \~english \brief Counters number per frequency sketch row, for a shard (power of 2)
+ */
+#define ROK4_TILE_CACHE_SKETCH_WIDTH 4096
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Tuile encodée en cache
+ * \details La donnée est partagée avec les sources qui l'utilisent : elle reste valide tant qu'elles la détiennent, même si la tuile est sortie du cache
+ * \~english
+ * \brief Cached encoded tile
+ * \details Data is shared with sources using it : it stays valid while they hold it, even if tile has been removed from cache
+ */
+struct TileCacheElement {
+    /**
+     * \~french \brief Donnée encodée de la tuile
+     * \~english \brief Tile's encoded data
+     */
+    std::unique_ptr<uint8_t[]> data;
+    /**
+     * \~french \brief Taille de la donnée
+     * \~english \brief Data size
+     */
+    size_t size;
+    /**
+     * \~french \brief Date de lecture de la donnée
+     * \~english \brief Data read date
+     */
+    std::time_t date;
+
+    TileCacheElement(uint8_t* d, size_t s) : data(d), size(s), date(std::time(NULL)) {}
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Cache mémoire des tuiles encodées
+ * \details Les tuiles sont identifiées par leur emplacement (contexte, objet, offset, taille), une fois l'index de la dalle résolu. Le cache est borné en mémoire occupée et partitionné selon la clé, chaque partition ayant son propre verrou.
+ *
+ * Les tuiles sont ordonnées par dernière utilisation (LRU), mais l'admission d'une nouvelle tuile quand la partition est pleine suit la politique TinyLFU : une esquisse de fréquence (count-min, compteurs 4 bits vieillis par moitié) estime la popularité récente des tuiles, demandées ou non, et la nouvelle tuile n'entre que si elle est plus demandée que toutes celles qu'elle ferait sortir. Un parcours ponctuel de nombreuses tuiles (moissonnage) ne vide donc pas le cache des tuiles réellement populaires.
+ *
+ * Comme pour le cache des index, une tuile n'est plus servie au-delà de #validity secondes, pour que les mises à jour des pyramides soient visibles.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Encoded tiles memory cache
+ * \details Tiles are identified by their location (context, object, offset, size), once the slab index is resolved. Cache is limited in used memory and sharded according to the key, each shard having its own lock.
+ *
+ * Tiles are ordered by last use (LRU), but a new tile admission when the shard is full follows the TinyLFU policy : a frequency sketch (count-min, 4 bits counters aged by half) estimates recent tiles' popularity, requested or not, and the new tile comes in only if it is more requested than all tiles it would evict. A one-time scan of many tiles (harvesting) does not flush really popular tiles.
+ *
+ * As for the index cache, a tile is no more served after #validity seconds, for pyramids' updates to be visible.
+ *
+ * This class is supposed to be used without instance
+ */
+class TileCache {
+
+private:
+
+    /**
+     * \~french \brief Politique d'admission TinyLFU d'une partition
+     * \details Esquisse de fréquence count-min : 4 lignes de compteurs 4 bits, deux compteurs par octet, divisés par deux régulièrement pour refléter la popularité récente
+     * \~english \brief TinyLFU admission policy of a shard
+     * \details Count-min frequency sketch : 4 rows of 4 bits counters, two counters per byte, regularly divided by two to reflect recent popularity
+     */
+    struct FrequencySketch {
+        /**
+         * \~french \brief Compteurs
+         * \~english \brief Counters
+         */
+        uint8_t counters[4][ROK4_TILE_CACHE_SKETCH_WIDTH / 2];
+        /**
+         * \~french \brief Nombre d'accès comptés depuis le dernier vieillissement
+         * \~english \brief Accesses counted since last aging
+         */
+        int samples;
+
+        FrequencySketch();
+
+        /**
+         * \~french \brief Estime la fréquence d'accès récente
+         * \~english \brief Estimate recent access frequency
+         */
+        int estimate_frequency(size_t hash);
+
+        /**
+         * \~french \brief Compte un accès
+         * \~english \brief Count an access
+         */
+        void record_access(size_t hash);
+
+        /**
+         * \~french \brief La tuile candidate n'entre que si elle est plus demandée que la victime
+         * \~english \brief Candidate tile comes in only if it is more requested than the victim
+         */
+        bool admit(size_t candidate, size_t victim);
+
+        /**
+         * \~french \brief Remet les compteurs à zéro
+         * \~english \brief Reset counters
+         */
+        void clear();
+    };
+
+    /**
+     * \~french \brief Tuiles en cache
+     * \details Mémoire maximale lue dans la variable d'environnement #ROK4_TILE_CACHE_MEMORY, 0 par défaut : pas de cache. Durée de validité lue dans la variable d'environnement #ROK4_TILE_CACHE_VALIDITY, 300 secondes par défaut comme pour le cache des index
+     * \~english \brief Cached tiles
+     * \details Maximal memory read from environment variable #ROK4_TILE_CACHE_MEMORY, default value : 0, no cache. Validity read from environment variable #ROK4_TILE_CACHE_VALIDITY, default value : 300 seconds as for the index cache
+     */
+    static ShardedLruCache<std::string, TileCacheElement, ROK4_TILE_CACHE_SHARDS, FrequencySketch> cache;
+
+    /**
+     * \~french \brief Clé identifiant une tuile
+     * \~english \brief Key identifying a tile
+     */
+    static std::string key(Context* context, std::string name, uint32_t offset, uint32_t size);
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructeur
+     */
+    TileCache();
+
+public:
+
+    /**
+     * \~french \brief Destructeur
+     * \~english \brief Destructor
+     */
+    ~TileCache();
+
+    /** \~french
+     * \brief Définit la mémoire maximale occupée par les tuiles en cache
+     * \param[in] b mémoire en octets, 0 pour désactiver le cache
+     ** \~english
+     * \brief Define maximal memory used by cached tiles
+     * \param[in] b memory in bytes, 0 to disable cache
+     */
+    static void set_memory_budget(size_t b);
+
+    /** \~french
+     * \brief Définit la durée de validité des tuiles en cache
+     * \param[in] v durée en secondes
+     ** \~english
+     * \brief Define cached tiles validity
+     * \param[in] v validity, in seconds
+     */
+    static void set_validity(int v);
+
+    /** \~french
+     * \brief Le cache est-il actif
+     ** \~english
+     * \brief Is cache enabled
+     */
+    static bool is_enabled() {
+        return cache.is_enabled();
+    }
+
+    /** \~french
+     * \brief Récupère une tuile en cache
+     * \details L'accès est compté dans l'esquisse de fréquence, que la tuile soit en cache ou non
+     * \param[in] context contexte de stockage de la dalle
+     * \param[in] name nom de la dalle
+     * \param[in] offset position de la tuile dans la dalle
+     * \param[in] size taille de la tuile
+     * \return la tuile, un pointeur nul si absente ou périmée
+     ** \~english
+     * \brief Get a cached tile
+     * \details Access is counted in the frequency sketch, whether tile is cached or not
+     * \param[in] context slab's storage context
+     * \param[in] name slab's name
+     * \param[in] offset tile's offset in the slab
+     * \param[in] size tile's size
+     * \return tile, a null pointer if missing or expired
+     */
+    static std::shared_ptr<TileCacheElement> get_tile(Context* context, std::string name, uint32_t offset, uint32_t size);
+
+    /** \~french
+     * \brief Propose une tuile lue au cache
+     * \details Le cache prend possession de la donnée, qu'il conserve la tuile ou non : l'appelant doit utiliser l'élément retourné pour garder la donnée.
+     * \param[in] context contexte de stockage de la dalle
+     * \param[in] name nom de la dalle
+     * \param[in] offset position de la tuile dans la dalle
+     * \param[in] size taille demandée de la tuile
+     * \param[in] data donnée lue, allouée avec new[]
+     * \param[in] data_size taille de la donnée lue
+     * \return l'élément détenant la donnée
+     ** \~english
+     * \brief Offer a read tile to the cache
+     * \details Cache takes data ownership, whether it keeps the tile or not : caller have to use returned element to keep data.
+     * \param[in] context slab's storage context
+     * \param[in] name slab's name
+     * \param[in] offset tile's offset in the slab
+     * \param[in] size tile's wanted size
+     * \param[in] data read data, allocated with new[]
+     * \param[in] data_size read data size
+     * \return element holding data
+     */
+    static std::shared_ptr<TileCacheElement> add_tile(Context* context, std::string name, uint32_t offset, uint32_t size, uint8_t* data, size_t data_size);
+
+    /** \~french
+     * \brief Nombre de tuiles trouvées dans le cache depuis le démarrage
+     ** \~english
+     * \brief Tiles found in the cache since start
+     */
+    static long get_hits() {
+        return cache.get_hits();
+    }
+
+    /** \~french
+     * \brief Nombre de tuiles absentes du cache depuis le démarrage
+     ** \~english
+     * \brief Tiles missing in the cache since start
+     */
+    static long get_misses() {
+        return cache.get_misses();
+    }
+
+    /** \~french
+     * \brief Mémoire occupée par les tuiles en cache, en octets
+     ** \~english
+     * \brief Memory used by cached tiles, in bytes
+     */
+    static size_t get_memory();
+
+    /**
+     * \~french \brief Vide le cache et remet les compteurs à zéro
+     * \~english \brief Empty the cache and reset counters
+     */
+    static void clean_tiles();
+};
@@ -0,0 +1,243 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file TileIndex.h
+ ** \~french
+ * \brief Définition de la classe TileIndex
+ ** \~english
+ * \brief Define classe TileIndex
+ */
+
+#pragma once
+
+#include <boost/log/trivial.hpp>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+#include "rok4/storage/Context.h"
+
+#define ROK4_TILE_INDEX_SIGNATURE "ROK4TIX1"
+#define ROK4_TILE_INDEX_HEADER_SIZE 32
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Index des tuiles d'un niveau
+ * \details Cet index, optionnel, associe à chaque tuile (colonne, ligne) d'un niveau la dalle qui la contient, sa position et sa taille dans cette dalle. Chargé une fois pour toutes, il permet de lire une tuile en une seule lecture de plage, sans passer par l'en-tête et l'index de la dalle.
+ *
+ * Format binaire (entiers dans l'ordre d'octets de la machine, comme les index des dalles ROK4) :
+ * \li signature ROK4_TILE_INDEX_SIGNATURE (8 octets)
+ * \li colonne et ligne minimales, nombre de colonnes et de lignes, nombre de dalles, taille de la table des noms (6 x int32)
+ * \li table des noms de dalles, séparés par des caractères nuls et complétée à un multiple de 4 octets
+ * \li pour chaque tuile, ligne par ligne : identifiant de dalle + 1 (0 pour une tuile absente), offset, taille (3 x uint32)
+ *
+ * Les noms de dalles sont ceux utilisables directement avec le contexte de stockage du niveau : l'outil de génération doit y mettre la dalle cible dans le cas d'une dalle symbolique.
+ * \~english
+ * \brief Level's tiles index
+ * \details This optional index maps each level's tile (column, row) to the slab containing it, its offset and its size in this slab. Loaded once, it allows to read a tile with a single range read, without slab header and index.
+ */
+class TileIndex {
+
+private:
+    /**
+     * \~french \brief Première colonne indexée
+     * \~english \brief First indexed column
+     */
+    int min_col;
+    /**
+     * \~french \brief Première ligne indexée
+     * \~english \brief First indexed row
+     */
+    int min_row;
+    /**
+     * \~french \brief Nombre de colonnes indexées
+     * \~english \brief Indexed columns number
+     */
+    int cols;
+    /**
+     * \~french \brief Nombre de lignes indexées
+     * \~english \brief Indexed rows number
+     */
+    int rows;
+
+    /**
+     * \~french \brief Noms des dalles, par identifiant
+     * \~english \brief Slabs' names, by identifier
+     */
+    std::vector<std::string> slabs;
+    /**
+     * \~french \brief Identifiants des dalles, par nom (construction uniquement)
+     * \~english \brief Slabs' identifiers, by name (building only)
+     */
+    std::map<std::string, uint32_t> slabs_ids;
+
+    /**
+     * \~french \brief Entrées des tuiles (dalle, offset, taille)
+     * \details Pointe soit dans une projection mémoire du fichier, soit dans un tableau possédé par l'index
+     * \~english \brief Tiles' entries (slab, offset, size)
+     */
+    const uint32_t* entries;
+    /**
+     * \~french \brief Entrées modifiables, lors de la construction
+     * \~english \brief Writable entries, when building
+     */
+    uint32_t* writable_entries;
+    /**
+     * \~french \brief Propriétaire de la mémoire des entrées
+     * \~english \brief Entries memory owner
+     */
+    std::shared_ptr<void> owner;
+
+    /**
+     * \~french \brief Protection des ajouts de dalles
+     * \~english \brief Slab additions protection
+     */
+    std::mutex mtx;
+
+    TileIndex ();
+
+public:
+
+    /**
+     * \~french
+     * \brief Crée un index vide, à compléter avec add_slab
+     * \param[in] min_col première colonne indexée
+     * \param[in] min_row première ligne indexée
+     * \param[in] cols nombre de colonnes indexées
+     * \param[in] rows nombre de lignes indexées
+     * \~english
+     * \brief Create an empty index, to fill with add_slab
+     * \param[in] min_col first indexed column
+     * \param[in] min_row first indexed row
+     * \param[in] cols indexed columns number
+     * \param[in] rows indexed rows number
+     */
+    TileIndex ( int min_col, int min_row, int cols, int rows );
+
+    /**
+     * \~french
+     * \brief Charge un index depuis le stockage
+     * \details Les entrées sont projetées en mémoire quand le contexte le permet, lues en une fois sinon
+     * \param[in] context contexte de stockage de l'index
+     * \param[in] name nom de l'index
+     * \return l'index, NULL en cas d'erreur
+     * \~english
+     * \brief Load an index from the storage
+     * \details Entries are memory mapped when the context allows it, read at once otherwise
+     * \param[in] context index' storage context
+     * \param[in] name index' name
+     * \return the index, NULL if failure
+     */
+    static TileIndex* load ( Context* context, std::string name );
+
+    /**
+     * \~french
+     * \brief Renseigne les tuiles d'une dalle
+     * \details Les tuiles hors de l'emprise indexée sont ignorées, comme celles de taille nulle.
+     * \param[in] name nom de la dalle
+     * \param[in] col colonne de la première tuile de la dalle
+     * \param[in] row ligne de la première tuile de la dalle
+     * \param[in] tiles_widthwise nombre de tuiles dans la largeur de la dalle
+     * \param[in] tiles_heightwise nombre de tuiles dans la hauteur de la dalle
+     * \param[in] offsets positions des tuiles dans la dalle
+     * \param[in] sizes tailles des tuiles dans la dalle
+     * \~english
+     * \brief Fill a slab's tiles
+     * \details Tiles out of the indexed extent are ignored, as null sized ones.
+     * \param[in] name slab's name
+     * \param[in] col slab's first tile column
+     * \param[in] row slab's first tile row
+     * \param[in] tiles_widthwise slab's tiles number, widthwise
+     * \param[in] tiles_heightwise slab's tiles number, heightwise
+     * \param[in] offsets tiles' offsets in the slab
+     * \param[in] sizes tiles' sizes in the slab
+     */
+    void add_slab ( std::string name, int col, int row, int tiles_widthwise, int tiles_heightwise, const uint32_t* offsets, const uint32_t* sizes );
+
+    /**
+     * \~french
+     * \brief Écrit l'index sur le stockage
+     * \param[in] context contexte de stockage de l'index
+     * \param[in] name nom de l'index
+     * \return VRAI en cas de succès, FAUX sinon
+     * \~english
+     * \brief Write index to the storage
+     * \param[in] context index' storage context
+     * \param[in] name index' name
+     * \return TRUE if success, FALSE otherwise
+     */
+    bool write ( Context* context, std::string name );
+
+    /**
+     * \~french
+     * \brief Récupère l'emplacement d'une tuile
+     * \param[in] col colonne de la tuile
+     * \param[in] row ligne de la tuile
+     * \param[out] slab nom de la dalle contenant la tuile
+     * \param[out] offset position de la tuile dans la dalle
+     * \param[out] size taille de la tuile
+     * \return VRAI si la tuile est présente, FAUX sinon
+     * \~english
+     * \brief Get a tile location
+     * \param[in] col tile's column
+     * \param[in] row tile's row
+     * \param[out] slab slab containing the tile
+     * \param[out] offset tile's offset in the slab
+     * \param[out] size tile's size
+     * \return TRUE if tile is present, FALSE otherwise
+     */
+    bool get_tile ( int col, int row, std::string& slab, uint32_t& offset, uint32_t& size );
+
+    /**
+     * \~french \brief Nombre de dalles référencées
+     * \~english \brief Referenced slabs number
+     */
+    int get_slabs_count () {
+        return slabs.size();
+    }
+
+    /**
+     * \~french \brief Destructeur par défaut
+     * \~english \brief Default destructor
+     */
+    ~TileIndex () { }
+};
@@ -47,6 +47,8 @@
 #pragma once
 
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <stdint.h>
 
@@ -102,6 +104,23 @@ inline std::string to_upper_case ( std::string str ) {
     return uc_str;
 }
 
+/**
+ * \~french \brief Lit un entier positif dans une variable d'environnement
+ * \param[in] name nom de la variable
+ * \param[in] default_value valeur retournée si la variable n'est pas définie, n'est pas un entier ou est négative
+ * \~english \brief Read a positive integer from an environment variable
+ * \param[in] name variable name
+ * \param[in] default_value value returned if the variable is not defined, is not an integer or is negative
+ */
+inline long long env_or_default ( const char* name, long long default_value ) {
+    long long value;
+    char* e = getenv ( name );
+    if ( e == NULL || sscanf ( e, "%lld", &value ) != 1 || value < 0 ) {
+        return default_value;
+    }
+    return value;
+}
+
 /**
  * \brief Conversion uint8 -> float
  * \warning Maximum value : 254
@@ -54,6 +54,11 @@
 #include <errno.h>
 #include "enums/Format.h"
 #include "storage/Context.h"
+#include <map>
+#include <sstream>
+#include "rok4/utils/SingleFlight.h"
+#include "rok4/utils/TileCache.h"
+#include "rok4/utils/SlabPrefixCache.h"
 
 StoreDataSource::StoreDataSource (std::string n, Context* c, const uint32_t o, const uint32_t s, std::string type, std::string encoding ) :
     name ( n ), context(c), offset(o), wanted_size(s), tile_indice(-1), tiles_number(-1), type (type), encoding( encoding )
@@ -71,150 +76,259 @@ StoreDataSource::StoreDataSource (const int tile_ind, const int tiles_nb, std::s
     already_tried = false;
 }
 
-/*
- * Fonction retournant les données de la tuile
- * Le fichier/objet ne doit etre lu qu une seule fois
- * Indique la taille de la tuile (inconnue a priori)
- */
-const uint8_t* StoreDataSource::get_data ( size_t &tile_size ) {
-    if ( already_tried) {
-        tile_size = size;
-        return data;
-    }
+bool StoreDataSource::follow_symlink ( uint8_t* indexheader, int realSize ) {
 
-    already_tried = true;
-
-    // il se peut que le contexte d'origine n'existe pas ou ne soit pas connecté, auquel cas on sort directement sans donnée
-    if (! context->is_connected()) {
-        data = NULL;
-        return NULL;
+    // Dans le cas d'un header de type objet lien, on verifie d'abord que la signature concernée est bien presente dans le header de l'objet
+    if ( realSize < ROK4_SYMLINK_SIGNATURE_SIZE || strncmp((char*) indexheader, ROK4_SYMLINK_SIGNATURE, ROK4_SYMLINK_SIGNATURE_SIZE) != 0 ) {
+        BOOST_LOG_TRIVIAL(error) << "Read data in " << context->get_path(name)  << " is neither an header and an index (too small) nor a link (no signature)";
+        return false;
     }
 
-    if (tile_indice == -1) {
-        // On a directement la taille et l'offset
-        data = new uint8_t[wanted_size];
-        int read_size = context->read(data, offset, wanted_size, name);
-        if (read_size < 0) {
-            BOOST_LOG_TRIVIAL(error) << "Cannot read " << context->get_path(name) << " from size and offset" ;
-            delete[] data;
-            data = NULL;
-            return NULL;
+    // On est dans le cas d'un objet symbolique
+
+    BOOST_LOG_TRIVIAL(debug) << "dalle symbolique";
+
+    std::string originalFullName = context->get_path(name);
+    std::string originalTrayName (context->get_tray());
+
+    char tmpName[realSize-ROK4_SYMLINK_SIGNATURE_SIZE+1];
+    memcpy((uint8_t*) tmpName, indexheader+ROK4_SYMLINK_SIGNATURE_SIZE,realSize-ROK4_SYMLINK_SIGNATURE_SIZE);
+    tmpName[realSize-ROK4_SYMLINK_SIGNATURE_SIZE] = '\0';
+    std::string full_name = std::string (tmpName);
+    name = full_name;
+
+    BOOST_LOG_TRIVIAL(debug) << " -> " << full_name;
+
+    if (context->get_type() != ContextType::FILECONTEXT) {
+        // Dans le cas du stockage objet, on sépare le nom du contenant du nom de l'objet
+        std::stringstream ss(full_name);
+        std::string token;
+        char delim = '/';
+        std::getline(ss, token, delim);
+        std::string tray_name = token;
+        name.erase(0, tray_name.length() + 1);
+
+        if (originalTrayName != tray_name) {
+            // Récupération ou ajout du nouveau contexte de stockage
+            // On reprécise le contexte d'origine, pour utiliser le même cluster en cas S3
+            Context* target_context = StoragePool::get_context(context->get_type(), tray_name, context);
+            // Problème lors de l'ajout ou de la récupération de ce contexte de stockage
+            if (target_context == NULL) {
+                return false;
+            }
+            context = target_context;
         }
-        tile_size = read_size;
-        size = tile_size;
-    } else {
-        // Nous n'avons pas les infos de taille et d'offset pour la tuile, nous allons devoir les récupérer lire
-        // On va regarder si on n'a pas nos informations dans le cache
+    }
 
-        std::string full_name = context->get_path(name);
+    BOOST_LOG_TRIVIAL(debug) <<  "Symbolic slab detected : " << originalFullName << " -> " << full_name ;
 
-        BOOST_LOG_TRIVIAL(debug) << "input slab " << full_name;
-        
-        if (! IndexCache::get_slab_infos(full_name, tile_indice, &context, &name, &offset, &wanted_size)) {
-            // Rien de valide dans le cache, on va lire l'index de la dalle
-            BOOST_LOG_TRIVIAL(debug) << "pas de cache";
+    return true;
+}
 
-            std::string originalFullName (full_name);
-            std::string originalTrayName (context->get_tray());
+void StoreDataSource::get_all_data ( std::vector<StoreDataSource*>& sources ) {
 
-            int headerIndexSize = ROK4_IMAGE_HEADER_SIZE + 2 * 4 * tiles_number;
-            uint8_t* indexheader = new uint8_t[headerIndexSize];
-            int realSize = context->read(indexheader, 0, headerIndexSize, name);
+    // Sources dont on connaît la position de la donnée
+    std::vector<StoreDataSource*> located;
 
-            if ( realSize < 0) {
-                BOOST_LOG_TRIVIAL(error) << "Cannot read header and index of slab " << full_name ;
-                delete[] indexheader;
-                return NULL;
-            }
+    // Sources dont on doit lire l'index, regroupées par dalle pour ne lire chaque index qu'une fois
+    // La clé est le nom complet de la dalle d'origine, qui sert aussi de clé dans le cache d'index
+    std::map<std::string, std::vector<StoreDataSource*> > to_index;
 
-            if ( realSize < headerIndexSize ) {
+    for (int i = 0; i < sources.size(); i++) {
+        StoreDataSource* s = sources.at(i);
+        if (s == NULL || s->already_tried) continue;
 
-                // On a lu moins que ce qu'on voulait : 
-                //      - soit c'est une dalle symbolique, ce qu'on va confirmer via la signature
-                //      - soit c'est une dalle cassée
+        s->already_tried = true;
 
-                // Dans le cas d'un header de type objet lien, on verifie d'abord que la signature concernée est bien presente dans le header de l'objet
-                if ( realSize < ROK4_SYMLINK_SIGNATURE_SIZE || strncmp((char*) indexheader, ROK4_SYMLINK_SIGNATURE, ROK4_SYMLINK_SIGNATURE_SIZE) != 0 ) {
-                    BOOST_LOG_TRIVIAL(error) << "Read data in " << full_name  << " is neither an header and an index (too small) nor a link (no signature)";
-                    delete[] indexheader;
-                    return NULL;
-                }
+        // il se peut que le contexte d'origine n'existe pas ou ne soit pas connecté, auquel cas on sort directement sans donnée
+        if (! s->context->is_connected()) continue;
 
-                // On est dans le cas d'un objet symbolique
+        if (s->tile_indice == -1) {
+            // On a directement la taille et l'offset
+            located.push_back(s);
+            continue;
+        }
 
-                BOOST_LOG_TRIVIAL(debug) << "dalle symbolique";
+        // Nous n'avons pas les infos de taille et d'offset pour la tuile, on va regarder si on n'a pas nos informations dans le cache
+        std::string full_name = s->context->get_path(s->name);
+        BOOST_LOG_TRIVIAL(debug) << "input slab " << full_name;
 
-                char tmpName[realSize-ROK4_SYMLINK_SIGNATURE_SIZE+1];
-                memcpy((uint8_t*) tmpName, indexheader+ROK4_SYMLINK_SIGNATURE_SIZE,realSize-ROK4_SYMLINK_SIGNATURE_SIZE);
-                tmpName[realSize-ROK4_SYMLINK_SIGNATURE_SIZE] = '\0';
-                full_name = std::string (tmpName);
-                name = full_name;
+        bool missing;
+        if (IndexCache::get_slab_infos(full_name, s->tile_indice, &(s->context), &(s->name), &(s->offset), &(s->wanted_size), &missing)) {
+            located.push_back(s);
+        } else if (missing) {
+            // La dalle est connue comme absente, inutile de tenter de la lire
+            BOOST_LOG_TRIVIAL(debug) << "Slab " << full_name << " is known as missing";
+        } else {
+            to_index[full_name].push_back(s);
+        }
+    }
 
+    // Lecture des index manquants : une seconde passe est faite pour les dalles symboliques, avec les index des dalles cibles
+    std::map<std::string, std::vector<StoreDataSource*> > symlinks;
+    for (int pass = 0; pass < 2 && ! to_index.empty(); pass++) {
 
-                BOOST_LOG_TRIVIAL(debug) << " -> " << full_name;
+        // Regroupement des lectures par contexte de stockage
+        std::map<Context*, std::vector<ReadRange> > ranges;
+        std::map<Context*, std::vector<std::string> > slabs;
 
-                if (context->get_type() != ContextType::FILECONTEXT) {
-                    // Dans le cas du stockage objet, on sépare le nom du contenant du nom de l'objet
-                    std::stringstream ss(full_name);
-                    std::string token;
-                    char delim = '/';
-                    std::getline(ss, token, delim);
-                    std::string tray_name = token;
-                    name.erase(0, tray_name.length() + 1);
+        std::map<std::string, std::vector<StoreDataSource*> >::iterator it;
+        for (it = to_index.begin(); it != to_index.end(); ++it) {
+            StoreDataSource* lead = it->second.front();
+            BOOST_LOG_TRIVIAL(debug) << "pas de cache";
+            int headerIndexSize = ROK4_IMAGE_HEADER_SIZE + 2 * 4 * lead->tiles_number;
+            // En stockage objet, on peut lire spéculativement le début de la dalle, qui contient souvent les premières tuiles
+            int readSize = SlabPrefixCache::get_read_size(lead->context, headerIndexSize);
+            ranges[lead->context].push_back(ReadRange(lead->name, new uint8_t[readSize], 0, readSize));
+            slabs[lead->context].push_back(it->first);
+        }
 
-                    if (originalTrayName != tray_name) {
-                        // Récupération ou ajout du nouveau contexte de stockage
-                        // On reprécise le contexte d'origine, pour utiliser le même cluster en cas S3
-                        context = StoragePool::get_context(context->get_type(), tray_name, context);
-                        // Problème lors de l'ajout ou de la récupération de ce contexte de stockage
-                        if (context == NULL) {
-                            data = NULL;
-                            return NULL;
+        std::map<Context*, std::vector<ReadRange> >::iterator cit;
+        for (cit = ranges.begin(); cit != ranges.end(); ++cit) {
+            SingleFlight::read_ranges(cit->first, cit->second);
+
+            for (int i = 0; i < cit->second.size(); i++) {
+                ReadRange& r = cit->second.at(i);
+                std::string originalFullName = slabs[cit->first].at(i);
+                std::vector<StoreDataSource*>& group = to_index[originalFullName];
+                StoreDataSource* lead = group.front();
+                int headerIndexSize = ROK4_IMAGE_HEADER_SIZE + 2 * 4 * lead->tiles_number;
+                bool keep = false;
+
+                if ( r.read_size < 0 ) {
+                    // On distingue une dalle absente, que l'on mémorise pour ne pas la relire à chaque demande, d'une erreur de lecture
+                    // Seule une absence certaine (fichier inexistant, HTTP 404) est mémorisée, jamais une erreur ou un stockage indisponible
+                    if ( lead->context->check_existence(lead->name) == 0 ) {
+                        BOOST_LOG_TRIVIAL(debug) << "Slab " << lead->context->get_path(lead->name) << " does not exist";
+                        IndexCache::add_missing_slab(originalFullName);
+                    } else {
+                        BOOST_LOG_TRIVIAL(error) << "Cannot read header and index of slab " << lead->context->get_path(lead->name) ;
+                    }
+                }
+                else if ( r.read_size < headerIndexSize ) {
+                    // On a lu moins que ce qu'on voulait : 
+                    //      - soit c'est une dalle symbolique, ce qu'on va confirmer via la signature
+                    //      - soit c'est une dalle cassée
+                    if (pass == 1) {
+                        BOOST_LOG_TRIVIAL(error) << "Read data in slab " << lead->context->get_path(lead->name) << " (referenced by " << originalFullName << ") is too small to be an header and an index";
+                    }
+                    else if (lead->follow_symlink(r.data, r.read_size)) {
+                        for (int j = 1; j < group.size(); j++) {
+                            group.at(j)->context = lead->context;
+                            group.at(j)->name = lead->name;
                         }
+                        symlinks[originalFullName] = group;
                     }
                 }
+                else {
+                    IndexCache::add_slab_infos(originalFullName, lead->context, lead->name, lead->tiles_number, r.data + ROK4_IMAGE_HEADER_SIZE, r.data + ROK4_IMAGE_HEADER_SIZE + 4 * lead->tiles_number);
+                    for (int j = 0; j < group.size(); j++) {
+                        StoreDataSource* s = group.at(j);
+                        s->context = lead->context;
+                        s->name = lead->name;
+                        s->offset = *((uint32_t*) (r.data + ROK4_IMAGE_HEADER_SIZE + 4 * s->tile_indice ));
+                        s->wanted_size = *((uint32_t*) (r.data + ROK4_IMAGE_HEADER_SIZE + 4 * lead->tiles_number + 4 * s->tile_indice ));
+                        located.push_back(s);
+                    }
 
-                BOOST_LOG_TRIVIAL(debug) <<  "Symbolic slab detected : " << originalFullName << " -> " << full_name ;
-
-                int realSize = context->read(indexheader, 0, headerIndexSize, name);
-
-                if ( realSize < 0) {
-                    BOOST_LOG_TRIVIAL(error) << "Cannot read header and index of slab " << full_name ;
-                    delete[] indexheader;
-                    return NULL;
-                }
-                if ( realSize < headerIndexSize ) {
-                    BOOST_LOG_TRIVIAL(error) << "Read data in slab " << full_name << " (referenced by " << originalFullName << ") is too small to be an header and an index";
-                    delete[] indexheader;
-                    return NULL;
+                    // Le début de dalle lu au-delà de l'index est conservé pour servir les tuiles qu'il contient
+                    if (r.size > headerIndexSize) {
+                        SlabPrefixCache::add_prefix(lead->context, lead->name, r.data, r.read_size);
+                        keep = true;
+                    }
                 }
 
+                if (! keep) delete[] r.data;
             }
+        }
+
+        to_index.swap(symlinks);
+        symlinks.clear();
+    }
+
+    // Lecture des données, regroupées par contexte de stockage
+    std::map<Context*, std::vector<ReadRange> > ranges;
+    std::map<Context*, std::vector<StoreDataSource*> > owners;
+
+    for (int i = 0; i < located.size(); i++) {
+        StoreDataSource* s = located.at(i);
+        if ( s->tile_indice != -1 && s->wanted_size == 0 ) {
+            BOOST_LOG_TRIVIAL(debug) <<  "Tuile non présente dans la dalle (taille nulle) " << s->context->get_path(s->name)  ;
+            continue;
+        }
 
-            IndexCache::add_slab_infos(originalFullName, context, name, tiles_number, indexheader + ROK4_IMAGE_HEADER_SIZE, indexheader + ROK4_IMAGE_HEADER_SIZE + 4 * tiles_number);
-            offset = *((uint32_t*) (indexheader + ROK4_IMAGE_HEADER_SIZE + 4 * tile_indice ));
-            wanted_size = *((uint32_t*) (indexheader + ROK4_IMAGE_HEADER_SIZE + 4 * tiles_number + 4 * tile_indice ));
-            delete[] indexheader;
+        // Si le stockage peut exposer directement la donnée, on l'utilise sans copie
+        const uint8_t* view = s->context->read_view(s->view_owner, s->offset, s->wanted_size, s->name);
+        if (view) {
+            s->data = (uint8_t*) view;
+            s->size = s->wanted_size;
+            continue;
         }
 
-        if ( wanted_size == 0 ) {
-            BOOST_LOG_TRIVIAL(debug) <<  "Tuile non présente dans la dalle (taille nulle) " << full_name  ;
-            data = NULL;
-            return NULL;
+        // Tuile déjà lue récemment : on partage la donnée du cache
+        std::shared_ptr<TileCacheElement> cached = TileCache::get_tile(s->context, s->name, s->offset, s->wanted_size);
+        if (cached) {
+            s->view_owner = cached;
+            s->data = cached->data.get();
+            s->size = cached->size;
+            continue;
         }
 
-        // Lecture de la tuile
-        data = new uint8_t[wanted_size];
-        if (context->read(data, offset, wanted_size, name) < 0) {
-            delete[] data;
-            data = NULL;
-            BOOST_LOG_TRIVIAL(error) <<  "Erreur lors de la lecture de la tuile dans l'objet " << full_name ;
-            return NULL;
+        // Tuile contenue dans un début de dalle lu récemment avec l'index : on partage cette donnée
+        std::shared_ptr<SlabPrefix> prefix = SlabPrefixCache::get_prefix(s->context, s->name);
+        if (prefix && (size_t) s->offset + s->wanted_size <= prefix->size) {
+            s->view_owner = prefix;
+            s->data = prefix->data.get() + s->offset;
+            s->size = s->wanted_size;
+            continue;
         }
 
-        tile_size = wanted_size;
-        size = wanted_size;
+        s->data = new uint8_t[s->wanted_size];
+        ranges[s->context].push_back(ReadRange(s->name, s->data, s->offset, s->wanted_size));
+        owners[s->context].push_back(s);
+    }
+
+    std::map<Context*, std::vector<ReadRange> >::iterator cit;
+    for (cit = ranges.begin(); cit != ranges.end(); ++cit) {
+        SingleFlight::read_ranges(cit->first, cit->second);
+
+        for (int i = 0; i < cit->second.size(); i++) {
+            ReadRange& r = cit->second.at(i);
+            StoreDataSource* s = owners[cit->first].at(i);
+
+            if (r.read_size < 0) {
+                if (s->tile_indice == -1) {
+                    BOOST_LOG_TRIVIAL(error) << "Cannot read " << s->context->get_path(s->name) << " from size and offset" ;
+                } else {
+                    BOOST_LOG_TRIVIAL(error) <<  "Erreur lors de la lecture de la tuile dans l'objet " << s->context->get_path(s->name) ;
+                }
+                delete[] s->data;
+                s->data = NULL;
+                continue;
+            }
+
+            // Dans le cas d'une lecture par index, on a forcément lu toute la tuile
+            s->size = (s->tile_indice == -1) ? r.read_size : s->wanted_size;
+
+            // La donnée est confiée au cache, qui la partagera avec les prochaines lectures de la tuile
+            if (TileCache::is_enabled()) {
+                s->view_owner = TileCache::add_tile(s->context, s->name, s->offset, s->wanted_size, s->data, s->size);
+            }
+        }
+    }
+}
+
+/*
+ * Fonction retournant les données de la tuile
+ * Le fichier/objet ne doit etre lu qu une seule fois
+ * Indique la taille de la tuile (inconnue a priori)
+ */
+const uint8_t* StoreDataSource::get_data ( size_t &tile_size ) {
+    if ( ! already_tried) {
+        std::vector<StoreDataSource*> sources (1, this);
+        get_all_data(sources);
     }
 
+    tile_size = size;
     return data;
 }
@@ -51,6 +51,8 @@
 
 #include <stdlib.h>
 #include <string>
+#include <vector>
+#include <memory>
 
 #include "datasource/DataSource.h"
 #include "storage/Context.h"
@@ -112,6 +114,13 @@ protected:
      * \details If asked serveral times, data source is read only once
      */
     uint8_t* data;
+    /**
+     * \~french \brief Détenteur de la donnée, quand #data est une vue sur le stockage
+     * \details Dans ce cas (fichier projeté en mémoire), #data n'a pas été alloué et ne doit pas être libéré
+     * \~english \brief Data holder, when #data is a view on the storage
+     * \details In this case (memory mapped file), #data was not allocated and must not be deleted
+     */
+    std::shared_ptr<void> view_owner;
     /**
      * \~french \brief A-t-on déjà essayé de lire la donnée
      * \~english \brief Have we already tried to read data
@@ -133,6 +142,20 @@ protected:
      */
     std::string type;
 
+    /**
+     * \~french \brief Suit le lien d'une dalle symbolique
+     * \details On vérifie la signature du lien, puis on met à jour le nom (#name) et éventuellement le contexte (#context) de la dalle cible
+     * \param[in] indexheader Données lues au début de la dalle
+     * \param[in] realSize Taille des données lues
+     * \return Faux si ce n'est pas un lien valide ou si le contexte cible n'est pas disponible
+     * \~english \brief Follow a symbolic slab's link
+     * \details Link signature is checked, then target slab's name (#name) and context (#context) are updated
+     * \param[in] indexheader Data read at the slab's beginning
+     * \param[in] realSize Read data size
+     * \return False if it's not a valid link or if target context is not available
+     */
+    bool follow_symlink ( uint8_t* indexheader, int realSize );
+
 public:
 
     /** \~french
@@ -196,13 +219,26 @@ public:
      */
     virtual const uint8_t* get_data ( size_t &tile_size );
 
+    /** \~french
+     * \brief Récupère la donnée de plusieurs sources en regroupant les lectures
+     * \details Les index absents du cache sont lus ensemble (une seule fois par dalle), puis les tuiles, via Context::read_ranges pour chaque contexte de stockage. Les tuiles accessibles sans copie (Context::read_view) ne sont pas lues. En stockage objet, si SlabPrefixCache est actif, le début de la dalle est lu avec l'index, et les tuiles qu'il contient sont servies sans nouvelle lecture. Les sources déjà lues sont ignorées. Les données sont ensuite disponibles via #get_data, sans nouvelle lecture.
+     * \param[in] sources Sources dont on veut la donnée
+     ** \~english
+     * \brief Get data of several sources, grouping reads
+     * \details Indexes missing from cache are read together (once per slab), then tiles, with Context::read_ranges for each storage context. Tiles available without copy (Context::read_view) are not read. For object storage, if SlabPrefixCache is enabled, slab's beginning is read with the index, and tiles inside it are served without new reading. Already read sources are ignored. Data are then available with #get_data, without new read.
+     * \param[in] sources Sources whose data is wanted
+     */
+    static void get_all_data ( std::vector<StoreDataSource*>& sources );
+
 
     /**
      * \~french \brief Supprime la donnée mémorisée (#data)
      * \~english \brief Delete memorized data (#data)
      */
     bool release_data() {
-        if (data) {
+        if (view_owner) {
+            view_owner.reset();
+        } else if (data) {
             delete[] data;
         }
         data = 0;
@@ -488,6 +488,9 @@ Rok4Image::Rok4Image (
 
     memorized_tiles_line = -1;
 
+    tile_index = NULL;
+    tile_index_col = 0;
+    tile_index_row = 0;
 }
 
 Rok4Image::Rok4Image ( std::string n, int tpw, int tph, Context* c ) :
@@ -508,6 +511,10 @@ Rok4Image::Rok4Image ( std::string n, int tpw, int tph, Context* c ) :
     pixel_size = 0;
     raw_tile_size = 0;
     raw_tile_line_size = 0;
+
+    tile_index = NULL;
+    tile_index_col = 0;
+    tile_index_row = 0;
 }
 
 /* ------------------------------------------------------------------------------------------------ */
@@ -550,7 +557,8 @@ boolean Rok4Image::memorize_raw_tiles ( int tilesLine )
     for (size_t i = 0; i < tiles_widthwise; i++) {
         // Pour avoir l'offset de lecture de la tuile à décoder dans le buffer total, on utilise l'offset dans la dalle, 
         // en déduisant l'offset de la première tuile (qui correspond au 0 de notre buffer total)
-        RawDataSource* encDS = new RawDataSource ( enc_data + tiles_offsets[firstTileIndex + i] - firstTileOffset, tiles_sizes[firstTileIndex + i]);
+        // La donnée est empruntée sans copie : totalDS la détient jusqu'à la fin du décodage de la ligne
+        RawDataSource* encDS = new RawDataSource ( enc_data + tiles_offsets[firstTileIndex + i] - firstTileOffset, tiles_sizes[firstTileIndex + i], std::shared_ptr<void>());
 
         DataSource* decDS;
         size_t tmpSize;
@@ -1077,6 +1085,10 @@ bool Rok4Image::write_final() {
         return false;
     }
 
+    if (tile_index != NULL) {
+        tile_index->add_slab(name, tile_index_col, tile_index_row, tiles_widthwise, tiles_heightwise, tiles_offsets, tiles_sizes);
+    }
+
     return true;
 }
 
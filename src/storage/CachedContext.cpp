@@ -0,0 +1,497 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file CachedContext.cpp
+ ** \~french
+ * \brief Implémentation de la classe CachedContext
+ * \details
+ * \li CachedContext : cache disque local devant un contexte de stockage objet
+ ** \~english
+ * \brief Implement classe CachedContext
+ * \details
+ * \li CachedContext : local disk cache in front of an object storage context
+ */
+
+#include "storage/CachedContext.h"
+#include "utils/Utils.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+CachedContext::CachedContext (Context* o) : Context(), origin(o) {
+
+}
+
+CachedContext::~CachedContext() {
+    delete origin;
+}
+
+void CachedContext::set_directory(std::string d) {
+    std::lock_guard<std::mutex> lock(mtx);
+    directory = d;
+    loaded = false;
+    lru.clear();
+    files.clear();
+    used_size = 0;
+    objects.clear();
+}
+
+void CachedContext::set_max_size(size_t s) {
+    std::lock_guard<std::mutex> lock(mtx);
+    max_size = s;
+}
+
+void CachedContext::set_validity(int v) {
+    std::lock_guard<std::mutex> lock(mtx);
+    validity = v;
+}
+
+bool CachedContext::is_enabled() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return directory != "";
+}
+
+size_t CachedContext::get_used_size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (! loaded) load_directory();
+    return used_size;
+}
+
+size_t CachedContext::get_objects_count() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (! loaded) load_directory();
+    return objects.size();
+}
+
+/**
+ * \~french \brief Lit la clé de portion enregistrée en tête d'un fichier du cache
+ * \~english \brief Read the range key stored at the beginning of a cache file
+ */
+static bool read_range_key(std::ifstream& ifs, std::string& range_key) {
+    size_t signature_size = strlen(ROK4_STORAGE_CACHE_SIGNATURE);
+    std::string signature(signature_size, '\0');
+    uint32_t key_size;
+    if (! ifs.read(&signature[0], signature_size) || signature != ROK4_STORAGE_CACHE_SIGNATURE ||
+        ! ifs.read((char*) &key_size, sizeof(key_size)) || key_size > 65536) {
+        return false;
+    }
+    range_key.assign(key_size, '\0');
+    return key_size == 0 || (bool) ifs.read(&range_key[0], key_size);
+}
+
+void CachedContext::load_directory() {
+    loaded = true;
+
+    // Les fichiers sont répartis dans 256 sous-dossiers, selon les deux premiers caractères de leur nom
+    std::vector<std::pair<std::time_t, std::pair<std::string, size_t> > > found;
+    for (int i = 0; i < 256; i++) {
+        std::ostringstream oss;
+        oss << directory << "/" << std::hex << std::setw(2) << std::setfill('0') << i;
+        std::string subdir = oss.str();
+
+        DIR* dir = opendir(subdir.c_str());
+        if (dir == NULL) continue;
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string file = subdir + "/" + entry->d_name;
+            struct stat st;
+            if (entry->d_name[0] == '.' || stat(file.c_str(), &st) != 0 || ! S_ISREG(st.st_mode)) continue;
+            if (strstr(entry->d_name, ".tmp") != NULL) {
+                // Écriture interrompue
+                ::remove(file.c_str());
+                continue;
+            }
+            found.push_back(std::make_pair(st.st_mtime, std::make_pair(file, (size_t) st.st_size)));
+        }
+        closedir(dir);
+    }
+
+    // Du plus récent au plus ancien
+    std::sort(found.begin(), found.end());
+    int count = 0;
+    for (int i = found.size() - 1; i >= 0; i--) {
+        std::string file = found.at(i).second.first;
+
+        // L'objet du fichier est retrouvé dans sa clé (objet|offset|taille)
+        std::ifstream ifs(file, std::ios::binary);
+        std::string range_key;
+        size_t size_pos = std::string::npos;
+        size_t offset_pos = std::string::npos;
+        if (ifs.is_open() && read_range_key(ifs, range_key)) {
+            size_pos = range_key.rfind('|');
+            if (size_pos != std::string::npos && size_pos > 0) offset_pos = range_key.rfind('|', size_pos - 1);
+        }
+        if (offset_pos == std::string::npos) {
+            ::remove(file.c_str());
+            continue;
+        }
+        std::string object = range_key.substr(0, offset_pos);
+
+        lru.push_back(file);
+        CacheFile& cache_file = files[file];
+        cache_file.size = found.at(i).second.second;
+        cache_file.position = --lru.end();
+        cache_file.object = object;
+        objects[object].files++;
+        used_size += cache_file.size;
+        count++;
+    }
+
+    BOOST_LOG_TRIVIAL(debug) << "Disk cache " << directory << " : " << count << " existing files (" << used_size << " bytes)";
+
+    while (used_size > max_size && ! lru.empty()) {
+        remove_file(files.find(lru.back()));
+    }
+}
+
+void CachedContext::remove_file(std::unordered_map<std::string, CacheFile>::iterator it) {
+    used_size -= it->second.size;
+    lru.erase(it->second.position);
+
+    std::unordered_map<std::string, CachedObject>::iterator oit = objects.find(it->second.object);
+    if (oit != objects.end() && --(oit->second.files) <= 0) {
+        objects.erase(oit);
+    }
+
+    ::remove(it->first.c_str());
+    files.erase(it);
+}
+
+void CachedContext::register_file(std::string file, size_t size, std::string object) {
+    std::unordered_map<std::string, CacheFile>::iterator it = files.find(file);
+    if (it != files.end()) {
+        // Le fichier est remplacé, il n'est plus compté pour son ancien objet
+        used_size -= it->second.size;
+        lru.erase(it->second.position);
+        std::unordered_map<std::string, CachedObject>::iterator oit = objects.find(it->second.object);
+        if (oit != objects.end() && --(oit->second.files) <= 0) {
+            objects.erase(oit);
+        }
+        files.erase(it);
+    }
+
+    lru.push_front(file);
+    CacheFile& cache_file = files[file];
+    cache_file.size = size;
+    cache_file.position = lru.begin();
+    cache_file.object = object;
+    objects[object].files++;
+    used_size += size;
+
+    while (used_size > max_size && lru.size() > 1) {
+        remove_file(files.find(lru.back()));
+    }
+}
+
+std::string CachedContext::object_key(std::string name) {
+    return origin->get_type_string() + "/" + origin->get_path(name);
+}
+
+std::string CachedContext::file_path(std::string range_key) {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0') << (uint64_t) std::hash<std::string>()(range_key);
+    std::string hash = oss.str();
+    return directory + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+/**
+ * \~french \brief Empreinte d'un contenu (FNV-1a 64 bits)
+ * \~english \brief Content fingerprint (FNV-1a 64 bits)
+ */
+static uint64_t fingerprint(const uint8_t* data, int size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    // 0 est réservé aux portions enregistrées sans empreinte connue
+    return h == 0 ? 1 : h;
+}
+
+int CachedContext::lookup(std::string object, int offset, int size, uint8_t* data) {
+    std::string range_key = object + "|" + std::to_string(offset) + "|" + std::to_string(size);
+    std::string file;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (directory == "") return -1;
+        if (! loaded) load_directory();
+        file = file_path(range_key);
+        if (files.find(file) == files.end()) return -1;
+    }
+
+    std::ifstream ifs(file, std::ios::binary);
+    if (! ifs.is_open()) return -1;
+
+    std::string stored_key;
+    uint64_t fp;
+    int64_t date;
+    int32_t data_size;
+    if (! read_range_key(ifs, stored_key) || stored_key != range_key ||
+        ! ifs.read((char*) &fp, sizeof(fp)) || ! ifs.read((char*) &date, sizeof(date)) ||
+        ! ifs.read((char*) &data_size, sizeof(data_size)) || data_size < 0 || data_size > size) {
+        // Collision de hash ou fichier corrompu : la portion sera relue et le fichier remplacé
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::time_t now = std::time(NULL);
+
+        // Le fichier a pu être supprimé entre temps, avec les informations de son objet
+        std::unordered_map<std::string, CacheFile>::iterator it = files.find(file);
+        if (it == files.end() || it->second.object != object) return -1;
+        std::unordered_map<std::string, CachedObject>::iterator oit = objects.find(object);
+        if (oit == objects.end()) return -1;
+        CachedObject& cached = oit->second;
+
+        if (cached.written >= date) return -1;
+
+        if (offset == 0) {
+            // En-tête : validité simple, l'empreinte est mémorisée pour valider les tuiles
+            if (now - date > validity) return -1;
+            cached.fingerprint = fp;
+        } else if (cached.fingerprint != 0) {
+            if (cached.fingerprint != fp) return -1;
+        } else if (now - date > validity) {
+            return -1;
+        }
+
+        lru.splice(lru.begin(), lru, it->second.position);
+    }
+
+    if (data_size > 0 && ! ifs.read((char*) data, data_size)) {
+        return -1;
+    }
+
+    BOOST_LOG_TRIVIAL(debug) << "Disk cache hit : " << data_size << " bytes (from the " << offset << " one) in the object " << object;
+    return data_size;
+}
+
+void CachedContext::store(std::string object, int offset, int size, uint8_t* data, int data_size) {
+    std::string range_key = object + "|" + std::to_string(offset) + "|" + std::to_string(size);
+    std::string file;
+    uint64_t fp = 0;
+    int64_t date = std::time(NULL);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (directory == "") return;
+        if (! loaded) load_directory();
+        file = file_path(range_key);
+
+        if (offset == 0) {
+            fp = fingerprint(data, data_size);
+        } else {
+            std::unordered_map<std::string, CachedObject>::iterator oit = objects.find(object);
+            if (oit != objects.end()) fp = oit->second.fingerprint;
+        }
+    }
+
+    // Écriture dans un fichier temporaire puis renommage, pour que les lecteurs ne voient jamais un fichier partiel
+    std::ostringstream tmp;
+    tmp << file << ".tmp." << std::this_thread::get_id();
+    std::string tmp_file = tmp.str();
+
+    mkdir(directory.c_str(), 0755);
+    mkdir(file.substr(0, file.find_last_of('/')).c_str(), 0755);
+
+    std::ofstream ofs(tmp_file, std::ios::binary | std::ios::trunc);
+    if (! ofs.is_open()) {
+        BOOST_LOG_TRIVIAL(warning) << "Cannot write disk cache file " << tmp_file;
+        return;
+    }
+    uint32_t key_size = range_key.size();
+    int32_t stored_size = data_size;
+    ofs.write(ROK4_STORAGE_CACHE_SIGNATURE, strlen(ROK4_STORAGE_CACHE_SIGNATURE));
+    ofs.write((char*) &key_size, sizeof(key_size));
+    ofs.write(range_key.data(), key_size);
+    ofs.write((char*) &fp, sizeof(fp));
+    ofs.write((char*) &date, sizeof(date));
+    ofs.write((char*) &stored_size, sizeof(stored_size));
+    ofs.write((char*) data, data_size);
+    ofs.close();
+
+    if (ofs.fail() || rename(tmp_file.c_str(), file.c_str()) != 0) {
+        BOOST_LOG_TRIVIAL(warning) << "Cannot write disk cache file " << file;
+        ::remove(tmp_file.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    register_file(file, strlen(ROK4_STORAGE_CACHE_SIGNATURE) + sizeof(key_size) + key_size + sizeof(fp) + sizeof(date) + sizeof(stored_size) + data_size, object);
+
+    // L'objet est suivi tant qu'il a un fichier dans le cache
+    if (offset == 0) {
+        CachedObject& cached = objects[object];
+        if (cached.fingerprint != 0 && cached.fingerprint != fp) {
+            BOOST_LOG_TRIVIAL(debug) << "Object " << object << " changed, its cached ranges are no more valid";
+        }
+        cached.fingerprint = fp;
+    }
+}
+
+bool CachedContext::connection() {
+    connected = origin->connection();
+    return connected;
+}
+
+bool CachedContext::exists(std::string name) {
+    return origin->exists(name);
+}
+
+int CachedContext::check_existence(std::string name) {
+    return origin->check_existence(name);
+}
+
+int CachedContext::read(uint8_t* data, int offset, int size, std::string name) {
+    std::string object = object_key(name);
+
+    int read_size = lookup(object, offset, size, data);
+    if (read_size >= 0) return read_size;
+
+    read_size = origin->read(data, offset, size, name);
+    if (read_size >= 0) store(object, offset, size, data, read_size);
+    return read_size;
+}
+
+std::future<int> CachedContext::read_async(uint8_t* data, int offset, int size, std::string name) {
+    std::string object = object_key(name);
+
+    int read_size = lookup(object, offset, size, data);
+    if (read_size >= 0) {
+        std::promise<int> result;
+        result.set_value(read_size);
+        return result.get_future();
+    }
+
+    // La lecture est lancée tout de suite, l'enregistrement dans le cache est fait à la récupération du résultat
+    std::shared_ptr<std::future<int> > pending = std::make_shared<std::future<int> >(origin->read_async(data, offset, size, name));
+    return std::async(std::launch::deferred, [this, pending, object, offset, size, data]() {
+        int read_size = pending->get();
+        if (read_size >= 0) store(object, offset, size, data, read_size);
+        return read_size;
+    });
+}
+
+bool CachedContext::read_ranges(std::vector<ReadRange>& ranges) {
+    std::vector<ReadRange> misses;
+    std::vector<int> positions;
+
+    for (int i = 0; i < ranges.size(); i++) {
+        ReadRange& r = ranges.at(i);
+        r.read_size = lookup(object_key(r.name), r.offset, r.size, r.data);
+        if (r.read_size < 0) {
+            misses.push_back(ReadRange(r.name, r.data, r.offset, r.size));
+            positions.push_back(i);
+        }
+    }
+
+    if (misses.empty()) return true;
+
+    // Les portions absentes sont lues en un lot, pour que le contexte décoré les regroupe (requête multi-portions, lectures parallèles)
+    origin->read_ranges(misses);
+
+    bool ok = true;
+    for (int m = 0; m < misses.size(); m++) {
+        ReadRange& r = ranges.at(positions.at(m));
+        r.read_size = misses.at(m).read_size;
+        if (r.read_size >= 0) {
+            store(object_key(r.name), r.offset, r.size, r.data, r.read_size);
+        } else {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+uint8_t* CachedContext::read_full(int& size, std::string name) {
+    return origin->read_full(size, name);
+}
+
+bool CachedContext::write(uint8_t* data, int offset, int size, std::string name) {
+    return origin->write(data, offset, size, name);
+}
+
+bool CachedContext::write_full(uint8_t* data, int size, std::string name) {
+    return origin->write_full(data, size, name);
+}
+
+bool CachedContext::open_to_write(std::string name) {
+    return origin->open_to_write(name);
+}
+
+bool CachedContext::close_to_write(std::string name) {
+    bool ok = origin->close_to_write(name);
+
+    // Les portions de l'objet enregistrées jusqu'ici ne sont plus valides. Un objet sans fichier dans le cache n'a rien à invalider
+    std::lock_guard<std::mutex> lock(mtx);
+    std::unordered_map<std::string, CachedObject>::iterator oit = objects.find(object_key(name));
+    if (oit != objects.end()) {
+        oit->second.written = std::time(NULL);
+        oit->second.fingerprint = 0;
+    }
+
+    return ok;
+}
+
+/**
+ * \~french \brief Lit une chaîne dans une variable d'environnement
+ * \~english \brief Read a string from an environment variable
+ */
+static std::string env_string(const char* name) {
+    char* e = getenv (name);
+    return e == NULL ? "" : std::string(e);
+}
+
+std::string CachedContext::directory = env_string(ROK4_STORAGE_CACHE_DIRECTORY);
+size_t CachedContext::max_size = env_or_default(ROK4_STORAGE_CACHE_SIZE, 10737418240LL);
+int CachedContext::validity = env_or_default(ROK4_STORAGE_CACHE_VALIDITY, 300);
+std::mutex CachedContext::mtx;
+bool CachedContext::loaded = false;
+std::list<std::string> CachedContext::lru;
+std::unordered_map<std::string, CachedContext::CacheFile> CachedContext::files;
+size_t CachedContext::used_size = 0;
+std::unordered_map<std::string, CachedContext::CachedObject> CachedContext::objects;
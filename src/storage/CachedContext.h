@@ -0,0 +1,392 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file CachedContext.h
+ ** \~french
+ * \brief Définition de la classe CachedContext
+ * \details
+ * \li CachedContext : cache disque local devant un contexte de stockage objet
+ ** \~english
+ * \brief Define classe CachedContext
+ * \details
+ * \li CachedContext : local disk cache in front of an object storage context
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <ctime>
+#include <boost/log/trivial.hpp>
+#include "storage/Context.h"
+
+/**
+ * \~french \brief Variable d'environnement donnant le dossier local du cache disque des contextes objet. Pas de cache si non définie
+ * \~english \brief Environment variable for the object contexts' disk cache local directory. No cache if not defined
+ */
+#define ROK4_STORAGE_CACHE_DIRECTORY "ROK4_STORAGE_CACHE_DIRECTORY"
+
+/**
+ * \~french \brief Variable d'environnement donnant la taille maximale en octets du cache disque
+ * \~english \brief Environment variable for the disk cache maximal size in bytes
+ */
+#define ROK4_STORAGE_CACHE_SIZE "ROK4_STORAGE_CACHE_SIZE"
+
+/**
+ * \~french \brief Variable d'environnement donnant la durée de validité en secondes des portions en cache disque
+ * \~english \brief Environment variable for the disk cached ranges validity in seconds
+ */
+#define ROK4_STORAGE_CACHE_VALIDITY "ROK4_STORAGE_CACHE_VALIDITY"
+
+/**
+ * \~french \brief Signature des fichiers du cache disque
+ * \~english \brief Disk cache files signature
+ */
+#define ROK4_STORAGE_CACHE_SIGNATURE "ROK4CCH1"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Cache disque local devant un contexte de stockage objet (S3, Swift, Ceph)
+ * \details Les portions lues (en-têtes et index de dalle, tuiles) sont enregistrées dans des fichiers d'un dossier local, partagé par tous les contextes décorés. Le cache est borné en taille, les portions les moins récemment utilisées étant supprimées en premier. Les fichiers présents au démarrage sont réutilisés.
+ *
+ * Revalidation : une portion commençant à l'octet 0 (en-tête et index d'une dalle) est servie pendant #validity secondes puis relue depuis le stockage. Son empreinte (hash du contenu) est alors comparée à celle mémorisée : les tuiles de la dalle, enregistrées avec cette empreinte, restent valides tant qu'elle ne change pas, sans jamais être relues. Une tuile dont la dalle n'a pas d'empreinte connue suit la validité simple. Une écriture via le contexte invalide toutes les portions de l'objet.
+ *
+ * Les écritures et lectures complètes sont transmises directement au contexte décoré.
+ * \~english
+ * \brief Local disk cache in front of an object storage context (S3, Swift, Ceph)
+ * \details Read ranges (slab headers and indexes, tiles) are stored in files in a local directory, shared by all decorated contexts. Cache is limited in size, least recently used ranges being removed first. Files present at startup are reused.
+ *
+ * Revalidation : a range starting at byte 0 (slab header and index) is served during #validity seconds then read again from the storage. Its fingerprint (content hash) is then compared with the memorized one : slab's tiles, stored with this fingerprint, stay valid while it doesn't change, without being read again. A tile whose slab has no known fingerprint follows the simple validity. A write through the context invalidates all object's ranges.
+ *
+ * Writes and full reads are directly forwarded to the decorated context.
+ */
+class CachedContext : public Context {
+
+private:
+
+    /**
+     * \~french \brief Contexte décoré, détenu
+     * \~english \brief Decorated context, owned
+     */
+    Context* origin;
+
+    /**
+     * \~french \brief Dossier du cache
+     * \details Lu dans la variable d'environnement #ROK4_STORAGE_CACHE_DIRECTORY
+     * \~english \brief Cache directory
+     * \details Read from environment variable #ROK4_STORAGE_CACHE_DIRECTORY
+     */
+    static std::string directory;
+
+    /**
+     * \~french \brief Taille maximale du cache, en octets
+     * \details Lue dans la variable d'environnement #ROK4_STORAGE_CACHE_SIZE, 10 Go par défaut
+     * \~english \brief Cache maximal size, in bytes
+     * \details Read from environment variable #ROK4_STORAGE_CACHE_SIZE, default value : 10 GB
+     */
+    static size_t max_size;
+
+    /**
+     * \~french \brief Durée de validité des portions, en secondes
+     * \details Lue dans la variable d'environnement #ROK4_STORAGE_CACHE_VALIDITY, 300 par défaut
+     * \~english \brief Ranges validity, in seconds
+     * \details Read from environment variable #ROK4_STORAGE_CACHE_VALIDITY, default value : 300
+     */
+    static int validity;
+
+    /**
+     * \~french \brief Exclusion mutuelle, protégeant les informations partagées du cache
+     * \~english \brief Mutual exclusion, protecting shared cache informations
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Les fichiers présents dans le dossier ont-ils été recensés
+     * \~english \brief Have directory's files been listed
+     */
+    static bool loaded;
+
+    /**
+     * \~french \brief Fichiers du cache, du plus récemment utilisé au plus ancien
+     * \~english \brief Cache files, from the most recently used to the oldest
+     */
+    static std::list<std::string> lru;
+
+    /**
+     * \~french \brief Fichier du cache
+     * \~english \brief Cache file
+     */
+    struct CacheFile {
+        /**
+         * \~french \brief Taille du fichier
+         * \~english \brief File size
+         */
+        size_t size;
+        /**
+         * \~french \brief Position dans #lru
+         * \~english \brief Position in #lru
+         */
+        std::list<std::string>::iterator position;
+        /**
+         * \~french \brief Objet dont le fichier contient une portion
+         * \~english \brief Object whose range is in the file
+         */
+        std::string object;
+    };
+
+    /**
+     * \~french \brief Fichiers du cache, par chemin
+     * \~english \brief Cache files, by path
+     */
+    static std::unordered_map<std::string, CacheFile> files;
+
+    /**
+     * \~french \brief Taille totale des fichiers du cache
+     * \~english \brief Cache files' total size
+     */
+    static size_t used_size;
+
+    /**
+     * \~french \brief Informations de revalidation d'un objet
+     * \~english \brief Object's revalidation informations
+     */
+    struct CachedObject {
+        /**
+         * \~french \brief Empreinte connue de l'en-tête, 0 si inconnue
+         * \~english \brief Known header fingerprint, 0 if unknown
+         */
+        uint64_t fingerprint;
+        /**
+         * \~french \brief Date de la dernière écriture via un contexte décoré, 0 si aucune
+         * \~english \brief Last write date through a decorated context, 0 if none
+         */
+        std::time_t written;
+        /**
+         * \~french \brief Nombre de fichiers du cache contenant une portion de l'objet
+         * \~english \brief Number of cache files containing an object's range
+         */
+        int files;
+
+        CachedObject() : fingerprint(0), written(0), files(0) {}
+    };
+
+    /**
+     * \~french \brief Objets ayant au moins un fichier dans le cache
+     * \details Un objet est oublié avec son dernier fichier : le nombre d'objets suivis est borné par celui des fichiers
+     * \~english \brief Objects with at least one file in the cache
+     * \details An object is forgotten with its last file : followed objects number is bounded by files' one
+     */
+    static std::unordered_map<std::string, CachedObject> objects;
+
+    /**
+     * \~french \brief Recense les fichiers déjà présents dans le dossier du cache
+     * \details L'objet de chaque fichier est lu dans son en-tête, les fichiers invalides sont supprimés. L'exclusion mutuelle doit être détenue
+     * \~english \brief List files already in the cache directory
+     * \details Each file's object is read from its header, invalid files are removed. Mutual exclusion have to be held
+     */
+    static void load_directory();
+
+    /**
+     * \~french \brief Enregistre un fichier dans le cache, en supprimant les plus anciens si nécessaire
+     * \details L'exclusion mutuelle doit être détenue
+     * \~english \brief Register a file in the cache, removing the oldest ones if needed
+     * \details Mutual exclusion have to be held
+     */
+    static void register_file(std::string file, size_t size, std::string object);
+
+    /**
+     * \~french \brief Supprime un fichier du cache, et oublie son objet s'il n'a plus de fichier
+     * \details L'exclusion mutuelle doit être détenue
+     * \~english \brief Remove a file from the cache, and forget its object if it has no more file
+     * \details Mutual exclusion have to be held
+     */
+    static void remove_file(std::unordered_map<std::string, CacheFile>::iterator it);
+
+    /**
+     * \~french \brief Nom complet de l'objet, identifiant le contenant
+     * \~english \brief Object full name, identifying the tray
+     */
+    std::string object_key(std::string name);
+
+    /**
+     * \~french \brief Chemin du fichier du cache pour une portion
+     * \~english \brief Cache file path for a range
+     */
+    static std::string file_path(std::string range_key);
+
+    /**
+     * \~french \brief Lit une portion dans le cache disque
+     * \return la taille lue, négative si la portion n'est pas en cache ou plus valide
+     * \~english \brief Read a range in the disk cache
+     * \return read size, negative if range is not cached or no more valid
+     */
+    int lookup(std::string object, int offset, int size, uint8_t* data);
+
+    /**
+     * \~french \brief Enregistre une portion lue dans le cache disque
+     * \~english \brief Store a read range in the disk cache
+     */
+    void store(std::string object, int offset, int size, uint8_t* data, int data_size);
+
+public:
+
+    /**
+     * \~french
+     * \brief Constructeur
+     * \param[in] o contexte décoré, dont le contexte de cache prend possession
+     * \~english
+     * \brief Constructor
+     * \param[in] o decorated context, owned by the cache context
+     */
+    CachedContext (Context* o);
+
+    /** \~french
+     * \brief Définit le dossier du cache disque
+     * \param[in] d dossier local, vide pour désactiver le cache
+     ** \~english
+     * \brief Define disk cache directory
+     * \param[in] d local directory, empty to disable cache
+     */
+    static void set_directory(std::string d);
+
+    /** \~french
+     * \brief Définit la taille maximale du cache disque
+     * \param[in] s taille en octets
+     ** \~english
+     * \brief Define disk cache maximal size
+     * \param[in] s size in bytes
+     */
+    static void set_max_size(size_t s);
+
+    /** \~french
+     * \brief Définit la durée de validité des portions en cache disque
+     * \param[in] v durée en secondes
+     ** \~english
+     * \brief Define disk cached ranges validity
+     * \param[in] v validity, in seconds
+     */
+    static void set_validity(int v);
+
+    /** \~french
+     * \brief Le cache disque est-il actif
+     ** \~english
+     * \brief Is disk cache enabled
+     */
+    static bool is_enabled();
+
+    /** \~french
+     * \brief Taille occupée par le cache disque, en octets
+     ** \~english
+     * \brief Disk cache used size, in bytes
+     */
+    static size_t get_used_size();
+
+    /** \~french
+     * \brief Nombre d'objets ayant au moins une portion en cache disque
+     ** \~english
+     * \brief Number of objects with at least one range in the disk cache
+     */
+    static size_t get_objects_count();
+
+    bool connection();
+    bool exists(std::string name);
+    int check_existence(std::string name);
+    int read(uint8_t* data, int offset, int size, std::string name);
+    std::future<int> read_async(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Récupère plusieurs portions de données, en servant celles en cache disque
+     * \details Les portions absentes du cache sont demandées en un seul lot au contexte décoré, puis enregistrées
+     * \~english \brief Get several data ranges, serving cached ones from disk
+     * \details Ranges missing from the cache are asked to the decorated context in one batch, then stored
+     */
+    bool read_ranges(std::vector<ReadRange>& ranges);
+    uint8_t* read_full(int& size, std::string name);
+    bool write(uint8_t* data, int offset, int size, std::string name);
+    bool write_full(uint8_t* data, int size, std::string name);
+    bool open_to_write(std::string name);
+    bool close_to_write(std::string name);
+
+    ContextType::eContextType get_type() {
+        return origin->get_type();
+    }
+
+    std::string get_type_string() {
+        return origin->get_type_string();
+    }
+
+    std::string get_tray() {
+        return origin->get_tray();
+    }
+
+    std::string get_path(std::string racine, int x, int y, int pathDepth = 2) {
+        return origin->get_path(racine, x, y, pathDepth);
+    }
+
+    std::string get_path(std::string name) {
+        return origin->get_path(name);
+    }
+
+    void print() {
+        BOOST_LOG_TRIVIAL(info) << "------ Disk cached context -------";
+        BOOST_LOG_TRIVIAL(info) << "\t- directory = " << directory;
+        origin->print();
+    }
+
+    std::string to_string() {
+        return "Disk cached (" + directory + ") " + origin->to_string();
+    }
+
+    void close_connection() {
+        origin->close_connection();
+        connected = false;
+    }
+
+    Context* get_origin() {
+        return origin->get_origin();
+    }
+
+    /**
+     * \~french \brief Destructeur, supprime le contexte décoré
+     * \~english \brief Destructor, delete decorated context
+     */
+    ~CachedContext();
+};
@@ -111,7 +111,7 @@ void split_path(std::string path, ContextType::eContextType& type, std::string&
 
 }
 
-Context::Context () : connected(false) {
+Context::Context () : connected(false), retry_policy(std::make_shared<RetryPolicy>()) {
 
     char* e = getenv (ROK4_OBJECT_READ_ATTEMPTS);
     if (e == NULL || sscanf ( e, "%d", &read_attempts ) != 1 ) {
@@ -127,4 +127,39 @@ Context::Context () : connected(false) {
     if (e == NULL || sscanf ( e, "%d", &waiting_time ) != 1 ) {
         waiting_time = 5;
     }
+
+    e = getenv (ROK4_OBJECT_WRITE_PART_SIZE);
+    if (e == NULL || sscanf ( e, "%d", &part_size ) != 1 || part_size < 0 ) {
+        part_size = 0;
+    }
+
+    e = getenv (ROK4_OBJECT_HEDGE_PERCENTILE);
+    if (e == NULL || sscanf ( e, "%d", &hedge_percentile ) != 1 || hedge_percentile < 0 || hedge_percentile > 100 ) {
+        hedge_percentile = 0;
+    }
+
+    e = getenv (ROK4_OBJECT_HEDGE_MIN_DELAY);
+    if (e == NULL || sscanf ( e, "%d", &hedge_min_delay ) != 1 || hedge_min_delay < 0 ) {
+        hedge_min_delay = 10;
+    }
+}
+
+bool Context::read_ranges(std::vector<ReadRange>& ranges) {
+    std::vector<std::future<int> > results;
+    for (int i = 0; i < ranges.size(); i++) {
+        results.push_back(read_async(ranges.at(i).data, ranges.at(i).offset, ranges.at(i).size, ranges.at(i).name));
+    }
+
+    bool ok = true;
+    for (int i = 0; i < ranges.size(); i++) {
+        ranges.at(i).read_size = results.at(i).get();
+        if (ranges.at(i).read_size < 0) ok = false;
+    }
+    return ok;
+}
+
+std::future<int> Context::read_async(uint8_t* data, int offset, int size, std::string name) {
+    std::promise<int> result;
+    result.set_value(read(data, offset, size, name));
+    return result.get_future();
 }
@@ -50,8 +50,20 @@
 #include "storage/FileContext.h"
 #include <fcntl.h>
 #include <cstdio>
+#include <cstring>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <memory>
+#include "config.h"
+#include "utils/Utils.h"
+
+#if IOURING_ENABLED
+#include <liburing.h>
+#endif
 
 using namespace std;
 
@@ -66,27 +78,263 @@ int FileContext::read(uint8_t* data, int offset, int size, std::string name) {
     std::string fullName = root_dir + name;
     BOOST_LOG_TRIVIAL(debug) << "File read : " << size << " bytes (from the " << offset << " one) in the file " << fullName;
 
-    // Ouverture du fichier
-    int fildes = open( fullName.c_str(), O_RDONLY );
-    if ( fildes < 0 ) {
-        BOOST_LOG_TRIVIAL(debug) <<  "Can't open file " << fullName ;
+    // Récupération d'un descripteur ouvert (en cache ou ouvert pour l'occasion)
+    std::shared_ptr<FileDescriptor> fd = FileDescriptorCache::get_descriptor(fullName);
+    if ( ! fd ) {
         return -1;
     }
 
-    size_t read_size = pread ( fildes, data, size, offset );
+    ssize_t read_size = pread ( fd->fd, data, size, offset );
 
     if ( read_size != size ) {
         BOOST_LOG_TRIVIAL(error) <<  "Impossible de lire la tuile dans le fichier " << fullName ;
         if ( read_size<0 ) BOOST_LOG_TRIVIAL(error) <<  "Code erreur="<<errno ;
-        close ( fildes );
         return -1;
     }
 
-    close ( fildes );
-
     return read_size;
 }
 
+/**
+ * \~french \brief Groupe de portions contiguës (ou presque) d'un fichier, lues en une fois
+ * \~english \brief Group of (almost) contiguous ranges of a file, read at once
+ */
+struct ReadGroup {
+    std::shared_ptr<FileDescriptor> fd;
+    int start;
+    int end;
+    std::vector<struct iovec> iov;
+    std::vector<int> members;
+    ssize_t result;
+};
+
+#if IOURING_ENABLED
+
+/**
+ * \~french \brief Anneau io_uring propre à un thread
+ * \~english \brief Thread's own io_uring ring
+ */
+struct ThreadRing {
+    struct io_uring ring;
+    bool ready;
+
+    ThreadRing() {
+        int ret = io_uring_queue_init(ROK4_FILE_IOURING_DEPTH, &ring, 0);
+        ready = (ret == 0);
+        if (! ready) {
+            BOOST_LOG_TRIVIAL(warning) << "Cannot initialize io_uring (error code " << -ret << "), files are read with preadv";
+        }
+    }
+
+    ~ThreadRing() {
+        if (ready) io_uring_queue_exit(&ring);
+    }
+};
+
+/**
+ * \~french \brief Lit les groupes via io_uring, par lots de #ROK4_FILE_IOURING_DEPTH lectures
+ * \details S'arrête au premier lot qui ne peut être préparé, soumis ou attendu, l'anneau n'étant alors plus utilisé pour ce thread. Les groupes d'un lot attendu gardent un résultat négatif en cas d'erreur et seront relus portion par portion
+ * \return Nombre de premiers groupes lus, 0 si io_uring n'est pas disponible pour ce thread
+ * \~english \brief Read groups with io_uring, by batches of #ROK4_FILE_IOURING_DEPTH readings
+ * \details Stops at the first batch which cannot be prepared, submitted or waited, the ring being then no more used for this thread. Groups of a waited batch keep a negative result on error and will be read again range by range
+ * \return Number of first read groups, 0 if io_uring is not available for this thread
+ */
+static size_t read_groups_uring(std::vector<ReadGroup>& groups) {
+    static thread_local ThreadRing tr;
+    if (! tr.ready) return 0;
+
+    size_t next = 0;
+    while (next < groups.size()) {
+        unsigned prepared = 0;
+        while (next + prepared < groups.size() && prepared < ROK4_FILE_IOURING_DEPTH) {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&tr.ring);
+            if (sqe == NULL) break;
+            ReadGroup& g = groups.at(next + prepared);
+            io_uring_prep_readv(sqe, g.fd->fd, g.iov.data(), g.iov.size(), g.start);
+            io_uring_sqe_set_data(sqe, &g);
+            prepared++;
+        }
+
+        if (prepared == 0) {
+            // Anneau plein sans lecture en cours : on ne progresserait plus
+            BOOST_LOG_TRIVIAL(warning) << "Cannot get io_uring submission entry, files are read with preadv";
+            tr.ready = false;
+            break;
+        }
+
+        unsigned submitted = 0;
+        while (submitted < prepared) {
+            int ret = io_uring_submit(&tr.ring);
+            if (ret <= 0) break;
+            submitted += ret;
+        }
+
+        if (submitted < prepared) {
+            // Des lectures préparées restent dans l'anneau : on ne l'utilise plus pour ce thread
+            BOOST_LOG_TRIVIAL(warning) << "Cannot submit io_uring readings, files are read with preadv";
+            tr.ready = false;
+        }
+
+        // On attend toutes les lectures soumises, les buffers devant rester valides jusqu'à leur fin
+        for (unsigned c = 0; c < submitted; c++) {
+            struct io_uring_cqe* cqe;
+            int ret;
+            do {
+                ret = io_uring_wait_cqe(&tr.ring, &cqe);
+            } while (ret == -EINTR);
+            if (ret < 0) {
+                BOOST_LOG_TRIVIAL(error) << "Cannot wait io_uring readings, error code " << -ret;
+                tr.ready = false;
+                break;
+            }
+            ReadGroup* g = (ReadGroup*) io_uring_cqe_get_data(cqe);
+            g->result = cqe->res;
+            io_uring_cqe_seen(&tr.ring, cqe);
+        }
+
+        // Les lectures soumises sont dans l'ordre de préparation
+        next += submitted;
+        if (! tr.ready) break;
+    }
+
+    return next;
+}
+
+#endif
+
+bool FileContext::read_ranges(std::vector<ReadRange>& ranges) {
+
+    if (ranges.size() == 1) {
+        ranges.at(0).read_size = read(ranges.at(0).data, ranges.at(0).offset, ranges.at(0).size, ranges.at(0).name);
+        return (ranges.at(0).read_size >= 0);
+    }
+
+    // On parcourt les portions par fichier puis par offset croissant, sans modifier l'ordre fourni
+    std::vector<int> order (ranges.size());
+    for (int i = 0; i < ranges.size(); i++) {
+        order.at(i) = i;
+    }
+    std::sort(order.begin(), order.end(), [&ranges](int a, int b) {
+        if (ranges.at(a).name != ranges.at(b).name) return ranges.at(a).name < ranges.at(b).name;
+        return ranges.at(a).offset < ranges.at(b).offset;
+    });
+
+    // Les octets entre deux portions regroupées sont lus dans ce buffer, puis ignorés
+    std::vector<uint8_t> gap_buffer (ROK4_FILE_MERGE_GAP);
+
+    // Constitution de tous les groupes de portions à lire en une fois, tous fichiers confondus
+    std::vector<ReadGroup> groups;
+
+    bool ok = true;
+    int i = 0;
+    while (i < order.size()) {
+        std::string name = ranges.at(order.at(i)).name;
+        std::string fullName = root_dir + name;
+
+        int j = i;
+        while (j < order.size() && ranges.at(order.at(j)).name == name) j++;
+
+        BOOST_LOG_TRIVIAL(debug) << "File read : " << (j - i) << " ranges in the file " << fullName;
+
+        std::shared_ptr<FileDescriptor> fd = FileDescriptorCache::get_descriptor(fullName);
+        if ( ! fd ) {
+            for (int k = i; k < j; k++) ranges.at(order.at(k)).read_size = -1;
+            ok = false;
+            i = j;
+            continue;
+        }
+
+        int k = i;
+        while (k < j) {
+            // Les portions d'un groupe ne doivent pas se chevaucher et être assez proches
+            ReadGroup g;
+            g.fd = fd;
+            g.start = ranges.at(order.at(k)).offset;
+            g.end = g.start;
+            g.result = -1;
+
+            while (k < j && g.iov.size() < IOV_MAX - 1) {
+                ReadRange& r = ranges.at(order.at(k));
+                if (! g.members.empty()) {
+                    if (r.offset < g.end || r.offset - g.end > ROK4_FILE_MERGE_GAP) break;
+                    if (r.offset > g.end) {
+                        struct iovec gap = { gap_buffer.data(), (size_t) (r.offset - g.end) };
+                        g.iov.push_back(gap);
+                    }
+                }
+                struct iovec dest = { r.data, (size_t) r.size };
+                g.iov.push_back(dest);
+                g.members.push_back(order.at(k));
+                g.end = r.offset + r.size;
+                k++;
+            }
+
+            groups.push_back(g);
+        }
+
+        i = j;
+    }
+
+    // Lecture des groupes : en un lot via io_uring si possible, sinon (ou pour ceux qui n'ont pu y être lus) un appel à preadv par groupe
+    size_t batched = 0;
+#if IOURING_ENABLED
+    if (groups.size() > 1 && uring_enabled) {
+        batched = read_groups_uring(groups);
+    }
+#endif
+    for (size_t g = batched; g < groups.size(); g++) {
+        groups.at(g).result = preadv ( groups.at(g).fd->fd, groups.at(g).iov.data(), groups.at(g).iov.size(), groups.at(g).start );
+    }
+
+    for (int g = 0; g < groups.size(); g++) {
+        ReadGroup& group = groups.at(g);
+
+        if ( group.result == group.end - group.start ) {
+            for (int m = 0; m < group.members.size(); m++) {
+                ranges.at(group.members.at(m)).read_size = ranges.at(group.members.at(m)).size;
+            }
+            continue;
+        }
+
+        // La lecture groupée est incomplète (fin de fichier) ou en erreur, on lit chaque portion séparément pour savoir lesquelles sont valides
+        for (int m = 0; m < group.members.size(); m++) {
+            ReadRange& r = ranges.at(group.members.at(m));
+            ssize_t read_size = pread ( group.fd->fd, r.data, r.size, r.offset );
+            if ( read_size != r.size ) {
+                BOOST_LOG_TRIVIAL(error) <<  "Impossible de lire la tuile dans le fichier " << root_dir + r.name ;
+                if ( read_size < 0 ) BOOST_LOG_TRIVIAL(error) <<  "Code erreur=" << errno ;
+                r.read_size = -1;
+                ok = false;
+            } else {
+                r.read_size = read_size;
+            }
+        }
+    }
+
+    return ok;
+}
+
+const uint8_t* FileContext::read_view(std::shared_ptr<void>& owner, int offset, int size, std::string name) {
+    if (! MappedFileCache::is_enabled()) {
+        return NULL;
+    }
+
+    std::string fullName = root_dir + name;
+    std::shared_ptr<MappedFile> mf = MappedFileCache::get_mapping(fullName);
+    if ( ! mf ) {
+        return NULL;
+    }
+
+    if ( offset < 0 || size < 0 || offset + (size_t) size > mf->size ) {
+        BOOST_LOG_TRIVIAL(debug) << "Range (" << size << " bytes from the " << offset << " one) is not in the mapped file " << fullName;
+        return NULL;
+    }
+
+    BOOST_LOG_TRIVIAL(debug) << "File view : " << size << " bytes (from the " << offset << " one) in the file " << fullName;
+
+    owner = mf;
+    return mf->data + offset;
+}
 
 uint8_t* FileContext::read_full(int& size, std::string name) {
     size = -1;
@@ -204,4 +452,16 @@ bool FileContext::exists(std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "Exists (FILE) ? " << get_path(name);
     struct stat buffer;   
     return (stat (get_path(name).c_str(), &buffer) == 0);
-}
\ No newline at end of file
+}
+
+int FileContext::check_existence(std::string name) {
+    BOOST_LOG_TRIVIAL(debug) << "Check existence (FILE) ? " << get_path(name);
+    struct stat buffer;
+    if (stat (get_path(name).c_str(), &buffer) == 0) return 1;
+    // Seules ces erreurs prouvent l'absence : un problème de droits ou d'entrée/sortie ne dit rien de l'existence du fichier
+    if (errno == ENOENT || errno == ENOTDIR) return 0;
+    BOOST_LOG_TRIVIAL(error) << "Cannot test file existence " << get_path(name) << " : " << strerror(errno);
+    return -1;
+}
+
+std::atomic<bool> FileContext::uring_enabled(env_or_default(ROK4_FILE_IOURING, 1) != 0);
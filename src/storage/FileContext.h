@@ -51,9 +51,30 @@
 
 #include <boost/log/trivial.hpp>
 #include "storage/Context.h"
+#include "rok4/utils/FileDescriptorCache.h"
+#include "rok4/utils/MappedFileCache.h"
 #include <iostream>
 #include <sys/stat.h>
 #include <fstream>
+#include <atomic>
+
+/**
+ * \~french \brief Écart maximal en octets entre deux portions pour qu'elles soient lues en une seule fois
+ * \~english \brief Maximal gap in bytes between two ranges to read them at once
+ */
+#define ROK4_FILE_MERGE_GAP 65536
+
+/**
+ * \~french \brief Nombre maximal de lectures soumises en une fois via io_uring (taille de l'anneau de chaque thread)
+ * \~english \brief Maximal number of readings submitted at once with io_uring (each thread's ring size)
+ */
+#define ROK4_FILE_IOURING_DEPTH 64
+
+/**
+ * \~french \brief Variable d'environnement permettant de désactiver io_uring (valeur 0), les fichiers étant alors lus avec preadv
+ * \~english \brief Environment variable to disable io_uring (value 0), files being then read with preadv
+ */
+#define ROK4_FILE_IOURING "ROK4_FILE_IOURING"
 
 /**
  * \author Institut national de l'information géographique et forestière
@@ -80,6 +101,14 @@ private:
      */
     std::ofstream output;
 
+    /**
+     * \~french \brief Les lectures groupées utilisent-elles io_uring
+     * \details Lu dans la variable d'environnement #ROK4_FILE_IOURING, vrai par défaut. Sans effet si la librairie n'est pas compilée avec io_uring
+     * \~english \brief Do grouped readings use io_uring
+     * \details Read from environment variable #ROK4_FILE_IOURING, default value : true. No effect if library is not built with io_uring
+     */
+    static std::atomic<bool> uring_enabled;
+
 public:
 
     /**
@@ -91,9 +120,36 @@ public:
      * \param[in] root Directory for manipulated files
      */
     FileContext (std::string root);
+
+    /**
+     * \~french \brief Active ou désactive io_uring pour les lectures groupées
+     * \param[in] e faux pour lire avec preadv
+     * \~english \brief Enable or disable io_uring for grouped readings
+     * \param[in] e false to read with preadv
+     */
+    static void set_uring_enabled(bool e) {
+        uring_enabled = e;
+    }
     
 
     int read(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Récupère plusieurs portions de données
+     * \details Les portions d'un même fichier sont lues avec une seule ouverture, et les portions proches (écart inférieur à #ROK4_FILE_MERGE_GAP) sont lues avec un seul appel à preadv, directement dans les buffers de destination. Si la librairie est compilée avec io_uring (IOURING_ENABLED), ces lectures sont soumises en un lot, tous fichiers confondus, pour exploiter la profondeur de file du périphérique.
+     * \~english \brief Get several data ranges
+     * \details Ranges from the same file are read with only one opening, and close ranges (gap lower than #ROK4_FILE_MERGE_GAP) are read with one preadv call, directly into destination buffers. If library is built with io_uring (IOURING_ENABLED), these readings are submitted in one batch, all files together, to use the device queue depth.
+     */
+    bool read_ranges(std::vector<ReadRange>& ranges);
+
+    /**
+     * \~french \brief Donne accès à une portion du fichier projeté en mémoire
+     * \details Disponible uniquement si la projection est activée (#ROK4_FILE_MAPPINGS_CACHE_SIZE), le fichier est alors projeté en entier via MappedFileCache. La portion doit être entièrement dans le fichier.
+     * \~english \brief Give access to a range of the memory mapped file
+     * \details Only available if mapping is enabled (#ROK4_FILE_MAPPINGS_CACHE_SIZE), file is then entirely mapped with MappedFileCache. Range have to be entirely in the file.
+     */
+    const uint8_t* read_view(std::shared_ptr<void>& owner, int offset, int size, std::string name);
+
     uint8_t* read_full(int& size, std::string name);
     bool write(uint8_t* data, int offset, int size, std::string name);
     bool write_full(uint8_t* data, int size, std::string name);
@@ -108,6 +164,8 @@ public:
      */
     bool open_to_write(std::string name) {
         std::string fullName = root_dir + name;
+        FileDescriptorCache::invalidate(fullName);
+        MappedFileCache::invalidate(fullName);
         output.open ( fullName.c_str(), std::ios_base::trunc | std::ios::binary );
         if (output.fail()) {
             return false;
@@ -150,6 +208,7 @@ public:
     bool connection();
 
     bool exists(std::string name);
+    int check_existence(std::string name);
 
     void close_connection() {
         connected = false;
@@ -0,0 +1,180 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file MultipartUpload.cpp
+ ** \~french
+ * \brief Implémentation de la classe MultipartUpload
+ * \details
+ * \li MultipartUpload : écriture d'un objet par parties, envoyées au fur et à mesure
+ ** \~english
+ * \brief Implement classe MultipartUpload
+ * \details
+ * \li MultipartUpload : object writing by parts, sent progressively
+ */
+
+#include "storage/MultipartUpload.h"
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+
+MultipartUpload::MultipartUpload (size_t ps) : part_size(ps), current_part(2), upload_id("") {}
+
+bool MultipartUpload::write (const uint8_t* data, size_t offset, size_t size) {
+
+    // Portion dans la première partie
+    if (offset < part_size) {
+        size_t in_first = std::min(size, part_size - offset);
+        if (first.size() < offset + in_first) {
+            first.resize(offset + in_first);
+        }
+        memcpy(&(first[0]) + offset, data, in_first);
+
+        data += in_first;
+        offset += in_first;
+        size -= in_first;
+    }
+
+    if (size == 0) return true;
+
+    // Portion au delà de la première partie
+    size_t current_start = part_size * (current_part - 1);
+    if (offset < current_start) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot write " << size << " bytes from the " << offset << " one : this part is already sent";
+        return false;
+    }
+
+    // Les trous éventuels dans la première partie sont comblés par des zéros
+    if (first.size() < part_size) {
+        first.resize(part_size);
+    }
+
+    if (current.size() < offset - current_start + size) {
+        current.resize(offset - current_start + size);
+    }
+    memcpy(&(current[0]) + offset - current_start, data, size);
+
+    return true;
+}
+
+bool MultipartUpload::write_full (const uint8_t* data, size_t size) {
+    if (is_started()) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot replace the whole content : parts are already sent";
+        return false;
+    }
+
+    first.clear();
+    current.clear();
+    return write(data, 0, size);
+}
+
+bool MultipartUpload::has_full_part () {
+    return (current.size() >= part_size);
+}
+
+bool MultipartUpload::is_started () {
+    return (current_part > 2);
+}
+
+std::shared_ptr<std::vector<char> > MultipartUpload::pop_part (int& number) {
+    number = current_part;
+    std::shared_ptr<std::vector<char> > part = std::make_shared<std::vector<char> >(current.begin(), current.begin() + part_size);
+    current.erase(current.begin(), current.begin() + part_size);
+    current_part++;
+    return part;
+}
+
+std::shared_ptr<std::vector<char> > MultipartUpload::pop_first () {
+    std::shared_ptr<std::vector<char> > part = std::make_shared<std::vector<char> >();
+    part->swap(first);
+    return part;
+}
+
+std::shared_ptr<std::vector<char> > MultipartUpload::pop_last (int& number) {
+    number = current_part;
+    std::shared_ptr<std::vector<char> > part = std::make_shared<std::vector<char> >();
+    part->swap(current);
+    current_part++;
+    return part;
+}
+
+std::vector<char>* MultipartUpload::pop_all () {
+    std::vector<char>* all = new std::vector<char>();
+    all->swap(first);
+    all->insert(all->end(), current.begin(), current.end());
+    current.clear();
+    return all;
+}
+
+void MultipartUpload::add_result (int number, size_t size, std::shared_future<std::string> result) {
+
+    // On borne le nombre d'envois simultanés, et donc la mémoire utilisée
+    int running = 0;
+    std::map<int, std::shared_future<std::string> >::iterator oldest = results.end();
+    std::map<int, std::shared_future<std::string> >::iterator it;
+    for (it = results.begin(); it != results.end(); ++it) {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            running++;
+            if (oldest == results.end()) oldest = it;
+        }
+    }
+    if (running >= ROK4_MULTIPART_MAX_PENDING) {
+        oldest->second.wait();
+    }
+
+    results.insert(std::make_pair(number, result));
+    sizes.insert(std::make_pair(number, size));
+}
+
+bool MultipartUpload::wait_results (std::vector<std::pair<int, std::string> >& identifiers) {
+    bool ok = true;
+    std::map<int, std::shared_future<std::string> >::iterator it;
+    for (it = results.begin(); it != results.end(); ++it) {
+        std::string id = it->second.get();
+        if (id == "") ok = false;
+        identifiers.push_back(std::make_pair(it->first, id));
+    }
+    return ok;
+}
+
+size_t MultipartUpload::get_part_size (int number) {
+    std::map<int, size_t>::iterator it = sizes.find(number);
+    if (it == sizes.end()) return 0;
+    return it->second;
+}
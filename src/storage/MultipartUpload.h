@@ -0,0 +1,218 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file MultipartUpload.h
+ ** \~french
+ * \brief Définition de la classe MultipartUpload
+ * \details
+ * \li MultipartUpload : écriture d'un objet par parties, envoyées au fur et à mesure
+ ** \~english
+ * \brief Define classe MultipartUpload
+ * \details
+ * \li MultipartUpload : object writing by parts, sent progressively
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <future>
+
+/**
+ * \~french \brief Nombre maximal de parties en cours d'envoi pour un même objet
+ * \details Au delà, l'écriture attend la fin de l'envoi le plus ancien, ce qui borne la mémoire utilisée
+ * \~english \brief Maximal number of parts being sent for one object
+ * \details Beyond, writing waits for the oldest sending end, to bound used memory
+ */
+#define ROK4_MULTIPART_MAX_PENDING 4
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Tampon d'écriture d'un objet envoyé par parties
+ * \details Les données sont découpées en parties de taille fixe, numérotées à partir de 1. La première partie (qui contient l'en-tête et l'index d'une dalle, écrits en dernier) est conservée jusqu'à la fermeture. Les parties suivantes sont disponibles pour l'envoi dès qu'elles sont complètes, ce qui suppose une écriture séquentielle au delà de la première partie.
+ *
+ * Les résultats des envois (identifiant de la partie, vide en cas d'échec) sont mémorisés pour constituer l'objet final.
+ * \~english
+ * \brief Writing buffer for an object sent by parts
+ * \details Data are split into fixed size parts, numbered from 1. First part (containing slab's header and index, written last) is kept until closing. Next parts are available to be sent as soon as they are complete, that implies a sequential writing beyond the first part.
+ *
+ * Sendings' results (part identifier, empty if failure) are memorized to make the final object.
+ */
+class MultipartUpload {
+
+private:
+
+    /**
+     * \~french \brief Taille des parties, en octets
+     * \~english \brief Parts size, in bytes
+     */
+    size_t part_size;
+
+    /**
+     * \~french \brief Première partie, conservée jusqu'à la fermeture
+     * \~english \brief First part, kept until closing
+     */
+    std::vector<char> first;
+
+    /**
+     * \~french \brief Données non envoyées au delà de la première partie
+     * \~english \brief Not sent data beyond the first part
+     */
+    std::vector<char> current;
+
+    /**
+     * \~french \brief Numéro de la partie commençant #current
+     * \~english \brief Number of the part starting #current
+     */
+    int current_part;
+
+    /**
+     * \~french \brief Résultat de l'envoi de chaque partie
+     * \~english \brief Sending result for each part
+     */
+    std::map<int, std::shared_future<std::string> > results;
+
+    /**
+     * \~french \brief Taille de chaque partie envoyée
+     * \~english \brief Size of each sent part
+     */
+    std::map<int, size_t> sizes;
+
+public:
+
+    /**
+     * \~french \brief Identifiant de l'envoi, donné par le stockage
+     * \~english \brief Upload identifier, given by the storage
+     */
+    std::string upload_id;
+
+    /**
+     * \~french \brief Crée un tampon vide
+     * \param[in] ps Taille des parties, en octets
+     * \~english \brief Create an empty buffer
+     * \param[in] ps Parts size, in bytes
+     */
+    MultipartUpload (size_t ps);
+
+    /**
+     * \~french \brief Écrit des données dans le tampon
+     * \return Faux si les données concernent une partie déjà envoyée
+     * \~english \brief Write data into the buffer
+     * \return False if data concern an already sent part
+     */
+    bool write (const uint8_t* data, size_t offset, size_t size);
+
+    /**
+     * \~french \brief Remplace le contenu du tampon
+     * \return Faux si des parties ont déjà été envoyées
+     * \~english \brief Replace buffer content
+     * \return False if parts are already sent
+     */
+    bool write_full (const uint8_t* data, size_t size);
+
+    /**
+     * \~french \brief Une partie complète est-elle prête à être envoyée
+     * \~english \brief Is a complete part ready to be sent
+     */
+    bool has_full_part ();
+
+    /**
+     * \~french \brief Des parties ont-elles déjà été retirées du tampon pour envoi
+     * \~english \brief Have parts already been removed from the buffer to be sent
+     */
+    bool is_started ();
+
+    /**
+     * \~french \brief Retire la prochaine partie complète du tampon
+     * \param[out] number Numéro de la partie
+     * \~english \brief Remove the next complete part from the buffer
+     * \param[out] number Part number
+     */
+    std::shared_ptr<std::vector<char> > pop_part (int& number);
+
+    /**
+     * \~french \brief Retire la première partie du tampon
+     * \~english \brief Remove the first part from the buffer
+     */
+    std::shared_ptr<std::vector<char> > pop_first ();
+
+    /**
+     * \~french \brief Retire la dernière partie (éventuellement incomplète) du tampon
+     * \param[out] number Numéro de la partie
+     * \return La partie, vide si il n'y a plus de données
+     * \~english \brief Remove the last (possibly incomplete) part from the buffer
+     * \param[out] number Part number
+     * \return The part, empty if no more data
+     */
+    std::shared_ptr<std::vector<char> > pop_last (int& number);
+
+    /**
+     * \~french \brief Retire l'ensemble des données du tampon, pour un envoi en une fois
+     * \details Uniquement possible si aucune partie n'a été retirée
+     * \~english \brief Remove all data from the buffer, to send them at once
+     * \details Only possible if no part has been removed
+     */
+    std::vector<char>* pop_all ();
+
+    /**
+     * \~french \brief Mémorise l'envoi d'une partie
+     * \details Si trop d'envois sont en cours, on attend la fin du plus ancien
+     * \~english \brief Memorize a part sending
+     * \details If too many sendings are running, we wait for the oldest one
+     */
+    void add_result (int number, size_t size, std::shared_future<std::string> result);
+
+    /**
+     * \~french \brief Attend la fin de tous les envois et récupère leurs identifiants, dans l'ordre des parties
+     * \return Faux si un envoi a échoué
+     * \~english \brief Wait for all sendings and get their identifiers, in parts order
+     * \return False if a sending failed
+     */
+    bool wait_results (std::vector<std::pair<int, std::string> >& identifiers);
+
+    /**
+     * \~french \brief Taille de la partie donnée
+     * \~english \brief Given part size
+     */
+    size_t get_part_size (int number);
+};
@@ -0,0 +1,158 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file RetryPolicy.cpp
+ ** \~french
+ * \brief Implémentation de la classe RetryPolicy
+ ** \~english
+ * \brief Implements classe RetryPolicy
+ */
+
+#include "rok4/storage/RetryPolicy.h"
+#include "rok4/storage/Context.h"
+#include "rok4/utils/Utils.h"
+
+#include <random>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+RetryPolicy::RetryPolicy () {
+    // Sans délai en millisecondes, on conserve le délai constant en secondes
+    int legacy = env_or_default(ROK4_OBJECT_ATTEMPTS_WAIT, 5) * 1000;
+    int base = env_or_default(ROK4_OBJECT_RETRY_BASE_DELAY, -1);
+    if (base < 0) {
+        set_delays(legacy, env_or_default(ROK4_OBJECT_RETRY_MAX_DELAY, legacy));
+    } else {
+        set_delays(base, env_or_default(ROK4_OBJECT_RETRY_MAX_DELAY, std::max(base, 1000)));
+    }
+    set_deadline(env_or_default(ROK4_OBJECT_RETRY_DEADLINE, 0));
+    breaker_threshold = env_or_default(ROK4_OBJECT_BREAKER_THRESHOLD, 0);
+    breaker_cooldown = env_or_default(ROK4_OBJECT_BREAKER_COOLDOWN, 5000);
+}
+
+RetryPolicy::RetryPolicy (int base, int max, int d, int threshold, int cooldown) {
+    set_delays(base, max);
+    set_deadline(d);
+    breaker_threshold = std::max(threshold, 0);
+    breaker_cooldown = std::max(cooldown, 0);
+}
+
+bool RetryPolicy::is_retryable (long http_code) {
+    if (http_code == 0 || http_code >= 500) return true;
+    if (http_code == 429 || http_code == 408) return true;
+    // Les autres codes (4xx) ne changeront pas en réessayant
+    return http_code < 400;
+}
+
+int RetryPolicy::get_delay (State& state) {
+    static thread_local std::mt19937 generator(std::random_device{}());
+
+    int upper = std::max(base_delay, std::min(max_delay, std::max(state.delay, base_delay) * 3));
+    std::uniform_int_distribution<int> distribution(base_delay, upper);
+    state.delay = distribution(generator);
+    return state.delay;
+}
+
+int RetryPolicy::next_delay (int attempt, int attempts, long http_code, State& state) {
+    if (attempt >= attempts || ! is_retryable(http_code)) return -1;
+
+    int delay = get_delay(state);
+
+    if (deadline > 0) {
+        int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - state.start).count();
+        if (elapsed + delay >= deadline) {
+            BOOST_LOG_TRIVIAL(error) << "Request deadline (" << deadline << " ms) exceeded, no more attempt";
+            return -1;
+        }
+    }
+
+    return delay;
+}
+
+bool RetryPolicy::is_available (std::string cluster) {
+    if (breaker_threshold == 0) return true;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    std::map<std::string, Breaker>::iterator it = breakers.find(cluster);
+    if (it == breakers.end() || it->second.failures < breaker_threshold) return true;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < it->second.open_until) return false;
+
+    // Fin du temps de repos : cette requête est l'essai, les autres continuent d'échouer immédiatement
+    it->second.open_until = now + std::chrono::milliseconds(breaker_cooldown);
+    return true;
+}
+
+void RetryPolicy::record (std::string cluster, long http_code, bool success) {
+    if (breaker_threshold == 0) return;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    Breaker& breaker = breakers[cluster];
+
+    // Une erreur définitive (objet absent par exemple) montre que le cluster répond
+    if (success || ! is_retryable(http_code)) {
+        if (breaker.failures >= breaker_threshold) {
+            BOOST_LOG_TRIVIAL(info) << "Storage cluster " << cluster << " answers again, circuit breaker closed";
+        }
+        breaker.failures = 0;
+        return;
+    }
+
+    breaker.failures++;
+    if (breaker.failures >= breaker_threshold) {
+        if (breaker.failures == breaker_threshold) {
+            BOOST_LOG_TRIVIAL(error) << "Storage cluster " << cluster << " failed " << breaker.failures << " times in a row, circuit breaker opened for " << breaker_cooldown << " ms";
+        }
+        breaker.open_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(breaker_cooldown);
+    }
+}
+
+void RetryPolicy::reset_breakers () {
+    std::lock_guard<std::mutex> lock(mtx);
+    breakers.clear();
+}
+
+RetryPolicy::~RetryPolicy () {
+
+}
+
+std::map<std::string, RetryPolicy::Breaker> RetryPolicy::breakers;
+std::mutex RetryPolicy::mtx;
@@ -52,6 +52,7 @@
 #include <openssl/hmac.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <thread>
 
 std::vector<std::string> S3Context::env_hosts;
 std::vector<std::string> S3Context::env_keys;
@@ -153,6 +154,9 @@ std::string S3Context::get_default_cluster() {
 }
 
 S3Context::S3Context(std::string b) : Context(), bucket_name(b), cluster_name("") {
+    // La taille lue dans l'environnement par Context doit respecter le minimum S3
+    set_part_size(part_size);
+
     if (!load_env()) {
         BOOST_LOG_TRIVIAL(error) << "Cannot load environment variables to use S3 storage";
         return;
@@ -273,100 +277,125 @@ static const char mon_name[][4] = {
     "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 
-int S3Context::read(uint8_t *data, int offset, int size, std::string name) {
+struct curl_slist* S3Context::prepare_read(CURL* curl, BufferStruct* buffer, int offset, int size, std::string name) {
 
-    BOOST_LOG_TRIVIAL(debug) << "S3 read : " << size << " bytes (from the " << offset << " one) in the object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name;
+    struct curl_slist *list = NULL;
 
-    int attempt = 1;
-    while (attempt) {
-    // On constitue le moyen de récupération des informations (avec les structures de LibcurlStruct)
+    int lastBytes = offset + size - 1;
 
-        CURLcode res;
-        struct curl_slist *list = NULL;
-        DataStruct chunk;
-        chunk.nbPassage = 0;
-        chunk.data = (char *)malloc(1);
-        chunk.size = 0;
+    std::string fullUrl = url + "/" + bucket_name + "/" + name;
 
-        int lastBytes = offset + size - 1;
+    time_t current;
 
-        CURL *curl = CurlPool::get_curl_env();
+    time(&current);
+    struct tm *ptm = gmtime(&current);
 
-        std::string fullUrl = url + "/" + bucket_name + "/" + name;
+    char gmt_time[40];
+    sprintf(
+        gmt_time, "%s, %.2d %s %d %.2d:%.2d:%.2d GMT",
+        wday_name[ptm->tm_wday], ptm->tm_mday, mon_name[ptm->tm_mon], 1900 + ptm->tm_year,
+        ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
 
-        time_t current;
+    std::string content_type = "application/octet-stream";
+    std::string resource = "/" + bucket_name + "/" + name;
+    std::string stringToSign = "GET\n\n" + content_type + "\n" + std::string(gmt_time) + "\n" + resource;
+    std::string signature = getAuthorizationHeader(stringToSign);
 
-        time(&current);
-        struct tm *ptm = gmtime(&current);
+    // Constitution du header
 
-        static char gmt_time[40];
-        sprintf(
-            gmt_time, "%s, %.2d %s %d %.2d:%.2d:%.2d GMT",
-            wday_name[ptm->tm_wday], ptm->tm_mday, mon_name[ptm->tm_mon], 1900 + ptm->tm_year,
-            ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
+    char range[50];
+    sprintf(range, "Range: bytes=%d-%d", offset, lastBytes);
+    list = curl_slist_append(list, range);
 
-        std::string content_type = "application/octet-stream";
-        std::string resource = "/" + bucket_name + "/" + name;
-        std::string stringToSign = "GET\n\n" + content_type + "\n" + std::string(gmt_time) + "\n" + resource;
-        std::string signature = getAuthorizationHeader(stringToSign);
+    char hd_host[256];
+    sprintf(hd_host, "Host: %s", host.c_str());
+    list = curl_slist_append(list, hd_host);
 
-        // Constitution du header
+    char d[100];
+    sprintf(d, "Date: %s", gmt_time);
+    list = curl_slist_append(list, d);
 
-        char range[50];
-        sprintf(range, "Range: bytes=%d-%d", offset, lastBytes);
-        list = curl_slist_append(list, range);
+    char ct[50];
+    sprintf(ct, "Content-Type: %s", content_type.c_str());
+    list = curl_slist_append(list, ct);
 
-        char hd_host[256];
-        sprintf(hd_host, "Host: %s", host.c_str());
-        list = curl_slist_append(list, hd_host);
+    std::string ex = "Expect:";
+    list = curl_slist_append(list, ex.c_str());
 
-        char d[100];
-        sprintf(d, "Date: %s", gmt_time);
-        list = curl_slist_append(list, d);
+    char auth[512];
+    sprintf(auth, "Authorization: AWS %s:%s", key.c_str(), signature.c_str());
 
-        char ct[50];
-        sprintf(ct, "Content-Type: %s", content_type.c_str());
-        list = curl_slist_append(list, ct);
+    list = curl_slist_append(list, auth);
 
-        std::string ex = "Expect:";
-        list = curl_slist_append(list, ex.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+    if (ssl_no_verify) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) buffer);
 
-        char auth[512];
-        sprintf(auth, "Authorization: AWS %s:%s", key.c_str(), signature.c_str());
+    if (timeout) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    }
 
-        list = curl_slist_append(list, auth);
+    return list;
+}
 
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-        curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
-        if (ssl_no_verify) {
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        }
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+int S3Context::read(uint8_t *data, int offset, int size, std::string name) {
 
-        if (timeout) {
-            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-        }
+    BOOST_LOG_TRIVIAL(debug) << "S3 read : " << size << " bytes (from the " << offset << " one) in the object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name;
+
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(url)) {
+        BOOST_LOG_TRIVIAL(error) << "S3 cluster " << ((cluster_name != "") ? cluster_name : host) << " unavailable (circuit breaker open), unable to read the object " << bucket_name << " / " << name;
+        return -1;
+    }
+
+    // Lecture doublée si la politique est active et qu'assez de durées ont été mesurées
+    int hedge_delay = latencies.get_hedge_delay(hedge_percentile, hedge_min_delay);
+    if (hedge_delay >= 0) {
+        std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+        std::future<int> future = result->get_future();
+        submit_hedged_read(result, data, offset, size, name, hedge_delay);
+        return future.get();
+    }
+
+    int attempt = 1;
+    RetryPolicy::State retry;
+    while (attempt) {
+    // On constitue le moyen de récupération des informations (avec les structures de LibcurlStruct)
+
+        CURLcode res;
+        // Les données sont reçues directement dans le buffer de l'appelant
+        BufferStruct buffer (data, size);
+
+        CURL *curl = CurlPool::get_curl_env();
+        struct curl_slist *list = prepare_read(curl, &buffer, offset, size, name);
 
         BOOST_LOG_TRIVIAL(debug) << "S3 READ START (" << size << ") " << pthread_self();
         res = curl_easy_perform(curl);
         BOOST_LOG_TRIVIAL(debug) << "S3 READ END (" << size << ") " << pthread_self();
 
         curl_slist_free_all(list);
-        // delete[] gmt_time;
+
+        // Réponse plus grande que demandé : une nouvelle tentative aurait le même résultat, et le service n'est pas en cause pour le disjoncteur
+        if (buffer.overflow) {
+            BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+            BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+            break;
+        }
 
         if (CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            retry_policy->record(url, 0, false);
+            int delay = retry_policy->next_delay(attempt, read_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > read_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -374,24 +403,180 @@ int S3Context::read(uint8_t *data, int offset, int size, std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            retry_policy->record(url, http_code, false);
+            int delay = retry_policy->next_delay(attempt, read_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
+        }
 
-            if (attempt > read_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
+        retry_policy->record(url, http_code, true);
+        latencies.add(get_duration(curl));
+        return buffer.size;
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
+
+    return -1;
+}
+
+std::future<int> S3Context::read_async(uint8_t *data, int offset, int size, std::string name) {
+
+    BOOST_LOG_TRIVIAL(debug) << "S3 asynchronous read : " << size << " bytes (from the " << offset << " one) in the object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name;
+
+    std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+    std::future<int> future = result->get_future();
+
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(url)) {
+        BOOST_LOG_TRIVIAL(error) << "S3 cluster " << ((cluster_name != "") ? cluster_name : host) << " unavailable (circuit breaker open), unable to read the object " << bucket_name << " / " << name;
+        result->set_value(-1);
+        return future;
+    }
+
+    int hedge_delay = latencies.get_hedge_delay(hedge_percentile, hedge_min_delay);
+    if (hedge_delay >= 0) {
+        submit_hedged_read(result, data, offset, size, name, hedge_delay);
+    } else {
+        submit_read(result, data, offset, size, name, 1, RetryPolicy::State());
+    }
+    return future;
+}
+
+void S3Context::submit_read(std::shared_ptr<std::promise<int> > result, uint8_t *data, int offset, int size, std::string name, int attempt, RetryPolicy::State retry) {
+
+    // Les données sont reçues directement dans le buffer de l'appelant
+    BufferStruct* buffer = new BufferStruct(data, size);
+
+    CURL *curl = curl_easy_init();
+    struct curl_slist *list = prepare_read(curl, buffer, offset, size, name);
+
+    // La fonction de fin est appelée dans le thread de la boucle curl : une nouvelle tentative est soumise avec un délai plutôt qu'une attente
+    CurlLoop::submit(curl, [this, result, data, offset, size, name, attempt, retry, curl, list, buffer](CURLcode res) {
+
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (CURLE_OK != res) http_code = 0;
+        int duration = get_duration(curl);
+        curl_slist_free_all(list);
+        curl_easy_cleanup(curl);
+
+        size_t read_size = buffer->size;
+        bool overflow = buffer->overflow;
+        delete buffer;
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && ! overflow) {
+            retry_policy->record(url, http_code, true);
+            latencies.add(duration);
+            result->set_value(read_size);
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+        if (overflow) {
+            BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+        } else if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+
+        // Réponse trop grande : ni nouvelle tentative, ni échec compté par le disjoncteur
+        if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow) {
+            retry_policy->record(url, http_code, false);
+            RetryPolicy::State next = retry;
+            if (retry_policy->next_delay(attempt, read_attempts, http_code, next) >= 0) {
+                submit_read(result, data, offset, size, name, attempt + 1, next);
+                return;
             }
         }
 
-        memcpy(data, chunk.data, chunk.size);
+        BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
+        result->set_value(-1);
+
+    }, (attempt == 1) ? 0 : retry.delay);
+}
+
+void S3Context::submit_hedged_read(std::shared_ptr<std::promise<int> > result, uint8_t *data, int offset, int size, std::string name, int delay) {
 
-        return chunk.size;
+    // La requête principale reçoit les données dans le buffer de l'appelant, la requête doublée dans un buffer propre
+    std::shared_ptr<HedgedReadStruct> hedged = std::make_shared<HedgedReadStruct>(size);
+    for (int i = 0; i < 2; i++) {
+        hedged->buffers[i] = new BufferStruct((i == 0) ? data : hedged->hedge_data.data(), size);
+        hedged->handles[i] = curl_easy_init();
+        hedged->lists[i] = prepare_read(hedged->handles[i], hedged->buffers[i], offset, size, name);
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << read_attempts << " tries" ;
+    // La requête principale est soumise en premier : une fois la réponse rendue, plus rien ne peut écrire dans le buffer de l'appelant
+    // La requête doublée, en attente pendant le délai, est annulée avant son lancement si la principale se termine avant
+    // Les identifiants sont verrouillés jusqu'à la fin des soumissions : la principale peut se terminer avant la soumission de la doublée
+    std::lock_guard<std::mutex> lock(hedged->ids_mtx);
+    for (int i = 0; i < 2; i++) {
+        hedged->ids[i] = CurlLoop::submit(hedged->handles[i], [this, result, hedged, data, offset, size, name, i](CURLcode res) {
+
+            CURL* curl = hedged->handles[i];
+            hedged->finished[i] = true;
+            long http_code = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+            if (CURLE_OK != res) http_code = 0;
+            int duration = get_duration(curl);
+            curl_slist_free_all(hedged->lists[i]);
+            curl_easy_cleanup(curl);
+
+            size_t read_size = hedged->buffers[i]->size;
+            bool overflow = hedged->buffers[i]->overflow;
+            delete hedged->buffers[i];
+
+            // L'autre requête a déjà répondu : celle-ci a été annulée
+            if (hedged->done) return;
+
+            if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && ! overflow) {
+                hedged->done = true;
+                // L'autre requête est retirée de la boucle avant la copie : elle ne peut plus écrire dans le buffer de l'appelant
+                // Une requête déjà terminée n'est plus dans la boucle (son objet curl a été libéré)
+                if (! hedged->finished[1 - i]) CurlLoop::cancel(hedged->get_id(1 - i));
+                if (i == 1) {
+                    // La latence observée par l'appelant court depuis la soumission de la requête principale
+                    duration = hedged->elapsed();
+                    BOOST_LOG_TRIVIAL(debug) << "S3 hedged read answered first (" << size << " bytes from the " << offset << " one in " << name << ")";
+                    memcpy(data, hedged->hedge_data.data(), read_size);
+                }
+                retry_policy->record(url, http_code, true);
+                latencies.add(duration);
+                result->set_value(read_size);
+                return;
+            }
 
-    return -1;
+            BOOST_LOG_TRIVIAL(error) <<  "Try 1 failed" << ((i == 1) ? " (hedged request)" : "");
+            if (overflow) {
+                BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+            } else if (CURLE_OK != res) {
+                BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            } else {
+                BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            }
+
+            if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow) {
+                retry_policy->record(url, http_code, false);
+            }
+
+            // L'autre requête peut encore réussir
+            hedged->failures++;
+            if (hedged->failures < 2) return;
+
+            hedged->done = true;
+            RetryPolicy::State retry;
+            if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow && retry_policy->next_delay(1, read_attempts, http_code, retry) >= 0) {
+                submit_read(result, data, offset, size, name, 2, retry);
+                return;
+            }
+
+            BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after 1 tries" ;
+            result->set_value(-1);
+
+        }, (i == 0) ? 0 : delay);
+    }
 }
 
 uint8_t *S3Context::read_full(int &size, std::string name) {
@@ -401,6 +586,7 @@ uint8_t *S3Context::read_full(int &size, std::string name) {
     // On constitue le moyen de récupération des informations (avec les structures de LibcurlStruct)
 
     int attempt = 1;
+    RetryPolicy::State retry;
     while (attempt) {
         CURLcode res;
         struct curl_slist *list = NULL;
@@ -472,14 +658,11 @@ uint8_t *S3Context::read_full(int &size, std::string name) {
         if (CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            int delay = retry_policy->next_delay(attempt, read_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > read_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -487,14 +670,11 @@ uint8_t *S3Context::read_full(int &size, std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            int delay = retry_policy->next_delay(attempt, read_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > read_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         size = chunk.size;
@@ -503,7 +683,7 @@ uint8_t *S3Context::read_full(int &size, std::string name) {
         return data;
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to full read S3 object" << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << read_attempts << " tries" ;
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to full read S3 object" << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
 
     return NULL;
 }
@@ -511,6 +691,15 @@ uint8_t *S3Context::read_full(int &size, std::string name) {
 bool S3Context::write(uint8_t *data, int offset, int size, std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "S3 write : " << size << " bytes (from the " << offset << " one) in the writing buffer " << name;
 
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find(name);
+    if (itu != uploads.end()) {
+        if (! itu->second->write(data, offset, size)) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot write in the S3 multipart upload " << name;
+            return false;
+        }
+        return send_parts(name, itu->second);
+    }
+
     std::map<std::string, std::vector<char> *>::iterator it1 = write_buffers.find(name);
     if (it1 == write_buffers.end()) {
         // pas de buffer pour ce nom d'objet
@@ -533,6 +722,15 @@ bool S3Context::write(uint8_t *data, int offset, int size, std::string name) {
 bool S3Context::write_full(uint8_t *data, int size, std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "S3 write : " << size << " bytes (one shot) in the writing buffer " << name;
 
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find(name);
+    if (itu != uploads.end()) {
+        if (! itu->second->write_full(data, size)) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot write in the S3 multipart upload " << name;
+            return false;
+        }
+        return send_parts(name, itu->second);
+    }
+
     std::map<std::string, std::vector<char> *>::iterator it1 = write_buffers.find(name);
     if (it1 == write_buffers.end()) {
         // pas de buffer pour ce nom d'objet
@@ -574,9 +772,12 @@ std::string S3Context::get_path(std::string name) {
 
 bool S3Context::open_to_write(std::string name) {
     std::map<std::string, std::vector<char> *>::iterator it1 = write_buffers.find(name);
-    if (it1 != write_buffers.end()) {
+    if (it1 != write_buffers.end() || uploads.find(name) != uploads.end()) {
         BOOST_LOG_TRIVIAL(error) << "A S3 writing buffer already exists for the name " << name;
         return false;
+    } else if (part_size > 0) {
+        // Écriture par parties, envoyées au fur et à mesure
+        uploads.insert(std::pair<std::string, MultipartUpload *>(name, new MultipartUpload(part_size)));
     } else {
         write_buffers.insert(std::pair<std::string, std::vector<char> *>(name, new std::vector<char>()));
     }
@@ -584,7 +785,32 @@ bool S3Context::open_to_write(std::string name) {
     return true;
 }
 
+void S3Context::set_part_size(int s) {
+    if (s > 0 && s < ROK4_S3_MIN_PART_SIZE) {
+        BOOST_LOG_TRIVIAL(warning) << "S3 multipart upload parts must be at least " << ROK4_S3_MIN_PART_SIZE << " bytes long, " << s << " is raised to this minimum";
+        s = ROK4_S3_MIN_PART_SIZE;
+    }
+    Context::set_part_size(s);
+}
+
 bool S3Context::close_to_write(std::string name) {
+
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find(name);
+    if (itu != uploads.end()) {
+        MultipartUpload* upload = itu->second;
+        uploads.erase(itu);
+
+        if (upload->is_started()) {
+            bool ok = complete_multipart(name, upload);
+            delete upload;
+            return ok;
+        }
+
+        // Aucune partie n'a été envoyée : l'objet est écrit en une fois
+        write_buffers.insert(std::pair<std::string, std::vector<char> *>(name, upload->pop_all()));
+        delete upload;
+    }
+
     std::map<std::string, std::vector<char> *>::iterator it1 = write_buffers.find(name);
     if (it1 == write_buffers.end()) {
         BOOST_LOG_TRIVIAL(error) << "The S3 writing buffer with name " << name << "does not exist, cannot flush it";
@@ -594,6 +820,7 @@ bool S3Context::close_to_write(std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "Write buffered " << it1->second->size() << " bytes in the S3 object " << name;
 
     int attempt = 1;
+    RetryPolicy::State retry;
     while (attempt) {
 
         CURLcode res;
@@ -664,14 +891,11 @@ bool S3Context::close_to_write(std::string name) {
         if (CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            int delay = retry_policy->next_delay(attempt, write_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -679,14 +903,11 @@ bool S3Context::close_to_write(std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            int delay = retry_policy->next_delay(attempt, write_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         BOOST_LOG_TRIVIAL(debug) << "Erase the flushed buffer";
@@ -695,13 +916,285 @@ bool S3Context::close_to_write(std::string name) {
         return true;
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << write_attempts << " tries" ;
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
+
+    return false;
+}
+
+struct curl_slist* S3Context::prepare_request(CURL* curl, std::string method, std::string content_type, std::string name, std::string subresource) {
+
+    struct curl_slist *list = NULL;
+
+    std::string fullUrl = url + "/" + bucket_name + "/" + name + subresource;
+
+    time_t current;
+
+    time(&current);
+    struct tm *ptm = gmtime(&current);
+
+    char gmt_time[40];
+    sprintf(
+        gmt_time, "%s, %.2d %s %d %.2d:%.2d:%.2d GMT",
+        wday_name[ptm->tm_wday], ptm->tm_mday, mon_name[ptm->tm_mon], 1900 + ptm->tm_year,
+        ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
+
+    // Les sous-ressources (?uploads, ?partNumber=...&uploadId=...) font partie de la ressource signée
+    std::string resource = "/" + bucket_name + "/" + name + subresource;
+    std::string stringToSign = method + "\n\n" + content_type + "\n" + std::string(gmt_time) + "\n" + resource;
+    std::string signature = getAuthorizationHeader(stringToSign);
+
+    // Constitution du header
+
+    char hd_host[256];
+    sprintf(hd_host, "Host: %s", host.c_str());
+    list = curl_slist_append(list, hd_host);
+
+    char d[100];
+    sprintf(d, "Date: %s", gmt_time);
+    list = curl_slist_append(list, d);
+
+    std::string ct = "Content-Type: " + content_type;
+    list = curl_slist_append(list, ct.c_str());
+
+    std::string ex = "Expect:";
+    list = curl_slist_append(list, ex.c_str());
+
+    char auth[512];
+    sprintf(auth, "Authorization: AWS %s:%s", key.c_str(), signature.c_str());
+    list = curl_slist_append(list, auth);
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    if (ssl_no_verify) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+
+    if (timeout) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    }
+
+    return list;
+}
+
+bool S3Context::start_multipart(std::string name, MultipartUpload* upload) {
+
+    BOOST_LOG_TRIVIAL(debug) << "S3 multipart upload start for the object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name;
+
+    int attempt = 1;
+    RetryPolicy::State retry;
+    while (attempt) {
+
+        DataStruct chunk;
+        chunk.nbPassage = 0;
+        chunk.data = (char *)malloc(1);
+        chunk.size = 0;
+
+        CURL *curl = CurlPool::get_curl_env();
+        struct curl_slist *list = prepare_request(curl, "POST", "application/octet-stream", name, "?uploads");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+
+        CURLcode res = curl_easy_perform(curl);
+        curl_slist_free_all(list);
+
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299) {
+            // L'identifiant de l'envoi est dans la réponse XML
+            std::string response(chunk.data, chunk.size);
+            size_t start = response.find("<UploadId>");
+            size_t end = response.find("</UploadId>");
+            if (start != std::string::npos && end != std::string::npos) {
+                upload->upload_id = response.substr(start + 10, end - start - 10);
+                return true;
+            }
+            BOOST_LOG_TRIVIAL(error) << "No upload identifier in the S3 response";
+            return false;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+        if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+        int delay = retry_policy->next_delay(attempt, write_attempts, (CURLE_OK == res) ? http_code : 0, retry);
+        if (delay < 0) break;
+        attempt++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to start the multipart upload of the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
+    return false;
+}
+
+void S3Context::submit_part(std::shared_ptr<std::promise<std::string> > result, std::string name, std::string upload_id, int number, std::shared_ptr<std::vector<char> > part, int attempt, RetryPolicy::State retry) {
+
+    BOOST_LOG_TRIVIAL(debug) << "S3 part " << number << " upload (" << part->size() << " bytes) for the object " << name;
+
+    std::string* etag = new std::string();
+
+    CURL *curl = curl_easy_init();
+    struct curl_slist *list = prepare_request(curl, "PUT", "application/octet-stream", name, "?partNumber=" + std::to_string(number) + "&uploadId=" + upload_id);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, part->data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) part->size());
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, etag_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) etag);
+
+    // La partie reste en mémoire (via le pointeur partagé) jusqu'à la fin de son envoi
+    CurlLoop::submit(curl, [this, result, name, upload_id, number, part, attempt, retry, curl, list, etag](CURLcode res) {
+
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_slist_free_all(list);
+        curl_easy_cleanup(curl);
+
+        std::string id = *etag;
+        delete etag;
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && id != "") {
+            result->set_value(id);
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed for the part " << number << " of " << name ;
+        if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+
+        RetryPolicy::State next = retry;
+        if (res != CURLE_ABORTED_BY_CALLBACK && retry_policy->next_delay(attempt, write_attempts, (CURLE_OK == res) ? http_code : 0, next) >= 0) {
+            submit_part(result, name, upload_id, number, part, attempt + 1, next);
+            return;
+        }
+
+        result->set_value("");
+
+    }, (attempt == 1) ? 0 : retry.delay);
+}
+
+bool S3Context::send_parts(std::string name, MultipartUpload* upload) {
+    while (upload->has_full_part()) {
+        if (! upload->is_started() && ! start_multipart(name, upload)) {
+            return false;
+        }
+
+        int number;
+        std::shared_ptr<std::vector<char> > part = upload->pop_part(number);
+        std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+        upload->add_result(number, part->size(), result->get_future().share());
+        submit_part(result, name, upload->upload_id, number, part, 1, RetryPolicy::State());
+    }
+    return true;
+}
+
+bool S3Context::complete_multipart(std::string name, MultipartUpload* upload) {
+
+    // Envoi des dernières données puis de la première partie (en-tête et index)
+    int number;
+    std::shared_ptr<std::vector<char> > last = upload->pop_last(number);
+    if (! last->empty()) {
+        std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+        upload->add_result(number, last->size(), result->get_future().share());
+        submit_part(result, name, upload->upload_id, number, last, 1, RetryPolicy::State());
+    }
+
+    std::shared_ptr<std::vector<char> > first = upload->pop_first();
+    std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+    upload->add_result(1, first->size(), result->get_future().share());
+    submit_part(result, name, upload->upload_id, 1, first, 1, RetryPolicy::State());
+
+    std::vector<std::pair<int, std::string> > etags;
+    if (! upload->wait_results(etags)) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to send all parts of the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name;
+        abort_multipart(name, upload);
+        return false;
+    }
+
+    std::ostringstream body;
+    body << "<CompleteMultipartUpload>";
+    for (int i = 0; i < etags.size(); i++) {
+        body << "<Part><PartNumber>" << etags.at(i).first << "</PartNumber><ETag>" << etags.at(i).second << "</ETag></Part>";
+    }
+    body << "</CompleteMultipartUpload>";
+    std::string xml = body.str();
+
+    int attempt = 1;
+    RetryPolicy::State retry;
+    while (attempt) {
+
+        DataStruct chunk;
+        chunk.nbPassage = 0;
+        chunk.data = (char *)malloc(1);
+        chunk.size = 0;
+
+        CURL *curl = CurlPool::get_curl_env();
+        struct curl_slist *list = prepare_request(curl, "POST", "application/xml", name, "?uploadId=" + upload->upload_id);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, xml.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) xml.size());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
 
+        CURLcode res = curl_easy_perform(curl);
+        curl_slist_free_all(list);
+
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+        // Une erreur peut être renvoyée dans une réponse 200
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && std::string(chunk.data, chunk.size).find("<Error>") == std::string::npos) {
+            return true;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+        if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+        int delay = retry_policy->next_delay(attempt, write_attempts, (CURLE_OK == res) ? http_code : 0, retry);
+        if (delay < 0) break;
+        attempt++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to complete the multipart upload of the S3 object " << bucket_name << "@" << ((cluster_name != "") ? cluster_name : host) << " / " << name << " after " << attempt << " tries" ;
+    abort_multipart(name, upload);
     return false;
 }
 
+void S3Context::abort_multipart(std::string name, MultipartUpload* upload) {
+
+    // Les parties déjà envoyées sont supprimées, sans nouvelle tentative en cas d'échec
+    CURL *curl = CurlPool::get_curl_env();
+    struct curl_slist *list = prepare_request(curl, "DELETE", "application/octet-stream", name, "?uploadId=" + upload->upload_id);
+    CURLcode res = curl_easy_perform(curl);
+    curl_slist_free_all(list);
+
+    if (CURLE_OK != res) {
+        BOOST_LOG_TRIVIAL(warning) << "Cannot abort the multipart upload of the S3 object " << name << " : " << curl_easy_strerror(res);
+    }
+}
+
 bool S3Context::exists(std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "Exists (S3) ? " << get_path(name);
+    return (check_existence(name) == 1);
+}
+
+int S3Context::check_existence(std::string name) {
+
+    // Disjoncteur ouvert : on n'envoie pas de requête et on ne peut pas conclure
+    if (! retry_policy->is_available(url)) {
+        BOOST_LOG_TRIVIAL(error) << "S3 cluster " << ((cluster_name != "") ? cluster_name : host) << " unavailable (circuit breaker open), unable to test object existence " << bucket_name << " / " << name;
+        return -1;
+    }
 
     CURLcode res;
     struct curl_slist *list = NULL;
@@ -765,14 +1258,19 @@ bool S3Context::exists(std::string name) {
     if (CURLE_OK != res) {
         BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from S3 : " << bucket_name + "/" + name;
         BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
-        return false;
+        retry_policy->record(url, 0, false);
+        return -1;
     }
 
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    retry_policy->record(url, http_code, http_code >= 200 && http_code <= 299);
     if (http_code >= 200 && http_code <= 299) {
-        return true;
+        return 1;
+    } else if (http_code == 404) {
+        return 0;
     } else {
-        return false;
+        BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from S3 : " << bucket_name + "/" + name << ", response HTTP code : " << http_code;
+        return -1;
     }
 }
\ No newline at end of file
@@ -50,15 +50,25 @@
 #pragma once
 
 #include <curl/curl.h>
+#include <memory>
 #include <boost/log/trivial.hpp>
 #include "storage/Context.h"
 #include "utils/LibcurlStruct.h"
 #include "utils/CurlPool.h"
+#include "utils/CurlLoop.h"
+#include "utils/LatencyTracker.h"
+#include "storage/MultipartUpload.h"
 
 #define ROK4_S3_URL "ROK4_S3_URL"
 #define ROK4_S3_KEY "ROK4_S3_KEY"
 #define ROK4_S3_SECRETKEY "ROK4_S3_SECRETKEY"
 
+/**
+ * \~french \brief Taille minimale en octets des parties d'un envoi multipart S3, hormis la dernière
+ * \~english \brief Minimal size in bytes of S3 multipart upload parts, except the last one
+ */
+#define ROK4_S3_MIN_PART_SIZE 5242880
+
 /**
  * \author Institut national de l'information géographique et forestière
  * \~french
@@ -158,6 +168,120 @@ private:
      */
     std::string getAuthorizationHeader(std::string toSign);
 
+    /**
+     * \~french \brief Prépare un objet curl pour la lecture d'une portion d'objet
+     * \details L'URL, les en-têtes signés (dont le Range) et la fonction de réception des données sont renseignés
+     * \param[in] curl Objet curl à configurer
+     * \param[in] buffer Buffer de réception des données
+     * \param[in] offset Début de la portion
+     * \param[in] size Taille de la portion
+     * \param[in] name Nom de l'objet
+     * \return Liste des en-têtes, à libérer par l'appelant une fois la requête exécutée
+     * \~english \brief Prepare a curl object to read an object's range
+     * \details URL, signed headers (with Range) and data callback are set
+     * \param[in] curl Curl object to configure
+     * \param[in] buffer Buffer to receive the data
+     * \param[in] offset Range start
+     * \param[in] size Range size
+     * \param[in] name Object name
+     * \return Headers list, to free by the caller once the request is performed
+     */
+    struct curl_slist* prepare_read(CURL* curl, BufferStruct* buffer, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Soumet une tentative de lecture asynchrone à la boucle curl
+     * \param[in] result Résultat à renseigner, à la fin de la dernière tentative
+     * \param[in] attempt Numéro de la tentative (à partir de 1)
+     * \param[in] retry État des tentatives, dont le délai avant cette tentative
+     * \~english \brief Submit an asynchronous reading attempt to the curl loop
+     * \param[in] result Result to fill, at the end of the last attempt
+     * \param[in] attempt Attempt number (from 1)
+     * \param[in] retry Attempts state, with the delay before this attempt
+     */
+    void submit_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int attempt, RetryPolicy::State retry);
+
+    /**
+     * \~french \brief Soumet une lecture doublée à la boucle curl
+     * \details Une seconde requête est lancée si la première n'est pas terminée après le délai. La première réponse valide est utilisée et l'autre requête est annulée. Si les deux échouent, les tentatives suivantes sont faites via #submit_read
+     * \param[in] result Résultat à renseigner
+     * \param[in] delay Délai en millisecondes avant le lancement de la seconde requête
+     * \~english \brief Submit a hedged reading to the curl loop
+     * \details A second request is performed if the first one is not done after the delay. The first valid response is used and the other request is cancelled. If both fail, next attempts are made with #submit_read
+     * \param[in] result Result to fill
+     * \param[in] delay Delay in milliseconds before the second request is performed
+     */
+    void submit_hedged_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int delay);
+
+    /**
+     * \~french \brief Durées des dernières lectures réussies, pour le calcul du délai de doublement
+     * \~english \brief Last successful readings durations, to compute hedging delay
+     */
+    LatencyTracker latencies;
+
+    /**
+     * \~french \brief Envois par parties en cours, par nom d'objet
+     * \details Utilisés à la place de #write_buffers quand la taille des parties (#part_size) est définie
+     * \~english \brief Running multipart uploads, by object name
+     * \details Used instead of #write_buffers when parts size (#part_size) is defined
+     */
+    std::map<std::string, MultipartUpload*> uploads;
+
+    /**
+     * \~french \brief Prépare un objet curl pour une requête signée sur un objet
+     * \param[in] curl Objet curl à configurer
+     * \param[in] method Méthode HTTP
+     * \param[in] content_type Type de contenu, intervenant dans la signature
+     * \param[in] name Nom de l'objet
+     * \param[in] subresource Sous-ressource S3, avec le '?' initial (peut être vide)
+     * \return Liste des en-têtes, à compléter éventuellement et à libérer par l'appelant une fois la requête exécutée
+     * \~english \brief Prepare a curl object for a signed request on an object
+     * \param[in] curl Curl object to configure
+     * \param[in] method HTTP method
+     * \param[in] content_type Content type, used in the signature
+     * \param[in] name Object name
+     * \param[in] subresource S3 subresource, with initial '?' (can be empty)
+     * \return Headers list, to possibly complete and to free by the caller once the request is performed
+     */
+    struct curl_slist* prepare_request(CURL* curl, std::string method, std::string content_type, std::string name, std::string subresource);
+
+    /**
+     * \~french \brief Démarre un envoi par parties et en mémorise l'identifiant
+     * \~english \brief Start a multipart upload and memorize its identifier
+     */
+    bool start_multipart(std::string name, MultipartUpload* upload);
+
+    /**
+     * \~french \brief Soumet l'envoi d'une partie à la boucle curl
+     * \param[in] result Identifiant (ETag) de la partie à renseigner, vide en cas d'échec
+     * \param[in] attempt Numéro de la tentative (à partir de 1)
+     * \param[in] retry État des tentatives, dont le délai avant cette tentative
+     * \~english \brief Submit a part sending to the curl loop
+     * \param[in] result Part identifier (ETag) to fill, empty if failure
+     * \param[in] attempt Attempt number (from 1)
+     * \param[in] retry Attempts state, with the delay before this attempt
+     */
+    void submit_part(std::shared_ptr<std::promise<std::string> > result, std::string name, std::string upload_id, int number, std::shared_ptr<std::vector<char> > part, int attempt, RetryPolicy::State retry);
+
+    /**
+     * \~french \brief Envoie les parties complètes du tampon, en démarrant l'envoi par parties si besoin
+     * \~english \brief Send buffer's complete parts, starting the multipart upload if needed
+     */
+    bool send_parts(std::string name, MultipartUpload* upload);
+
+    /**
+     * \~french \brief Envoie les dernières parties, attend la fin de tous les envois et finalise l'objet
+     * \details En cas d'échec, l'envoi par parties est annulé
+     * \~english \brief Send last parts, wait for all sendings and complete the object
+     * \details If failure, multipart upload is aborted
+     */
+    bool complete_multipart(std::string name, MultipartUpload* upload);
+
+    /**
+     * \~french \brief Annule un envoi par parties
+     * \~english \brief Abort a multipart upload
+     */
+    void abort_multipart(std::string name, MultipartUpload* upload);
+
 public:
 
     /**
@@ -198,6 +322,15 @@ public:
     static std::string get_default_cluster();
 
     int read(uint8_t* data, int offset, int size, std::string name);
+
+
+    /**
+     * \~french \brief Lance la lecture d'une portion d'objet dans la boucle curl partagée (CurlLoop)
+     * \details Les tentatives suivantes sont soumises à la boucle avec un délai, sans bloquer de thread
+     * \~english \brief Start to read an object's range in the shared curl loop (CurlLoop)
+     * \details Next attempts are submitted to the loop with a delay, without blocking a thread
+     */
+    std::future<int> read_async(uint8_t* data, int offset, int size, std::string name);
     uint8_t* read_full(int& size, std::string name);
     bool write(uint8_t* data, int offset, int size, std::string name);
     bool write_full(uint8_t* data, int size, std::string name);
@@ -205,6 +338,16 @@ public:
     bool open_to_write(std::string name);
     bool close_to_write(std::string name);
 
+    /**
+     * \~french \brief Modifie la taille des parties pour l'écriture par morceaux
+     * \details Une taille inférieure au minimum accepté par S3 (#ROK4_S3_MIN_PART_SIZE) est relevée à ce minimum, avec un avertissement : l'envoi échouerait sinon à la fermeture, une fois toutes les parties envoyées
+     * \param[in] s Taille en octets, 0 pour désactiver l'écriture par morceaux
+     * \~english \brief Change parts size for writing by pieces
+     * \details A size below the S3 minimum (#ROK4_S3_MIN_PART_SIZE) is raised to this minimum, with a warning : upload would fail otherwise when closing, once all parts are sent
+     * \param[in] s Size in bytes, 0 to disable writing by pieces
+     */
+    void set_part_size(int s);
+
     std::string get_path(std::string racine,int x,int y,int pathDepth);
     std::string get_path(std::string name);
 
@@ -240,6 +383,7 @@ public:
     bool connection();
     
     bool exists(std::string name);
+    int check_existence(std::string name);
 
     void close_connection() {
         connected = false;
@@ -247,6 +391,10 @@ public:
 
     ~S3Context() {
         close_connection();
+        std::map<std::string, MultipartUpload*>::iterator it;
+        for (it = uploads.begin(); it != uploads.end(); ++it) {
+            delete it->second;
+        }
     }
 };
 
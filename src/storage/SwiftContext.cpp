@@ -48,6 +48,8 @@
  */
 
 #include "storage/SwiftContext.h"
+#include <thread>
+#include <algorithm>
 #include <sys/stat.h>
 #include <time.h>
 
@@ -85,6 +87,11 @@ SwiftContext::SwiftContext (std::string cont) : Context(), ssl_no_verify(false),
         keystone_auth=true;
     }
 
+    char* ranges = getenv (ROK4_SWIFT_MAX_RANGES);
+    if (ranges == NULL || sscanf ( ranges, "%d", &max_ranges ) != 1 || max_ranges < 1) {
+        max_ranges = 50;
+    }
+
     ssl_no_verify = get_ssl_no_verify();
     timeout = get_timeout();
 }
@@ -93,6 +100,26 @@ bool SwiftContext::connection() {
 
     if (! connected) {
 
+        credentials.auth_url = auth_url;
+        credentials.user_name = user_name;
+        credentials.user_passwd = user_passwd;
+        credentials.keystone_auth = keystone_auth;
+        credentials.ssl_no_verify = ssl_no_verify;
+        credentials.timeout = timeout;
+
+        char* domain = getenv (ROK4_KEYSTONE_DOMAINID);
+        char* project = getenv (ROK4_KEYSTONE_PROJECTID);
+        char* account = getenv (ROK4_SWIFT_ACCOUNT);
+        if (keystone_auth) {
+            if (domain != NULL) domain_id.assign(domain);
+            if (project != NULL) project_id.assign(project);
+            credentials.domain_id = domain_id;
+            credentials.project_id = project_id;
+        } else {
+            if (account != NULL) user_account.assign(account);
+            credentials.user_account = user_account;
+        }
+
         // On va regarder si on a le token dans un fichier, pour éviter une authentification
         char* tf = getenv (ROK4_SWIFT_TOKEN_FILE);
         if (tf != NULL && use_token_from_file) {
@@ -106,9 +133,12 @@ bool SwiftContext::connection() {
                 BOOST_LOG_TRIVIAL(debug) << "File " << token_file << " does not exist";
             }
             else if ( token_stream.is_open() ) {
+                std::string token;
                 getline(token_stream, token);
                 token_stream.close();
                 BOOST_LOG_TRIVIAL(debug) << "File " << token_file << " exists: token loaded " << token;
+                // Le jeton du fichier est partagé, sauf si un jeton est déjà connu pour ces identifiants
+                SwiftTokenManager::set_token(credentials, token);
                 connected = true;
                 return true;
             } else {
@@ -119,175 +149,73 @@ bool SwiftContext::connection() {
         
         use_token_from_file = false;
 
-        if (keystone_auth) {
-            BOOST_LOG_TRIVIAL(debug) << "Keystone authentication";
-
-            char* domain = getenv (ROK4_KEYSTONE_DOMAINID);
-            if (domain == NULL) {
-                BOOST_LOG_TRIVIAL(error) << "We need a domain id (ROK4_KEYSTONE_DOMAINID) for a keystone authentication";
-                return false;
-            } else {
-                domain_id.assign(domain);
-            }
-
-            char* project = getenv (ROK4_KEYSTONE_PROJECTID);
-            if (project == NULL) {
-                BOOST_LOG_TRIVIAL(error) << "We need a project id (ROK4_KEYSTONE_PROJECTID) for a keystone authentication";
-                return false;
-            } else {
-                project_id.assign(project);
-            }
-
-            if (token == "") {
-
-                CURLcode res;
-                struct curl_slist *list = NULL;
-                CURL* curl = CurlPool::get_curl_env();
-
-                curl_easy_setopt(curl, CURLOPT_URL, auth_url.c_str());
-                if(ssl_no_verify){
-                    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-                }
-
-                // On constitue le header
-
-                const char* ct = "Content-Type: application/json";
-                list = curl_slist_append(list, ct);
-
-                // On constitue le body
-
-                std::string body = "{ \"auth\": {\"scope\": { \"project\": {\"id\": \""+project_id+"\"}}, ";
-                body += " \"identity\": { \"methods\": [\"password\"], \"password\": { \"user\": { \"domain\": { \"id\": \""+domain_id+"\"},";
-                body += "\"name\": \""+user_name+"\", \"password\": \""+user_passwd+"\" } } } } }";
-
-                HeaderStruct authHdr;
-                DataStruct chunk;
-                chunk.nbPassage = 0;
-                chunk.data = (char*) malloc(1);
-                chunk.size = 0;
-
-                curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-                curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*) &authHdr);
-                curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
-                curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &chunk);
-
-                if (timeout) {
-                    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-                    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-                }
-
-                res = curl_easy_perform(curl);
-                if( CURLE_OK != res) {
-                    BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to Keystone";
-                    BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
-                    curl_slist_free_all(list);
-                    return false;
-                }
-
-                long http_code = 0;
-                curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
-                if (http_code < 200 || http_code > 299) {
-                    BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to Keystone";
-                    BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
-                    curl_slist_free_all(list);
-                    return false;
-                }
-
-                // On récupère le token dans le header de la réponse
-                token = std::string(authHdr.token);
-
-                curl_slist_free_all(list);
-            }
-        } else {
-
-            BOOST_LOG_TRIVIAL(debug) << "Swift authentication";
-
-            char* account = getenv (ROK4_SWIFT_ACCOUNT);
-            if (account == NULL) {
-                BOOST_LOG_TRIVIAL(error) << "We need an account (ROK4_SWIFT_ACCOUNT) for a Swift authentication";
-                return false;
-            } else {
-                user_account.assign(account);
-            }
-
-            CURLcode res;
-            struct curl_slist *list = NULL;
-
-            CURL* curl = CurlPool::get_curl_env();
-
-            curl_easy_setopt(curl, CURLOPT_URL, auth_url.c_str());
-            if(ssl_no_verify){
-                curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            }
-
-            // On constitue le header et le moyen de récupération des informations (avec les structures de LibcurlStruct)
+        // Les identifiants complets ne sont nécessaires que pour s'authentifier
+        if (keystone_auth && domain == NULL) {
+            BOOST_LOG_TRIVIAL(error) << "We need a domain id (ROK4_KEYSTONE_DOMAINID) for a keystone authentication";
+            return false;
+        }
+        if (keystone_auth && project == NULL) {
+            BOOST_LOG_TRIVIAL(error) << "We need a project id (ROK4_KEYSTONE_PROJECTID) for a keystone authentication";
+            return false;
+        }
+        if (! keystone_auth && account == NULL) {
+            BOOST_LOG_TRIVIAL(error) << "We need an account (ROK4_SWIFT_ACCOUNT) for a Swift authentication";
+            return false;
+        }
 
-            char xUser[256];
-            strcpy(xUser, "X-Storage-User: ");
-            strcat(xUser, user_account.c_str());
-            strcat(xUser, ":");
-            strcat(xUser, user_name.c_str());
+        // Le jeton est partagé par tous les contextes utilisant les mêmes identifiants : l'authentification n'est faite que si besoin
+        if (SwiftTokenManager::get_token(credentials) == "") {
+            return false;
+        }
 
-            char xPass[256];
-            strcpy(xPass, "X-Storage-Pass: ");
-            strcat(xPass, user_passwd.c_str());
+        connected = true;
+    }
 
-            char xAuthUser[256];
-            strcpy(xAuthUser, "X-Auth-User: ");
-            strcat(xAuthUser, user_account.c_str());
-            strcat(xAuthUser, ":");
-            strcat(xAuthUser, user_name.c_str());
+    return true;
+}
 
-            char xAuthKey[256];
-            strcpy(xAuthKey, "X-Auth-Key: ");
-            strcat(xAuthKey, user_passwd.c_str());
+std::string SwiftContext::get_token() {
+    return SwiftTokenManager::get_token(credentials);
+}
 
+std::string SwiftContext::getAuthToken() {
+    return get_token();
+}
 
-            list = curl_slist_append(list, xUser);
-            list = curl_slist_append(list, xPass);        
-            list = curl_slist_append(list, xAuthUser);
-            list = curl_slist_append(list, xAuthKey);
+bool SwiftContext::renew_token(std::string rejected) {
+    use_token_from_file = false;
+    return (SwiftTokenManager::renew_token(credentials, rejected) != "");
+}
 
-            HeaderStruct authHdr;
+struct curl_slist* SwiftContext::prepare_read(CURL* curl, BufferStruct* buffer, int offset, int size, std::string name, std::string token) {
 
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-            curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*) &authHdr);
-            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    struct curl_slist *list = NULL;
 
-            if (timeout) {
-                curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-                curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-            }
+    int lastBytes = offset + size - 1;
 
-            res = curl_easy_perform(curl);
-            if( CURLE_OK != res) {
-                BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to Swift";
-                BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
-                curl_slist_free_all(list);
-                return false;
-            }
+    std::string fullUrl;
+    fullUrl = public_url + "/" + container_name + "/" + name;
 
-            long http_code = 0;
-            curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
-            if (http_code < 200 || http_code > 299) {
-                BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to Swift";
-                BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
-                curl_slist_free_all(list);
-                return false;
-            }
+    char range[50];
+    sprintf(range, "Range: bytes=%d-%d", offset, lastBytes);
 
-            // On récupère le token dans le header de la réponse
-            token = std::string(authHdr.token);
+    list = curl_slist_append(list, token.c_str());
+    list = curl_slist_append(list, range);
 
-            curl_slist_free_all(list);
-        }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+    if(ssl_no_verify){
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) buffer);
 
-        connected = true;
+    if (timeout) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
     }
 
-    return true;
+    return list;
 }
 
 int SwiftContext::read(uint8_t* data, int offset, int size, std::string name) {
@@ -299,44 +227,35 @@ int SwiftContext::read(uint8_t* data, int offset, int size, std::string name) {
 
     BOOST_LOG_TRIVIAL(debug) << "Swift read : " << size << " bytes (from the " << offset << " one) in the object " << container_name << " / " << name;
 
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(public_url)) {
+        BOOST_LOG_TRIVIAL(error) << "Swift cluster " << public_url << " unavailable (circuit breaker open), unable to read the object " << container_name << " / " << name;
+        return -1;
+    }
+
+    // Lecture doublée si la politique est active et qu'assez de durées ont été mesurées
+    int hedge_delay = latencies.get_hedge_delay(hedge_percentile, hedge_min_delay);
+    if (hedge_delay >= 0) {
+        std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+        std::future<int> future = result->get_future();
+        submit_hedged_read(result, data, offset, size, name, hedge_delay);
+        return future.get();
+    }
+
     int attempt = 1;
+    RetryPolicy::State retry;
     bool reconnection = false;
     while (attempt) {
         
         CURLcode res;
-        struct curl_slist *list = NULL;
-        DataStruct chunk;
-        chunk.nbPassage = 0;
-        chunk.data = (char*) malloc(1);
-        chunk.size = 0;
-
-        int lastBytes = offset + size - 1;
+        // Les données sont reçues directement dans le buffer de l'appelant
+        BufferStruct buffer (data, size);
 
+        std::string token = get_token();
         CURL* curl = CurlPool::get_curl_env();
 
         // On constitue le header et le moyen de récupération des informations (avec les structures de LibcurlStruct)
-
-        std::string fullUrl;
-        fullUrl = public_url + "/" + container_name + "/" + name;
-
-        char range[50];
-        sprintf(range, "Range: bytes=%d-%d", offset, lastBytes);
-
-        list = curl_slist_append(list, token.c_str());
-        list = curl_slist_append(list, range);
-
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-        curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
-        if(ssl_no_verify){
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        }
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &chunk);
-
-        if (timeout) {
-            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-        }
+        struct curl_slist *list = prepare_read(curl, &buffer, offset, size, name, token);
 
         BOOST_LOG_TRIVIAL(debug) << "SWIFT READ START (" << size << ") " << pthread_self();
         res = curl_easy_perform(curl);
@@ -344,17 +263,22 @@ int SwiftContext::read(uint8_t* data, int offset, int size, std::string name) {
         
         curl_slist_free_all(list);
 
+        // Réponse plus grande que demandé : une nouvelle tentative aurait le même résultat, et le service n'est pas en cause pour le disjoncteur
+        if (buffer.overflow) {
+            BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+            BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+            break;
+        }
+
         if( CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) << "Cannot read data from Swift : " << size << " bytes (from the " << offset << " one) in the object " << name;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            retry_policy->record(public_url, 0, false);
+            int delay = retry_policy->next_delay(attempt, read_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -364,11 +288,8 @@ int SwiftContext::read(uint8_t* data, int offset, int size, std::string name) {
         // Nous faisons une nouvelle demande de token et réessayons une fois (hors compte des tentatives de lecture)
         if ( ! reconnection && (http_code == 403 || http_code == 401 || http_code == 400) ) {
             BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
-            connected = false;
             reconnection = true;
-            token = "";
-            use_token_from_file = false;
-            if (! connection()) {
+            if (! renew_token(token)) {
                 BOOST_LOG_TRIVIAL(error) << "Reconnection attempt failed.";
                 return -1;
             }
@@ -379,24 +300,362 @@ int SwiftContext::read(uint8_t* data, int offset, int size, std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            retry_policy->record(public_url, http_code, false);
+            int delay = retry_policy->next_delay(attempt, read_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
+        }
+
+        retry_policy->record(public_url, http_code, true);
+        latencies.add(get_duration(curl));
+        return buffer.size;
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the Swift object " << container_name << " / " << name << " after " << attempt << " tries" ;
+    return -1;
+}
+
+
+std::future<int> SwiftContext::read_async(uint8_t* data, int offset, int size, std::string name) {
+
+    if (! connected) {
+        BOOST_LOG_TRIVIAL(error) << "Impossible de lire via un contexte non connecté";
+        std::promise<int> result;
+        result.set_value(-1);
+        return result.get_future();
+    }
 
-            if (attempt > read_attempts) {
-                break;
+    BOOST_LOG_TRIVIAL(debug) << "Swift asynchronous read : " << size << " bytes (from the " << offset << " one) in the object " << container_name << " / " << name;
+
+    std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+    std::future<int> future = result->get_future();
+
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(public_url)) {
+        BOOST_LOG_TRIVIAL(error) << "Swift cluster " << public_url << " unavailable (circuit breaker open), unable to read the object " << container_name << " / " << name;
+        result->set_value(-1);
+        return future;
+    }
+
+    int hedge_delay = latencies.get_hedge_delay(hedge_percentile, hedge_min_delay);
+    if (hedge_delay >= 0) {
+        submit_hedged_read(result, data, offset, size, name, hedge_delay);
+    } else {
+        submit_read(result, data, offset, size, name, 1, false, RetryPolicy::State(), "");
+    }
+    return future;
+}
+
+void SwiftContext::submit_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int attempt, bool reconnection, RetryPolicy::State retry, std::string rejected) {
+
+    if (rejected != "") {
+        use_token_from_file = false;
+    }
+
+    // Une éventuelle authentification est faite par le SwiftTokenManager, hors du thread de la boucle curl
+    SwiftTokenManager::get_token_async(credentials, rejected, [this, result, data, offset, size, name, attempt, reconnection, retry, rejected](std::string token) {
+        if (token == "") {
+            BOOST_LOG_TRIVIAL(error) << ((rejected != "") ? "Reconnection attempt failed." : "No Swift token available");
+            result->set_value(-1);
+            return;
+        }
+        if (rejected != "") {
+            BOOST_LOG_TRIVIAL(debug) << "Successfully reconnected.";
+        }
+        send_read(result, data, offset, size, name, attempt, reconnection, retry, token);
+    });
+}
+
+void SwiftContext::send_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int attempt, bool reconnection, RetryPolicy::State retry, std::string token) {
+
+    // Les données sont reçues directement dans le buffer de l'appelant
+    BufferStruct* buffer = new BufferStruct(data, size);
+
+    CURL* curl = curl_easy_init();
+    struct curl_slist *list = prepare_read(curl, buffer, offset, size, name, token);
+
+    // La fonction de fin est appelée dans le thread de la boucle curl : une nouvelle tentative est soumise avec un délai plutôt qu'une attente
+    CurlLoop::submit(curl, [this, result, data, offset, size, name, attempt, reconnection, retry, curl, list, buffer, token](CURLcode res) {
+
+        long http_code = 0;
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (CURLE_OK != res) http_code = 0;
+        int duration = get_duration(curl);
+        curl_slist_free_all(list);
+        curl_easy_cleanup(curl);
+
+        size_t read_size = buffer->size;
+        bool overflow = buffer->overflow;
+        delete buffer;
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && ! overflow) {
+            retry_policy->record(public_url, http_code, true);
+            latencies.add(duration);
+            result->set_value(read_size);
+            return;
+        }
+
+        // Nous avons un refus d'accès, cela peut venir d'une authentification expirée
+        // Nous faisons une nouvelle demande de token et réessayons une fois (hors compte des tentatives de lecture)
+        if ( CURLE_OK == res && ! reconnection && (http_code == 403 || http_code == 401 || http_code == 400) ) {
+            BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
+            // Nouvelle tentative immédiate, avec un nouveau jeton
+            RetryPolicy::State next = retry;
+            next.delay = 0;
+            submit_read(result, data, offset, size, name, attempt, true, next, token);
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+        if (overflow) {
+            BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+        } else if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+
+        // Réponse trop grande : ni nouvelle tentative, ni échec compté par le disjoncteur
+        if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow) {
+            retry_policy->record(public_url, http_code, false);
+            RetryPolicy::State next = retry;
+            if (retry_policy->next_delay(attempt, read_attempts, http_code, next) >= 0) {
+                submit_read(result, data, offset, size, name, attempt + 1, reconnection, next, "");
+                return;
+            }
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the Swift object " << container_name << " / " << name << " after " << attempt << " tries" ;
+        result->set_value(-1);
+
+    }, (attempt == 1) ? 0 : retry.delay);
+}
+
+
+void SwiftContext::submit_hedged_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int delay) {
+
+    // La requête principale reçoit les données dans le buffer de l'appelant, la requête doublée dans un buffer propre
+    std::shared_ptr<HedgedReadStruct> hedged = std::make_shared<HedgedReadStruct>(size);
+    std::string token = get_token();
+    for (int i = 0; i < 2; i++) {
+        hedged->buffers[i] = new BufferStruct((i == 0) ? data : hedged->hedge_data.data(), size);
+        hedged->handles[i] = curl_easy_init();
+        hedged->lists[i] = prepare_read(hedged->handles[i], hedged->buffers[i], offset, size, name, token);
+    }
+
+    // La requête principale est soumise en premier : une fois la réponse rendue, plus rien ne peut écrire dans le buffer de l'appelant
+    // La requête doublée, en attente pendant le délai, est annulée avant son lancement si la principale se termine avant
+    // Les identifiants sont verrouillés jusqu'à la fin des soumissions : la principale peut se terminer avant la soumission de la doublée
+    std::lock_guard<std::mutex> lock(hedged->ids_mtx);
+    for (int i = 0; i < 2; i++) {
+        hedged->ids[i] = CurlLoop::submit(hedged->handles[i], [this, result, hedged, data, offset, size, name, i, token](CURLcode res) {
+
+            CURL* curl = hedged->handles[i];
+            hedged->finished[i] = true;
+            long http_code = 0;
+            curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+            if (CURLE_OK != res) http_code = 0;
+            int duration = get_duration(curl);
+            curl_slist_free_all(hedged->lists[i]);
+            curl_easy_cleanup(curl);
+
+            size_t read_size = hedged->buffers[i]->size;
+            bool overflow = hedged->buffers[i]->overflow;
+            delete hedged->buffers[i];
+
+            // L'autre requête a déjà répondu : celle-ci a été annulée
+            if (hedged->done) return;
+
+            if (CURLE_OK == res && http_code >= 200 && http_code <= 299 && ! overflow) {
+                hedged->done = true;
+                // L'autre requête est retirée de la boucle avant la copie : elle ne peut plus écrire dans le buffer de l'appelant
+                // Une requête déjà terminée n'est plus dans la boucle (son objet curl a été libéré)
+                if (! hedged->finished[1 - i]) CurlLoop::cancel(hedged->get_id(1 - i));
+                if (i == 1) {
+                    // La latence observée par l'appelant court depuis la soumission de la requête principale
+                    duration = hedged->elapsed();
+                    BOOST_LOG_TRIVIAL(debug) << "Swift hedged read answered first (" << size << " bytes from the " << offset << " one in " << name << ")";
+                    memcpy(data, hedged->hedge_data.data(), read_size);
+                }
+                retry_policy->record(public_url, http_code, true);
+                latencies.add(duration);
+                result->set_value(read_size);
+                return;
+            }
+
+            BOOST_LOG_TRIVIAL(error) <<  "Try 1 failed" << ((i == 1) ? " (hedged request)" : "");
+            if (overflow) {
+                BOOST_LOG_TRIVIAL(error) << "Response is bigger than the wanted " << size << " bytes";
+            } else if (CURLE_OK != res) {
+                BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
             } else {
-                sleep(waiting_time);
-                continue;
+                BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            }
+
+            // Un refus d'accès peut venir d'une authentification expirée : la lecture simple gère la reconnexion
+            bool authentication = (CURLE_OK == res && (http_code == 403 || http_code == 401 || http_code == 400));
+            if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow && ! authentication) {
+                retry_policy->record(public_url, http_code, false);
+            }
+
+            // L'autre requête peut encore réussir
+            hedged->failures++;
+            if (hedged->failures < 2) return;
+
+            hedged->done = true;
+
+            if (res != CURLE_ABORTED_BY_CALLBACK && ! overflow) {
+                RetryPolicy::State retry;
+                if (authentication) {
+                    submit_read(result, data, offset, size, name, 1, true, retry, token);
+                    return;
+                }
+                if (retry_policy->next_delay(1, read_attempts, http_code, retry) >= 0) {
+                    submit_read(result, data, offset, size, name, 2, false, retry, "");
+                    return;
+                }
+            }
+
+            BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the Swift object " << container_name << " / " << name << " after 1 tries" ;
+            result->set_value(-1);
+
+        }, (i == 0) ? 0 : delay);
+    }
+}
+
+bool SwiftContext::read_ranges(std::vector<ReadRange>& ranges) {
+
+    if (! connected) {
+        BOOST_LOG_TRIVIAL(error) << "Impossible de lire via un contexte non connecté";
+        for (int i = 0; i < ranges.size(); i++) ranges.at(i).read_size = -1;
+        return false;
+    }
+
+    // On regroupe les portions par objet, sans modifier l'ordre fourni
+    std::vector<int> order (ranges.size());
+    for (int i = 0; i < ranges.size(); i++) {
+        order.at(i) = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&ranges](int a, int b) {
+        return ranges.at(a).name < ranges.at(b).name;
+    });
+
+    std::vector<std::future<bool> > batches;
+    std::vector<std::vector<ReadRange*> > batches_ranges;
+    std::vector<std::future<int> > singles;
+    std::vector<ReadRange*> singles_ranges;
+
+    int i = 0;
+    while (i < order.size()) {
+        int j = i;
+        while (j < order.size() && ranges.at(order.at(j)).name == ranges.at(order.at(i)).name) j++;
+
+        if (j - i == 1 || max_ranges < 2 || ! retry_policy->is_available(public_url)) {
+            // Une seule portion pour l'objet (ou requêtes multiples désactivées) : lecture classique
+            for (int k = i; k < j; k++) {
+                ReadRange* r = &(ranges.at(order.at(k)));
+                singles.push_back(read_async(r->data, r->offset, r->size, r->name));
+                singles_ranges.push_back(r);
+            }
+        } else {
+            BOOST_LOG_TRIVIAL(debug) << "Swift read : " << (j - i) << " ranges in the object " << container_name << " / " << ranges.at(order.at(i)).name;
+            for (int k = i; k < j; k += max_ranges) {
+                std::vector<ReadRange*> batch;
+                for (int l = k; l < j && l < k + max_ranges; l++) {
+                    batch.push_back(&(ranges.at(order.at(l))));
+                }
+                batches.push_back(submit_ranges(batch));
+                batches_ranges.push_back(batch);
             }
         }
 
-        memcpy(data, chunk.data, chunk.size);
-        return chunk.size;
+        i = j;
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) from the Swift object " << container_name << " / " << name << " after " << read_attempts << " tries" ;
-    return -1;
+    // Les portions des requêtes multiples en échec sont relues une à une, avec les tentatives et la reconnexion de read_async
+    for (int b = 0; b < batches.size(); b++) {
+        if (batches.at(b).get()) continue;
+        for (int k = 0; k < batches_ranges.at(b).size(); k++) {
+            ReadRange* r = batches_ranges.at(b).at(k);
+            if (r->read_size >= 0) continue;
+            singles.push_back(read_async(r->data, r->offset, r->size, r->name));
+            singles_ranges.push_back(r);
+        }
+    }
+
+    for (int s = 0; s < singles.size(); s++) {
+        singles_ranges.at(s)->read_size = singles.at(s).get();
+    }
+
+    bool ok = true;
+    for (int i = 0; i < ranges.size(); i++) {
+        if (ranges.at(i).read_size < 0) ok = false;
+    }
+    return ok;
 }
 
+std::future<bool> SwiftContext::submit_ranges(std::vector<ReadRange*> ranges) {
+
+    std::shared_ptr<std::promise<bool> > result = std::make_shared<std::promise<bool> >();
+    std::future<bool> future = result->get_future();
+
+    for (int i = 0; i < ranges.size(); i++) {
+        ranges.at(i)->read_size = -1;
+    }
+    ByteRangesReceiver* receiver = new ByteRangesReceiver(ranges);
+    std::string name = ranges.at(0)->name;
+    std::string fullUrl = public_url + "/" + container_name + "/" + name;
+
+    std::string token = get_token();
+    CURL* curl = curl_easy_init();
+
+    struct curl_slist *list = NULL;
+    list = curl_slist_append(list, token.c_str());
+    list = curl_slist_append(list, receiver->get_range_header().c_str());
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+    if(ssl_no_verify){
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, ByteRangesReceiver::header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) receiver);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ByteRangesReceiver::data_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) receiver);
+    if (timeout) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    }
+
+    CurlLoop::submit(curl, [this, result, receiver, curl, list, name](CURLcode res) {
+
+        long http_code = 0;
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (CURLE_OK != res) http_code = 0;
+        curl_slist_free_all(list);
+        curl_easy_cleanup(curl);
+
+        bool ok = false;
+        if (CURLE_OK == res && (http_code == 200 || http_code == 206)) {
+            ok = receiver->finish();
+            retry_policy->record(public_url, http_code, true);
+            if (! ok) {
+                BOOST_LOG_TRIVIAL(error) << "Some ranges are missing in the multi-range response for the Swift object " << container_name << " / " << name;
+            }
+        } else if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << "Multi-range reading failed for the Swift object " << container_name << " / " << name << " : " << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(debug) << "Multi-range reading failed for the Swift object " << container_name << " / " << name << ", response HTTP code : " << http_code;
+        }
+        delete receiver;
+
+        result->set_value(ok);
+    });
+
+    return future;
+}
 
 uint8_t* SwiftContext::read_full(int& size, std::string name) {
 
@@ -410,6 +669,7 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
     }
 
     int attempt = 1;
+    RetryPolicy::State retry;
     bool reconnection = false;
     while (attempt) {
         
@@ -420,6 +680,7 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
         chunk.data = (char*) malloc(1);
         chunk.size = 0;
 
+        std::string token = get_token();
         CURL* curl = CurlPool::get_curl_env();
 
         // On constitue le header et le moyen de récupération des informations (avec les structures de LibcurlStruct)
@@ -449,14 +710,11 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
         if( CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) << "Cannot read full object from Swift : " << name;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            int delay = retry_policy->next_delay(attempt, write_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -466,11 +724,8 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
         // Nous faisons une nouvelle demande de token et réessayons une fois (hors compte des tentatives de lecture)
         if ( ! reconnection && (http_code == 403 || http_code == 401 || http_code == 400) ) {
             BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
-            connected = false;
             reconnection = true;
-            token = "";
-            use_token_from_file = false;
-            if (! connection()) {
+            if (! renew_token(token)) {
                 BOOST_LOG_TRIVIAL(error) << "Reconnection attempt failed.";
                 return NULL;
             }
@@ -481,14 +736,11 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            int delay = retry_policy->next_delay(attempt, read_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > read_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         uint8_t* data = new uint8_t[chunk.size];
@@ -497,7 +749,7 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
         return data;
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to full read Swift object " << container_name << " / " << name << " after " << read_attempts << " tries" ;
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to full read Swift object " << container_name << " / " << name << " after " << attempt << " tries" ;
 
     return NULL;
 }
@@ -505,6 +757,16 @@ uint8_t* SwiftContext::read_full(int& size, std::string name) {
 bool SwiftContext::write(uint8_t* data, int offset, int size, std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "Swift write : " << size << " bytes (from the " << offset << " one) in the writing buffer " << name;
 
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find ( name );
+    if ( itu != uploads.end() ) {
+        if (! itu->second->write(data, offset, size)) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot write in the Swift segmented upload " << name;
+            return false;
+        }
+        send_parts(name, itu->second);
+        return true;
+    }
+
     std::map<std::string, std::vector<char>*>::iterator it1 = write_buffers.find ( name );
     if ( it1 == write_buffers.end() ) {
         // pas de buffer pour ce nom d'objet
@@ -527,6 +789,16 @@ bool SwiftContext::write(uint8_t* data, int offset, int size, std::string name)
 bool SwiftContext::write_full(uint8_t* data, int size, std::string name) {
     BOOST_LOG_TRIVIAL(debug) << "Swift write : " << size << " bytes (one shot) in the writing buffer " << name;
 
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find ( name );
+    if ( itu != uploads.end() ) {
+        if (! itu->second->write_full(data, size)) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot write in the Swift segmented upload " << name;
+            return false;
+        }
+        send_parts(name, itu->second);
+        return true;
+    }
+
     std::map<std::string, std::vector<char>*>::iterator it1 = write_buffers.find ( name );
     if ( it1 == write_buffers.end() ) {
         // pas de buffer pour ce nom d'objet
@@ -557,10 +829,13 @@ std::string SwiftContext::get_tray() {
 bool SwiftContext::open_to_write(std::string name) {
 
     std::map<std::string, std::vector<char>*>::iterator it1 = write_buffers.find ( name );
-    if ( it1 != write_buffers.end() ) {
+    if ( it1 != write_buffers.end() || uploads.find ( name ) != uploads.end() ) {
         BOOST_LOG_TRIVIAL(error) << "A Swift writing buffer already exists for the name " << name;
         return false;
 
+    } else if (part_size > 0) {
+        // Écriture par segments, envoyés au fur et à mesure
+        uploads.insert ( std::pair<std::string,MultipartUpload*>(name, new MultipartUpload(part_size)) );
     } else {
         write_buffers.insert ( std::pair<std::string,std::vector<char>*>(name, new std::vector<char>()) );
     }
@@ -571,6 +846,21 @@ bool SwiftContext::open_to_write(std::string name) {
 
 bool SwiftContext::close_to_write(std::string name) {
 
+    std::map<std::string, MultipartUpload*>::iterator itu = uploads.find ( name );
+    if ( itu != uploads.end() ) {
+        MultipartUpload* upload = itu->second;
+        uploads.erase(itu);
+
+        if (upload->is_started()) {
+            bool ok = complete_multipart(name, upload);
+            delete upload;
+            return ok;
+        }
+
+        // Aucun segment n'a été envoyé : l'objet est écrit en une fois
+        write_buffers.insert ( std::pair<std::string,std::vector<char>*>(name, upload->pop_all()) );
+        delete upload;
+    }
 
     std::map<std::string, std::vector<char>*>::iterator it1 = write_buffers.find ( name );
     if ( it1 == write_buffers.end() ) {
@@ -582,10 +872,12 @@ bool SwiftContext::close_to_write(std::string name) {
 
 
     int attempt = 1;
+    RetryPolicy::State retry;
     bool reconnection = false;
     while (attempt) {
         CURLcode res;
         struct curl_slist *list = NULL;
+        std::string token = get_token();
         CURL* curl = CurlPool::get_curl_env();
 
         // On constitue le header
@@ -615,14 +907,11 @@ bool SwiftContext::close_to_write(std::string name) {
         if( CURLE_OK != res) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            int delay = retry_policy->next_delay(attempt, write_attempts, 0, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         long http_code = 0;
@@ -632,11 +921,8 @@ bool SwiftContext::close_to_write(std::string name) {
         // Nous faisons une nouvelle demande de token et réessayons une fois (hors compte des tentatives de lecture)
         if ( ! reconnection && (http_code == 403 || http_code == 401 || http_code == 400) ) {
             BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
-            connected = false;
             reconnection = true;
-            token = "";
-            use_token_from_file = false;
-            if (! connection()) {
+            if (! renew_token(token)) {
                 BOOST_LOG_TRIVIAL(error) << "Reconnection attempt failed.";
                 return false;
             }
@@ -648,14 +934,11 @@ bool SwiftContext::close_to_write(std::string name) {
         if (http_code < 200 || http_code > 299) {
             BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
             BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+            int delay = retry_policy->next_delay(attempt, write_attempts, http_code, retry);
+            if (delay < 0) break;
             attempt++;
-
-            if (attempt > write_attempts) {
-                break;
-            } else {
-                sleep(waiting_time);
-                continue;
-            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            continue;
         }
 
         BOOST_LOG_TRIVIAL(debug) << "Erase the flushed buffer";
@@ -664,66 +947,297 @@ bool SwiftContext::close_to_write(std::string name) {
         return true;
     }
 
-    BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the Swift object " << name << " after " << write_attempts << " tries" ;
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the Swift object " << name << " after " << attempt << " tries" ;
 
     return false;
 }
 
-std::string SwiftContext::get_path(std::string racine,int x,int y,int pathDepth){
-    return racine + "_" + std::to_string(x) + "_" + std::to_string(y);
+std::string SwiftContext::get_segment_name(std::string name, int number) {
+    char suffix[20];
+    sprintf(suffix, "%06d", number);
+    return name + "_segments/" + std::string(suffix);
 }
 
-std::string SwiftContext::get_path(std::string name) {  
-    return container_name + "/" + name;
-}
+void SwiftContext::submit_part(std::shared_ptr<std::promise<std::string> > result, std::string name, int number, std::shared_ptr<std::vector<char> > part, int attempt, bool reconnection, RetryPolicy::State retry, std::string rejected) {
 
+    if (rejected != "") {
+        use_token_from_file = false;
+    }
 
-bool SwiftContext::exists(std::string name) {
+    // Une éventuelle authentification est faite par le SwiftTokenManager, hors du thread de la boucle curl
+    SwiftTokenManager::get_token_async(credentials, rejected, [this, result, name, number, part, attempt, reconnection, retry, rejected](std::string token) {
+        if (token == "") {
+            BOOST_LOG_TRIVIAL(error) << ((rejected != "") ? "Reconnection attempt failed." : "No Swift token available");
+            result->set_value("");
+            return;
+        }
+        if (rejected != "") {
+            BOOST_LOG_TRIVIAL(debug) << "Successfully reconnected.";
+        }
+        send_part(result, name, number, part, attempt, reconnection, retry, token);
+    });
+}
 
-    BOOST_LOG_TRIVIAL(debug) << "Exists (SWIFT) ? " << get_path(name);
+void SwiftContext::send_part(std::shared_ptr<std::promise<std::string> > result, std::string name, int number, std::shared_ptr<std::vector<char> > part, int attempt, bool reconnection, RetryPolicy::State retry, std::string token) {
 
-    if (! connected) {
-        BOOST_LOG_TRIVIAL(error) << "Try to test object existence using the unconnected swift context " << container_name;
-        return false;
-    }
-        
-    CURLcode res;
-    struct curl_slist *list = NULL;
-    CURL* curl = CurlPool::get_curl_env();
+    std::string segment = get_segment_name(name, number);
+    BOOST_LOG_TRIVIAL(debug) << "Swift segment " << number << " upload (" << part->size() << " bytes) : " << container_name << " / " << segment;
 
-    std::string fullUrl;
-    fullUrl = public_url + "/" + container_name + "/" + name;
+    std::string* etag = new std::string();
 
+    CURL* curl = curl_easy_init();
+    struct curl_slist *list = NULL;
     list = curl_slist_append(list, token.c_str());
 
+    std::string fullUrl = public_url + "/" + container_name + "/" + segment;
+
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
     curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
-    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
     if(ssl_no_verify){
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
     }
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, part->data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) part->size());
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, etag_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *) etag);
 
     if (timeout) {
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
         curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
     }
 
-    res = curl_easy_perform(curl);
-    
-    curl_slist_free_all(list);
+    // Le segment reste en mémoire (via le pointeur partagé) jusqu'à la fin de son envoi
+    CurlLoop::submit(curl, [this, result, name, number, part, attempt, reconnection, retry, curl, list, etag, token](CURLcode res) {
 
-    if( CURLE_OK != res) {
-        BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from SWIFT : " << container_name + "/" + name;
-        BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
-        return false;
+        long http_code = 0;
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_slist_free_all(list);
+        curl_easy_cleanup(curl);
+
+        std::string id = *etag;
+        delete etag;
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299) {
+            // Le manifeste n'impose pas l'empreinte du segment
+            result->set_value((id == "") ? "null" : id);
+            return;
+        }
+
+        // Nous avons un refus d'accès, cela peut venir d'une authentification expirée
+        if ( CURLE_OK == res && ! reconnection && (http_code == 403 || http_code == 401 || http_code == 400) ) {
+            BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
+            // Nouvelle tentative immédiate, avec un nouveau jeton
+            RetryPolicy::State next = retry;
+            next.delay = 0;
+            submit_part(result, name, number, part, attempt, true, next, token);
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed for the segment " << number << " of " << name ;
+        if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+
+        RetryPolicy::State next = retry;
+        if (res != CURLE_ABORTED_BY_CALLBACK && retry_policy->next_delay(attempt, write_attempts, (CURLE_OK == res) ? http_code : 0, next) >= 0) {
+            submit_part(result, name, number, part, attempt + 1, reconnection, next, "");
+            return;
+        }
+
+        result->set_value("");
+
+    }, (attempt == 1) ? 0 : retry.delay);
+}
+
+void SwiftContext::send_parts(std::string name, MultipartUpload* upload) {
+    while (upload->has_full_part()) {
+        int number;
+        std::shared_ptr<std::vector<char> > part = upload->pop_part(number);
+        std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+        upload->add_result(number, part->size(), result->get_future().share());
+        submit_part(result, name, number, part, 1, false, RetryPolicy::State(), "");
     }
+}
 
-    long http_code = 0;
-    curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code >= 200 && http_code <= 299) {
-        return true;
-    } else {
+bool SwiftContext::complete_multipart(std::string name, MultipartUpload* upload) {
+
+    // Envoi des dernières données puis du premier segment (en-tête et index)
+    int number;
+    std::shared_ptr<std::vector<char> > last = upload->pop_last(number);
+    if (! last->empty()) {
+        std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+        upload->add_result(number, last->size(), result->get_future().share());
+        submit_part(result, name, number, last, 1, false, RetryPolicy::State(), "");
+    }
+
+    std::shared_ptr<std::vector<char> > first = upload->pop_first();
+    std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+    upload->add_result(1, first->size(), result->get_future().share());
+    submit_part(result, name, 1, first, 1, false, RetryPolicy::State(), "");
+
+    std::vector<std::pair<int, std::string> > etags;
+    if (! upload->wait_results(etags)) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to send all segments of the Swift object " << container_name << " / " << name;
         return false;
     }
 
+    // Manifeste (Static Large Object) listant les segments dans l'ordre
+    std::ostringstream body;
+    body << "[";
+    for (int i = 0; i < etags.size(); i++) {
+        std::string etag = etags.at(i).second;
+        if (etag != "null") etag = "\"" + etag + "\"";
+        if (i != 0) body << ",";
+        body << "{\"path\":\"/" << container_name << "/" << get_segment_name(name, etags.at(i).first) << "\",\"etag\":" << etag << ",\"size_bytes\":" << upload->get_part_size(etags.at(i).first) << "}";
+    }
+    body << "]";
+    std::string manifest = body.str();
+
+    int attempt = 1;
+    RetryPolicy::State retry;
+    bool reconnection = false;
+    while (attempt) {
+        CURLcode res;
+        struct curl_slist *list = NULL;
+        std::string token = get_token();
+        CURL* curl = CurlPool::get_curl_env();
+
+        std::string fullUrl = public_url + "/" + container_name + "/" + name + "?multipart-manifest=put";
+
+        list = curl_slist_append(list, token.c_str());
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+        curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+        if(ssl_no_verify){
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        }
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, manifest.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) manifest.size());
+
+        if (timeout) {
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+        }
+
+        res = curl_easy_perform(curl);
+        curl_slist_free_all(list);
+
+        long http_code = 0;
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+        if (CURLE_OK == res && http_code >= 200 && http_code <= 299) {
+            return true;
+        }
+
+        if ( CURLE_OK == res && ! reconnection && (http_code == 403 || http_code == 401) ) {
+            BOOST_LOG_TRIVIAL(debug) << "Authentication may have expired. Reconnecting...";
+            reconnection = true;
+            if (! renew_token(token)) {
+                BOOST_LOG_TRIVIAL(error) << "Reconnection attempt failed.";
+                return false;
+            }
+            BOOST_LOG_TRIVIAL(debug) << "Successfully reconnected.";
+            continue;
+        }
+
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
+        if (CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        }
+        int delay = retry_policy->next_delay(attempt, write_attempts, (CURLE_OK == res) ? http_code : 0, retry);
+        if (delay < 0) break;
+        attempt++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to write the manifest of the Swift object " << container_name << " / " << name << " after " << attempt << " tries" ;
+    return false;
+}
+
+std::string SwiftContext::get_path(std::string racine,int x,int y,int pathDepth){
+    return racine + "_" + std::to_string(x) + "_" + std::to_string(y);
+}
+
+std::string SwiftContext::get_path(std::string name) {  
+    return container_name + "/" + name;
+}
+
+
+bool SwiftContext::exists(std::string name) {
+
+    BOOST_LOG_TRIVIAL(debug) << "Exists (SWIFT) ? " << get_path(name);
+    return (check_existence(name) == 1);
+}
+
+int SwiftContext::check_existence(std::string name) {
+
+    if (! connected) {
+        BOOST_LOG_TRIVIAL(error) << "Try to test object existence using the unconnected swift context " << container_name;
+        return -1;
+    }
+
+    // Disjoncteur ouvert : on n'envoie pas de requête et on ne peut pas conclure
+    if (! retry_policy->is_available(public_url)) {
+        BOOST_LOG_TRIVIAL(error) << "Swift cluster " << public_url << " unavailable (circuit breaker open), unable to test object existence " << container_name << " / " << name;
+        return -1;
+    }
+
+    std::string fullUrl;
+    fullUrl = public_url + "/" + container_name + "/" + name;
+
+    std::string token = get_token();
+    CURL* curl = CurlPool::get_curl_env();
+
+    // Un jeton refusé est renouvelé une fois avant de conclure
+    for (int attempt = 1; attempt <= 2; attempt++) {
+        struct curl_slist *list = NULL;
+        list = curl_slist_append(list, token.c_str());
+
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+        curl_easy_setopt(curl, CURLOPT_URL, fullUrl.c_str());
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        if(ssl_no_verify){
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        }
+
+        if (timeout) {
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+        }
+
+        CURLcode res = curl_easy_perform(curl);
+
+        curl_slist_free_all(list);
+
+        if( CURLE_OK != res) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from SWIFT : " << container_name + "/" + name;
+            BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+            retry_policy->record(public_url, 0, false);
+            return -1;
+        }
+
+        long http_code = 0;
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+        retry_policy->record(public_url, http_code, http_code >= 200 && http_code <= 299);
+        if (http_code >= 200 && http_code <= 299) {
+            return 1;
+        } else if (http_code == 404) {
+            return 0;
+        } else if ((http_code == 401 || http_code == 403) && attempt == 1 && renew_token(token)) {
+            token = get_token();
+            continue;
+        }
+
+        BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from SWIFT : " << container_name + "/" + name << ", response HTTP code : " << http_code;
+        return -1;
+    }
+
+    return -1;
 }
\ No newline at end of file
@@ -50,11 +50,17 @@
 #pragma once
 
 #include <curl/curl.h>
+#include <memory>
 #include <boost/log/trivial.hpp>
 #include "storage/Context.h"
 #include "utils/LibcurlStruct.h"
 #include <fstream>
 #include "utils/CurlPool.h"
+#include "utils/CurlLoop.h"
+#include "utils/LatencyTracker.h"
+#include "storage/MultipartUpload.h"
+#include "storage/SwiftTokenManager.h"
+#include "utils/ByteRangesReceiver.h"
 
 
 #define ROK4_SWIFT_AUTHURL "ROK4_SWIFT_AUTHURL"
@@ -65,6 +71,7 @@
 #define ROK4_SWIFT_PUBLICURL "ROK4_SWIFT_PUBLICURL"
 #define ROK4_SWIFT_ACCOUNT "ROK4_SWIFT_ACCOUNT"
 #define ROK4_SWIFT_TOKEN_FILE "ROK4_SWIFT_TOKEN_FILE"
+#define ROK4_SWIFT_MAX_RANGES "ROK4_SWIFT_MAX_RANGES"
 
 /**
  * \author Institut national de l'information géographique et forestière
@@ -131,10 +138,10 @@ private:
     std::string container_name;
 
     /**
-     * \~french \brief Token à utiliser pour chaque échange avec Swift
-     * \~english \brief Token to use to communicate with Swift
+     * \~french \brief Identifiants d'authentification, clé du jeton partagé dans le SwiftTokenManager
+     * \~english \brief Authentication credentials, shared token key in SwiftTokenManager
      */
-    std::string token;
+    SwiftCredentials credentials;
 
     std::string token_file;
     bool use_token_from_file;
@@ -151,6 +158,156 @@ private:
      */
     int timeout;
 
+    /**
+     * \~french \brief Prépare un objet curl pour la lecture d'une portion d'objet
+     * \details L'URL, les en-têtes (jeton et Range) et la fonction de réception des données sont renseignés
+     * \param[in] curl Objet curl à configurer
+     * \param[in] buffer Buffer de réception des données
+     * \param[in] offset Début de la portion
+     * \param[in] size Taille de la portion
+     * \param[in] name Nom de l'objet
+     * \param[in] token En-tête d'authentification à utiliser
+     * \return Liste des en-têtes, à libérer par l'appelant une fois la requête exécutée
+     * \~english \brief Prepare a curl object to read an object's range
+     * \details URL, headers (token and Range) and data callback are set
+     * \param[in] curl Curl object to configure
+     * \param[in] buffer Buffer to receive the data
+     * \param[in] offset Range start
+     * \param[in] size Range size
+     * \param[in] name Object name
+     * \param[in] token Authentication header to use
+     * \return Headers list, to free by the caller once the request is performed
+     */
+    struct curl_slist* prepare_read(CURL* curl, BufferStruct* buffer, int offset, int size, std::string name, std::string token);
+
+    /**
+     * \~french \brief Retourne le jeton partagé courant, en s'authentifiant si besoin
+     * \~english \brief Get the current shared token, authenticating if needed
+     */
+    std::string get_token();
+
+    /**
+     * \~french \brief Obtient un nouveau jeton après le refus de celui fourni
+     * \details Une seule authentification est faite même si plusieurs requêtes ont été refusées en même temps
+     * \param[in] rejected Jeton refusé
+     * \~english \brief Get a new token after the provided one rejection
+     * \details Only one authentication is done even if several requests have been rejected at the same time
+     * \param[in] rejected Rejected token
+     */
+    bool renew_token(std::string rejected);
+
+    /**
+     * \~french \brief Soumet une tentative de lecture asynchrone à la boucle curl
+     * \details Le jeton est obtenu via SwiftTokenManager::get_token_async : appelée depuis une fonction de fin, aucune authentification n'est faite dans le thread de la boucle
+     * \param[in] result Résultat à renseigner, à la fin de la dernière tentative
+     * \param[in] attempt Numéro de la tentative (à partir de 1)
+     * \param[in] reconnection Une reconnexion a-t-elle déjà été faite pour cette lecture
+     * \param[in] retry État des tentatives, dont le délai avant cette tentative
+     * \param[in] rejected Jeton refusé lors de la tentative précédente, vide si aucun
+     * \~english \brief Submit an asynchronous reading attempt to the curl loop
+     * \details Token is got with SwiftTokenManager::get_token_async : called from a completion function, no authentication is done in the loop's thread
+     * \param[in] result Result to fill, at the end of the last attempt
+     * \param[in] attempt Attempt number (from 1)
+     * \param[in] reconnection Has a reconnection already been done for this reading
+     * \param[in] retry Attempts state, with the delay before this attempt
+     * \param[in] rejected Token rejected by the previous attempt, empty if none
+     */
+    void submit_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int attempt, bool reconnection, RetryPolicy::State retry, std::string rejected);
+
+    /**
+     * \~french \brief Envoie une tentative de lecture asynchrone à la boucle curl, avec le jeton fourni
+     * \~english \brief Send an asynchronous reading attempt to the curl loop, with the provided token
+     */
+    void send_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int attempt, bool reconnection, RetryPolicy::State retry, std::string token);
+
+    /**
+     * \~french \brief Soumet une lecture doublée à la boucle curl
+     * \details Une seconde requête est lancée si la première n'est pas terminée après le délai. La première réponse valide est utilisée et l'autre requête est annulée. Si les deux échouent, les tentatives suivantes sont faites via #submit_read
+     * \param[in] result Résultat à renseigner
+     * \param[in] delay Délai en millisecondes avant le lancement de la seconde requête
+     * \~english \brief Submit a hedged reading to the curl loop
+     * \details A second request is performed if the first one is not done after the delay. The first valid response is used and the other request is cancelled. If both fail, next attempts are made with #submit_read
+     * \param[in] result Result to fill
+     * \param[in] delay Delay in milliseconds before the second request is performed
+     */
+    void submit_hedged_read(std::shared_ptr<std::promise<int> > result, uint8_t* data, int offset, int size, std::string name, int delay);
+
+    /**
+     * \~french \brief Nombre maximal de portions demandées dans une même requête
+     * \details Récupéré via la variable d'environnement ROK4_SWIFT_MAX_RANGES (50 par défaut, comme la limite de Swift). Une valeur de 1 désactive les requêtes multi-portions.
+     * \~english \brief Maximal ranges count asked in one request
+     * \details Read with environment variable ROK4_SWIFT_MAX_RANGES (50 by default, like the Swift limit). A value of 1 disables multi-range requests.
+     */
+    int max_ranges;
+
+    /**
+     * \~french \brief Soumet la lecture de plusieurs portions d'un objet en une requête à la boucle curl
+     * \details Les données sont reçues directement dans les buffers des portions via ByteRangesReceiver. Aucune nouvelle tentative n'est faite : en cas d'échec, les portions non lues sont relues une à une par #read_ranges.
+     * \param[in] ranges Portions d'un même objet
+     * \return Vrai si toutes les portions ont été lues
+     * \~english \brief Submit several ranges reading from one object with one request to the curl loop
+     * \details Data are directly received into ranges' buffers with ByteRangesReceiver. No new attempt is made : if failure, unread ranges are read again one by one by #read_ranges.
+     * \param[in] ranges Ranges from the same object
+     * \return True if all ranges have been read
+     */
+    std::future<bool> submit_ranges(std::vector<ReadRange*> ranges);
+
+    /**
+     * \~french \brief Durées des dernières lectures réussies, pour le calcul du délai de doublement
+     * \~english \brief Last successful readings durations, to compute hedging delay
+     */
+    LatencyTracker latencies;
+
+    /**
+     * \~french \brief Envois par segments en cours, par nom d'objet
+     * \details Utilisés à la place de #write_buffers quand la taille des parties (#part_size) est définie
+     * \~english \brief Running segmented uploads, by object name
+     * \details Used instead of #write_buffers when parts size (#part_size) is defined
+     */
+    std::map<std::string, MultipartUpload*> uploads;
+
+    /**
+     * \~french \brief Nom de l'objet stockant un segment
+     * \~english \brief Name of the object storing a segment
+     */
+    std::string get_segment_name(std::string name, int number);
+
+    /**
+     * \~french \brief Soumet l'envoi d'un segment à la boucle curl
+     * \details Comme pour #submit_read, le jeton est obtenu sans authentification dans le thread de la boucle
+     * \param[in] result Empreinte (Etag) du segment à renseigner, vide en cas d'échec
+     * \param[in] attempt Numéro de la tentative (à partir de 1)
+     * \param[in] reconnection Une reconnexion a-t-elle déjà été faite pour cet envoi
+     * \param[in] retry État des tentatives, dont le délai avant cette tentative
+     * \param[in] rejected Jeton refusé lors de la tentative précédente, vide si aucun
+     * \~english \brief Submit a segment sending to the curl loop
+     * \details As for #submit_read, token is got without authentication in the loop's thread
+     * \param[in] result Segment hash (Etag) to fill, empty if failure
+     * \param[in] attempt Attempt number (from 1)
+     * \param[in] reconnection Has a reconnection already been done for this sending
+     * \param[in] retry Attempts state, with the delay before this attempt
+     * \param[in] rejected Token rejected by the previous attempt, empty if none
+     */
+    void submit_part(std::shared_ptr<std::promise<std::string> > result, std::string name, int number, std::shared_ptr<std::vector<char> > part, int attempt, bool reconnection, RetryPolicy::State retry, std::string rejected);
+
+    /**
+     * \~french \brief Envoie un segment via la boucle curl, avec le jeton fourni
+     * \~english \brief Send a segment with the curl loop, with the provided token
+     */
+    void send_part(std::shared_ptr<std::promise<std::string> > result, std::string name, int number, std::shared_ptr<std::vector<char> > part, int attempt, bool reconnection, RetryPolicy::State retry, std::string token);
+
+    /**
+     * \~french \brief Envoie les segments complets du tampon
+     * \~english \brief Send buffer's complete segments
+     */
+    void send_parts(std::string name, MultipartUpload* upload);
+
+    /**
+     * \~french \brief Envoie les derniers segments, attend la fin de tous les envois et écrit le manifeste (Static Large Object)
+     * \~english \brief Send last segments, wait for all sendings and write the manifest (Static Large Object)
+     */
+    bool complete_multipart(std::string name, MultipartUpload* upload);
+
 
 public:
 
@@ -187,6 +344,23 @@ public:
     std::string get_tray();
           
     int read(uint8_t* data, int offset, int size, std::string name);
+
+
+    /**
+     * \~french \brief Lance la lecture d'une portion d'objet dans la boucle curl partagée (CurlLoop)
+     * \details Les tentatives suivantes sont soumises à la boucle avec un délai, sans bloquer de thread. Une reconnexion est faite si l'authentification semble expirée.
+     * \~english \brief Start to read an object's range in the shared curl loop (CurlLoop)
+     * \details Next attempts are submitted to the loop with a delay, without blocking a thread. A reconnection is done if authentication seems to be expired.
+     */
+    std::future<int> read_async(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Récupère plusieurs portions de données
+     * \details Les portions d'un même objet sont demandées en une seule requête (Range: bytes=a-b,c-d,...), par lots de #max_ranges, la réponse multipart/byteranges étant lue directement dans les buffers des portions. Les objets avec une seule portion, et les portions d'une requête multiple en échec, sont lus via #read_async.
+     * \~english \brief Get several data ranges
+     * \details Ranges from the same object are asked with only one request (Range: bytes=a-b,c-d,...), by batches of #max_ranges, the multipart/byteranges response being directly read into ranges' buffers. Objects with only one range, and ranges of a failed multiple request, are read with #read_async.
+     */
+    bool read_ranges(std::vector<ReadRange>& ranges);
     uint8_t* read_full(int& size, std::string name);
     bool write(uint8_t* data, int offset, int size, std::string name);
     bool write_full(uint8_t* data, int size, std::string name);
@@ -200,7 +374,7 @@ public:
     void print() {
         BOOST_LOG_TRIVIAL(info) <<  "------ Swift Context -------" ;
         BOOST_LOG_TRIVIAL(info) <<  "\t- container name = " << container_name ;
-        BOOST_LOG_TRIVIAL(info) <<  "\t- token = " << token ;
+        BOOST_LOG_TRIVIAL(info) <<  "\t- token = " << (connected ? get_token() : "") ;
     }
 
     std::string to_string() {
@@ -218,8 +392,8 @@ public:
     }
     
     /**
-     * \~french \brief Récupère le token #token
-     * \details 
+     * \~french \brief Récupère le jeton partagé par le SwiftTokenManager
+     * \details Une authentification n'est faite que si aucun contexte utilisant les mêmes identifiants n'a déjà de jeton valide
      * \li Pour une authentification keystone
      * <TABLE>
      * <TR><TH>Attribut</TH><TH>Variables d'environnement</TH>
@@ -231,22 +405,26 @@ public:
      * <TR><TH>Attribut</TH><TH>Variables d'environnement</TH>
      * <TR><TD>user_account</TD><TD>ROK4_SWIFT_ACCOUNT</TD>
      * </TABLE>
-     * \~english \brief Get token #token
+     * \~english \brief Get token shared by SwiftTokenManager
+     * \details Authentication is done only if no context using the same credentials already has a valid token
      */
     bool connection();
 
     bool exists(std::string name);
+    int check_existence(std::string name);
 
     /**
-     * \~french \brief Returne le jeton d'authentification #token
-     * \~english \brief Returns authentification token #token
+     * \~french \brief Returne le jeton d'authentification partagé courant
+     * \~english \brief Returns current shared authentification token
      */
     std::string getAuthToken();
 
     void close_connection() {
-        connected = false;        
+        if (! connected) return;
+        connected = false;
         // On met à jour le fichier de jeton d'authentification Swift s'il a été fourni et que le token utilisé n'est pas celui dedans
-        if(token_file != "" && ! use_token_from_file) {
+        std::string token = (token_file != "") ? SwiftTokenManager::get_token(credentials) : "";
+        if(token_file != "" && ! use_token_from_file && token != "") {
             std::fstream token_stream;
             token_stream.open(token_file, std::ios::out);
             if ( token_stream.is_open() ) {
@@ -264,6 +442,10 @@ public:
     
     ~SwiftContext() {
         close_connection();
+        std::map<std::string, MultipartUpload*>::iterator it;
+        for (it = uploads.begin(); it != uploads.end(); ++it) {
+            delete it->second;
+        }
     }
 };
 
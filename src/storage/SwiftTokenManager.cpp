@@ -0,0 +1,379 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file SwiftTokenManager.cpp
+ ** \~french
+ * \brief Implémentation de la classe SwiftTokenManager
+ ** \~english
+ * \brief Implements classe SwiftTokenManager
+ */
+
+#include "storage/SwiftTokenManager.h"
+#include "utils/CurlPool.h"
+#include "utils/LibcurlStruct.h"
+#include "utils/Utils.h"
+#include "rok4/thirdparty/json11.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+/**
+ * \~french \brief Convertit une date ISO 8601 UTC (2026-10-17T12:00:00.000000Z) en date système
+ * \~english \brief Convert an UTC ISO 8601 date (2026-10-17T12:00:00.000000Z) to system date
+ */
+static bool parse_iso_date(std::string date, std::chrono::system_clock::time_point& result) {
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    if (sscanf(date.c_str(), "%d-%d-%dT%d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6) {
+        return false;
+    }
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    result = std::chrono::system_clock::from_time_t(timegm(&t));
+    return true;
+}
+
+bool SwiftTokenManager::authenticate(CURL* curl, const SwiftCredentials& credentials, std::string& token, std::chrono::system_clock::time_point& expiry) {
+
+    expiry = std::chrono::system_clock::time_point();
+
+    CURLcode res;
+    struct curl_slist *list = NULL;
+    if (curl == NULL) {
+        curl = CurlPool::get_curl_env();
+    } else {
+        curl_easy_reset(curl);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, credentials.auth_url.c_str());
+    if(credentials.ssl_no_verify){
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+
+    HeaderStruct authHdr;
+    DataStruct chunk;
+    chunk.nbPassage = 0;
+    chunk.data = (char*) malloc(1);
+    chunk.size = 0;
+
+    std::string body;
+
+    if (credentials.keystone_auth) {
+        BOOST_LOG_TRIVIAL(debug) << "Keystone authentication";
+
+        // On constitue le header
+
+        const char* ct = "Content-Type: application/json";
+        list = curl_slist_append(list, ct);
+
+        // On constitue le body
+
+        body = "{ \"auth\": {\"scope\": { \"project\": {\"id\": \""+credentials.project_id+"\"}}, ";
+        body += " \"identity\": { \"methods\": [\"password\"], \"password\": { \"user\": { \"domain\": { \"id\": \""+credentials.domain_id+"\"},";
+        body += "\"name\": \""+credentials.user_name+"\", \"password\": \""+credentials.user_passwd+"\" } } } } }";
+
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+    } else {
+        BOOST_LOG_TRIVIAL(debug) << "Swift authentication";
+
+        // On constitue le header et le moyen de récupération des informations (avec les structures de LibcurlStruct)
+
+        std::string user = credentials.user_account + ":" + credentials.user_name;
+        list = curl_slist_append(list, ("X-Storage-User: " + user).c_str());
+        list = curl_slist_append(list, ("X-Storage-Pass: " + credentials.user_passwd).c_str());
+        list = curl_slist_append(list, ("X-Auth-User: " + user).c_str());
+        list = curl_slist_append(list, ("X-Auth-Key: " + credentials.user_passwd).c_str());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, data_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) &chunk);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void*) &authHdr);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+
+    if (credentials.timeout) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, credentials.timeout);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, credentials.timeout);
+    }
+
+    res = curl_easy_perform(curl);
+    curl_slist_free_all(list);
+
+    std::string service = credentials.keystone_auth ? "Keystone" : "Swift";
+
+    if( CURLE_OK != res) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to " << service;
+        BOOST_LOG_TRIVIAL(error) << curl_easy_strerror(res);
+        return false;
+    }
+
+    long http_code = 0;
+    curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code < 200 || http_code > 299) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to " << service;
+        BOOST_LOG_TRIVIAL(error) << "Response HTTP code : " << http_code;
+        return false;
+    }
+
+    if (authHdr.token == NULL) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot authenticate to " << service;
+        BOOST_LOG_TRIVIAL(error) << "No token in the response";
+        return false;
+    }
+
+    // On récupère le token dans le header de la réponse
+    token = std::string(authHdr.token);
+
+    // Ainsi que sa date d'expiration, si fournie
+    if (credentials.keystone_auth) {
+        std::string err;
+        json11::Json doc = json11::Json::parse ( std::string(chunk.data, chunk.size), err );
+        if (doc["token"]["expires_at"].is_string() && parse_iso_date(doc["token"]["expires_at"].string_value(), expiry)) {
+            BOOST_LOG_TRIVIAL(debug) << "Keystone token expires at " << doc["token"]["expires_at"].string_value();
+        }
+    } else if (authHdr.expires >= 0) {
+        expiry = std::chrono::system_clock::now() + std::chrono::seconds(authHdr.expires);
+        BOOST_LOG_TRIVIAL(debug) << "Swift token expires in " << authHdr.expires << " seconds";
+    }
+
+    return true;
+}
+
+bool SwiftTokenManager::update(std::unique_lock<std::mutex>& lock, Token& token, CURL* curl) {
+
+    SwiftCredentials credentials = token.credentials;
+    std::string value;
+    std::chrono::system_clock::time_point expiry;
+
+    // Pas de verrou pendant la requête d'authentification
+    lock.unlock();
+    bool ok = authenticate(curl, credentials, value, expiry);
+    lock.lock();
+
+    token.authenticating = false;
+    token.generation++;
+
+    if (ok) {
+        token.value = value;
+        token.expiry = expiry;
+        token.refresh = std::chrono::system_clock::time_point();
+
+        if (expiry != std::chrono::system_clock::time_point() && refresh_margin > 0) {
+            token.refresh = expiry - std::chrono::seconds(refresh_margin);
+            // Jeton de durée de vie plus courte que la marge : renouvellement à mi-vie, pas en continu
+            std::chrono::system_clock::time_point half = std::chrono::system_clock::now() + (expiry - std::chrono::system_clock::now()) / 2;
+            if (token.refresh < half) token.refresh = half;
+            if (! refresher.joinable() && ! stopping) {
+                refresher = std::thread(SwiftTokenManager::run);
+            }
+        }
+    }
+
+    changed.notify_all();
+    return ok;
+}
+
+bool SwiftTokenManager::is_usable(const Token& token, std::string rejected) {
+    // Pendant un renouvellement (anticipé ou demandé par un autre), le jeton courant reste utilisable jusqu'à son expiration
+    bool expired = (token.expiry != std::chrono::system_clock::time_point() && std::chrono::system_clock::now() >= token.expiry);
+    return (token.value != "" && token.value != rejected && ! expired);
+}
+
+std::string SwiftTokenManager::acquire(std::unique_lock<std::mutex>& lock, const SwiftCredentials& credentials, std::string rejected, CURL* curl) {
+
+    std::map<std::string, Token>::iterator it = tokens.find(credentials.get_key());
+    if (it == tokens.end()) {
+        it = tokens.insert(std::make_pair(credentials.get_key(), Token())).first;
+        it->second.credentials = credentials;
+    }
+    Token& token = it->second;
+
+    if (is_usable(token, rejected)) {
+        return token.value;
+    }
+
+    // Jeton inutilisable et authentification déjà en cours : on attend et utilise son résultat
+    if (token.authenticating) {
+        int generation = token.generation;
+        changed.wait(lock, [&token, generation]() { return token.generation != generation; });
+        if (token.value == rejected) return "";
+        return token.value;
+    }
+
+    token.authenticating = true;
+    if (update(lock, token, curl)) {
+        return token.value;
+    }
+
+    // Le jeton refusé ou expiré n'est plus proposé
+    token.value = "";
+    return "";
+}
+
+std::string SwiftTokenManager::get_token(const SwiftCredentials& credentials) {
+    std::unique_lock<std::mutex> lock(mtx);
+    return acquire(lock, credentials, "", NULL);
+}
+
+std::string SwiftTokenManager::renew_token(const SwiftCredentials& credentials, std::string rejected) {
+    std::unique_lock<std::mutex> lock(mtx);
+    return acquire(lock, credentials, rejected, NULL);
+}
+
+void SwiftTokenManager::set_token(const SwiftCredentials& credentials, std::string token) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    Token& t = tokens[credentials.get_key()];
+    if (t.value == "" && ! t.authenticating) {
+        t.credentials = credentials;
+        t.value = token;
+    }
+}
+
+void SwiftTokenManager::get_token_async(const SwiftCredentials& credentials, std::string rejected, Callback callback) {
+    std::string value;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        std::map<std::string, Token>::iterator it = tokens.find(credentials.get_key());
+        if (it != tokens.end() && is_usable(it->second, rejected)) {
+            value = it->second.value;
+        } else if (! stopping) {
+            // L'authentification est confiée au thread de renouvellement
+            Request request = { credentials, rejected, callback };
+            requests.push_back(request);
+            if (! refresher.joinable()) {
+                refresher = std::thread(SwiftTokenManager::run);
+            }
+            changed.notify_all();
+            return;
+        }
+    }
+
+    callback(value);
+}
+
+void SwiftTokenManager::run() {
+
+    // Objet curl propre au thread, qui peut se terminer après la destruction du CurlPool en fin de programme
+    CURL* curl = curl_easy_init();
+
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (! stopping) {
+
+        // Demandes asynchrones : la fonction est appelée sans le verrou
+        if (! requests.empty()) {
+            Request request = requests.front();
+            requests.pop_front();
+            std::string value = acquire(lock, request.credentials, request.rejected, curl);
+            lock.unlock();
+            request.callback(value);
+            lock.lock();
+            continue;
+        }
+
+        // Recherche du prochain jeton à renouveler
+        std::map<std::string, Token>::iterator next = tokens.end();
+        std::map<std::string, Token>::iterator it;
+        for (it = tokens.begin(); it != tokens.end(); ++it) {
+            if (it->second.authenticating || it->second.refresh == std::chrono::system_clock::time_point()) continue;
+            if (next == tokens.end() || it->second.refresh < next->second.refresh) {
+                next = it;
+            }
+        }
+
+        if (next == tokens.end()) {
+            changed.wait(lock);
+            continue;
+        }
+
+        if (std::chrono::system_clock::now() < next->second.refresh) {
+            changed.wait_until(lock, next->second.refresh);
+            continue;
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "Renew Swift token before its expiry (" << next->second.credentials.auth_url << ")";
+        Token& token = next->second;
+        token.authenticating = true;
+        if (! update(lock, token, curl)) {
+            // Le jeton actuel reste utilisé jusqu'à son expiration, nouvel essai un peu plus tard
+            std::chrono::system_clock::time_point retry = std::chrono::system_clock::now() + std::chrono::seconds(std::max(1, refresh_margin / 10));
+            token.refresh = (retry < token.expiry) ? retry : std::chrono::system_clock::time_point();
+        }
+    }
+
+    lock.unlock();
+    curl_easy_cleanup(curl);
+}
+
+void SwiftTokenManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+        changed.notify_all();
+    }
+
+    if (refresher.joinable()) {
+        refresher.join();
+    }
+
+    std::deque<Request> aborted;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        aborted.swap(requests);
+    }
+    for (int i = 0; i < aborted.size(); i++) {
+        aborted.at(i).callback("");
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    tokens.clear();
+    stopping = false;
+}
+
+std::map<std::string, SwiftTokenManager::Token> SwiftTokenManager::tokens;
+std::mutex SwiftTokenManager::mtx;
+std::condition_variable SwiftTokenManager::changed;
+std::thread SwiftTokenManager::refresher;
+std::deque<SwiftTokenManager::Request> SwiftTokenManager::requests;
+bool SwiftTokenManager::stopping = false;
+int SwiftTokenManager::refresh_margin = env_or_default(ROK4_SWIFT_TOKEN_REFRESH, 60);
+SwiftTokenManager::Stopper SwiftTokenManager::stopper;
@@ -0,0 +1,327 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file SwiftTokenManager.h
+ ** \~french
+ * \brief Définition de la classe SwiftTokenManager
+ * \details
+ * \li SwiftCredentials : identifiants d'authentification Swift ou Keystone
+ * \li SwiftTokenManager : jetons d'authentification partagés par tous les contextes Swift
+ ** \~english
+ * \brief Define classe SwiftTokenManager
+ * \details
+ * \li SwiftCredentials : Swift or Keystone authentication credentials
+ * \li SwiftTokenManager : authentication tokens shared by all Swift contexts
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <curl/curl.h>
+#include <boost/log/trivial.hpp>
+
+#define ROK4_SWIFT_TOKEN_REFRESH "ROK4_SWIFT_TOKEN_REFRESH"
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french \brief Identifiants d'authentification Swift ou Keystone
+ * \~english \brief Swift or Keystone authentication credentials
+ */
+struct SwiftCredentials {
+    std::string auth_url;
+    std::string user_name;
+    std::string user_passwd;
+    std::string user_account;
+    bool keystone_auth;
+    std::string domain_id;
+    std::string project_id;
+    bool ssl_no_verify;
+    int timeout;
+
+    SwiftCredentials() : keystone_auth(false), ssl_no_verify(false), timeout(0) {}
+
+    /**
+     * \~french \brief Clé identifiant le jeton : URL d'authentification et identifiants
+     * \~english \brief Key identifying the token : authentication URL and credentials
+     */
+    std::string get_key() const {
+        return auth_url + "|" + user_account + ":" + user_name + "|" + user_passwd + "|" + domain_id + "/" + project_id;
+    }
+};
+
+/**
+ * \author Institut national de l'information géographique et forestière
+ * \~french
+ * \brief Jetons d'authentification Swift partagés par tous les contextes et threads
+ * \details Un jeton est conservé par URL d'authentification et identifiants. Quand plusieurs demandeurs ont besoin d'une authentification en même temps (premier jeton, jeton refusé ou expiré), une seule requête est faite et les autres attendent son résultat.
+ *
+ * Si la date d'expiration du jeton est connue (en-tête X-Auth-Token-Expires pour Swift, champ expires_at pour Keystone), un thread le renouvelle ROK4_SWIFT_TOKEN_REFRESH secondes (60 par défaut, 0 pour désactiver) avant son expiration : les requêtes n'attendent alors plus d'authentification.
+ *
+ * Ce même thread traite les demandes asynchrones (#get_token_async), faites depuis les fonctions de fin de la boucle curl (CurlLoop) qui ne doivent pas attendre une authentification.
+ *
+ * Cette classe est prévue pour être utilisée sans instance
+ * \~english
+ * \brief Swift authentication tokens shared by all contexts and threads
+ * \details One token is kept per authentication URL and credentials. When several requesters need an authentication at the same time (first token, rejected or expired token), only one request is made and others wait for its result.
+ *
+ * If token expiry is known (X-Auth-Token-Expires header for Swift, expires_at field for Keystone), a thread renews it ROK4_SWIFT_TOKEN_REFRESH seconds (60 by default, 0 to disable) before its expiry : requests then no longer wait for authentication.
+ *
+ * This thread also processes asynchronous requests (#get_token_async), made from curl loop (CurlLoop) completion functions which must not wait for an authentication.
+ *
+ * This class is supposed to be used without instance
+ */
+class SwiftTokenManager {
+
+public:
+
+    /**
+     * \~french \brief Fonction recevant le jeton demandé de manière asynchrone, vide en cas d'échec
+     * \~english \brief Function receiving the asynchronously asked token, empty if failure
+     */
+    typedef std::function<void(std::string)> Callback;
+
+private:
+
+    /**
+     * \~french \brief Jeton d'un ensemble d'identifiants
+     * \~english \brief Token of a credentials set
+     */
+    struct Token {
+        SwiftCredentials credentials;
+        /**
+         * \~french \brief En-tête d'authentification ("X-Auth-Token: ..."), vide si aucun jeton valide
+         * \~english \brief Authentication header ("X-Auth-Token: ..."), empty if no valid token
+         */
+        std::string value;
+        /**
+         * \~french \brief Date d'expiration, l'origine des temps si inconnue
+         * \~english \brief Expiry date, epoch if unknown
+         */
+        std::chrono::system_clock::time_point expiry;
+        /**
+         * \~french \brief Authentification en cours
+         * \~english \brief Authentication in progress
+         */
+        bool authenticating;
+        /**
+         * \~french \brief Nombre d'authentifications terminées, pour que les demandeurs en attente récupèrent le résultat sans en relancer une
+         * \~english \brief Finished authentications count, so that waiting requesters get the result without starting a new one
+         */
+        int generation;
+        /**
+         * \~french \brief Date du renouvellement anticipé par le thread de renouvellement, l'origine des temps si aucun
+         * \~english \brief Anticipated renewal date by renewing thread, epoch if none
+         */
+        std::chrono::system_clock::time_point refresh;
+
+        Token() : authenticating(false), generation(0) {}
+    };
+
+    /**
+     * \~french \brief Demande asynchrone de jeton
+     * \~english \brief Asynchronous token request
+     */
+    struct Request {
+        SwiftCredentials credentials;
+        std::string rejected;
+        Callback callback;
+    };
+
+    /**
+     * \~french \brief Jetons, par clé d'identifiants
+     * \~english \brief Tokens, by credentials key
+     */
+    static std::map<std::string, Token> tokens;
+
+    /**
+     * \~french \brief Exclusion mutuelle pour les jetons
+     * \~english \brief Mutual exclusion for tokens
+     */
+    static std::mutex mtx;
+
+    /**
+     * \~french \brief Signale la fin d'une authentification, ou l'arrêt, aux threads en attente
+     * \~english \brief Notify waiting threads of an authentication end, or of stopping
+     */
+    static std::condition_variable changed;
+
+    /**
+     * \~french \brief Thread de renouvellement des jetons avant expiration, et de traitement des demandes asynchrones
+     * \~english \brief Thread renewing tokens before expiry, and processing asynchronous requests
+     */
+    static std::thread refresher;
+
+    /**
+     * \~french \brief Demandes asynchrones en attente, traitées par le thread de renouvellement
+     * \~english \brief Waiting asynchronous requests, processed by the renewing thread
+     */
+    static std::deque<Request> requests;
+
+    /**
+     * \~french \brief Arrêt du thread de renouvellement demandé
+     * \~english \brief Renewing thread stop asked
+     */
+    static bool stopping;
+
+    /**
+     * \~french \brief Délai en secondes avant expiration auquel un jeton est renouvelé, 0 pour désactiver
+     * \~english \brief Delay in seconds before expiry when a token is renewed, 0 to disable
+     */
+    static int refresh_margin;
+
+    /**
+     * \~french \brief Arrête le thread de renouvellement à la fin du programme
+     * \~english \brief Stop renewing thread at program end
+     */
+    static struct Stopper {
+        ~Stopper() { SwiftTokenManager::stop(); }
+    } stopper;
+
+    /**
+     * \~french \brief Demande un nouveau jeton au service d'authentification
+     * \param[in] curl Objet curl à utiliser, NULL pour celui du thread dans le CurlPool
+     * \param[in] credentials Identifiants
+     * \param[out] token En-tête d'authentification obtenu
+     * \param[out] expiry Date d'expiration, l'origine des temps si inconnue
+     * \~english \brief Ask a new token to the authentication service
+     * \param[in] curl Curl object to use, NULL for the thread's one in CurlPool
+     * \param[in] credentials Credentials
+     * \param[out] token Got authentication header
+     * \param[out] expiry Expiry date, epoch if unknown
+     */
+    static bool authenticate(CURL* curl, const SwiftCredentials& credentials, std::string& token, std::chrono::system_clock::time_point& expiry);
+
+    /**
+     * \~french \brief Retourne un jeton valide, différent de celui refusé, en s'authentifiant si besoin
+     * \details Appelé avec le verrou #mtx, relâché pendant l'authentification. L'objet curl est celui du thread dans le CurlPool si NULL
+     * \~english \brief Get a valid token, different from the rejected one, authenticating if needed
+     * \details Called with #mtx lock, released during authentication. Curl object is the thread's one in CurlPool if NULL
+     */
+    static std::string acquire(std::unique_lock<std::mutex>& lock, const SwiftCredentials& credentials, std::string rejected, CURL* curl);
+
+    /**
+     * \~french \brief Le jeton peut-il être utilisé sans authentification ni attente
+     * \details Un jeton ni expiré ni refusé reste utilisable pendant son renouvellement
+     * \~english \brief Can token be used without authentication nor waiting
+     * \details A token neither expired nor rejected is still usable during its renewal
+     */
+    static bool is_usable(const Token& token, std::string rejected);
+
+    /**
+     * \~french \brief Authentifie et met à jour un jeton marqué en cours d'authentification
+     * \details Appelé avec le verrou #mtx, relâché pendant l'authentification. En cas d'échec, le jeton n'est pas modifié
+     * \~english \brief Authenticate and update a token marked as authenticating
+     * \details Called with #mtx lock, released during authentication. If failure, token is not modified
+     */
+    static bool update(std::unique_lock<std::mutex>& lock, Token& token, CURL* curl);
+
+    /**
+     * \~french \brief Boucle du thread de renouvellement
+     * \~english \brief Renewing thread loop
+     */
+    static void run();
+
+    /**
+     * \~french \brief Constructeur
+     * \~english \brief Constructor
+     */
+    SwiftTokenManager() {};
+
+public:
+
+    /**
+     * \~french \brief Retourne un jeton valide pour ces identifiants
+     * \details Le jeton partagé est retourné s'il existe et n'a pas expiré, sinon une authentification est faite
+     * \return En-tête d'authentification ("X-Auth-Token: ..."), vide en cas d'échec
+     * \~english \brief Get a valid token for these credentials
+     * \details Shared token is returned if it exists and has not expired, otherwise authentication is done
+     * \return Authentication header ("X-Auth-Token: ..."), empty if failure
+     */
+    static std::string get_token(const SwiftCredentials& credentials);
+
+    /**
+     * \~french \brief Retourne un nouveau jeton après le refus de celui fourni
+     * \details Si un autre demandeur a déjà renouvelé le jeton refusé, le nouveau est retourné sans nouvelle authentification
+     * \param[in] credentials Identifiants
+     * \param[in] rejected Jeton refusé par le service
+     * \return En-tête d'authentification ("X-Auth-Token: ..."), vide en cas d'échec
+     * \~english \brief Get a new token after the provided one rejection
+     * \details If another requester already renewed the rejected token, the new one is returned without authentication
+     * \param[in] credentials Credentials
+     * \param[in] rejected Token rejected by the service
+     * \return Authentication header ("X-Auth-Token: ..."), empty if failure
+     */
+    static std::string renew_token(const SwiftCredentials& credentials, std::string rejected);
+
+    /**
+     * \~french \brief Fournit un jeton obtenu par ailleurs (fichier de jeton), d'expiration inconnue
+     * \details Sans effet si un jeton est déjà connu pour ces identifiants
+     * \~english \brief Provide a token got elsewhere (token file), with unknown expiry
+     * \details No effect if a token is already known for these credentials
+     */
+    static void set_token(const SwiftCredentials& credentials, std::string token);
+
+    /**
+     * \~french \brief Fournit un jeton valide, différent de celui refusé, sans jamais bloquer l'appelant
+     * \details Si le jeton partagé est utilisable, la fonction est appelée immédiatement. Sinon, l'authentification (ou l'attente de celle en cours) est faite par le thread de renouvellement, qui appelle ensuite la fonction. Utilisable depuis une fonction de fin de la boucle curl.
+     * \param[in] credentials Identifiants
+     * \param[in] rejected Jeton refusé par le service, vide si aucun
+     * \param[in] callback Fonction recevant l'en-tête d'authentification, vide en cas d'échec
+     * \~english \brief Provide a valid token, different from the rejected one, never blocking the caller
+     * \details If the shared token is usable, function is immediately called. Otherwise, authentication (or waiting for the running one) is done by the renewing thread, which then calls the function. Usable from a curl loop completion function.
+     * \param[in] credentials Credentials
+     * \param[in] rejected Token rejected by the service, empty if none
+     * \param[in] callback Function receiving the authentication header, empty if failure
+     */
+    static void get_token_async(const SwiftCredentials& credentials, std::string rejected, Callback callback);
+
+    /**
+     * \~french \brief Arrête le thread de renouvellement et oublie tous les jetons
+     * \details Les demandes asynchrones en attente reçoivent un jeton vide
+     * \~english \brief Stop renewing thread and forget all tokens
+     * \details Waiting asynchronous requests receive an empty token
+     */
+    static void stop();
+};
@@ -49,9 +49,12 @@
 
 #include "storage/ceph/CephPoolContext.h"
 #include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
 
 
-CephPoolContext::CephPoolContext (std::string pool) : Context(), pool_name(pool) {
+CephPoolContext::CephPoolContext (std::string pool) : Context(), pool_name(pool), closing(false), submitting(0) {
 
     char* cluster = getenv (ROK4_CEPH_CLUSTERNAME);
     if (cluster == NULL) {
@@ -116,6 +119,10 @@ bool CephPoolContext::connection() {
             return false;
         }
 
+        {
+            std::lock_guard<std::mutex> lock(retries_mtx);
+            closing = false;
+        }
         connected = true;
     }
 
@@ -131,8 +138,15 @@ int CephPoolContext::read(uint8_t* data, int offset, int size, std::string name)
         return -1;
     }
 
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(cluster_name)) {
+        BOOST_LOG_TRIVIAL(error) << "Ceph cluster " << cluster_name << " unavailable (circuit breaker open), unable to read the object " << pool_name << " / " << name;
+        return -1;
+    }
+
     int readSize;
     int attempt = 1;
+    RetryPolicy::State retry;
     bool error = false;
     while(attempt) {
         readSize = rados_read(io_ctx, name.c_str(), (char*) data, size, offset);
@@ -142,6 +156,7 @@ int CephPoolContext::read(uint8_t* data, int offset, int size, std::string name)
             // Seul le timeout donne lieu à une nouvelle tentative
             if (readSize == -ETIMEDOUT) {
                 BOOST_LOG_TRIVIAL(warning) <<  "Try " << attempt << " timed out" ;
+                retry_policy->record(cluster_name, 0, false);
             } else {
                 BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
                 BOOST_LOG_TRIVIAL(error) << "Error code: " << readSize ;
@@ -150,25 +165,209 @@ int CephPoolContext::read(uint8_t* data, int offset, int size, std::string name)
             }
         } else {
             error = false;
+            retry_policy->record(cluster_name, 0, true);
             break;
         }
 
+        int delay = retry_policy->next_delay(attempt, read_attempts, 0, retry);
+        if (delay < 0) break;
         attempt++;
-
-        if (attempt > read_attempts) {
-            break;
-        } else {
-            sleep(waiting_time);
-        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
     }
 
     if (error) {
-        BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) in the Ceph object " << pool_name << " / " << name  << " after " << read_attempts << " tries" ;
+        BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << size << " bytes (from the " << offset << " one) in the Ceph object " << pool_name << " / " << name  << " after " << attempt << " tries" ;
     }
 
     return readSize;
 }
 
+std::future<int> CephPoolContext::read_async(uint8_t* data, int offset, int size, std::string name) {
+
+    BOOST_LOG_TRIVIAL(debug) << "Ceph asynchronous read : " << size << " bytes (from the " << offset << " one) in the object " << pool_name << " / " << name;
+
+    std::shared_ptr<std::promise<int> > result = std::make_shared<std::promise<int> >();
+    std::future<int> future = result->get_future();
+
+    if (! connected) {
+        BOOST_LOG_TRIVIAL(error) << "Try to read using the unconnected ceph pool context " << pool_name;
+        result->set_value(-1);
+        return future;
+    }
+
+    // Disjoncteur ouvert : le cluster ne répond plus, on échoue immédiatement
+    if (! retry_policy->is_available(cluster_name)) {
+        BOOST_LOG_TRIVIAL(error) << "Ceph cluster " << cluster_name << " unavailable (circuit breaker open), unable to read the object " << pool_name << " / " << name;
+        result->set_value(-1);
+        return future;
+    }
+
+    AioRead* request = new AioRead();
+    request->context = this;
+    request->result = result;
+    request->data = data;
+    request->offset = offset;
+    request->size = size;
+    request->name = name;
+    request->attempt = 1;
+
+    submit_read(request);
+    return future;
+}
+
+void CephPoolContext::submit_read(AioRead* request) {
+
+    rados_completion_t completion;
+    int ret = rados_aio_create_completion(request, CephPoolContext::read_complete, NULL, &completion);
+    if (ret >= 0) {
+        ret = rados_aio_read(io_ctx, request->name.c_str(), completion, (char*) request->data, request->size, request->offset);
+        if (ret >= 0) return;
+        rados_aio_release(completion);
+    }
+
+    BOOST_LOG_TRIVIAL(error) << "Cannot submit asynchronous read of the Ceph object " << pool_name << " / " << request->name;
+    BOOST_LOG_TRIVIAL(error) << strerror(-ret);
+    request->result->set_value(-1);
+    delete request;
+}
+
+void CephPoolContext::read_complete(rados_completion_t completion, void* arg) {
+
+    AioRead* request = (AioRead*) arg;
+    CephPoolContext* context = request->context;
+
+    int readSize = rados_aio_get_return_value(completion);
+    rados_aio_release(completion);
+
+    if (readSize >= 0) {
+        context->retry_policy->record(context->cluster_name, 0, true);
+        request->result->set_value(readSize);
+        delete request;
+        return;
+    }
+
+    // Seul le timeout donne lieu à une nouvelle tentative
+    if (readSize == -ETIMEDOUT) {
+        BOOST_LOG_TRIVIAL(warning) <<  "Try " << request->attempt << " timed out" ;
+        context->retry_policy->record(context->cluster_name, 0, false);
+
+        int delay = context->retry_policy->next_delay(request->attempt, context->read_attempts, 0, request->retry);
+        if (delay >= 0) {
+            request->attempt++;
+            // Le thread librados n'attend pas : la nouvelle tentative est soumise après le délai par le thread des tentatives
+            schedule_read(request, delay);
+            return;
+        }
+    } else {
+        BOOST_LOG_TRIVIAL(error) <<  "Try " << request->attempt << " failed" ;
+        BOOST_LOG_TRIVIAL(error) << "Error code: " << readSize ;
+        BOOST_LOG_TRIVIAL(error) << strerror(-readSize);
+    }
+
+    BOOST_LOG_TRIVIAL(error) <<  "Unable to read " << request->size << " bytes (from the " << request->offset << " one) in the Ceph object " << context->pool_name << " / " << request->name  << " after " << request->attempt << " tries" ;
+    request->result->set_value(-1);
+    delete request;
+}
+
+
+void CephPoolContext::schedule_read(AioRead* request, int delay) {
+    {
+        std::lock_guard<std::mutex> lock(retries_mtx);
+        if (! retries_stopping && ! request->context->closing) {
+            if (! retries_thread.joinable()) {
+                retries_thread = std::thread(CephPoolContext::run_retries);
+            }
+            retries.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), request));
+            retries_cv.notify_all();
+            return;
+        }
+    }
+
+    BOOST_LOG_TRIVIAL(error) << "Unable to read the Ceph object " << request->context->pool_name << " / " << request->name << " : context is closing";
+    request->result->set_value(-1);
+    delete request;
+}
+
+void CephPoolContext::run_retries() {
+    std::unique_lock<std::mutex> lock(retries_mtx);
+
+    while (! retries_stopping) {
+        if (retries.empty()) {
+            retries_cv.wait(lock);
+            continue;
+        }
+
+        if (retries.begin()->first > std::chrono::steady_clock::now()) {
+            retries_cv.wait_until(lock, retries.begin()->first);
+            continue;
+        }
+
+        AioRead* request = retries.begin()->second;
+        retries.erase(retries.begin());
+        CephPoolContext* context = request->context;
+        context->submitting++;
+
+        lock.unlock();
+        context->submit_read(request);
+        lock.lock();
+
+        context->submitting--;
+        retries_cv.notify_all();
+    }
+}
+
+void CephPoolContext::cancel_retries() {
+    std::vector<AioRead*> cancelled;
+    {
+        std::unique_lock<std::mutex> lock(retries_mtx);
+        closing = true;
+
+        std::multimap<std::chrono::steady_clock::time_point, AioRead*>::iterator it = retries.begin();
+        while (it != retries.end()) {
+            if (it->second->context == this) {
+                cancelled.push_back(it->second);
+                it = retries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        // Les lectures soumises entre-temps seront attendues par rados_aio_flush
+        while (submitting > 0) {
+            retries_cv.wait(lock);
+        }
+    }
+
+    for (int i = 0; i < cancelled.size(); i++) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to read the Ceph object " << pool_name << " / " << cancelled.at(i)->name << " : context is closing";
+        cancelled.at(i)->result->set_value(-1);
+        delete cancelled.at(i);
+    }
+}
+
+CephPoolContext::Stopper::~Stopper() {
+    std::multimap<std::chrono::steady_clock::time_point, AioRead*> aborted;
+    {
+        std::lock_guard<std::mutex> lock(retries_mtx);
+        retries_stopping = true;
+        retries_cv.notify_all();
+    }
+
+    if (retries_thread.joinable()) {
+        retries_thread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(retries_mtx);
+        aborted.swap(retries);
+    }
+
+    std::multimap<std::chrono::steady_clock::time_point, AioRead*>::iterator it;
+    for (it = aborted.begin(); it != aborted.end(); ++it) {
+        it->second->result->set_value(-1);
+        delete it->second;
+    }
+}
 
 uint8_t* CephPoolContext::read_full(int& size, std::string name) {
 
@@ -191,42 +390,33 @@ uint8_t* CephPoolContext::read_full(int& size, std::string name) {
         return NULL;
     }
 
-    uint8_t* data = new uint8_t(fullSize);
+    uint8_t* data = new uint8_t[fullSize];
 
-    int attempt = 1;
-    bool error = false;
-    while(attempt) {
-        size = rados_read(io_ctx, name.c_str(), (char*) data, fullSize, 0);
+    // Toutes les portions sont demandées ensemble, puis attendues
+    std::vector<std::future<int> > chunks;
+    for (uint64_t offset = 0; offset < fullSize; offset += ROK4_CEPH_FULL_READ_CHUNK) {
+        int chunkSize = std::min((uint64_t) ROK4_CEPH_FULL_READ_CHUNK, fullSize - offset);
+        chunks.push_back(read_async(data + offset, offset, chunkSize, name));
+    }
 
-        if (size < 0) {
+    bool error = false;
+    int readSize = 0;
+    for (int i = 0; i < chunks.size(); i++) {
+        int chunkSize = chunks.at(i).get();
+        if (chunkSize < 0) {
             error = true;
-            // Seul le timeout donne lieu à une nouvelle tentative
-            if (size == -ETIMEDOUT) {
-                BOOST_LOG_TRIVIAL(warning) <<  "Try " << attempt << " timed out" ;
-            } else {
-                BOOST_LOG_TRIVIAL(error) <<  "Try " << attempt << " failed" ;
-                BOOST_LOG_TRIVIAL(error) << "Error code: " << size ;
-                BOOST_LOG_TRIVIAL(error) << strerror(-size);
-                break;
-            }
         } else {
-            error = false;
-            break;
-        }
-
-        attempt++;
-
-        if (attempt > read_attempts) {
-            break;
-        } else {
-            sleep(waiting_time);
+            readSize += chunkSize;
         }
     }
 
     if (error) {
-        BOOST_LOG_TRIVIAL(error) <<  "Unable to read full Ceph object " << pool_name << " / " << name  << " after " << read_attempts << " tries" ;
+        BOOST_LOG_TRIVIAL(error) <<  "Unable to read full Ceph object " << pool_name << " / " << name ;
+        delete[] data;
+        return NULL;
     }
 
+    size = readSize;
     return data;
 }
 
@@ -309,6 +499,7 @@ bool CephPoolContext::close_to_write(std::string name) {
 
     bool ok = true;
     int attempt = 1;
+    RetryPolicy::State retry;
     while(attempt) {
         int err = rados_write_full(io_ctx,name.c_str(), &((*(it1->second))[0]), it1->second->size());
         if (err < 0) {
@@ -321,13 +512,10 @@ bool CephPoolContext::close_to_write(std::string name) {
             break;
         }
 
+        int delay = retry_policy->next_delay(attempt, write_attempts, 0, retry);
+        if (delay < 0) break;
         attempt++;
-
-        if (attempt > write_attempts) {
-            break;
-        } else {
-            sleep(waiting_time);
-        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
     }
 
     if (ok) {
@@ -335,7 +523,7 @@ bool CephPoolContext::close_to_write(std::string name) {
         delete it1->second;
         write_buffers.erase(it1);
     } else {
-        BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the object " << name << " after " << write_attempts << " tries" ;
+        BOOST_LOG_TRIVIAL(error) <<  "Unable to flush " << it1->second->size() << " bytes in the object " << name << " after " << attempt << " tries" ;
     }
     return ok;
 }
@@ -365,4 +553,36 @@ bool CephPoolContext::exists(std::string name) {
     } else {
         return true;
     }
-}
\ No newline at end of file
+}
+
+int CephPoolContext::check_existence(std::string name) {
+
+    BOOST_LOG_TRIVIAL(debug) << "Check existence (CEPH) ? " << get_path(name);
+
+    if (! connected) {
+        BOOST_LOG_TRIVIAL(error) << "Try to test object existence using the unconnected ceph pool context " << pool_name;
+        return -1;
+    }
+
+    // Disjoncteur ouvert : le cluster ne répond plus, on ne peut pas conclure
+    if (! retry_policy->is_available(cluster_name)) {
+        BOOST_LOG_TRIVIAL(error) << "Ceph cluster " << cluster_name << " unavailable (circuit breaker open), unable to test object existence " << pool_name << " / " << name;
+        return -1;
+    }
+
+    uint64_t fullSize;
+    time_t time;
+    int ret = rados_stat(io_ctx, name.c_str(), &fullSize, &time);
+    if (ret >= 0) return 1;
+    if (ret == -ENOENT) return 0;
+    BOOST_LOG_TRIVIAL(error) << "Cannot test object existence from CEPH : " << pool_name << " / " << name << " : " << strerror(-ret);
+    return -1;
+}
+
+std::multimap<std::chrono::steady_clock::time_point, CephPoolContext::AioRead*> CephPoolContext::retries;
+std::thread CephPoolContext::retries_thread;
+bool CephPoolContext::retries_stopping = false;
+std::mutex CephPoolContext::retries_mtx;
+std::condition_variable CephPoolContext::retries_cv;
+// Défini après le thread et son état pour être détruit avant eux
+CephPoolContext::Stopper CephPoolContext::stopper;
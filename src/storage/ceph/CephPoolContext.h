@@ -51,12 +51,23 @@
 
 #include <rados/librados.h>
 #include <boost/log/trivial.hpp>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "storage/Context.h"
 
 #define ROK4_CEPH_USERNAME "ROK4_CEPH_USERNAME"
 #define ROK4_CEPH_CLUSTERNAME "ROK4_CEPH_CLUSTERNAME"
 #define ROK4_CEPH_CONFFILE "ROK4_CEPH_CONFFILE"
 
+/**
+ * \~french \brief Taille des portions lues en parallèle par #CephPoolContext::read_full, en octets
+ * \~english \brief Size of ranges read in parallel by #CephPoolContext::read_full, in bytes
+ */
+#define ROK4_CEPH_FULL_READ_CHUNK 4194304
+
 
 /**
  * \author Institut national de l'information géographique et forestière
@@ -102,6 +113,119 @@ private:
      */
     rados_ioctx_t io_ctx;
 
+    /**
+     * \~french \brief Le contexte est-il en cours de fermeture
+     * \details Plus aucune nouvelle tentative n'est alors programmée. Protégé par #retries_mtx
+     * \~english \brief Is context closing
+     * \details No more new attempt is then scheduled. Protected by #retries_mtx
+     */
+    bool closing;
+
+    /**
+     * \~french \brief Nombre de nouvelles tentatives du contexte en cours de soumission par le thread des tentatives
+     * \details Protégé par #retries_mtx
+     * \~english \brief Number of context's new attempts being submitted by the retries thread
+     * \details Protected by #retries_mtx
+     */
+    int submitting;
+
+    /**
+     * \~french \brief Lecture asynchrone en cours, argument de la fonction de fin librados
+     * \~english \brief Pending asynchronous read, librados completion function argument
+     */
+    struct AioRead {
+        CephPoolContext* context;
+        std::shared_ptr<std::promise<int> > result;
+        uint8_t* data;
+        int offset;
+        int size;
+        std::string name;
+        int attempt;
+        RetryPolicy::State retry;
+    };
+
+    /**
+     * \~french \brief Soumet une tentative de lecture asynchrone
+     * \details La promesse est remplie par la fonction de fin, ou directement si la soumission échoue
+     * \~english \brief Submit an asynchronous read attempt
+     * \details Promise is fulfilled by the completion function, or directly if submission fails
+     */
+    void submit_read(AioRead* request);
+
+    /**
+     * \~french \brief Fonction de fin de lecture, appelée dans un thread librados
+     * \details Seul le timeout donne lieu à une nouvelle tentative, soumise après le délai de la politique de réessai sans bloquer le thread librados
+     * \~english \brief Read completion function, called in a librados thread
+     * \details Only timeout leads to a new attempt, submitted after the retry policy delay without blocking the librados thread
+     */
+    static void read_complete(rados_completion_t completion, void* arg);
+
+    /**
+     * \~french \brief Nouvelles tentatives de lecture en attente, par date de soumission
+     * \~english \brief Pending new read attempts, by submission date
+     */
+    static std::multimap<std::chrono::steady_clock::time_point, AioRead*> retries;
+
+    /**
+     * \~french \brief Thread unique soumettant les nouvelles tentatives une fois leur délai écoulé
+     * \details Lancé à la première tentative programmée
+     * \~english \brief Only thread submitting new attempts once their delay elapsed
+     * \details Started with the first scheduled attempt
+     */
+    static std::thread retries_thread;
+
+    /**
+     * \~french \brief Le thread des tentatives doit-il s'arrêter
+     * \~english \brief Have the retries thread to stop
+     */
+    static bool retries_stopping;
+
+    /**
+     * \~french \brief Exclusion mutuelle des tentatives en attente
+     * \~english \brief Pending attempts mutual exclusion
+     */
+    static std::mutex retries_mtx;
+
+    /**
+     * \~french \brief Réveil du thread des tentatives (nouvelle tentative, arrêt) et de la fermeture des contextes (fin de soumission)
+     * \~english \brief Wakes up the retries thread (new attempt, stop) and contexts' closing (submission end)
+     */
+    static std::condition_variable retries_cv;
+
+    /**
+     * \~french \brief Programme une nouvelle tentative de lecture après un délai
+     * \details La lecture échoue immédiatement si le contexte est en cours de fermeture ou le programme en cours d'arrêt
+     * \param[in] request lecture à soumettre de nouveau
+     * \param[in] delay délai en millisecondes
+     * \~english \brief Schedule a new read attempt after a delay
+     * \details Read fails immediately if context is closing or program is stopping
+     * \param[in] request read to submit again
+     * \param[in] delay delay in milliseconds
+     */
+    static void schedule_read(AioRead* request, int delay);
+
+    /**
+     * \~french \brief Boucle du thread des tentatives
+     * \details Les soumissions sont faites hors du verrou, librados pouvant bloquer le temps que des lectures en cours se terminent
+     * \~english \brief Retries thread's loop
+     * \details Submissions are done outside the lock, librados being able to block until running reads are done
+     */
+    static void run_retries();
+
+    /**
+     * \~french \brief Fait échouer les tentatives en attente du contexte et attend la fin de celles en cours de soumission
+     * \~english \brief Fail context's pending attempts and wait for those being submitted
+     */
+    void cancel_retries();
+
+    /**
+     * \~french \brief Arrête le thread des tentatives à la fin du programme, avant sa destruction
+     * \~english \brief Stop the retries thread at program end, before its destruction
+     */
+    static struct Stopper {
+        ~Stopper();
+    } stopper;
+
 public:
 
     /**
@@ -139,6 +263,7 @@ public:
     bool connection();
 
     bool exists(std::string name);
+    int check_existence(std::string name);
 
     /**
      * \~french \brief Nettoie les objets librados
@@ -146,6 +271,7 @@ public:
      */
     void close_connection() {
         if (connected) {
+            cancel_retries();
             rados_aio_flush(io_ctx);
             rados_ioctx_destroy(io_ctx);
             rados_shutdown(cluster);
@@ -178,6 +304,21 @@ public:
     }
 
     int read(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Lecture asynchrone via rados_aio_read
+     * \details Toutes les lectures soumises (tuiles d'une fenêtre, en-têtes et index de plusieurs dalles via #read_ranges) sont ainsi envoyées ensemble aux OSD
+     * \~english \brief Asynchronous read with rados_aio_read
+     * \details All submitted readings (window's tiles, several slabs' headers and indexes with #read_ranges) are sent together to the OSDs
+     */
+    std::future<int> read_async(uint8_t* data, int offset, int size, std::string name);
+
+    /**
+     * \~french \brief Lit un objet entier
+     * \details La taille est obtenue avec rados_stat, puis l'objet est lu par portions de #ROK4_CEPH_FULL_READ_CHUNK octets, lues en parallèle
+     * \~english \brief Read a whole object
+     * \details Size is got with rados_stat, then object is read by ranges of #ROK4_CEPH_FULL_READ_CHUNK bytes, read in parallel
+     */
     uint8_t* read_full(int& size, std::string name);
     bool write(uint8_t* data, int offset, int size, std::string name);
     bool write_full(uint8_t* data, int size, std::string name);
@@ -0,0 +1,264 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file ByteRangesReceiver.cpp
+ ** \~french
+ * \brief Implémentation de la classe ByteRangesReceiver
+ ** \~english
+ * \brief Implements classe ByteRangesReceiver
+ */
+
+#include "utils/ByteRangesReceiver.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <boost/log/trivial.hpp>
+
+/**
+ * \~french \brief Lit la première et la dernière position d'une valeur Content-Range (bytes a-b/total)
+ * \~english \brief Read first and last positions from a Content-Range value (bytes a-b/total)
+ */
+static bool parse_content_range (std::string value, int64_t& first, int64_t& last) {
+    long long f, l;
+    if (sscanf(value.c_str(), " bytes %lld-%lld", &f, &l) != 2 || f < 0 || l < f) {
+        return false;
+    }
+    first = f;
+    last = l;
+    return true;
+}
+
+ByteRangesReceiver::ByteRangesReceiver (std::vector<ReadRange*> r) : ranges(r), received(r.size(), 0), state(SINGLE), position(0), remaining(0) {
+    std::stable_sort(ranges.begin(), ranges.end(), [](ReadRange* a, ReadRange* b) {
+        return a->offset < b->offset;
+    });
+}
+
+std::string ByteRangesReceiver::get_range_header () {
+    std::ostringstream header;
+    header << "Range: bytes=";
+    for (int i = 0; i < ranges.size(); i++) {
+        if (i != 0) header << ",";
+        header << ranges.at(i)->offset << "-" << (ranges.at(i)->offset + ranges.at(i)->size - 1);
+    }
+    return header.str();
+}
+
+void ByteRangesReceiver::add_header (std::string header) {
+
+    while (! header.empty() && (header.back() == '\r' || header.back() == '\n')) {
+        header.pop_back();
+    }
+
+    // Ligne de statut : nouvelle réponse, seul le corps d'une réponse 200 ou 206 est exploité
+    if (header.compare(0, 5, "HTTP/") == 0) {
+        size_t space = header.find(' ');
+        int code = (space == std::string::npos) ? 0 : atoi(header.c_str() + space + 1);
+        state = (code == 200 || code == 206) ? SINGLE : DONE;
+        boundary.clear();
+        position = 0;
+        remaining = 0;
+        line.clear();
+        std::fill(received.begin(), received.end(), 0);
+        return;
+    }
+
+    size_t colon = header.find(':');
+    if (colon == std::string::npos || state != SINGLE) {
+        return;
+    }
+    std::string name = header.substr(0, colon);
+    std::string value = header.substr(colon + 1);
+
+    if (strcasecmp(name.c_str(), "Content-Range") == 0) {
+        int64_t first, last;
+        if (parse_content_range(value, first, last)) {
+            position = first;
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "Invalid Content-Range header : " << value;
+            state = FAILED;
+        }
+    }
+    else if (strcasecmp(name.c_str(), "Content-Type") == 0) {
+        if (strcasestr(value.c_str(), "multipart/byteranges") == NULL) {
+            return;
+        }
+        size_t b = value.find("boundary=");
+        if (b == std::string::npos) {
+            BOOST_LOG_TRIVIAL(error) << "No boundary in multipart response : " << value;
+            state = FAILED;
+            return;
+        }
+        boundary = value.substr(b + 9);
+        size_t end = boundary.find(';');
+        if (end != std::string::npos) boundary.erase(end);
+        while (! boundary.empty() && boundary.back() == ' ') boundary.pop_back();
+        if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+            boundary = boundary.substr(1, boundary.size() - 2);
+        }
+    }
+}
+
+void ByteRangesReceiver::copy (const char* data, size_t size) {
+    int64_t end = position + size;
+    for (int i = 0; i < ranges.size(); i++) {
+        ReadRange* r = ranges.at(i);
+        if (r->offset >= end) break;
+        int64_t from = std::max(position, (int64_t) r->offset);
+        int64_t to = std::min(end, (int64_t) r->offset + r->size);
+        if (from >= to) continue;
+        memcpy(r->data + (from - r->offset), data + (from - position), to - from);
+        received.at(i) += (to - from);
+    }
+    position = end;
+}
+
+void ByteRangesReceiver::process_line () {
+
+    if (! line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+
+    if (state == BOUNDARY) {
+        // Les lignes précédant un séparateur (préambule, fin de la partie précédente) sont ignorées
+        if (line == "--" + boundary) {
+            state = PART_HEADERS;
+            remaining = -1;
+        } else if (line == "--" + boundary + "--") {
+            state = DONE;
+        }
+    }
+    else if (state == PART_HEADERS) {
+        if (line.empty()) {
+            // Fin des en-têtes de la partie
+            if (remaining < 0) {
+                BOOST_LOG_TRIVIAL(error) << "Multipart response's part without Content-Range header";
+                state = FAILED;
+            } else {
+                state = PART_DATA;
+            }
+        } else {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos && strcasecmp(line.substr(0, colon).c_str(), "Content-Range") == 0) {
+                int64_t first, last;
+                if (parse_content_range(line.substr(colon + 1), first, last)) {
+                    position = first;
+                    remaining = last - first + 1;
+                } else {
+                    BOOST_LOG_TRIVIAL(error) << "Invalid Content-Range header in multipart response : " << line;
+                    state = FAILED;
+                }
+            }
+        }
+    }
+
+    line.clear();
+}
+
+bool ByteRangesReceiver::receive (const char* data, size_t size) {
+
+    if (state == SINGLE) {
+        if (! boundary.empty()) {
+            state = BOUNDARY;
+        } else {
+            copy(data, size);
+            return true;
+        }
+    }
+
+    while (size > 0) {
+        if (state == DONE) return true;
+        if (state == FAILED) return false;
+
+        if (state == PART_DATA) {
+            size_t n = std::min((int64_t) size, remaining);
+            copy(data, n);
+            data += n;
+            size -= n;
+            remaining -= n;
+            if (remaining == 0) state = BOUNDARY;
+            continue;
+        }
+
+        // Séparateur ou en-têtes de partie : lecture ligne par ligne
+        const char* eol = (const char*) memchr(data, '\n', size);
+        size_t n = (eol == NULL) ? size : (eol - data);
+        line.append(data, n);
+        if (line.size() > ROK4_BYTE_RANGES_MAX_LINE) {
+            BOOST_LOG_TRIVIAL(error) << "Malformed multipart response : line too long";
+            state = FAILED;
+            return false;
+        }
+        if (eol == NULL) return true;
+        data += n + 1;
+        size -= n + 1;
+        process_line();
+    }
+
+    return (state != FAILED);
+}
+
+bool ByteRangesReceiver::finish () {
+    bool ok = (state != FAILED);
+    for (int i = 0; i < ranges.size(); i++) {
+        ReadRange* r = ranges.at(i);
+        // Une portion incomplète est en erreur : elle sera relue seule, ce qui distingue une troncature du transfert de la fin de l'objet
+        if (state == FAILED || received.at(i) < r->size) {
+            r->read_size = -1;
+            ok = false;
+        } else {
+            r->read_size = r->size;
+        }
+    }
+    return ok;
+}
+
+size_t ByteRangesReceiver::header_callback (char* data, size_t size, size_t nmemb, void* receiver) {
+    ((ByteRangesReceiver*) receiver)->add_header(std::string(data, size * nmemb));
+    return size * nmemb;
+}
+
+size_t ByteRangesReceiver::data_callback (char* data, size_t size, size_t nmemb, void* receiver) {
+    if (! ((ByteRangesReceiver*) receiver)->receive(data, size * nmemb)) {
+        return 0;
+    }
+    return size * nmemb;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file CurlLoop.cpp
+ ** \~french
+ * \brief Implémentation de la classe CurlLoop
+ ** \~english
+ * \brief Implements classe CurlLoop
+ */
+
+#include "utils/CurlLoop.h"
+#include "utils/CurlPool.h"
+
+CurlLoop::~CurlLoop(){
+
+}
+
+uint64_t CurlLoop::submit(CURL* handle, Callback callback, int delay) {
+    CurlPool::set_http_version(handle, true);
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (! stopping) {
+            if (multi == NULL) {
+                multi = curl_multi_init();
+                if (CurlPool::get_max_host_connections() > 0) {
+                    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) CurlPool::get_max_host_connections());
+                }
+                if (CurlPool::is_http2()) {
+                    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+                }
+                loop = std::thread(CurlLoop::run);
+            }
+
+            Submission s = { ++last_id, handle, callback };
+            pending.insert(std::make_pair(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay), s));
+            curl_multi_wakeup(multi);
+            return s.id;
+        }
+    }
+
+    callback(CURLE_ABORTED_BY_CALLBACK);
+    return 0;
+}
+
+void CurlLoop::cancel(uint64_t id) {
+    if (id == 0) return;
+
+    Callback callback;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        // Requête pas encore lancée : on la retire simplement des requêtes en attente
+        std::multimap<std::chrono::steady_clock::time_point, Submission>::iterator it;
+        for (it = pending.begin(); it != pending.end(); ++it) {
+            if (it->second.id == id) break;
+        }
+
+        if (it != pending.end()) {
+            callback = it->second.callback;
+            pending.erase(it);
+        } else if (multi == NULL) {
+            return;
+        } else if (std::this_thread::get_id() != loop.get_id()) {
+            // Les requêtes en cours ne sont manipulées que par le thread de la boucle
+            // L'identifiant n'étant jamais réutilisé, une requête terminée d'ici là ne peut être confondue avec une autre
+            cancelled.push_back(id);
+            curl_multi_wakeup(multi);
+            return;
+        }
+    }
+
+    if (callback) {
+        callback(CURLE_ABORTED_BY_CALLBACK);
+    } else {
+        abort_running(id);
+    }
+}
+
+void CurlLoop::abort_running(uint64_t id) {
+    std::map<CURL*, Running>::iterator it;
+    for (it = running.begin(); it != running.end(); ++it) {
+        if (it->second.id == id) break;
+    }
+    if (it == running.end()) return;
+
+    Callback callback = it->second.callback;
+    curl_multi_remove_handle(multi, it->first);
+    running.erase(it);
+    callback(CURLE_ABORTED_BY_CALLBACK);
+}
+
+void CurlLoop::run() {
+
+    while (true) {
+
+        // Ajout des requêtes soumises dont le délai est écoulé, et calcul de l'attente maximale avant la prochaine
+        int timeout = 1000;
+        std::vector<uint64_t> to_cancel;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopping) break;
+
+            to_cancel.swap(cancelled);
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            while (! pending.empty() && pending.begin()->first <= now) {
+                Submission s = pending.begin()->second;
+                pending.erase(pending.begin());
+                Running r = { s.id, s.callback };
+                running.insert(std::make_pair(s.handle, r));
+                curl_multi_add_handle(multi, s.handle);
+            }
+
+            if (! pending.empty()) {
+                int wait = std::chrono::duration_cast<std::chrono::milliseconds>(pending.begin()->first - now).count() + 1;
+                if (wait < timeout) timeout = wait;
+            }
+        }
+
+        for (int i = 0; i < to_cancel.size(); i++) {
+            abort_running(to_cancel.at(i));
+        }
+
+        int still_running;
+        CURLMcode mc = curl_multi_perform(multi, &still_running);
+        if (mc != CURLM_OK) {
+            BOOST_LOG_TRIVIAL(error) << "Curl multi error : " << curl_multi_strerror(mc);
+        }
+
+        // Requêtes terminées : on les retire de la boucle avant d'appeler leur fonction de fin
+        CURLMsg* msg;
+        int left;
+        std::vector<std::pair<Callback, CURLcode> > done;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL* handle = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(multi, handle);
+            std::map<CURL*, Running>::iterator it = running.find(handle);
+            if (it != running.end()) {
+                done.push_back(std::make_pair(it->second.callback, res));
+                running.erase(it);
+            }
+        }
+        for (int i = 0; i < done.size(); i++) {
+            done.at(i).first(done.at(i).second);
+        }
+
+        if (! done.empty()) continue;
+
+        curl_multi_poll(multi, NULL, 0, timeout, NULL);
+    }
+
+    // Arrêt : toutes les requêtes sont interrompues
+    std::map<CURL*, Running>::iterator it;
+    for (it = running.begin(); it != running.end(); ++it) {
+        curl_multi_remove_handle(multi, it->first);
+        it->second.callback(CURLE_ABORTED_BY_CALLBACK);
+    }
+    running.clear();
+    cancelled.clear();
+}
+
+void CurlLoop::stop() {
+    std::multimap<std::chrono::steady_clock::time_point, Submission> aborted;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (multi == NULL) return;
+        stopping = true;
+        curl_multi_wakeup(multi);
+    }
+
+    loop.join();
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        aborted.swap(pending);
+    }
+
+    std::multimap<std::chrono::steady_clock::time_point, Submission>::iterator it;
+    for (it = aborted.begin(); it != aborted.end(); ++it) {
+        it->second.callback(CURLE_ABORTED_BY_CALLBACK);
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    curl_multi_cleanup(multi);
+    multi = NULL;
+    stopping = false;
+}
+
+CURLM* CurlLoop::multi = NULL;
+std::thread CurlLoop::loop;
+bool CurlLoop::stopping = false;
+std::multimap<std::chrono::steady_clock::time_point, CurlLoop::Submission> CurlLoop::pending;
+std::map<CURL*, CurlLoop::Running> CurlLoop::running;
+std::vector<uint64_t> CurlLoop::cancelled;
+uint64_t CurlLoop::last_id = 0;
+std::mutex CurlLoop::mtx;
+// Défini en dernier pour être détruit en premier
+CurlLoop::Stopper CurlLoop::stopper;
@@ -44,35 +44,158 @@
  */
 
 #include "utils/CurlPool.h"
+#include "utils/Utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 CurlPool::~CurlPool(){
 
 }
 
+CurlPool::ThreadCurl::~ThreadCurl() {
+    if (handle == NULL) return;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    // Si l'annuaire a été nettoyé entre temps, l'objet n'existe plus
+    if (pool.erase(handle) > 0) {
+        curl_easy_cleanup(handle);
+    }
+    handle = NULL;
+}
+
+void CurlPool::lock_share(CURL* /* handle */, curl_lock_data data, curl_lock_access /* access */, void* /* userptr */) {
+    share_locks[data].lock();
+}
+
+void CurlPool::unlock_share(CURL* /* handle */, curl_lock_data data, void* /* userptr */) {
+    share_locks[data].unlock();
+}
+
+long CurlPool::parse_http_version(const char* value, int features) {
+    if (value == NULL) {
+        return CURL_HTTP_VERSION_NONE;
+    }
+
+    long version = CURL_HTTP_VERSION_NONE;
+    if (strcmp(value, "1.1") == 0) {
+        return CURL_HTTP_VERSION_1_1;
+    } else if (strcmp(value, "2") == 0) {
+        version = CURL_HTTP_VERSION_2TLS;
+    } else if (strcmp(value, "2-prior-knowledge") == 0) {
+        version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+    } else {
+        BOOST_LOG_TRIVIAL(warning) << "Version HTTP inconnue (" << ROK4_CURL_HTTP_VERSION << ") : " << value;
+        return CURL_HTTP_VERSION_NONE;
+    }
+
+    if (! (features & CURL_VERSION_HTTP2)) {
+        BOOST_LOG_TRIVIAL(warning) << "HTTP/2 non supporté par libcurl, utilisation de HTTP/1.1";
+        return CURL_HTTP_VERSION_1_1;
+    }
+
+    return version;
+}
+
+long CurlPool::http_version_from_env() {
+    return parse_http_version(getenv (ROK4_CURL_HTTP_VERSION), curl_version_info(CURLVERSION_NOW)->features);
+}
+
+void CurlPool::set_http_version(long version) {
+    http_version = version;
+}
+
+bool CurlPool::is_http2() {
+    long version = http_version.load();
+    return version == CURL_HTTP_VERSION_2TLS || version == CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+}
+
+void CurlPool::set_http_version(CURL* curl, bool multiplexed) {
+    long version = http_version.load();
+    if (version == CURL_HTTP_VERSION_NONE) return;
+
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, version);
+    if (multiplexed && is_http2()) {
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+}
+
+void CurlPool::apply_options(CURL* curl) {
+    if (share != NULL) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+
+    if (tcp_keepalive > 0) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, (long) tcp_keepalive);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, (long) tcp_keepalive);
+    }
+
+    set_http_version(curl, false);
+}
+
 CURL *CurlPool::get_curl_env() {
-    pthread_t i = pthread_self();
 
-    std::map<pthread_t, CURL*>::iterator it = pool.find ( i );
-    if ( it == pool.end() ) {
-        CURL* c = curl_easy_init();
-        pool.insert ( std::pair<pthread_t, CURL*>(i,c) );
-        return c;
+    if (local.handle == NULL || local.generation != generation.load()) {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (share == NULL) {
+            share = curl_share_init();
+            curl_share_setopt(share, CURLSHOPT_LOCKFUNC, CurlPool::lock_share);
+            curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, CurlPool::unlock_share);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            // Pas de partage des connexions (CURL_LOCK_DATA_CONNECT) : libcurl ne le permet pas entre threads concurrents
+        }
+
+        local.handle = curl_easy_init();
+        local.generation = generation.load();
+        pool.insert(local.handle);
     } else {
-        curl_easy_reset(it->second);
-        return it->second;
+        curl_easy_reset(local.handle);
     }
+
+    apply_options(local.handle);
+    return local.handle;
+}
+
+int CurlPool::get_curls_count() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return pool.size();
+}
+
+int CurlPool::get_max_host_connections() {
+    return max_host_connections;
 }
 
 void CurlPool::print_curls_count() {
-    BOOST_LOG_TRIVIAL(info) << "Nombre de contextes curl : " << pool.size();
+    BOOST_LOG_TRIVIAL(info) << "Nombre de contextes curl : " << get_curls_count();
 }
 
 void CurlPool::clean_curls() {
-    std::map<pthread_t, CURL*>::iterator it;
+    std::lock_guard<std::mutex> lock(mtx);
+
+    std::set<CURL*>::iterator it;
     for (it = pool.begin(); it != pool.end(); ++it) {
-        curl_easy_cleanup(it->second);
+        curl_easy_cleanup(*it);
     }
     pool.clear();
+    generation++;
+
+    // Plus aucun objet n'utilise le partage
+    if (share != NULL) {
+        curl_share_cleanup(share);
+        share = NULL;
+    }
 }
 
-std::map<pthread_t, CURL*> CurlPool::pool;
+thread_local CurlPool::ThreadCurl CurlPool::local;
+std::set<CURL*> CurlPool::pool;
+std::atomic<unsigned int> CurlPool::generation(0);
+CURLSH* CurlPool::share = NULL;
+std::mutex CurlPool::share_locks[CURL_LOCK_DATA_LAST];
+std::mutex CurlPool::mtx;
+int CurlPool::tcp_keepalive = env_or_default(ROK4_CURL_TCP_KEEPALIVE, 0);
+int CurlPool::max_host_connections = env_or_default(ROK4_CURL_MAX_HOST_CONNECTIONS, 0);
+std::atomic<long> CurlPool::http_version(CurlPool::http_version_from_env());
@@ -0,0 +1,112 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file DecodedTileCache.cpp
+ ** \~french
+ * \brief Implémentation de la classe DecodedTileCache
+ ** \~english
+ * \brief Implements classe DecodedTileCache
+ */
+
+#include <sstream>
+#include <functional>
+
+#include "rok4/utils/DecodedTileCache.h"
+#include "rok4/utils/Utils.h"
+
+DecodedTileCache::DecodedTileCache() {
+
+}
+
+DecodedTileCache::~DecodedTileCache() {
+
+}
+
+void DecodedTileCache::set_memory_budget(size_t b) {
+    cache.set_memory_budget(b);
+}
+
+void DecodedTileCache::set_validity(int v) {
+    cache.set_validity(v);
+}
+
+std::string DecodedTileCache::key(Level* level, int col, int row) {
+    std::ostringstream oss;
+    oss << (void*) level << "|" << col << "|" << row;
+    return oss.str();
+}
+
+std::shared_ptr<DecodedTileElement> DecodedTileCache::get_tile(Level* level, int col, int row) {
+    if (! is_enabled()) {
+        return std::shared_ptr<DecodedTileElement>();
+    }
+    return cache.get(key(level, col, row));
+}
+
+std::shared_ptr<DecodedTileElement> DecodedTileCache::add_tile(Level* level, int col, int row, uint8_t* data, size_t size) {
+    std::shared_ptr<DecodedTileElement> elem = std::make_shared<DecodedTileElement>(data, size, level);
+    if (is_enabled()) {
+        cache.add(key(level, col, row), elem);
+    }
+    return elem;
+}
+
+/**
+ * \~french \brief La tuile appartient-elle au niveau
+ * \~english \brief Does tile belong to level
+ */
+static bool same_level(const DecodedTileElement& elem, Level* level) {
+    return elem.level == level;
+}
+
+void DecodedTileCache::clean_level(Level* level) {
+    cache.remove_if(std::bind(same_level, std::placeholders::_1, level));
+}
+
+size_t DecodedTileCache::get_memory() {
+    return cache.get_memory();
+}
+
+void DecodedTileCache::clean_tiles() {
+    cache.clean();
+}
+
+ShardedLruCache<std::string, DecodedTileElement, ROK4_DECODED_TILE_CACHE_SHARDS> DecodedTileCache::cache(
+    env_or_default(ROK4_DECODED_TILE_CACHE_MEMORY, 0), env_or_default(ROK4_DECODED_TILE_CACHE_VALIDITY, 300)
+);
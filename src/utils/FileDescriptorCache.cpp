@@ -0,0 +1,189 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file FileDescriptorCache.cpp
+ ** \~french
+ * \brief Implémentation de la classe FileDescriptorCache
+ ** \~english
+ * \brief Implements classe FileDescriptorCache
+ */
+
+#include "rok4/utils/FileDescriptorCache.h"
+#include "rok4/utils/Utils.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <boost/log/trivial.hpp>
+
+FileDescriptor::~FileDescriptor() {
+    close(fd);
+}
+
+FileDescriptorCache::FileDescriptorCache() {
+
+}
+
+FileDescriptorCache::~FileDescriptorCache() {
+
+}
+
+void FileDescriptorCache::set_size(int s) {
+    mtx.lock();
+    size = s;
+    while (lru.size() > size) {
+        map.erase(lru.back());
+        lru.pop_back();
+    }
+    mtx.unlock();
+}
+
+void FileDescriptorCache::set_validity(int v) {
+    validity = v;
+}
+
+std::shared_ptr<FileDescriptor> FileDescriptorCache::open_descriptor(std::string path) {
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        BOOST_LOG_TRIVIAL(debug) << "Can't open file " << path;
+        return NULL;
+    }
+
+    struct stat st;
+    if ( fstat(fd, &st) != 0 ) {
+        BOOST_LOG_TRIVIAL(error) << "Can't stat file " << path << ", error code " << errno;
+        close(fd);
+        return NULL;
+    }
+
+    return std::make_shared<FileDescriptor>(fd, st.st_dev, st.st_ino);
+}
+
+void FileDescriptorCache::insert(std::string path, std::shared_ptr<FileDescriptor> fd) {
+    auto it = map.find(path);
+    if (it != map.end()) {
+        // Un thread concurrent a ouvert le même fichier : on garde le descripteur le plus récent
+        lru.erase(it->second.second);
+        map.erase(it);
+    }
+
+    while (! lru.empty() && lru.size() >= size) {
+        // Le descripteur n'est réellement fermé que lorsque les lectures en cours l'ont relâché
+        map.erase(lru.back());
+        lru.pop_back();
+    }
+
+    lru.push_front(path);
+    map[path] = std::make_pair(fd, lru.begin());
+}
+
+std::shared_ptr<FileDescriptor> FileDescriptorCache::get_descriptor(std::string path) {
+
+    if (size <= 0) {
+        return open_descriptor(path);
+    }
+
+    std::shared_ptr<FileDescriptor> fd;
+
+    mtx.lock();
+    auto it = map.find(path);
+    if (it != map.end()) {
+        fd = it->second.first;
+        // Remise en tête de liste
+        lru.splice(lru.begin(), lru, it->second.second);
+    }
+    mtx.unlock();
+
+    if (fd) {
+        std::time_t now = std::time(NULL);
+        if (now - fd->checked <= validity) {
+            return fd;
+        }
+
+        // Le fichier a pu être supprimé ou remplacé depuis l'ouverture : on compare l'inode actuel à celui du descripteur
+        struct stat st;
+        if ( stat(path.c_str(), &st) == 0 && st.st_dev == fd->device && st.st_ino == fd->inode ) {
+            fd->checked = now;
+            return fd;
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "File " << path << " changed since opening, descriptor is dropped";
+        mtx.lock();
+        it = map.find(path);
+        if (it != map.end() && it->second.first == fd) {
+            lru.erase(it->second.second);
+            map.erase(it);
+        }
+        mtx.unlock();
+    }
+
+    fd = open_descriptor(path);
+    if (fd) {
+        mtx.lock();
+        insert(path, fd);
+        mtx.unlock();
+    }
+
+    return fd;
+}
+
+void FileDescriptorCache::invalidate(std::string path) {
+    mtx.lock();
+    auto it = map.find(path);
+    if (it != map.end()) {
+        lru.erase(it->second.second);
+        map.erase(it);
+    }
+    mtx.unlock();
+}
+
+void FileDescriptorCache::clean_descriptors() {
+    mtx.lock();
+    map.clear();
+    lru.clear();
+    mtx.unlock();
+}
+
+std::list<std::string> FileDescriptorCache::lru;
+std::unordered_map<std::string, std::pair<std::shared_ptr<FileDescriptor>, std::list<std::string>::iterator> > FileDescriptorCache::map;
+int FileDescriptorCache::size = env_or_default(ROK4_FILE_DESCRIPTORS_CACHE_SIZE, 100);
+int FileDescriptorCache::validity = env_or_default(ROK4_FILE_DESCRIPTORS_CACHE_VALIDITY, 10);
+std::mutex FileDescriptorCache::mtx;
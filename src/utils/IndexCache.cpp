@@ -44,6 +44,10 @@
  */
 
 #include "rok4/utils/IndexCache.h"
+#include "rok4/enums/Format.h"
+#include "rok4/utils/StoragePool.h"
+#include <fstream>
+#include <cstdio>
 
 IndexCache::IndexCache() {
 
@@ -55,100 +59,475 @@ IndexCache::~IndexCache() {
 
 void IndexCache::setCacheSize(int s) {
     size = s;
+    update_shards_count();
 }
 
 void IndexCache::set_validity(int v) {
     validity = v;
 }
 
+void IndexCache::set_missing_validity(int v) {
+    missing_validity = v;
+}
+
+void IndexCache::set_memory_budget(size_t b) {
+    memory_budget = b;
+    update_shards_count();
+}
+
+void IndexCache::update_shards_count() {
+    int count = ROK4_INDEX_CACHE_SHARDS;
+    if (memory_budget == 0) {
+        count = size / ROK4_INDEX_CACHE_MIN_SHARD_SIZE;
+        if (count < 1) count = 1;
+        if (count > ROK4_INDEX_CACHE_SHARDS) count = ROK4_INDEX_CACHE_SHARDS;
+    }
+
+    // Les clés changent de partition : les éléments présents ne seraient plus trouvés
+    if (shards_count.exchange(count) != count) {
+        clean_indexes();
+    }
+}
+
+void IndexCache::set_stale_validity(int v) {
+    stale_validity = v;
+}
+
+void IndexCache::set_refresh_hits(int h) {
+    refresh_hits = h;
+}
+
+void IndexCache::schedule_refresh(const std::string& key, const IndexElement* elem) {
+    RefreshTask task = { key, elem->context, elem->name, elem->tiles_number };
+
+    std::lock_guard<std::mutex> lock(refresh_mtx);
+    if (refresh_stopping) return;
+    if (! refresher.joinable()) {
+        refresher = std::thread(IndexCache::run_refresher);
+    }
+    refresh_queue.push_back(task);
+    refresh_cv.notify_one();
+}
+
+void IndexCache::run_refresher() {
+    while (true) {
+        RefreshTask task;
+        {
+            std::unique_lock<std::mutex> lock(refresh_mtx);
+            refresh_cv.wait(lock, [] { return refresh_stopping || ! refresh_queue.empty(); });
+            if (refresh_stopping) break;
+            task = refresh_queue.front();
+            refresh_queue.pop_front();
+        }
+        refresh(task);
+    }
+}
+
+void IndexCache::refresh(const RefreshTask& task) {
+    BOOST_LOG_TRIVIAL(debug) << "Refresh index of slab " << task.context->get_path(task.name);
+
+    int headerIndexSize = ROK4_IMAGE_HEADER_SIZE + 2 * 4 * task.tiles_number;
+    uint8_t* indexheader = new uint8_t[headerIndexSize];
+    int realSize = task.context->read(indexheader, 0, headerIndexSize, task.name);
+
+    if (realSize == headerIndexSize) {
+        add_slab_infos(task.key, task.context, task.name, task.tiles_number, indexheader + ROK4_IMAGE_HEADER_SIZE, indexheader + ROK4_IMAGE_HEADER_SIZE + 4 * task.tiles_number);
+    } else if (realSize < 0 && task.context->check_existence(task.name) == 0) {
+        // Seule une absence certaine est mémorisée : une erreur du stockage ne doit pas rendre la dalle introuvable
+        BOOST_LOG_TRIVIAL(debug) << "Slab " << task.context->get_path(task.name) << " does not exist anymore";
+        add_missing_slab(task.key);
+    } else {
+        // L'élément périmé est servi jusqu'à sa péremption définitive, l'index sera alors relu lors d'une demande
+        BOOST_LOG_TRIVIAL(warning) << "Cannot refresh index of slab " << task.context->get_path(task.name);
+    }
+
+    delete[] indexheader;
+}
+
+void IndexCache::stop_refresher() {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mtx);
+        if (! refresher.joinable()) return;
+        refresh_stopping = true;
+        refresh_cv.notify_one();
+    }
+
+    refresher.join();
+
+    std::lock_guard<std::mutex> lock(refresh_mtx);
+    refresh_queue.clear();
+    refresh_stopping = false;
+}
+
+IndexCache::Shard& IndexCache::get_shard(size_t hash) {
+    return shards[hash % shards_count];
+}
+
+std::atomic<const IndexCache::Bucket*>& IndexCache::get_bucket(Shard& shard, size_t hash) {
+    // Bits de l'empreinte indépendants du choix de la partition
+    return shard.buckets[(hash / ROK4_INDEX_CACHE_SHARDS) % ROK4_INDEX_CACHE_BUCKETS];
+}
+
+std::shared_ptr<const IndexElement> IndexCache::find_element(const std::string& key) {
+    size_t hash = std::hash<std::string>()(key);
+    Shard& shard = get_shard(hash);
+
+    // Le compartiment lu ne peut être libéré tant que la lecture est enregistrée
+    int parity = shard.epoch & 1;
+    shard.readers[parity]++;
+
+    std::shared_ptr<const IndexElement> found;
+    const Bucket* bucket = get_bucket(shard, hash);
+    if (bucket != NULL) {
+        Bucket::const_iterator it;
+        for (it = bucket->begin(); it != bucket->end(); ++it) {
+            if (it->first == key) {
+                found = it->second;
+                break;
+            }
+        }
+    }
+
+    shard.readers[parity]--;
+    return found;
+}
+
+void IndexCache::set_element(Shard& shard, const std::string& key, std::shared_ptr<const IndexElement> elem) {
+    std::atomic<const Bucket*>& slot = get_bucket(shard, std::hash<std::string>()(key));
+
+    // Copie du compartiment courant : les lectures en cours continuent d'utiliser l'ancien
+    const Bucket* current = slot;
+    Bucket* updated = new Bucket();
+    if (current != NULL) {
+        updated->reserve(current->size() + 1);
+        Bucket::const_iterator it;
+        for (it = current->begin(); it != current->end(); ++it) {
+            if (it->first != key) updated->push_back(*it);
+        }
+    }
+    if (elem) {
+        updated->push_back(std::make_pair(key, elem));
+    }
+
+    if (updated->empty()) {
+        delete updated;
+        updated = NULL;
+    }
+    slot = updated;
+    if (current != NULL) shard.retired.push_back(current);
+}
+
+void IndexCache::reclaim(Shard& shard) {
+    if (shard.retired.empty()) return;
+
+    // Deux changements d'époque : une lecture enregistrée tardivement sur l'ancienne parité (époque lue juste avant un changement) est ainsi toujours attendue avant la libération des compartiments qu'elle a pu lire
+    for (int flip = 0; flip < 2; flip++) {
+        int parity = shard.epoch++ & 1;
+        while (shard.readers[parity] != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (int r = 0; r < shard.retired.size(); r++) {
+        delete shard.retired.at(r);
+    }
+    shard.retired.clear();
+}
+
 void IndexCache::add_slab_infos(std::string origin_slab_name, Context *data_context, std::string data_slab_name, int tiles_number, uint8_t *offsets, uint8_t *sizes) {
     // On utilise le nom original de la dalle (celle à lire a priori) comme clé dans la map
     // Potentiellement ce nom est différent de la vraie dalle contenant la donnée (dans le cas d'une dalle symbolique)
     // mais c'est via cette dalle symbolique que la donnée est a priori requêtée
     // donc c'est ce nom qu'on utilisera pour l'interrogation du cache
 
-    mtx.lock();
+    add_element(origin_slab_name, std::shared_ptr<const IndexElement>(new IndexElement(data_context, data_slab_name, tiles_number, offsets, sizes)));
+}
 
-    IndexElement *elem = new IndexElement(origin_slab_name, data_context, data_slab_name, tiles_number, offsets, sizes);
+void IndexCache::add_missing_slab(std::string origin_slab_name) {
+    add_element(origin_slab_name, std::shared_ptr<const IndexElement>(new IndexElement()));
+}
 
-    // L'information n'est a priori pas dans le cache car
-    // Soit elle était dans le cache et valide, alors on aurait utilisé ce cache et on n'aurait pas fait appel à cet ajout
-    // Soit elle était dans le cache mais obsolète, alors on l'aurait déjà supprimé du cache
+void IndexCache::add_element(std::string key, std::shared_ptr<const IndexElement> elem) {
 
-    if (cache.size() == size)
-    {
-        // On récupère le dernier élément du cache
-        IndexElement *last = cache.back();
-        // On le vire du cache
-        cache.pop_back();
-        // On le déréférence de la map d'accès
-        map.erase(last->key);
-        delete last;
+    size_t hash = std::hash<std::string>()(key);
+    int count = shards_count;
+    int index = hash % count;
+
+    // Chaque partition contient au plus sa part de la taille totale, en nombre d'éléments ou en mémoire.
+    // Le reste de la division est réparti sur les premières partitions : la somme des parts vaut la taille totale
+    size_t budget = memory_budget;
+    size_t shard_limit;
+    if (budget > 0) {
+        shard_limit = budget / count;
+    } else {
+        int total = size;
+        if (total < 1) total = 1;
+        shard_limit = total / count + (index < total % count ? 1 : 0);
+    }
+    // La clé est stockée dans le compartiment, dans l'ordre d'ajout et dans les positions
+    size_t elem_memory = elem->get_memory_size() + 3 * key.capacity();
+
+    Shard& shard = shards[index];
+    std::lock_guard<std::mutex> lock(shard.mtx);
+
+    // L'information peut déjà être dans le cache, obsolète, ou ajoutée par un thread concurrent
+    std::unordered_map<std::string, Order::iterator>::iterator pos = shard.positions.find(key);
+    if (pos != shard.positions.end()) {
+        shard.memory -= pos->second->second;
+        shard.order.erase(pos->second);
+        shard.positions.erase(pos);
     }
 
-    // update reference
-    cache.push_front(elem);
-    map[origin_slab_name] = cache.begin();
+    // On retire les éléments les plus anciens de la partition jusqu'à avoir la place
+    while (! shard.order.empty()) {
+        if (budget > 0 && shard.memory + elem_memory <= shard_limit) break;
+        if (budget == 0 && shard.order.size() < shard_limit) break;
 
-    mtx.unlock();
+        std::pair<std::string, size_t>& oldest = shard.order.back();
+        set_element(shard, oldest.first, std::shared_ptr<const IndexElement>());
+        shard.memory -= oldest.second;
+        shard.positions.erase(oldest.first);
+        shard.order.pop_back();
+    }
+
+    shard.order.push_front(std::make_pair(key, elem_memory));
+    shard.positions[key] = shard.order.begin();
+    shard.memory += elem_memory;
+    set_element(shard, key, elem);
+
+    reclaim(shard);
 }
 
-bool IndexCache::get_slab_infos(std::string key, int tile_number, Context **data_context, std::string *data_slab_name, uint32_t *offset, uint32_t *size) {
-    std::unordered_map<std::string, std::list<IndexElement *>::iterator>::iterator it = map.find(key);
-    if (it == map.end())
-    {
+bool IndexCache::get_slab_infos(std::string key, int tile_number, Context **data_context, std::string *data_slab_name, uint32_t *offset, uint32_t *size, bool *missing) {
+    if (missing) *missing = false;
+
+    // Lecture sans verrou de l'instantané courant du compartiment
+    std::shared_ptr<const IndexElement> found = find_element(key);
+    if (! found) {
         return false;
     }
-    else
-    {
-        // Gestion de la péremption du cache (une heure max)
-        std::time_t now = std::time(NULL);
-        if (now - (*(it->second))->date > validity)
-        {
-            mtx.lock();
 
-            // on le cherche à nouveau pour vérifier qu'il n'a pas déjà été supprimé par un thread concurrent
-            it = map.find(key);
+    const IndexElement* elem = found.get();
+
+    elem->hits.fetch_add(1, std::memory_order_relaxed);
+
+    // Gestion de la péremption du cache : l'élément obsolète sera remplacé lors de l'ajout de l'index relu
+    std::time_t age = std::time(NULL) - elem->date;
+    if (elem->missing) {
+        if (age > missing_validity) return false;
+    } else if (age > validity) {
+        // L'élément périmé peut encore être servi, le temps d'être rafraîchi en tâche de fond s'il est assez demandé
+        if (age > validity + stale_validity) return false;
+        if (elem->hits >= refresh_hits && ! elem->refreshing.exchange(true)) {
+            schedule_refresh(key, elem);
+        }
+    }
+
+    if (elem->missing) {
+        if (missing) *missing = true;
+        return false;
+    }
+
+    if (tile_number < 0 || tile_number >= elem->tiles_number) {
+        return false;
+    }
+
+    *data_slab_name = elem->name;
+    *data_context = elem->context;
+    *offset = elem->get_offset(tile_number);
+    *size = elem->get_size(tile_number);
+
+    // On fait le choix de ne pas remettre en tête du cache cet élément, même s'il vient d'être accéder
+    // C'est parce qu'en plus d'avoir une taille limite, les élément cachés ont une date de péromption
+    // Il serait donc dommage de remettre en avant (donc plus loin d'une suppression par taille de cache atteinte)
+    // un élément qui va de toute manière finir par être obsolète.
+    // C'est une différence avec une cache LRU classique
+    // Cela permet aussi de ne jamais modifier le cache lors d'une lecture
+
+    return true;
+}
+
+/**
+ * \~french \brief Écrit une chaîne (taille puis caractères) dans l'instantané
+ * \~english \brief Write a string (size then characters) in the snapshot
+ */
+static void write_string(std::ofstream& ofs, const std::string& str) {
+    uint32_t length = str.size();
+    ofs.write((char*) &length, sizeof(length));
+    ofs.write(str.data(), length);
+}
+
+/**
+ * \~french \brief Lit une chaîne (taille puis caractères) dans l'instantané
+ * \~english \brief Read a string (size then characters) from the snapshot
+ */
+static bool read_string(std::ifstream& ifs, std::string& str) {
+    uint32_t length;
+    if (! ifs.read((char*) &length, sizeof(length))) return false;
+    str.resize(length);
+    if (length > 0 && ! ifs.read(&str[0], length)) return false;
+    return true;
+}
+
+int IndexCache::save_snapshot(std::string path, int min_hits) {
+
+    // Identification des contextes de stockage par leur clé dans le StoragePool, pour pouvoir les recréer au chargement
+    std::map<Context*, std::pair<ContextType::eContextType, std::string> > contexts;
+    std::shared_ptr<const std::map<std::pair<ContextType::eContextType, std::string>, Context*> > pool = StoragePool::get_pool();
+    std::map<std::pair<ContextType::eContextType, std::string>, Context*>::const_iterator pit;
+    for (pit = pool->begin(); pit != pool->end(); ++pit) {
+        contexts[pit->second] = pit->first;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream ofs(tmp_path, std::ios::trunc | std::ios::binary);
+    if (! ofs.is_open()) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot open index cache snapshot file " << tmp_path;
+        return -1;
+    }
+
+    ofs.write(ROK4_INDEX_CACHE_SNAPSHOT_SIGNATURE, strlen(ROK4_INDEX_CACHE_SNAPSHOT_SIGNATURE));
 
-            if (it != map.end())
-            {
-                delete *(it->second);
-                cache.erase(it->second);
-                map.erase(it);
+    int count = 0;
+    for (int i = 0; i < ROK4_INDEX_CACHE_SHARDS; i++) {
+        // Du plus ancien au plus récent, pour retrouver le même ordre au chargement
+        std::vector<std::string> keys;
+        {
+            std::lock_guard<std::mutex> lock(shards[i].mtx);
+            Order::const_reverse_iterator oit;
+            for (oit = shards[i].order.rbegin(); oit != shards[i].order.rend(); ++oit) {
+                keys.push_back(oit->first);
             }
+        }
+
+        std::vector<std::string>::const_iterator kit;
+        for (kit = keys.begin(); kit != keys.end(); ++kit) {
+            std::shared_ptr<const IndexElement> found = find_element(*kit);
+            // Élément retiré depuis
+            if (! found) continue;
+            const IndexElement* elem = found.get();
+            if (elem->missing || elem->hits < min_hits) continue;
+
+            std::map<Context*, std::pair<ContextType::eContextType, std::string> >::iterator cit = contexts.find(elem->context);
+            if (cit == contexts.end()) continue;
+
+            uint8_t type = cit->second.first;
+            int64_t date = elem->date;
+            uint32_t hits = elem->hits;
+            uint32_t tiles_number = elem->tiles_number;
+
+            write_string(ofs, *kit);
+            ofs.write((char*) &type, sizeof(type));
+            write_string(ofs, cit->second.second);
+            write_string(ofs, elem->name);
+            ofs.write((char*) &date, sizeof(date));
+            ofs.write((char*) &hits, sizeof(hits));
+            ofs.write((char*) &tiles_number, sizeof(tiles_number));
+            ofs.write((char*) elem->tiles.get(), 2 * sizeof(uint32_t) * tiles_number);
+            count++;
+        }
+    }
+
+    ofs.close();
+    if (ofs.fail()) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot write index cache snapshot file " << tmp_path;
+        remove(tmp_path.c_str());
+        return -1;
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot rename index cache snapshot file " << tmp_path << " to " << path;
+        remove(tmp_path.c_str());
+        return -1;
+    }
+
+    BOOST_LOG_TRIVIAL(debug) << count << " index cache elements saved in " << path;
+    return count;
+}
+
+int IndexCache::load_snapshot(std::string path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (! ifs.is_open()) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot open index cache snapshot file " << path;
+        return -1;
+    }
+
+    size_t signature_size = strlen(ROK4_INDEX_CACHE_SNAPSHOT_SIGNATURE);
+    std::string signature(signature_size, '\0');
+    if (! ifs.read(&signature[0], signature_size) || signature != ROK4_INDEX_CACHE_SNAPSHOT_SIGNATURE) {
+        BOOST_LOG_TRIVIAL(error) << "File " << path << " is not an index cache snapshot";
+        return -1;
+    }
+
+    std::time_t now = std::time(NULL);
+    int count = 0;
+    while (ifs.peek() != EOF) {
+        std::string key, tray, name;
+        uint8_t type;
+        int64_t date;
+        uint32_t hits, tiles_number;
+
+        if (! read_string(ifs, key) || ! ifs.read((char*) &type, sizeof(type)) || ! read_string(ifs, tray) || ! read_string(ifs, name) ||
+            ! ifs.read((char*) &date, sizeof(date)) || ! ifs.read((char*) &hits, sizeof(hits)) || ! ifs.read((char*) &tiles_number, sizeof(tiles_number))) {
+            BOOST_LOG_TRIVIAL(error) << "Truncated index cache snapshot file " << path;
+            return -1;
+        }
 
-            mtx.unlock();
+        if (tiles_number > ROK4_INDEX_CACHE_SNAPSHOT_MAX_TILES) {
+            BOOST_LOG_TRIVIAL(error) << "Invalid tiles number (" << tiles_number << ") in index cache snapshot file " << path;
+            return -1;
+        }
 
-            return false;
+        std::shared_ptr<IndexElement> elem (new IndexElement(NULL, name, tiles_number, date));
+        if (! ifs.read((char*) elem->tiles.get(), 2 * sizeof(uint32_t) * tiles_number)) {
+            BOOST_LOG_TRIVIAL(error) << "Truncated index cache snapshot file " << path;
+            return -1;
         }
 
-        *data_slab_name = (*(it->second))->name;
-        *data_context = (*(it->second))->context;
-        *offset = (*(it->second))->offsets.at(tile_number);
-        *size = (*(it->second))->sizes.at(tile_number);
+        // Élément déjà définitivement périmé
+        if (now - date > validity + stale_validity) continue;
 
-        // On fait le choix de ne pas remettre en tête du cache cet élément, même s'il vient d'être accéder
-        // C'est parce qu'en plus d'avoir une taille limite, les élément cachés ont une date de péromption
-        // Il serait donc dommage de remettre en avant (donc plus loin d'une suppression par taille de cache atteinte)
-        // un élément qui va de toute manière finir par être obsolète.
-        // C'est une différence avec une cache LRU classique
+        elem->context = StoragePool::get_context((ContextType::eContextType) type, tray);
+        if (elem->context == NULL) {
+            BOOST_LOG_TRIVIAL(warning) << "Cannot get storage context for index cache element " << key;
+            continue;
+        }
+        elem->hits = hits;
 
-        return true;
+        add_element(key, elem);
+        count++;
     }
+
+    BOOST_LOG_TRIVIAL(debug) << count << " index cache elements loaded from " << path;
+    return count;
 }
 
 void IndexCache::clean_indexes() {
-    mtx.lock();
-    std::list<IndexElement*>::iterator it;
-    for (it = cache.begin(); it != cache.end(); ++it) {
-        delete *it;
+    for (int i = 0; i < ROK4_INDEX_CACHE_SHARDS; i++) {
+        std::lock_guard<std::mutex> lock(shards[i].mtx);
+        for (int b = 0; b < ROK4_INDEX_CACHE_BUCKETS; b++) {
+            const Bucket* current = shards[i].buckets[b].exchange(NULL);
+            if (current != NULL) shards[i].retired.push_back(current);
+        }
+        reclaim(shards[i]);
+        shards[i].order.clear();
+        shards[i].positions.clear();
+        shards[i].memory = 0;
     }
-    cache.clear();
-    mtx.unlock();
 }
 
-std::list<IndexElement *> IndexCache::cache;
-std::unordered_map<std::string, std::list<IndexElement *>::iterator> IndexCache::map;
-int IndexCache::size = 100;
-int IndexCache::validity = 300;
-std::mutex IndexCache::mtx;
+IndexCache::Shard IndexCache::shards[ROK4_INDEX_CACHE_SHARDS];
+std::atomic<int> IndexCache::size(100);
+std::atomic<int> IndexCache::shards_count(100 / ROK4_INDEX_CACHE_MIN_SHARD_SIZE);
+std::atomic<int> IndexCache::validity(300);
+std::atomic<int> IndexCache::missing_validity(60);
+std::atomic<size_t> IndexCache::memory_budget(0);
+std::atomic<int> IndexCache::stale_validity(0);
+std::atomic<int> IndexCache::refresh_hits(10);
+std::thread IndexCache::refresher;
+std::deque<IndexCache::RefreshTask> IndexCache::refresh_queue;
+bool IndexCache::refresh_stopping = false;
+std::mutex IndexCache::refresh_mtx;
+std::condition_variable IndexCache::refresh_cv;
+// Défini après le thread et son état pour être détruit avant eux
+IndexCache::Stopper IndexCache::stopper;
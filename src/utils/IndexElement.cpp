@@ -45,13 +45,26 @@
 
 #include "rok4/utils/IndexElement.h"
 
-IndexElement::IndexElement(std::string k, Context *c, std::string n, int tiles_number, uint8_t *os, uint8_t *ss) {
-    key = k;
+IndexElement::IndexElement(Context *c, std::string n, int tiles_number, uint8_t *os, uint8_t *ss) : tiles(new uint32_t[2 * tiles_number]), hits(0), refreshing(false) {
     context = c;
     name = n;
+    missing = false;
+    this->tiles_number = tiles_number;
     date = std::time(NULL);
     for (int i = 0; i < tiles_number; i++) {
-        offsets.push_back(*((uint32_t*) (os + i*4)));
-        sizes.push_back(*((uint32_t*) (ss + i*4)));
-    }        
-}
\ No newline at end of file
+        memcpy(tiles.get() + 2 * i, os + i * 4, 4);
+        memcpy(tiles.get() + 2 * i + 1, ss + i * 4, 4);
+    }
+}
+
+IndexElement::IndexElement(Context *c, std::string n, int tiles_number, std::time_t d) : tiles(new uint32_t[2 * tiles_number]), hits(0), refreshing(false) {
+    context = c;
+    name = n;
+    missing = false;
+    this->tiles_number = tiles_number;
+    date = d;
+}
+
+IndexElement::IndexElement() : context(NULL), missing(true), tiles_number(0), hits(0), refreshing(false) {
+    date = std::time(NULL);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file LatencyTracker.cpp
+ ** \~french
+ * \brief Implémentation de la classe LatencyTracker
+ ** \~english
+ * \brief Implements classe LatencyTracker
+ */
+
+#include "utils/LatencyTracker.h"
+
+#include <algorithm>
+
+LatencyTracker::LatencyTracker () : next(0), since_computing(0), computed_percentile(0), computed_value(-1) {
+    samples.reserve(ROK4_LATENCY_TRACKER_CAPACITY);
+}
+
+void LatencyTracker::add (int duration) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (samples.size() < ROK4_LATENCY_TRACKER_CAPACITY) {
+        samples.push_back(duration);
+    } else {
+        samples.at(next) = duration;
+    }
+    next = (next + 1) % ROK4_LATENCY_TRACKER_CAPACITY;
+    since_computing++;
+}
+
+int LatencyTracker::get_percentile (int percentile) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (samples.size() < ROK4_LATENCY_TRACKER_MIN_SAMPLES) return -1;
+
+    if (percentile < 1) percentile = 1;
+    if (percentile > 100) percentile = 100;
+
+    if (computed_value < 0 || percentile != computed_percentile || since_computing >= ROK4_LATENCY_TRACKER_REFRESH) {
+        std::vector<int> sorted(samples);
+        size_t rank = ((sorted.size() - 1) * percentile) / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        computed_value = sorted.at(rank);
+        computed_percentile = percentile;
+        since_computing = 0;
+    }
+
+    return computed_value;
+}
+
+int LatencyTracker::get_hedge_delay (int percentile, int min_delay) {
+    if (percentile <= 0) return -1;
+
+    int delay = get_percentile(percentile);
+    if (delay < 0) return -1;
+
+    return std::max(delay, min_delay);
+}
+
+int LatencyTracker::get_count () {
+    std::lock_guard<std::mutex> lock(mtx);
+    return samples.size();
+}
+
+LatencyTracker::~LatencyTracker () {
+
+}
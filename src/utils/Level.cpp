@@ -45,6 +45,7 @@
 #include "datasource/Decoder.h"
 #include "datastream/TiffEncoder.h"
 #include "datasource/TiffHeaderDataSource.h"
+#include "utils/DecodedTileCache.h"
 #include <cmath>
 #include <boost/log/trivial.hpp>
 #include "processors/Kernel.h"
@@ -105,6 +106,15 @@ Level::Level ( json11::Json doc, Pyramid* pyramid, std::string path) : Configura
         return;
     }
 
+    // Index des tuiles du niveau, optionnel
+    std::string tile_index_name = "";
+    if (doc["storage"]["tile_index"].is_string()) {
+        tile_index_name = doc["storage"]["tile_index"].string_value();
+    } else if (! doc["storage"]["tile_index"].is_null()) {
+        error_message = "Level " + id +": storage.tile_index have to be a string";
+        return;
+    }
+
     /******************* STOCKAGE FICHIER ? *********************/
 
     if (doc["storage"]["type"].string_value() == "FILE") {
@@ -140,6 +150,15 @@ Level::Level ( json11::Json doc, Pyramid* pyramid, std::string path) : Configura
 
         path_depth = doc["storage"]["path_depth"].number_value();
 
+        if ( tile_index_name != "" ) {
+            if ( tile_index_name.compare ( 0, 2, "./" ) == 0 ) {
+                tile_index_name.replace ( 0, 1, parent );
+            } else if ( tile_index_name.compare ( 0, 1, "/" ) != 0 ) {
+                tile_index_name.insert ( 0,"/" );
+                tile_index_name.insert ( 0, parent );
+            }
+        }
+
         context = StoragePool::get_context(ContextType::FILECONTEXT, "");
         if (context == NULL) {
             error_message = "Level " + id +": cannot add file storage context";
@@ -214,6 +233,14 @@ Level::Level ( json11::Json doc, Pyramid* pyramid, std::string path) : Configura
         return;
     }
 
+    if ( tile_index_name != "" ) {
+        // Un index absent ou illisible n'est pas bloquant : on lira alors les index des dalles
+        tile_index.reset ( TileIndex::load ( context, tile_index_name ) );
+        if ( ! tile_index ) {
+            BOOST_LOG_TRIVIAL(warning) << "Level " << id << ": cannot load tile index " << tile_index_name << ", slabs' indexes will be read";
+        }
+    }
+
     /******************* PYRAMIDE VECTEUR *********************/
     if (doc["tables"].is_array()) {
         for (json11::Json t : doc["tables"].array_items()) {
@@ -337,6 +364,7 @@ Level::Level ( Level* obj ) : Configuration(obj->file_path), tm_limits(obj->tm_l
     format = obj->format;
 
     context = obj->context;
+    tile_index = obj->tile_index;
 
     if (Rok4Format::is_raster(format)) {
         nodata_value = new int[channels];
@@ -347,6 +375,7 @@ Level::Level ( Level* obj ) : Configuration(obj->file_path), tm_limits(obj->tm_l
 }
 
 Level::~Level() {
+    if ( DecodedTileCache::is_enabled() ) DecodedTileCache::clean_level ( this );
     if (nodata_value != NULL) delete[] nodata_value;
 }
 
@@ -513,10 +542,27 @@ Image* Level::getwindow ( unsigned int max_tile_x, unsigned int max_tile_y, Boun
     memset ( bottom, 0, nby*sizeof ( int ) );
     bottom[nby- 1] = tm->get_tile_height() - euclideanDivisionRemainder ( bbox.ymax -1,tm->get_tile_height() ) - 1;
 
+    // Toutes les tuiles de la fenêtre sont lues en une fois, pour que le stockage puisse regrouper ou paralléliser les lectures
+    // Les tuiles déjà décodées récemment ne sont pas relues
+    std::vector<DataSource*> decoded ( nbx * nby, NULL );
+    std::vector<StoreDataSource*> sources ( nbx * nby, NULL );
+    for ( int y = 0; y < nby; y++ ) {
+        for ( int x = 0; x < nbx; x++ ) {
+            decoded[y * nbx + x] = get_cached_decoded_tile ( tile_xmin + x, tile_ymin + y );
+            if ( decoded[y * nbx + x] == NULL ) {
+                sources[y * nbx + x] = ( StoreDataSource* ) get_encoded_tile ( tile_xmin + x, tile_ymin + y );
+            }
+        }
+    }
+    StoreDataSource::get_all_data ( sources );
+
     std::vector<std::vector<Image*> > T ( nby, std::vector<Image*> ( nbx ) );
     for ( int y = 0; y < nby; y++ ) {
         for ( int x = 0; x < nbx; x++ ) {
-            T[y][x] = get_tile ( tile_xmin + x, tile_ymin + y, left[x], top[y], right[x], bottom[y] );
+            if ( decoded[y * nbx + x] == NULL ) {
+                decoded[y * nbx + x] = cache_decoded_tile ( decode_tile ( sources[y * nbx + x] ), tile_xmin + x, tile_ymin + y );
+            }
+            T[y][x] = tile_to_image ( decoded[y * nbx + x], tile_xmin + x, tile_ymin + y, left[x], top[y], right[x], bottom[y], false );
         }
     }
 
@@ -556,6 +602,18 @@ DataSource* Level::get_encoded_tile ( int x, int y ) { // TODO: return 0 sur des
         return NULL;
     }
 
+    // Avec l'index des tuiles du niveau, on connaît directement la dalle et la plage à lire
+    if ( tile_index ) {
+        std::string slab;
+        uint32_t offset, size;
+        if ( ! tile_index->get_tile ( x, y, slab, offset, size ) ) {
+            // Tuile absente
+            return NULL;
+        }
+        BOOST_LOG_TRIVIAL(debug) << slab;
+        return new StoreDataSource ( slab, context, offset, size, Rok4Format::to_mime_type ( format ), Rok4Format::to_encoding( format ) );
+    }
+
     //on stocke une dalle
     // Index de la tuile (cf. ordre de rangement des tuiles)
     int n = ( y % tiles_per_height ) * tiles_per_width + ( x % tiles_per_width );
@@ -568,8 +626,42 @@ DataSource* Level::get_encoded_tile ( int x, int y ) { // TODO: return 0 sur des
 }
 
 DataSource* Level::get_decoded_tile ( int x, int y ) {
+    DataSource* cached = get_cached_decoded_tile ( x, y );
+    if ( cached != NULL ) return cached;
+    return cache_decoded_tile ( decode_tile ( get_encoded_tile ( x, y ) ), x, y );
+}
+
+DataSource* Level::get_cached_decoded_tile ( int x, int y ) {
+    std::shared_ptr<DecodedTileElement> cached = DecodedTileCache::get_tile ( this, x, y );
+    if ( ! cached ) return NULL;
+    return new RawDataSource ( cached->data.get(), cached->size, cached );
+}
+
+DataSource* Level::cache_decoded_tile ( DataSource* decoded_data, int x, int y ) {
+
+    // Les tuiles brutes n'ont pas de décodage à épargner
+    if ( decoded_data == NULL || ! DecodedTileCache::is_enabled() ||
+         format == Rok4Format::TIFF_RAW_UINT8 || format == Rok4Format::TIFF_RAW_FLOAT32 ) {
+        return decoded_data;
+    }
+
+    size_t size;
+    const uint8_t* data = decoded_data->get_data ( size );
+    if ( data == NULL ) {
+        delete decoded_data;
+        return NULL;
+    }
+
+    uint8_t* copy = new uint8_t[size];
+    memcpy ( copy, data, size );
+    delete decoded_data;
+
+    std::shared_ptr<DecodedTileElement> elem = DecodedTileCache::add_tile ( this, x, y, copy, size );
+    return new RawDataSource ( elem->data.get(), elem->size, elem );
+}
+
+DataSource* Level::decode_tile ( DataSource* encoded_data ) {
 
-    DataSource* encoded_data = get_encoded_tile ( x, y );
     if (encoded_data == NULL) return 0;
 
     size_t size;
@@ -620,13 +712,15 @@ DataSource* Level::get_tile (int x, int y) {
 }
 
 Image* Level::get_tile ( int x, int y, int left, int top, int right, int bottom, bool null_for_nodata ) {
-    int pixel_size=1;
     BOOST_LOG_TRIVIAL(debug) <<  "GetTile Image"  ;
+    return tile_to_image ( get_decoded_tile ( x,y ), x, y, left, top, right, bottom, null_for_nodata );
+}
+
+Image* Level::tile_to_image ( DataSource* ds, int x, int y, int left, int top, int right, int bottom, bool null_for_nodata ) {
+    int pixel_size=1;
     if ( format==Rok4Format::TIFF_RAW_FLOAT32 || format == Rok4Format::TIFF_LZW_FLOAT32 || format == Rok4Format::TIFF_ZIP_FLOAT32 || format == Rok4Format::TIFF_PKB_FLOAT32 )
         pixel_size=4;
 
-    DataSource* ds = get_decoded_tile ( x,y );
-
     BoundingBox<double> bb ( 
         tm->get_x0() + x * tm->get_tile_width() * tm->get_res() + left * tm->get_res(),
         tm->get_y0() - ( y+1 ) * tm->get_tile_height() * tm->get_res() + bottom * tm->get_res(),
@@ -0,0 +1,195 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file MappedFileCache.cpp
+ ** \~french
+ * \brief Implémentation de la classe MappedFileCache
+ ** \~english
+ * \brief Implements classe MappedFileCache
+ */
+
+#include "rok4/utils/MappedFileCache.h"
+#include "rok4/utils/Utils.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <boost/log/trivial.hpp>
+
+MappedFile::~MappedFile() {
+    munmap((void*) data, size);
+}
+
+MappedFileCache::MappedFileCache() {
+
+}
+
+MappedFileCache::~MappedFileCache() {
+
+}
+
+void MappedFileCache::set_size(int s) {
+    mtx.lock();
+    size = s;
+    while (lru.size() > 0 && lru.size() > size) {
+        map.erase(lru.back());
+        lru.pop_back();
+    }
+    mtx.unlock();
+}
+
+void MappedFileCache::set_validity(int v) {
+    validity = v;
+}
+
+std::shared_ptr<MappedFile> MappedFileCache::map_file(std::string path) {
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        BOOST_LOG_TRIVIAL(debug) << "Can't open file " << path;
+        return NULL;
+    }
+
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || st.st_size == 0 ) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // La projection reste valide après la fermeture du descripteur
+    close(fd);
+
+    if ( data == MAP_FAILED ) {
+        BOOST_LOG_TRIVIAL(error) << "Can't map file " << path << ", error code " << errno;
+        return NULL;
+    }
+
+    // Les tuiles sont lues de manière dispersée dans la dalle, la lecture anticipée du système serait en grande partie inutile
+    madvise(data, st.st_size, MADV_RANDOM);
+
+    return std::make_shared<MappedFile>((const uint8_t*) data, st.st_size, st.st_dev, st.st_ino);
+}
+
+std::shared_ptr<MappedFile> MappedFileCache::get_mapping(std::string path) {
+
+    if (size <= 0) {
+        return NULL;
+    }
+
+    std::shared_ptr<MappedFile> mf;
+
+    mtx.lock();
+    auto it = map.find(path);
+    if (it != map.end()) {
+        mf = it->second.first;
+        lru.splice(lru.begin(), lru, it->second.second);
+    }
+    mtx.unlock();
+
+    if (mf) {
+        std::time_t now = std::time(NULL);
+        if (now - mf->checked <= validity) {
+            return mf;
+        }
+
+        struct stat st;
+        if ( stat(path.c_str(), &st) == 0 && st.st_dev == mf->device && st.st_ino == mf->inode && st.st_size == mf->size ) {
+            mf->checked = now;
+            return mf;
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "File " << path << " changed since mapping, mapping is dropped";
+        mtx.lock();
+        it = map.find(path);
+        if (it != map.end() && it->second.first == mf) {
+            lru.erase(it->second.second);
+            map.erase(it);
+        }
+        mtx.unlock();
+    }
+
+    mf = map_file(path);
+    if (! mf) {
+        return NULL;
+    }
+
+    mtx.lock();
+    it = map.find(path);
+    if (it != map.end()) {
+        // Un thread concurrent a projeté le même fichier : on garde la projection la plus récente
+        lru.erase(it->second.second);
+        map.erase(it);
+    }
+    while (! lru.empty() && lru.size() >= size) {
+        // La projection n'est réellement supprimée que lorsque les sources qui l'utilisent l'ont relâchée
+        map.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(path);
+    map[path] = std::make_pair(mf, lru.begin());
+    mtx.unlock();
+
+    return mf;
+}
+
+void MappedFileCache::invalidate(std::string path) {
+    mtx.lock();
+    auto it = map.find(path);
+    if (it != map.end()) {
+        lru.erase(it->second.second);
+        map.erase(it);
+    }
+    mtx.unlock();
+}
+
+void MappedFileCache::clean_mappings() {
+    mtx.lock();
+    map.clear();
+    lru.clear();
+    mtx.unlock();
+}
+
+std::list<std::string> MappedFileCache::lru;
+std::unordered_map<std::string, std::pair<std::shared_ptr<MappedFile>, std::list<std::string>::iterator> > MappedFileCache::map;
+int MappedFileCache::size = env_or_default(ROK4_FILE_MAPPINGS_CACHE_SIZE, 0);
+int MappedFileCache::validity = env_or_default(ROK4_FILE_MAPPINGS_CACHE_VALIDITY, 10);
+std::mutex MappedFileCache::mtx;
@@ -0,0 +1,147 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file SingleFlight.cpp
+ ** \~french
+ * \brief Implémentation de la classe SingleFlight
+ ** \~english
+ * \brief Implements classe SingleFlight
+ */
+
+#include <sstream>
+#include <string.h>
+#include <boost/log/trivial.hpp>
+
+#include "rok4/utils/SingleFlight.h"
+#include "rok4/utils/Utils.h"
+
+std::string SingleFlight::key(Context* context, ReadRange& range) {
+    std::ostringstream oss;
+    oss << (void*) context << "|" << range.offset << "|" << range.size << "|" << range.name;
+    return oss.str();
+}
+
+bool SingleFlight::read_ranges(Context* context, std::vector<ReadRange>& ranges) {
+
+    if (! enabled || context->get_type() == ContextType::FILECONTEXT) {
+        return context->read_ranges(ranges);
+    }
+
+    // Répartition entre les portions à lire nous-même et celles déjà en cours de lecture
+    std::vector<ReadRange> to_read;
+    std::vector<int> to_read_indices;
+    std::vector<std::pair<std::string, std::shared_ptr<Flight> > > led;
+    std::vector<std::pair<int, std::pair<std::string, std::shared_ptr<Flight> > > > followed;
+
+    for (int i = 0; i < ranges.size(); i++) {
+        std::string k = key(context, ranges.at(i));
+        Shard& shard = get_shard(k);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+
+        // Une portion demandée plusieurs fois dans le même lot y est aussi trouvée : une seule lecture
+        std::unordered_map<std::string, std::shared_ptr<Flight> >::iterator it = shard.flights.find(k);
+        if (it != shard.flights.end()) {
+            it->second->followers++;
+            followed.push_back(std::make_pair(i, *it));
+            continue;
+        }
+
+        std::shared_ptr<Flight> f = std::make_shared<Flight>();
+        shard.flights.insert(std::make_pair(k, f));
+        led.push_back(std::make_pair(k, f));
+        to_read.push_back(ranges.at(i));
+        to_read_indices.push_back(i);
+    }
+
+    bool ok = true;
+    if (! to_read.empty()) {
+        ok = context->read_ranges(to_read);
+    }
+
+    if (! followed.empty()) {
+        BOOST_LOG_TRIVIAL(debug) << followed.size() << " read(s) shared with another one";
+    }
+
+    // Publication des résultats, avant toute attente
+    for (int i = 0; i < to_read.size(); i++) {
+        ReadRange& r = to_read.at(i);
+        ranges.at(to_read_indices.at(i)).read_size = r.read_size;
+
+        Shard& shard = get_shard(led.at(i).first);
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            std::shared_ptr<Flight> f = led.at(i).second;
+            f->read_size = r.read_size;
+            f->done = true;
+            if (r.read_size > 0 && f->followers > 0) {
+                // La donnée n'est copiée que si quelqu'un l'attend
+                f->data.assign(r.data, r.data + r.read_size);
+            }
+            shard.flights.erase(led.at(i).first);
+        }
+        shard.cv.notify_all();
+    }
+
+    if (followed.empty()) {
+        return ok;
+    }
+
+    shared_count += followed.size();
+
+    for (int i = 0; i < followed.size(); i++) {
+        Shard& shard = get_shard(followed.at(i).second.first);
+        std::shared_ptr<Flight> f = followed.at(i).second.second;
+        std::unique_lock<std::mutex> lock(shard.mtx);
+        shard.cv.wait(lock, [&f] { return f->done; });
+
+        ReadRange& r = ranges.at(followed.at(i).first);
+        r.read_size = f->read_size;
+        if (r.read_size < 0) {
+            ok = false;
+        } else if (r.read_size > 0) {
+            memcpy(r.data, f->data.data(), r.read_size);
+        }
+    }
+
+    return ok;
+}
+
+SingleFlight::Shard SingleFlight::shards[ROK4_SINGLE_FLIGHT_SHARDS];
+std::atomic<bool> SingleFlight::enabled(env_or_default(ROK4_SINGLE_FLIGHT_READS, 1) != 0);
+std::atomic<long> SingleFlight::shared_count(0);
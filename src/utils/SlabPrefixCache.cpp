@@ -0,0 +1,158 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+/**
+ * \file SlabPrefixCache.cpp
+ ** \~french
+ * \brief Implémentation de la classe SlabPrefixCache
+ ** \~english
+ * \brief Implements classe SlabPrefixCache
+ */
+
+#include <sstream>
+#include <boost/log/trivial.hpp>
+
+#include "rok4/utils/SlabPrefixCache.h"
+#include "rok4/utils/Utils.h"
+
+SlabPrefixCache::SlabPrefixCache() {
+
+}
+
+SlabPrefixCache::~SlabPrefixCache() {
+
+}
+
+void SlabPrefixCache::set_prefix_size(int s) {
+    prefix_size = s;
+}
+
+void SlabPrefixCache::set_validity(int v) {
+    validity = v;
+}
+
+void SlabPrefixCache::set_capacity(int c) {
+    capacity = c;
+}
+
+std::string SlabPrefixCache::key(Context* context, std::string name) {
+    std::ostringstream oss;
+    oss << (void*) context << "|" << name;
+    return oss.str();
+}
+
+void SlabPrefixCache::remove(std::string key) {
+    std::unordered_map<std::string, std::pair<std::shared_ptr<SlabPrefix>, std::list<std::string>::iterator> >::iterator it = prefixes.find(key);
+    if (it == prefixes.end()) return;
+    lru.erase(it->second.second);
+    prefixes.erase(it);
+}
+
+int SlabPrefixCache::get_read_size(Context* context, int header_index_size) {
+    // Sur fichier, une lecture supplémentaire ne coûte pas un aller-retour réseau : on ne lit que l'en-tête et l'index
+    int s = prefix_size;
+    if (s <= header_index_size || context->get_type() == ContextType::FILECONTEXT) {
+        return header_index_size;
+    }
+    return s;
+}
+
+std::shared_ptr<SlabPrefix> SlabPrefixCache::get_prefix(Context* context, std::string name) {
+    if (prefix_size <= 0) {
+        return std::shared_ptr<SlabPrefix>();
+    }
+
+    std::string k = key(context, name);
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    std::unordered_map<std::string, std::pair<std::shared_ptr<SlabPrefix>, std::list<std::string>::iterator> >::iterator it = prefixes.find(k);
+    if (it == prefixes.end()) {
+        return std::shared_ptr<SlabPrefix>();
+    }
+
+    if (std::time(NULL) - it->second.first->date > validity) {
+        // Début de dalle périmé : les tuiles seront lues depuis le stockage
+        remove(k);
+        return std::shared_ptr<SlabPrefix>();
+    }
+
+    lru.splice(lru.begin(), lru, it->second.second);
+    return it->second.first;
+}
+
+std::shared_ptr<SlabPrefix> SlabPrefixCache::add_prefix(Context* context, std::string name, uint8_t* data, size_t data_size) {
+    std::shared_ptr<SlabPrefix> elem = std::make_shared<SlabPrefix>(data, data_size);
+
+    if (capacity <= 0) {
+        return elem;
+    }
+
+    std::string k = key(context, name);
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    remove(k);
+    while (! lru.empty() && lru.size() >= capacity) {
+        remove(lru.back());
+    }
+
+    lru.push_front(k);
+    prefixes.insert(std::make_pair(k, std::make_pair(elem, lru.begin())));
+
+    BOOST_LOG_TRIVIAL(debug) << "Slab beginning cached : " << data_size << " bytes of " << context->get_path(name);
+
+    return elem;
+}
+
+int SlabPrefixCache::get_count() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return prefixes.size();
+}
+
+void SlabPrefixCache::clean_prefixes() {
+    std::lock_guard<std::mutex> lock(mtx);
+    lru.clear();
+    prefixes.clear();
+}
+
+std::list<std::string> SlabPrefixCache::lru;
+std::unordered_map<std::string, std::pair<std::shared_ptr<SlabPrefix>, std::list<std::string>::iterator> > SlabPrefixCache::prefixes;
+std::mutex SlabPrefixCache::mtx;
+std::atomic<int> SlabPrefixCache::prefix_size(env_or_default(ROK4_SLAB_PREFIX_SIZE, 0));
+std::atomic<int> SlabPrefixCache::validity(env_or_default(ROK4_SLAB_PREFIX_VALIDITY, 10));
+std::atomic<int> SlabPrefixCache::capacity(env_or_default(ROK4_SLAB_PREFIX_COUNT, 64));
@@ -44,22 +44,26 @@
  */
 
 #include "utils/StoragePool.h"
+#include "utils/IndexCache.h"
 #include "storage/FileContext.h"
 #include "storage/SwiftContext.h"
 #include "storage/S3Context.h"
+#include "storage/CachedContext.h"
 
 StoragePool::StoragePool(){
 
 }
 
 std::string StoragePool::to_string() {
+        std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > current = get_pool();
+
         std::ostringstream oss;
         oss.setf ( std::ios::fixed,std::ios::floatfield );
         oss << "------ Context pool -------" << std::endl;
-        oss << "\t- context number = " << pool.size() << std::endl;
+        oss << "\t- context number = " << current->size() << std::endl;
 
-        std::map<std::pair<ContextType::eContextType,std::string>, Context*>::iterator it = pool.begin();
-        while (it != pool.end()) {
+        std::map<std::pair<ContextType::eContextType,std::string>, Context*>::const_iterator it = current->begin();
+        while (it != current->end()) {
             std::pair<ContextType::eContextType,std::string> key = it->first;
             oss << "\t\t- pot = " << key.first << "/" << key.second << std::endl;
             oss << it->second->to_string() << std::endl;
@@ -76,8 +80,9 @@ void StoragePool::get_storages_count (int& file_count, int& s3_count, int& ceph_
         s3_count = 0;
         ceph_count = 0;
         swift_count = 0;
-        std::map<std::pair<ContextType::eContextType,std::string>, Context*>::iterator it = pool.begin();
-        while (it != pool.end()) {
+        std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > current = get_pool();
+        std::map<std::pair<ContextType::eContextType,std::string>, Context*>::const_iterator it = current->begin();
+        while (it != current->end()) {
             std::pair<ContextType::eContextType,std::string> key = it->first;
             switch(key.first) {
                 #if CEPH_ENABLED
@@ -99,8 +104,8 @@ void StoragePool::get_storages_count (int& file_count, int& s3_count, int& ceph_
         }
     }
 
-std::map<std::pair<ContextType::eContextType,std::string>,Context*> StoragePool::get_pool() {
-        return pool;
+std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > StoragePool::get_pool() {
+        return std::atomic_load(&pool);
     }
 
 StoragePool::~StoragePool(){
@@ -109,15 +114,60 @@ StoragePool::~StoragePool(){
 
 
 void StoragePool::clean_storages () {
-    std::map<std::pair<ContextType::eContextType,std::string>,Context*>::iterator it;
-    for (it=pool.begin(); it!=pool.end(); ++it) {
+    // Le rafraîchissement des index en tâche de fond utilise les contextes
+    IndexCache::stop_refresher();
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > current = std::atomic_load(&pool);
+    std::atomic_store(&pool, std::make_shared<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> >());
+
+    std::map<std::pair<ContextType::eContextType,std::string>,Context*>::const_iterator it;
+    for (it=current->begin(); it!=current->end(); ++it) {
         delete it->second;
-        it->second = NULL;
     }
 }
 
-Context * StoragePool::get_context(ContextType::eContextType type, std::string tray, Context* reference_context) {
+Context* StoragePool::create_context(ContextType::eContextType type, std::string tray) {
+    Context* ctx;
+
+    // on créé le context selon le type de stockage
+    switch(type){
+#if CEPH_ENABLED
+        case ContextType::CEPHCONTEXT:
+            ctx = new CephPoolContext(tray);
+            break;
+#endif
+        case ContextType::SWIFTCONTEXT:
+            ctx = new SwiftContext(tray);
+            break;
+        case ContextType::S3CONTEXT:
+            ctx = new S3Context(tray);
+            break;
+        case ContextType::FILECONTEXT:
+            ctx = new FileContext(tray);
+            break;
+        default:
+            BOOST_LOG_TRIVIAL(error) << "Unhandled storage context type";
+            return NULL;
+    }
+
+    // Les contextes objet peuvent être précédés d'un cache disque local
+    if (type != ContextType::FILECONTEXT && CachedContext::is_enabled()) {
+        ctx = new CachedContext(ctx);
+    }
+
+    // on connecte pour vérifier que ce contexte est valide
+    if (! ctx->connection()) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot connect " << ContextType::to_string(type) << " storage context, tray '" << tray << "'";
+        delete ctx;
+        return NULL;
+    }
 
+    return ctx;
+}
+
+Context * StoragePool::get_context(ContextType::eContextType type, std::string tray, Context* reference_context) {
     if (reference_context != 0 && reference_context->get_type() != type) {
         BOOST_LOG_TRIVIAL(error) << "Asked storage context and reference one have to own the same type";
         return NULL;
@@ -143,56 +193,67 @@ Context * StoragePool::get_context(ContextType::eContextType type, std::string t
                 }
             } else {
                 // On ajoute le nom du cluster au nom du bucket
-                cluster_name = ((S3Context *)reference_context)->getCluster();
+                cluster_name = ((S3Context *)reference_context->get_origin())->getCluster();
             }
 
             tray = tray + "@" + cluster_name;
         }
     }
 
-    Context* ctx;
     std::pair<ContextType::eContextType,std::string> key = make_pair(type,tray);
 
-    std::map<std::pair<ContextType::eContextType,std::string>, Context*>::iterator it = pool.find (key);
-    if ( it != pool.end() ) {
-        // le contenant est déjà existant et donc connecté
+    // Recherche sans verrou dans l'instantané courant : le contenant est déjà existant et donc connecté
+    std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > current = std::atomic_load(&pool);
+    std::map<std::pair<ContextType::eContextType,std::string>, Context*>::const_iterator it = current->find (key);
+    if ( it != current->end() ) {
         return it->second;
+    }
 
-    } else {
-        // ce contenant n'est pas encore connecté, on va créer la connexion
-        // on créé le context selon le type de stockage
-        switch(type){
-#if CEPH_ENABLED
-            case ContextType::CEPHCONTEXT:
-                ctx = new CephPoolContext(tray);
-                break;
-#endif
-            case ContextType::SWIFTCONTEXT:
-                ctx = new SwiftContext(tray);
-                break;
-            case ContextType::S3CONTEXT:
-                ctx = new S3Context(tray);
-                break;
-            case ContextType::FILECONTEXT:
-                ctx = new FileContext(tray);
-                break;
-            default:
-                BOOST_LOG_TRIVIAL(error) << "Unhandled storage context type";
-                return NULL;
+    // ce contenant n'est pas encore connecté : un seul thread crée la connexion, les autres attendent son résultat
+    std::promise<Context*> created;
+    std::shared_future<Context*> pending;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        current = std::atomic_load(&pool);
+        it = current->find (key);
+        if ( it != current->end() ) {
+            return it->second;
         }
 
-        // on connecte pour vérifier que ce contexte est valide
-        if (! ctx->connection()) {
-            BOOST_LOG_TRIVIAL(error) << "Cannot connect " << ContextType::to_string(type) << " storage context, tray '" << tray << "'";
-            delete ctx;
-            return NULL;
+        std::map<std::pair<ContextType::eContextType,std::string>, std::shared_future<Context*> >::iterator cit = creating.find (key);
+        if ( cit != creating.end() ) {
+            pending = cit->second;
+        } else {
+            creating.insert(make_pair(key, created.get_future().share()));
         }
+    }
+
+    if (pending.valid()) {
+        return pending.get();
+    }
 
-        BOOST_LOG_TRIVIAL(debug) << "Add storage context " << ContextType::to_string(type) << ", tray '" << tray << "'";
-        pool.insert(make_pair(key,ctx));
+    // La création et la connexion se font hors verrou
+    Context* ctx = create_context(type, tray);
 
-        return ctx;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (ctx != NULL) {
+            BOOST_LOG_TRIVIAL(debug) << "Add storage context " << ContextType::to_string(type) << ", tray '" << tray << "'";
+            std::map<std::pair<ContextType::eContextType,std::string>,Context*>* updated = new std::map<std::pair<ContextType::eContextType,std::string>,Context*>(*std::atomic_load(&pool));
+            updated->insert(make_pair(key,ctx));
+            std::atomic_store(&pool, std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> >(updated));
+        }
+
+        // En cas d'échec, une demande ultérieure retentera la création
+        creating.erase(key);
     }
+    created.set_value(ctx);
+
+    return ctx;
 }
 
-std::map<std::pair<ContextType::eContextType,std::string>,Context*> StoragePool::pool;
\ No newline at end of file
+std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > StoragePool::pool = std::make_shared<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> >();
+std::map<std::pair<ContextType::eContextType,std::string>,std::shared_future<Context*> > StoragePool::creating;
+std::mutex StoragePool::mtx;
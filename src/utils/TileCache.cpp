@@ -0,0 +1,158 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file TileCache.cpp
+ ** \~french
+ * \brief Implémentation de la classe TileCache
+ ** \~english
+ * \brief Implements classe TileCache
+ */
+
+#include <sstream>
+#include <string.h>
+#include <boost/log/trivial.hpp>
+
+#include "rok4/utils/TileCache.h"
+#include "rok4/utils/Utils.h"
+
+TileCache::FrequencySketch::FrequencySketch() : samples(0) {
+    memset(counters, 0, sizeof(counters));
+}
+
+TileCache::TileCache() {
+
+}
+
+TileCache::~TileCache() {
+
+}
+
+void TileCache::set_memory_budget(size_t b) {
+    cache.set_memory_budget(b);
+}
+
+void TileCache::set_validity(int v) {
+    cache.set_validity(v);
+}
+
+std::string TileCache::key(Context* context, std::string name, uint32_t offset, uint32_t size) {
+    std::ostringstream oss;
+    oss << (void*) context << "|" << offset << "|" << size << "|" << name;
+    return oss.str();
+}
+
+/**
+ * \~french \brief Mélange d'un hash (splitmix64), pour dériver les positions dans les lignes de l'esquisse
+ * \~english \brief Hash mixing (splitmix64), to derive positions in sketch rows
+ */
+static uint64_t mix(uint64_t h) {
+    h += 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+void TileCache::FrequencySketch::record_access(size_t hash) {
+    for (int row = 0; row < 4; row++) {
+        uint64_t index = mix(hash + row) & (ROK4_TILE_CACHE_SKETCH_WIDTH - 1);
+        uint8_t& cell = counters[row][index / 2];
+        int shift = (index & 1) * 4;
+        if (((cell >> shift) & 0x0F) < 15) {
+            cell += (1 << shift);
+        }
+    }
+
+    // Vieillissement : tous les compteurs sont divisés par deux, pour que l'esquisse reflète la popularité récente
+    if (++samples >= 10 * ROK4_TILE_CACHE_SKETCH_WIDTH) {
+        for (int row = 0; row < 4; row++) {
+            for (int i = 0; i < ROK4_TILE_CACHE_SKETCH_WIDTH / 2; i++) {
+                counters[row][i] = (counters[row][i] >> 1) & 0x77;
+            }
+        }
+        samples /= 2;
+    }
+}
+
+int TileCache::FrequencySketch::estimate_frequency(size_t hash) {
+    int frequency = 15;
+    for (int row = 0; row < 4; row++) {
+        uint64_t index = mix(hash + row) & (ROK4_TILE_CACHE_SKETCH_WIDTH - 1);
+        int count = (counters[row][index / 2] >> ((index & 1) * 4)) & 0x0F;
+        if (count < frequency) frequency = count;
+    }
+    return frequency;
+}
+
+bool TileCache::FrequencySketch::admit(size_t candidate, size_t victim) {
+    return estimate_frequency(victim) < estimate_frequency(candidate);
+}
+
+void TileCache::FrequencySketch::clear() {
+    memset(counters, 0, sizeof(counters));
+    samples = 0;
+}
+
+std::shared_ptr<TileCacheElement> TileCache::get_tile(Context* context, std::string name, uint32_t offset, uint32_t size) {
+    if (! is_enabled()) {
+        return std::shared_ptr<TileCacheElement>();
+    }
+    return cache.get(key(context, name, offset, size));
+}
+
+std::shared_ptr<TileCacheElement> TileCache::add_tile(Context* context, std::string name, uint32_t offset, uint32_t size, uint8_t* data, size_t data_size) {
+    std::shared_ptr<TileCacheElement> elem = std::make_shared<TileCacheElement>(data, data_size);
+
+    if (is_enabled() && ! cache.add(key(context, name, offset, size), elem)) {
+        BOOST_LOG_TRIVIAL(debug) << "Tile " << context->get_path(name) << " (" << offset << "," << size << ") not admitted in cache";
+    }
+
+    return elem;
+}
+
+size_t TileCache::get_memory() {
+    return cache.get_memory();
+}
+
+void TileCache::clean_tiles() {
+    cache.clean();
+}
+
+ShardedLruCache<std::string, TileCacheElement, ROK4_TILE_CACHE_SHARDS, TileCache::FrequencySketch> TileCache::cache(
+    env_or_default(ROK4_TILE_CACHE_MEMORY, 0), env_or_default(ROK4_TILE_CACHE_VALIDITY, 300)
+);
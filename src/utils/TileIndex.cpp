@@ -0,0 +1,247 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+/**
+ * \file TileIndex.cpp
+ ** \~french
+ * \brief Implémentation de la classe TileIndex
+ ** \~english
+ * \brief Implements classe TileIndex
+ */
+
+#include <string.h>
+#include <climits>
+
+#include "rok4/utils/TileIndex.h"
+
+TileIndex::TileIndex () : min_col(0), min_row(0), cols(0), rows(0), entries(NULL), writable_entries(NULL) { }
+
+TileIndex::TileIndex ( int min_col, int min_row, int cols, int rows ) : min_col(min_col), min_row(min_row), cols(cols), rows(rows) {
+    if (this->cols < 0) this->cols = 0;
+    if (this->rows < 0) this->rows = 0;
+    size_t count = 3 * (size_t) this->cols * this->rows;
+    writable_entries = new uint32_t[count];
+    memset(writable_entries, 0, count * sizeof(uint32_t));
+    owner = std::shared_ptr<void>(writable_entries, std::default_delete<uint32_t[]>());
+    entries = writable_entries;
+}
+
+TileIndex* TileIndex::load ( Context* context, std::string name ) {
+
+    uint8_t header[ROK4_TILE_INDEX_HEADER_SIZE];
+    if (context->read(header, 0, ROK4_TILE_INDEX_HEADER_SIZE, name) != ROK4_TILE_INDEX_HEADER_SIZE) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot read tile index header " << name;
+        return NULL;
+    }
+
+    size_t signature_size = strlen(ROK4_TILE_INDEX_SIGNATURE);
+    if (memcmp(header, ROK4_TILE_INDEX_SIGNATURE, signature_size) != 0) {
+        BOOST_LOG_TRIVIAL(error) << "Object " << name << " is not a tile index";
+        return NULL;
+    }
+
+    int32_t values[6];
+    memcpy(values, header + signature_size, sizeof(values));
+    int32_t slabs_count = values[4];
+    int32_t names_size = values[5];
+
+    if (values[2] <= 0 || values[3] <= 0 || slabs_count < 0 || names_size < 0 || names_size % 4 != 0) {
+        BOOST_LOG_TRIVIAL(error) << "Invalid tile index header " << name;
+        return NULL;
+    }
+
+    size_t entries_size = 3 * sizeof(uint32_t) * (size_t) values[2] * values[3];
+    if (entries_size > INT_MAX || ROK4_TILE_INDEX_HEADER_SIZE + (size_t) names_size > INT_MAX - entries_size) {
+        BOOST_LOG_TRIVIAL(error) << "Tile index " << name << " is too big (" << values[2] << "x" << values[3] << " tiles)";
+        return NULL;
+    }
+
+    TileIndex* ti = new TileIndex();
+    ti->min_col = values[0];
+    ti->min_row = values[1];
+    ti->cols = values[2];
+    ti->rows = values[3];
+
+    // Table des noms de dalles
+    if (names_size > 0) {
+        std::vector<char> names (names_size);
+        if (context->read((uint8_t*) names.data(), ROK4_TILE_INDEX_HEADER_SIZE, names_size, name) != names_size) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot read tile index slabs names " << name;
+            delete ti;
+            return NULL;
+        }
+        int start = 0;
+        for (int i = 0; i < names_size && ti->slabs.size() < (size_t) slabs_count; i++) {
+            if (names[i] == '\0') {
+                ti->slabs.push_back(std::string(names.data() + start, i - start));
+                start = i + 1;
+            }
+        }
+    }
+
+    if (ti->slabs.size() != (size_t) slabs_count) {
+        BOOST_LOG_TRIVIAL(error) << "Inconsistent slabs count in tile index " << name;
+        delete ti;
+        return NULL;
+    }
+
+    // Entrées des tuiles : projection mémoire si possible, lecture en une fois sinon
+    int entries_offset = ROK4_TILE_INDEX_HEADER_SIZE + names_size;
+    const uint8_t* view = context->read_view(ti->owner, entries_offset, entries_size, name);
+    if (view != NULL) {
+        ti->entries = (const uint32_t*) view;
+    } else {
+        uint32_t* buffer = new uint32_t[entries_size / sizeof(uint32_t)];
+        ti->owner = std::shared_ptr<void>(buffer, std::default_delete<uint32_t[]>());
+        if (context->read((uint8_t*) buffer, entries_offset, entries_size, name) != (int) entries_size) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot read tile index entries " << name;
+            delete ti;
+            return NULL;
+        }
+        ti->entries = buffer;
+    }
+
+    BOOST_LOG_TRIVIAL(debug) << "Tile index " << name << " loaded : " << ti->cols << "x" << ti->rows << " tiles in " << slabs_count << " slabs";
+
+    return ti;
+}
+
+void TileIndex::add_slab ( std::string name, int col, int row, int tiles_widthwise, int tiles_heightwise, const uint32_t* offsets, const uint32_t* sizes ) {
+    if (writable_entries == NULL) {
+        BOOST_LOG_TRIVIAL(error) << "Cannot add slab " << name << " to a loaded tile index";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    uint32_t id;
+    std::map<std::string, uint32_t>::iterator it = slabs_ids.find(name);
+    if (it == slabs_ids.end()) {
+        id = slabs.size();
+        slabs.push_back(name);
+        slabs_ids.insert(std::pair<std::string, uint32_t>(name, id));
+    } else {
+        id = it->second;
+    }
+
+    for (int j = 0; j < tiles_heightwise; j++) {
+        int r = row + j - min_row;
+        if (r < 0 || r >= rows) continue;
+        for (int i = 0; i < tiles_widthwise; i++) {
+            int c = col + i - min_col;
+            if (c < 0 || c >= cols) continue;
+
+            int n = j * tiles_widthwise + i;
+            if (sizes[n] == 0) continue;
+
+            uint32_t* entry = writable_entries + 3 * ((size_t) r * cols + c);
+            entry[0] = id + 1;
+            entry[1] = offsets[n];
+            entry[2] = sizes[n];
+        }
+    }
+}
+
+bool TileIndex::write ( Context* context, std::string name ) {
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    std::string names;
+    for (size_t i = 0; i < slabs.size(); i++) {
+        names.append(slabs.at(i));
+        names.push_back('\0');
+    }
+    // Les entrées restent alignées sur 4 octets
+    while (names.size() % 4 != 0) names.push_back('\0');
+
+    size_t entries_size = 3 * sizeof(uint32_t) * (size_t) cols * rows;
+    size_t total_size = ROK4_TILE_INDEX_HEADER_SIZE + names.size() + entries_size;
+    if (total_size > INT_MAX) {
+        BOOST_LOG_TRIVIAL(error) << "Tile index " << name << " is too big (" << total_size << " bytes)";
+        return false;
+    }
+
+    std::vector<uint8_t> buffer (total_size);
+    size_t signature_size = strlen(ROK4_TILE_INDEX_SIGNATURE);
+    memcpy(buffer.data(), ROK4_TILE_INDEX_SIGNATURE, signature_size);
+    int32_t values[6] = { min_col, min_row, cols, rows, (int32_t) slabs.size(), (int32_t) names.size() };
+    memcpy(buffer.data() + signature_size, values, sizeof(values));
+    memcpy(buffer.data() + ROK4_TILE_INDEX_HEADER_SIZE, names.data(), names.size());
+    memcpy(buffer.data() + ROK4_TILE_INDEX_HEADER_SIZE + names.size(), entries, entries_size);
+
+    if (! context->open_to_write(name)) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to open tile index output " << name;
+        return false;
+    }
+
+    if (! context->write_full(buffer.data(), total_size, name)) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to write tile index output " << name;
+        context->close_to_write(name);
+        return false;
+    }
+
+    if (! context->close_to_write(name)) {
+        BOOST_LOG_TRIVIAL(error) << "Unable to close tile index output " << name;
+        return false;
+    }
+
+    return true;
+}
+
+bool TileIndex::get_tile ( int col, int row, std::string& slab, uint32_t& offset, uint32_t& size ) {
+    int c = col - min_col;
+    int r = row - min_row;
+    if (c < 0 || c >= cols || r < 0 || r >= rows) {
+        return false;
+    }
+
+    const uint32_t* entry = entries + 3 * ((size_t) r * cols + c);
+    if (entry[0] == 0 || entry[2] == 0) {
+        return false;
+    }
+
+    if (entry[0] > slabs.size()) {
+        BOOST_LOG_TRIVIAL(error) << "Invalid slab identifier in tile index for tile " << col << "," << row;
+        return false;
+    }
+
+    slab = slabs.at(entry[0] - 1);
+    offset = entry[1];
+    size = entry[2];
+    return true;
+}
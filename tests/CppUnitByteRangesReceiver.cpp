@@ -0,0 +1,182 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string.h>
+
+#include "rok4/utils/ByteRangesReceiver.h"
+
+class CppUnitByteRangesReceiver : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitByteRangesReceiver );
+
+    CPPUNIT_TEST ( range_header );
+    CPPUNIT_TEST ( multipart );
+    CPPUNIT_TEST ( multipart_split );
+    CPPUNIT_TEST ( single_part );
+    CPPUNIT_TEST ( full_object );
+    CPPUNIT_TEST ( missing_part );
+    CPPUNIT_TEST ( malformed );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string object;
+    uint8_t buffers[3][10];
+    std::vector<ReadRange> ranges;
+
+    std::vector<ReadRange*> get_pointers() {
+        std::vector<ReadRange*> pointers;
+        for (int i = 0; i < ranges.size(); i++) pointers.push_back(&(ranges.at(i)));
+        return pointers;
+    }
+
+    std::string get_part(int offset, int size) {
+        return "--b0undary\r\nContent-Type: image/tiff\r\nContent-Range: bytes " + std::to_string(offset) + "-" + std::to_string(offset + size - 1) + "/100\r\n\r\n" + object.substr(offset, size) + "\r\n";
+    }
+
+    void check_range(int i) {
+        CPPUNIT_ASSERT_EQUAL ( ranges.at(i).size, ranges.at(i).read_size );
+        CPPUNIT_ASSERT ( memcmp(ranges.at(i).data, object.c_str() + ranges.at(i).offset, ranges.at(i).size) == 0 );
+    }
+
+public:
+    void setUp() {
+        object.clear();
+        for (int i = 0; i < 100; i++) object.push_back((char) ('A' + (i % 26)));
+        memset(buffers, 0, sizeof(buffers));
+        ranges.clear();
+        // Portions volontairement non triées
+        ranges.push_back(ReadRange("slab", buffers[0], 60, 10));
+        ranges.push_back(ReadRange("slab", buffers[1], 5, 10));
+        ranges.push_back(ReadRange("slab", buffers[2], 30, 4));
+    }
+
+    void range_header();
+    void multipart();
+    void multipart_split();
+    void single_part();
+    void full_object();
+    void missing_part();
+    void malformed();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitByteRangesReceiver );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitByteRangesReceiver, "CppUnitByteRangesReceiver" );
+
+void CppUnitByteRangesReceiver::range_header() {
+    ByteRangesReceiver receiver (get_pointers());
+    CPPUNIT_ASSERT_EQUAL ( std::string("Range: bytes=5-14,30-33,60-69"), receiver.get_range_header() );
+}
+
+void CppUnitByteRangesReceiver::multipart() {
+    ByteRangesReceiver receiver (get_pointers());
+    receiver.add_header("HTTP/1.1 206 Partial Content\r\n");
+    receiver.add_header("Content-Type: multipart/byteranges; boundary=b0undary\r\n");
+
+    std::string body = get_part(5, 10) + get_part(30, 4) + get_part(60, 10) + "--b0undary--\r\n";
+    CPPUNIT_ASSERT ( receiver.receive(body.c_str(), body.size()) );
+    CPPUNIT_ASSERT ( receiver.finish() );
+    for (int i = 0; i < 3; i++) check_range(i);
+}
+
+void CppUnitByteRangesReceiver::multipart_split() {
+    ByteRangesReceiver receiver (get_pointers());
+    receiver.add_header("HTTP/2 206\r\n");
+    receiver.add_header("content-type: multipart/byteranges; boundary=\"b0undary\"\r\n");
+
+    // Le corps arrive octet par octet, les parties sont dans le désordre
+    std::string body = "preamble\r\n" + get_part(60, 10) + get_part(5, 10) + get_part(30, 4) + "--b0undary--\r\n";
+    for (int i = 0; i < body.size(); i++) {
+        CPPUNIT_ASSERT ( receiver.receive(body.c_str() + i, 1) );
+    }
+    CPPUNIT_ASSERT ( receiver.finish() );
+    for (int i = 0; i < 3; i++) check_range(i);
+}
+
+void CppUnitByteRangesReceiver::single_part() {
+    ByteRangesReceiver receiver (get_pointers());
+    // Le serveur a fusionné les portions en une seule
+    receiver.add_header("HTTP/1.1 206 Partial Content\r\n");
+    receiver.add_header("Content-Range: bytes 5-69/100\r\n");
+
+    std::string body = object.substr(5, 65);
+    CPPUNIT_ASSERT ( receiver.receive(body.c_str(), 40) );
+    CPPUNIT_ASSERT ( receiver.receive(body.c_str() + 40, 25) );
+    CPPUNIT_ASSERT ( receiver.finish() );
+    for (int i = 0; i < 3; i++) check_range(i);
+}
+
+void CppUnitByteRangesReceiver::full_object() {
+    ByteRangesReceiver receiver (get_pointers());
+    // Redirection ignorée, puis l'objet complet
+    receiver.add_header("HTTP/1.1 301 Moved Permanently\r\n");
+    CPPUNIT_ASSERT ( receiver.receive("moved", 5) );
+    receiver.add_header("HTTP/1.1 200 OK\r\n");
+    receiver.add_header("Content-Type: image/tiff\r\n");
+
+    CPPUNIT_ASSERT ( receiver.receive(object.c_str(), object.size()) );
+    CPPUNIT_ASSERT ( receiver.finish() );
+    for (int i = 0; i < 3; i++) check_range(i);
+}
+
+void CppUnitByteRangesReceiver::missing_part() {
+    ranges.at(0).offset = 95;
+    ByteRangesReceiver receiver (get_pointers());
+    receiver.add_header("HTTP/1.1 206 Partial Content\r\n");
+    receiver.add_header("Content-Type: multipart/byteranges; boundary=b0undary\r\n");
+
+    // Portion tronquée par la fin de l'objet, et portion absente : toutes deux seront relues seules
+    std::string body = get_part(5, 10) + get_part(95, 5) + "--b0undary--\r\n";
+    CPPUNIT_ASSERT ( receiver.receive(body.c_str(), body.size()) );
+    CPPUNIT_ASSERT ( ! receiver.finish() );
+    check_range(1);
+    CPPUNIT_ASSERT_EQUAL ( -1, ranges.at(0).read_size );
+    CPPUNIT_ASSERT_EQUAL ( -1, ranges.at(2).read_size );
+}
+
+void CppUnitByteRangesReceiver::malformed() {
+    ByteRangesReceiver receiver (get_pointers());
+    receiver.add_header("HTTP/1.1 206 Partial Content\r\n");
+    receiver.add_header("Content-Type: multipart/byteranges; boundary=b0undary\r\n");
+
+    std::string body = "--b0undary\r\nContent-Type: image/tiff\r\n\r\n" + object.substr(5, 10);
+    CPPUNIT_ASSERT ( ! receiver.receive(body.c_str(), body.size()) );
+    CPPUNIT_ASSERT ( ! receiver.finish() );
+    for (int i = 0; i < 3; i++) CPPUNIT_ASSERT_EQUAL ( -1, ranges.at(i).read_size );
+}
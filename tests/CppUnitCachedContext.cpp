@@ -0,0 +1,280 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <atomic>
+#include <stdlib.h>
+#include "storage/CachedContext.h"
+
+/**
+ * Contexte de test : contenu déterministe dépendant d'une version, avec comptage des lectures
+ */
+class CountingContext : public Context {
+public:
+    std::atomic<int> reads;
+    std::atomic<int> batches;
+    uint8_t version;
+
+    CountingContext() : Context(), reads(0), batches(0), version(0) { }
+
+    bool connection() { connected = true; return true; }
+    bool exists(std::string name) { return true; }
+    int read(uint8_t* data, int offset, int size, std::string name) {
+        reads++;
+        for (int i = 0; i < size; i++) data[i] = (uint8_t) (offset + i + version);
+        return size;
+    }
+    bool read_ranges(std::vector<ReadRange>& ranges) {
+        batches++;
+        return Context::read_ranges(ranges);
+    }
+    uint8_t* read_full(int& size, std::string name) { size = -1; return NULL; }
+    bool write(uint8_t* data, int offset, int size, std::string name) { return true; }
+    bool write_full(uint8_t* data, int size, std::string name) { return true; }
+    bool open_to_write(std::string name) { return true; }
+    bool close_to_write(std::string name) { version++; return true; }
+    ContextType::eContextType get_type() { return ContextType::S3CONTEXT; }
+    std::string get_type_string() { return "COUNTINGCONTEXT"; }
+    std::string get_tray() { return "bucket"; }
+    std::string get_path(std::string racine, int x, int y, int pathDepth = 2) { return racine; }
+    std::string get_path(std::string name) { return "bucket/" + name; }
+    void print() { }
+    std::string to_string() { return "COUNTINGCONTEXT"; }
+    void close_connection() { }
+};
+
+class CppUnitCachedContext : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitCachedContext );
+
+    CPPUNIT_TEST ( read_through );
+    CPPUNIT_TEST ( revalidation );
+    CPPUNIT_TEST ( write_invalidation );
+    CPPUNIT_TEST ( eviction );
+    CPPUNIT_TEST ( batch );
+    CPPUNIT_TEST ( reload );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string directory;
+    CountingContext* origin;
+    CachedContext* context;
+
+    bool read_range(int offset, int size) {
+        uint8_t buffer[64];
+        if (context->read(buffer, offset, size, "slab") != size) return false;
+        for (int i = 0; i < size; i++) {
+            if (buffer[i] != (uint8_t) (offset + i + origin->version)) return false;
+        }
+        return true;
+    }
+
+public:
+    void setUp();
+    void read_through();
+    void revalidation();
+    void write_invalidation();
+    void eviction();
+    void batch();
+    void reload();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitCachedContext );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitCachedContext, "CppUnitCachedContext" );
+
+void CppUnitCachedContext::setUp() {
+    char pattern[] = "/tmp/rok4_cached_context_XXXXXX";
+    directory = std::string(mkdtemp(pattern));
+
+    CachedContext::set_directory(directory);
+    CachedContext::set_max_size(10485760);
+    CachedContext::set_validity(300);
+
+    origin = new CountingContext();
+    context = new CachedContext(origin);
+    CPPUNIT_ASSERT ( context->connection() );
+}
+
+void CppUnitCachedContext::read_through() {
+    CPPUNIT_ASSERT ( CachedContext::is_enabled() );
+    CPPUNIT_ASSERT ( context->get_origin() == origin );
+
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) origin->reads );
+
+    // Les portions sont désormais lues sur le disque local
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) origin->reads );
+
+    // Une autre portion est lue sur le stockage
+    CPPUNIT_ASSERT ( read_range(100, 8) );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+
+    // Le cache est partagé et persiste au delà du contexte
+    CountingContext* other = new CountingContext();
+    CachedContext* other_context = new CachedContext(other);
+    uint8_t buffer[16];
+    CPPUNIT_ASSERT_EQUAL ( 16, other_context->read(buffer, 100, 16, "slab") );
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 100, buffer[0] );
+    CPPUNIT_ASSERT_EQUAL ( 0, (int) other->reads );
+    delete other_context;
+
+    // Lecture asynchrone
+    std::future<int> result = context->read_async(buffer, 100, 16, "slab");
+    CPPUNIT_ASSERT_EQUAL ( 16, result.get() );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+    result = context->read_async(buffer, 200, 16, "slab");
+    CPPUNIT_ASSERT_EQUAL ( 16, result.get() );
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 200, buffer[0] );
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) origin->reads );
+    CPPUNIT_ASSERT ( read_range(200, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) origin->reads );
+}
+
+void CppUnitCachedContext::revalidation() {
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) origin->reads );
+
+    // En-têtes toujours relus : les tuiles restent valides tant que l'en-tête ne change pas
+    CachedContext::set_validity(-1);
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+
+    // L'objet a changé sur le stockage : l'en-tête relu a une autre empreinte, la tuile est relue
+    origin->version = 7;
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 5, (int) origin->reads );
+}
+
+void CppUnitCachedContext::write_invalidation() {
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) origin->reads );
+
+    uint8_t data[4] = {0, 0, 0, 0};
+    CPPUNIT_ASSERT ( context->open_to_write("slab") );
+    CPPUNIT_ASSERT ( context->write(data, 0, 4, "slab") );
+    CPPUNIT_ASSERT ( context->close_to_write("slab") );
+
+    // L'objet a été écrit par ce processus, la portion en cache n'est plus utilisée
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) origin->reads );
+}
+
+void CppUnitCachedContext::eviction() {
+    CachedContext::set_max_size(1000);
+
+    for (int i = 0; i < 20; i++) {
+        CPPUNIT_ASSERT ( read_range(i * 64, 64) );
+    }
+    CPPUNIT_ASSERT_EQUAL ( 20, (int) origin->reads );
+    CPPUNIT_ASSERT ( CachedContext::get_used_size() <= 1000 );
+    CPPUNIT_ASSERT ( CachedContext::get_used_size() > 0 );
+
+    // Les portions les plus récentes sont conservées, les plus anciennes ont été supprimées
+    CPPUNIT_ASSERT ( read_range(19 * 64, 64) );
+    CPPUNIT_ASSERT_EQUAL ( 20, (int) origin->reads );
+    CPPUNIT_ASSERT ( read_range(0, 64) );
+    CPPUNIT_ASSERT_EQUAL ( 21, (int) origin->reads );
+}
+
+void CppUnitCachedContext::batch() {
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) origin->reads );
+
+    uint8_t buffers[3][16];
+    std::vector<ReadRange> ranges;
+    ranges.push_back(ReadRange("slab", buffers[0], 200, 16));
+    ranges.push_back(ReadRange("slab", buffers[1], 100, 16));
+    ranges.push_back(ReadRange("slab", buffers[2], 300, 16));
+
+    // Seules les portions absentes du cache sont demandées, en un seul lot
+    CPPUNIT_ASSERT ( context->read_ranges(ranges) );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) origin->batches );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+    for (int i = 0; i < 3; i++) {
+        CPPUNIT_ASSERT_EQUAL ( 16, ranges.at(i).read_size );
+        CPPUNIT_ASSERT_EQUAL ( (uint8_t) ranges.at(i).offset, buffers[i][0] );
+    }
+
+    // Toutes les portions sont désormais en cache
+    CPPUNIT_ASSERT ( context->read_ranges(ranges) );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) origin->batches );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+}
+
+void CppUnitCachedContext::reload() {
+    CPPUNIT_ASSERT ( read_range(0, 32) );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, CachedContext::get_objects_count() );
+
+    // Les objets des fichiers présents au démarrage sont retrouvés
+    CachedContext::set_directory(directory);
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, CachedContext::get_objects_count() );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) origin->reads );
+
+    // Une écriture invalide aussi les portions retrouvées au démarrage
+    CPPUNIT_ASSERT ( context->close_to_write("slab") );
+    CPPUNIT_ASSERT ( read_range(100, 16) );
+    CPPUNIT_ASSERT_EQUAL ( 3, (int) origin->reads );
+
+    // Un objet est oublié avec sa dernière portion
+    CachedContext::set_max_size(0);
+    CPPUNIT_ASSERT ( read_range(200, 16) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, CachedContext::get_objects_count() );
+    CountingContext* other = new CountingContext();
+    CachedContext* other_context = new CachedContext(other);
+    uint8_t buffer[16];
+    CPPUNIT_ASSERT_EQUAL ( 16, other_context->read(buffer, 0, 16, "other") );
+    delete other_context;
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, CachedContext::get_objects_count() );
+}
+
+void CppUnitCachedContext::tearDown() {
+    delete context;
+    CachedContext::set_directory("");
+    system(("rm -rf " + directory).c_str());
+}
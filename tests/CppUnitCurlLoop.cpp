@@ -0,0 +1,365 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rok4/utils/CurlLoop.h"
+#include "rok4/utils/LibcurlStruct.h"
+
+class CppUnitCurlLoop : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitCurlLoop );
+
+    CPPUNIT_TEST ( submit );
+    CPPUNIT_TEST ( delay );
+    CPPUNIT_TEST ( cancel_pending );
+    CPPUNIT_TEST ( cancel_running );
+    CPPUNIT_TEST ( cancel_done );
+    CPPUNIT_TEST ( cancel_from_callback );
+    CPPUNIT_TEST ( stop );
+    CPPUNIT_TEST ( hedged_answered_first );
+    CPPUNIT_TEST ( main_answered_first );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string path;
+    std::string url;
+    int server;
+    std::string stalled_url;
+
+    // Prépare une lecture, les données reçues étant ajoutées à la chaîne fournie
+    CURL* prepare(std::string u, std::string* received) {
+        CURL* curl = curl_easy_init();
+        curl_easy_setopt(curl, CURLOPT_URL, u.c_str());
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CppUnitCurlLoop::write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, received);
+        return curl;
+    }
+
+    static size_t write(char* ptr, size_t size, size_t nmemb, void* userp) {
+        ((std::string*) userp)->append(ptr, size * nmemb);
+        return size * nmemb;
+    }
+
+    // Soumet une requête dont le code retour est rendu par la promesse, l'objet curl étant nettoyé
+    static uint64_t submit_with(CURL* curl, std::shared_ptr<std::promise<CURLcode> > result, int delay = 0) {
+        return CurlLoop::submit(curl, [curl, result](CURLcode res) {
+            curl_easy_cleanup(curl);
+            result->set_value(res);
+        }, delay);
+    }
+
+    // Soumet une lecture doublée comme S3Context et SwiftContext : la première réponse valide annule l'autre requête si elle n'est pas terminée
+    // Les codes retour des deux requêtes sont rendus par les promesses, la durée depuis la soumission de la principale par celle de la gagnante
+    static void submit_hedged(std::shared_ptr<HedgedReadStruct> hedged, std::string urls[2], int delay,
+                              std::shared_ptr<std::promise<CURLcode> > codes[2], std::shared_ptr<std::promise<std::pair<int, int> > > winner) {
+        for (int i = 0; i < 2; i++) {
+            hedged->handles[i] = curl_easy_init();
+            curl_easy_setopt(hedged->handles[i], CURLOPT_URL, urls[i].c_str());
+            curl_easy_setopt(hedged->handles[i], CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(hedged->handles[i], CURLOPT_WRITEFUNCTION, buffer_callback);
+            curl_easy_setopt(hedged->handles[i], CURLOPT_WRITEDATA, hedged->buffers[i]);
+        }
+        std::lock_guard<std::mutex> lock(hedged->ids_mtx);
+        for (int i = 0; i < 2; i++) {
+            std::shared_ptr<std::promise<CURLcode> > code = codes[i];
+            hedged->ids[i] = CurlLoop::submit(hedged->handles[i], [hedged, i, code, winner](CURLcode res) {
+                hedged->finished[i] = true;
+                curl_easy_cleanup(hedged->handles[i]);
+                code->set_value(res);
+                if (hedged->done || res != CURLE_OK) return;
+
+                hedged->done = true;
+                if (! hedged->finished[1 - i]) CurlLoop::cancel(hedged->get_id(1 - i));
+                winner->set_value(std::make_pair(i, hedged->elapsed()));
+            }, (i == 0) ? 0 : delay);
+        }
+    }
+
+public:
+    void setUp();
+    void tearDown();
+
+    void submit();
+    void delay();
+    void cancel_pending();
+    void cancel_running();
+    void cancel_done();
+    void cancel_from_callback();
+    void stop();
+    void hedged_answered_first();
+    void main_answered_first();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitCurlLoop );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitCurlLoop, "CppUnitCurlLoop" );
+
+void CppUnitCurlLoop::setUp() {
+    path = "/tmp/rok4_cppunit_curlloop_" + std::to_string(getpid());
+    std::ofstream out(path.c_str());
+    out << "0123456789";
+    out.close();
+    url = "file://" + path;
+
+    // Serveur qui accepte les connexions (via la file d'attente du noyau) sans jamais répondre : les requêtes restent en cours
+    server = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    bind(server, (struct sockaddr*) &addr, sizeof(addr));
+    listen(server, 16);
+    socklen_t len = sizeof(addr);
+    getsockname(server, (struct sockaddr*) &addr, &len);
+    stalled_url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/stalled";
+}
+
+void CppUnitCurlLoop::tearDown() {
+    CurlLoop::stop();
+    close(server);
+    unlink(path.c_str());
+}
+
+void CppUnitCurlLoop::submit() {
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > result = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> future = result->get_future();
+
+    uint64_t id = submit_with(prepare(url, &received), result);
+    CPPUNIT_ASSERT ( id != 0 );
+    CPPUNIT_ASSERT ( future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, future.get() );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), received );
+
+    // Les identifiants ne sont pas réutilisés
+    std::string other;
+    std::shared_ptr<std::promise<CURLcode> > other_result = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> other_future = other_result->get_future();
+    CPPUNIT_ASSERT ( submit_with(prepare(url, &other), other_result) > id );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, other_future.get() );
+}
+
+void CppUnitCurlLoop::delay() {
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > result = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> future = result->get_future();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    submit_with(prepare(url, &received), result, 200);
+    CPPUNIT_ASSERT ( future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, future.get() );
+    CPPUNIT_ASSERT ( elapsed >= 200 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), received );
+}
+
+void CppUnitCurlLoop::cancel_pending() {
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > result = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> future = result->get_future();
+
+    uint64_t id = submit_with(prepare(url, &received), result, 10000);
+    CurlLoop::cancel(id);
+
+    // Requête pas encore lancée : la fonction de fin est appelée directement
+    CPPUNIT_ASSERT ( future.wait_for(std::chrono::seconds(0)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, future.get() );
+    CPPUNIT_ASSERT ( received.empty() );
+}
+
+void CppUnitCurlLoop::cancel_running() {
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > result = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> future = result->get_future();
+
+    uint64_t id = submit_with(prepare(stalled_url, &received), result);
+    CPPUNIT_ASSERT ( future.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout );
+
+    // Annulation depuis un autre thread que celui de la boucle : prise en compte au prochain tour
+    CurlLoop::cancel(id);
+    CPPUNIT_ASSERT ( future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, future.get() );
+}
+
+void CppUnitCurlLoop::cancel_done() {
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > done = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> done_future = done->get_future();
+    uint64_t done_id = submit_with(prepare(url, &received), done);
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, done_future.get() );
+
+    // L'objet curl libéré peut être réalloué à la requête suivante : l'annulation de la précédente ne doit pas la concerner
+    std::string other;
+    std::shared_ptr<std::promise<CURLcode> > running = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> running_future = running->get_future();
+    uint64_t running_id = submit_with(prepare(stalled_url, &other), running);
+
+    CurlLoop::cancel(done_id);
+    CPPUNIT_ASSERT ( running_future.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout );
+
+    CurlLoop::cancel(running_id);
+    CPPUNIT_ASSERT ( running_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, running_future.get() );
+}
+
+void CppUnitCurlLoop::cancel_from_callback() {
+    std::string stalled;
+    std::shared_ptr<std::promise<CURLcode> > running = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> running_future = running->get_future();
+    uint64_t running_id = submit_with(prepare(stalled_url, &stalled), running);
+
+    // Depuis une fonction de fin, l'annulation est immédiate
+    std::string received;
+    CURL* curl = prepare(url, &received);
+    std::shared_ptr<std::promise<bool> > cancelled = std::make_shared<std::promise<bool> >();
+    std::future<bool> cancelled_future = cancelled->get_future();
+    std::shared_ptr<std::future<CURLcode> > shared_running = std::make_shared<std::future<CURLcode> >(std::move(running_future));
+    CurlLoop::submit(curl, [curl, running_id, shared_running, cancelled](CURLcode res) {
+        curl_easy_cleanup(curl);
+        CurlLoop::cancel(running_id);
+        cancelled->set_value(shared_running->wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    }, 50);
+
+    CPPUNIT_ASSERT ( cancelled_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT ( cancelled_future.get() );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, shared_running->get() );
+}
+
+void CppUnitCurlLoop::stop() {
+    std::string stalled;
+    std::shared_ptr<std::promise<CURLcode> > running = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> running_future = running->get_future();
+    submit_with(prepare(stalled_url, &stalled), running);
+
+    std::string received;
+    std::shared_ptr<std::promise<CURLcode> > pending = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> pending_future = pending->get_future();
+    submit_with(prepare(url, &received), pending, 10000);
+
+    CPPUNIT_ASSERT ( running_future.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout );
+
+    // Les requêtes en cours comme en attente sont interrompues
+    CurlLoop::stop();
+    CPPUNIT_ASSERT ( running_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, running_future.get() );
+    CPPUNIT_ASSERT ( pending_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, pending_future.get() );
+
+    // La boucle redémarre à la soumission suivante
+    std::shared_ptr<std::promise<CURLcode> > restarted = std::make_shared<std::promise<CURLcode> >();
+    std::future<CURLcode> restarted_future = restarted->get_future();
+    submit_with(prepare(url, &received), restarted);
+    CPPUNIT_ASSERT ( restarted_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, restarted_future.get() );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), received );
+}
+
+void CppUnitCurlLoop::hedged_answered_first() {
+    uint8_t data[10];
+    std::shared_ptr<HedgedReadStruct> hedged = std::make_shared<HedgedReadStruct>(10);
+    BufferStruct main_buffer(data, 10);
+    BufferStruct hedge_buffer(hedged->hedge_data.data(), 10);
+    hedged->buffers[0] = &main_buffer;
+    hedged->buffers[1] = &hedge_buffer;
+
+    std::string urls[2] = { stalled_url, url };
+    std::shared_ptr<std::promise<CURLcode> > codes[2] = { std::make_shared<std::promise<CURLcode> >(), std::make_shared<std::promise<CURLcode> >() };
+    std::future<CURLcode> main_code = codes[0]->get_future();
+    std::future<CURLcode> hedge_code = codes[1]->get_future();
+    std::shared_ptr<std::promise<std::pair<int, int> > > winner = std::make_shared<std::promise<std::pair<int, int> > >();
+    std::future<std::pair<int, int> > winner_future = winner->get_future();
+
+    submit_hedged(hedged, urls, 100, codes, winner);
+
+    CPPUNIT_ASSERT ( winner_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    std::pair<int, int> w = winner_future.get();
+    CPPUNIT_ASSERT_EQUAL ( 1, w.first );
+    // La durée compte le délai avant doublement, pas seulement la requête doublée
+    CPPUNIT_ASSERT ( w.second >= 100 );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, hedge_code.get() );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), std::string((char*) hedged->hedge_data.data(), hedge_buffer.size) );
+
+    // La requête principale, toujours en cours, a été annulée par la fonction de fin de la requête doublée
+    CPPUNIT_ASSERT ( main_code.wait_for(std::chrono::seconds(0)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, main_code.get() );
+    CPPUNIT_ASSERT ( hedged->finished[0] && hedged->finished[1] );
+}
+
+void CppUnitCurlLoop::main_answered_first() {
+    uint8_t data[10];
+    std::shared_ptr<HedgedReadStruct> hedged = std::make_shared<HedgedReadStruct>(10);
+    BufferStruct main_buffer(data, 10);
+    BufferStruct hedge_buffer(hedged->hedge_data.data(), 10);
+    hedged->buffers[0] = &main_buffer;
+    hedged->buffers[1] = &hedge_buffer;
+
+    std::string urls[2] = { url, url };
+    std::shared_ptr<std::promise<CURLcode> > codes[2] = { std::make_shared<std::promise<CURLcode> >(), std::make_shared<std::promise<CURLcode> >() };
+    std::future<CURLcode> main_code = codes[0]->get_future();
+    std::future<CURLcode> hedge_code = codes[1]->get_future();
+    std::shared_ptr<std::promise<std::pair<int, int> > > winner = std::make_shared<std::promise<std::pair<int, int> > >();
+    std::future<std::pair<int, int> > winner_future = winner->get_future();
+
+    submit_hedged(hedged, urls, 10000, codes, winner);
+
+    CPPUNIT_ASSERT ( winner_future.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( 0, winner_future.get().first );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_OK, main_code.get() );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), std::string((char*) data, main_buffer.size) );
+
+    // La requête doublée, encore en attente de son délai, est annulée avant son lancement
+    CPPUNIT_ASSERT ( hedge_code.wait_for(std::chrono::seconds(1)) == std::future_status::ready );
+    CPPUNIT_ASSERT_EQUAL ( CURLE_ABORTED_BY_CALLBACK, hedge_code.get() );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 0, hedge_buffer.size );
+}
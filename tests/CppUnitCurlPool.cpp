@@ -0,0 +1,293 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rok4/utils/CurlPool.h"
+#include "rok4/utils/CurlLoop.h"
+
+/**
+ * Serveur HTTP/2 en clair minimal (h2c, sans négociation) : répond "0123456789" à chaque requête
+ */
+class CurlPoolH2cServer {
+public:
+    int port;
+    std::atomic<int> connections;
+    std::atomic<int> requests;
+
+    CurlPoolH2cServer() : connections(0), requests(0), server(-1), stopping(false) {
+        server = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(server, (struct sockaddr*) &addr, sizeof(addr));
+        listen(server, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(server, (struct sockaddr*) &addr, &len);
+        port = ntohs(addr.sin_port);
+        acceptor = std::thread([this]() { accept_loop(); });
+    }
+
+    ~CurlPoolH2cServer() {
+        stopping = true;
+        shutdown(server, SHUT_RDWR);
+        close(server);
+        acceptor.join();
+        for (int i = 0; i < handlers.size(); i++) handlers.at(i).join();
+    }
+
+private:
+    int server;
+    std::atomic<bool> stopping;
+    std::thread acceptor;
+    std::vector<std::thread> handlers;
+
+    void accept_loop() {
+        while (true) {
+            int client = accept(server, NULL, NULL);
+            if (client < 0) return;
+            connections++;
+            handlers.push_back(std::thread([this, client]() { handle(client); close(client); }));
+        }
+    }
+
+    static bool read_all(int fd, uint8_t* buffer, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t r = recv(fd, buffer + done, size - done, 0);
+            if (r <= 0) return false;
+            done += r;
+        }
+        return true;
+    }
+
+    static void send_frame(int fd, uint8_t type, uint8_t flags, uint32_t stream, const uint8_t* payload, uint32_t size) {
+        uint8_t header[9] = {
+            (uint8_t) (size >> 16), (uint8_t) (size >> 8), (uint8_t) size, type, flags,
+            (uint8_t) (stream >> 24), (uint8_t) (stream >> 16), (uint8_t) (stream >> 8), (uint8_t) stream
+        };
+        send(fd, header, 9, MSG_NOSIGNAL);
+        if (size > 0) send(fd, payload, size, MSG_NOSIGNAL);
+    }
+
+public:
+    static size_t discard(char* /* ptr */, size_t size, size_t nmemb, void* /* userp */) {
+        return size * nmemb;
+    }
+
+private:
+    static void answer(int fd, uint32_t stream) {
+        // Statut 200 : entrée 8 de la table statique HPACK
+        uint8_t status = 0x88;
+        send_frame(fd, 0x1, 0x4, stream, &status, 1);
+        send_frame(fd, 0x0, 0x1, stream, (const uint8_t*) "0123456789", 10);
+    }
+
+    void handle(int fd) {
+        uint8_t preface[24];
+        if (! read_all(fd, preface, 24) || memcmp(preface, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24) != 0) return;
+        // SETTINGS : jusqu'à 100 flux simultanés
+        uint8_t settings[6] = { 0x0, 0x3, 0x0, 0x0, 0x0, 100 };
+        send_frame(fd, 0x4, 0x0, 0, settings, 6);
+
+        while (! stopping) {
+            struct pollfd p = { fd, POLLIN, 0 };
+            if (poll(&p, 1, 100) <= 0) continue;
+
+            uint8_t header[9];
+            if (! read_all(fd, header, 9)) return;
+            uint32_t size = (header[0] << 16) | (header[1] << 8) | header[2];
+            uint8_t type = header[3];
+            uint8_t flags = header[4];
+            uint32_t stream = ((header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+            std::vector<uint8_t> payload(size);
+            if (size > 0 && ! read_all(fd, payload.data(), size)) return;
+
+            if (type == 0x4 && ! (flags & 0x1)) {
+                // SETTINGS : acquittement
+                send_frame(fd, 0x4, 0x1, 0, NULL, 0);
+            } else if (type == 0x1) {
+                // HEADERS : nouvelle requête
+                requests++;
+                answer(fd, stream);
+            } else if (type == 0x7) {
+                // GOAWAY
+                return;
+            }
+        }
+    }
+};
+
+class CppUnitCurlPool : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitCurlPool );
+
+    CPPUNIT_TEST ( same_thread );
+    CPPUNIT_TEST ( other_threads );
+    CPPUNIT_TEST ( clean );
+    CPPUNIT_TEST ( http_version );
+    CPPUNIT_TEST ( http2_loop );
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void same_thread();
+    void other_threads();
+    void clean();
+    void http_version();
+    void http2_loop();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitCurlPool );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitCurlPool, "CppUnitCurlPool" );
+
+void CppUnitCurlPool::same_thread() {
+    CURL* first = CurlPool::get_curl_env();
+    CPPUNIT_ASSERT ( first != NULL );
+    CPPUNIT_ASSERT ( CurlPool::get_curl_env() == first );
+}
+
+void CppUnitCurlPool::other_threads() {
+    CURL* mine = CurlPool::get_curl_env();
+    int count = CurlPool::get_curls_count();
+
+    const int threads_count = 8;
+    CURL* handles[threads_count];
+    std::thread threads[threads_count];
+    for (int i = 0; i < threads_count; i++) {
+        threads[i] = std::thread([&handles, i]() {
+            handles[i] = CurlPool::get_curl_env();
+        });
+    }
+    for (int i = 0; i < threads_count; i++) threads[i].join();
+
+    for (int i = 0; i < threads_count; i++) {
+        CPPUNIT_ASSERT ( handles[i] != NULL );
+        CPPUNIT_ASSERT ( handles[i] != mine );
+    }
+
+    // Les objets des threads terminés sont libérés
+    CPPUNIT_ASSERT_EQUAL ( count, CurlPool::get_curls_count() );
+}
+
+void CppUnitCurlPool::clean() {
+    CurlPool::get_curl_env();
+    CPPUNIT_ASSERT ( CurlPool::get_curls_count() > 0 );
+
+    CurlPool::clean_curls();
+    CPPUNIT_ASSERT_EQUAL ( 0, CurlPool::get_curls_count() );
+
+    // Un nouvel objet est créé au prochain appel
+    CPPUNIT_ASSERT ( CurlPool::get_curl_env() != NULL );
+    CPPUNIT_ASSERT_EQUAL ( 1, CurlPool::get_curls_count() );
+}
+
+void CppUnitCurlPool::http_version() {
+    int http2 = CURL_VERSION_HTTP2;
+
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_NONE, CurlPool::parse_http_version(NULL, http2) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_1_1, CurlPool::parse_http_version("1.1", http2) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_2TLS, CurlPool::parse_http_version("2", http2) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE, CurlPool::parse_http_version("2-prior-knowledge", http2) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_NONE, CurlPool::parse_http_version("3", http2) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_NONE, CurlPool::parse_http_version("", http2) );
+
+    // libcurl sans HTTP/2 : repli sur HTTP/1.1
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_1_1, CurlPool::parse_http_version("2", 0) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_1_1, CurlPool::parse_http_version("2-prior-knowledge", 0) );
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_1_1, CurlPool::parse_http_version("1.1", 0) );
+
+    CurlPool::set_http_version(CURL_HTTP_VERSION_1_1);
+    CPPUNIT_ASSERT ( ! CurlPool::is_http2() );
+    CurlPool::set_http_version(CURL_HTTP_VERSION_2TLS);
+    CPPUNIT_ASSERT ( CurlPool::is_http2() );
+    CurlPool::set_http_version(CurlPool::parse_http_version(getenv(ROK4_CURL_HTTP_VERSION), curl_version_info(CURLVERSION_NOW)->features));
+}
+
+void CppUnitCurlPool::http2_loop() {
+    if (! (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2)) return;
+
+    CurlPoolH2cServer server;
+    std::string url = "http://127.0.0.1:" + std::to_string(server.port) + "/object";
+
+    // La boucle est recréée pour appliquer le multiplexage à son objet curl multiple
+    CurlLoop::stop();
+    long previous = CurlPool::parse_http_version(getenv(ROK4_CURL_HTTP_VERSION), curl_version_info(CURLVERSION_NOW)->features);
+    CurlPool::set_http_version(CurlPool::parse_http_version("2-prior-knowledge", curl_version_info(CURLVERSION_NOW)->features));
+
+    CURL* curl = curl_easy_init();
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlPoolH2cServer::discard);
+    std::shared_ptr<std::promise<long> > result = std::make_shared<std::promise<long> >();
+    std::future<long> future = result->get_future();
+    CurlLoop::submit(curl, [curl, result](CURLcode res) {
+        long version = 0;
+        long http_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_easy_cleanup(curl);
+        result->set_value((res == CURLE_OK && http_code == 200) ? version : -1);
+    });
+
+    // HTTP/2 est parlé d'emblée, sans négociation ni TLS
+    long version = future.get();
+    CPPUNIT_ASSERT_EQUAL ( (long) CURL_HTTP_VERSION_2_0, version );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) server.requests );
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) server.connections );
+
+    CurlLoop::stop();
+    CurlPool::set_http_version(previous);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include "rok4/utils/DecodedTileCache.h"
+
+class CppUnitDecodedTileCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitDecodedTileCache );
+
+    CPPUNIT_TEST ( add_and_get );
+    CPPUNIT_TEST ( eviction );
+    CPPUNIT_TEST ( clean_level );
+    CPPUNIT_TEST ( validity );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    // Les niveaux ne servent que d'identifiants dans le cache
+    Level* level1;
+    Level* level2;
+
+    std::shared_ptr<DecodedTileElement> add(Level* level, int col, int row, size_t size) {
+        uint8_t* data = new uint8_t[size];
+        memset(data, col, size);
+        return DecodedTileCache::add_tile(level, col, row, data, size);
+    }
+
+public:
+    void setUp();
+    void add_and_get();
+    void eviction();
+    void clean_level();
+    void validity();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitDecodedTileCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitDecodedTileCache, "CppUnitDecodedTileCache" );
+
+void CppUnitDecodedTileCache::setUp() {
+    level1 = (Level*) 0x1000;
+    level2 = (Level*) 0x2000;
+    DecodedTileCache::clean_tiles();
+    DecodedTileCache::set_memory_budget(1000000);
+    DecodedTileCache::set_validity(300);
+}
+
+void CppUnitDecodedTileCache::add_and_get() {
+    CPPUNIT_ASSERT ( ! DecodedTileCache::get_tile(level1, 3, 4) );
+    std::shared_ptr<DecodedTileElement> added = add(level1, 3, 4, 1000);
+
+    std::shared_ptr<DecodedTileElement> cached = DecodedTileCache::get_tile(level1, 3, 4);
+    CPPUNIT_ASSERT_MESSAGE ( "Decoded tile not cached", cached );
+    CPPUNIT_ASSERT_MESSAGE ( "Decoded data is not shared", added->data.get() == cached->data.get() );
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 3, cached->data[999] );
+
+    CPPUNIT_ASSERT ( ! DecodedTileCache::get_tile(level2, 3, 4) );
+    CPPUNIT_ASSERT ( ! DecodedTileCache::get_tile(level1, 4, 3) );
+    CPPUNIT_ASSERT_EQUAL ( 1L, DecodedTileCache::get_hits() );
+    CPPUNIT_ASSERT_EQUAL ( 3L, DecodedTileCache::get_misses() );
+}
+
+void CppUnitDecodedTileCache::eviction() {
+    DecodedTileCache::set_memory_budget(1000 * ROK4_DECODED_TILE_CACHE_SHARDS);
+
+    std::shared_ptr<DecodedTileElement> first = add(level1, 0, 0, 1000);
+    for (int i = 1; i < 100; i++) add(level1, i, 0, 1000);
+
+    CPPUNIT_ASSERT ( DecodedTileCache::get_memory() <= 1000 * ROK4_DECODED_TILE_CACHE_SHARDS );
+    // Une tuile sortie du cache reste lisible par qui la détient
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 0, first->data[0] );
+
+    // Tuile plus grande qu'une partition : non conservée
+    std::shared_ptr<DecodedTileElement> big = add(level1, 0, 1, 5000);
+    CPPUNIT_ASSERT ( big->data );
+    CPPUNIT_ASSERT ( ! DecodedTileCache::get_tile(level1, 0, 1) );
+}
+
+void CppUnitDecodedTileCache::clean_level() {
+    add(level1, 1, 1, 100);
+    add(level2, 1, 1, 100);
+    DecodedTileCache::clean_level(level1);
+
+    CPPUNIT_ASSERT ( ! DecodedTileCache::get_tile(level1, 1, 1) );
+    CPPUNIT_ASSERT ( DecodedTileCache::get_tile(level2, 1, 1) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 100, DecodedTileCache::get_memory() );
+}
+
+void CppUnitDecodedTileCache::validity() {
+    add(level1, 1, 1, 100);
+    DecodedTileCache::set_validity(0);
+    sleep(1);
+    CPPUNIT_ASSERT_MESSAGE ( "Expired decoded tile is served", ! DecodedTileCache::get_tile(level1, 1, 1) );
+}
+
+void CppUnitDecodedTileCache::tearDown() {
+    DecodedTileCache::clean_tiles();
+    DecodedTileCache::set_memory_budget(0);
+}
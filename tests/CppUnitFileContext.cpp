@@ -0,0 +1,251 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <limits.h>
+#include "storage/FileContext.h"
+#include "rok4/utils/FileDescriptorCache.h"
+#include "rok4/utils/MappedFileCache.h"
+
+/**
+ * Taille des fichiers de test
+ */
+#define CPPUNIT_FILE_CONTEXT_SIZE 200000
+
+class CppUnitFileContext : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitFileContext );
+
+    CPPUNIT_TEST ( merge_gaps );
+    CPPUNIT_TEST ( iov_max );
+    CPPUNIT_TEST ( caller_order );
+    CPPUNIT_TEST ( short_read );
+    CPPUNIT_TEST ( preadv_fallback );
+    CPPUNIT_TEST ( read_view );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    FileContext* context;
+    std::vector<uint8_t*> buffers;
+
+    // Contenu déterministe, différent pour chaque fichier
+    static uint8_t expected(int file, int offset) {
+        return (uint8_t) ((offset * (file + 1)) % 251);
+    }
+
+    static std::string file_name(int file) {
+        return "CppUnitFileContext_" + std::to_string(file) + ".bin";
+    }
+
+    void write_file(int file) {
+        std::ofstream ofs("/tmp/" + file_name(file), std::ios::trunc | std::ios::binary);
+        for (int i = 0; i < CPPUNIT_FILE_CONTEXT_SIZE; i++) ofs.put((char) expected(file, i));
+    }
+
+    ReadRange range(int file, int offset, int size) {
+        uint8_t* data = new uint8_t[size];
+        buffers.push_back(data);
+        return ReadRange(file_name(file), data, offset, size);
+    }
+
+    // Vérifie qu'une portion a été lue entièrement, depuis le bon fichier et au bon endroit
+    static bool check(ReadRange& r, int file) {
+        if (r.read_size != r.size) return false;
+        for (int i = 0; i < r.size; i++) {
+            if (r.data[i] != expected(file, r.offset + i)) return false;
+        }
+        return true;
+    }
+
+public:
+    void setUp();
+    void merge_gaps();
+    void iov_max();
+    void caller_order();
+    void short_read();
+    void preadv_fallback();
+    void read_view();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitFileContext );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitFileContext, "CppUnitFileContext" );
+
+void CppUnitFileContext::setUp() {
+    write_file(0);
+    write_file(1);
+    FileDescriptorCache::clean_descriptors();
+    context = new FileContext("/tmp/");
+    context->connection();
+}
+
+void CppUnitFileContext::merge_gaps() {
+    std::vector<ReadRange> ranges;
+    // Portions proches (regroupées, l'écart est lu et ignoré), contiguës, chevauchantes et éloignées
+    ranges.push_back(range(0, 1200, 50));
+    ranges.push_back(range(0, 100000, 10));
+    ranges.push_back(range(0, 1000, 100));
+    ranges.push_back(range(0, 1100, 100));
+    ranges.push_back(range(0, 1150, 20));
+    ranges.push_back(range(0, 1000 + ROK4_FILE_MERGE_GAP, 30));
+
+    CPPUNIT_ASSERT ( context->read_ranges(ranges) );
+    for (int i = 0; i < ranges.size(); i++) {
+        CPPUNIT_ASSERT_MESSAGE ( "Range " + std::to_string(i) + " badly read", check(ranges.at(i), 0) );
+    }
+}
+
+void CppUnitFileContext::iov_max() {
+    // Plus de portions proches qu'un seul appel à preadv ne peut en lire
+    std::vector<ReadRange> ranges;
+    for (int i = IOV_MAX + 500; i >= 0; i--) {
+        ranges.push_back(range(0, i * 10, 8));
+    }
+
+    CPPUNIT_ASSERT ( context->read_ranges(ranges) );
+    for (int i = 0; i < ranges.size(); i++) {
+        CPPUNIT_ASSERT_MESSAGE ( "Range " + std::to_string(i) + " badly read", check(ranges.at(i), 0) );
+    }
+}
+
+void CppUnitFileContext::caller_order() {
+    // Portions de deux fichiers mélangées : chacune doit recevoir ses propres octets
+    std::vector<ReadRange> ranges;
+    std::vector<int> files;
+    for (int i = 0; i < 50; i++) {
+        int file = (i * 7) % 2;
+        ranges.push_back(range(file, ((i * 37) % 50) * 1000, 500));
+        files.push_back(file);
+    }
+
+    CPPUNIT_ASSERT ( context->read_ranges(ranges) );
+    for (int i = 0; i < ranges.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL ( file_name(files.at(i)), ranges.at(i).name );
+        CPPUNIT_ASSERT_EQUAL ( ((i * 37) % 50) * 1000, ranges.at(i).offset );
+        CPPUNIT_ASSERT_MESSAGE ( "Range " + std::to_string(i) + " badly read", check(ranges.at(i), files.at(i)) );
+    }
+}
+
+void CppUnitFileContext::short_read() {
+    // La dernière portion du groupe dépasse la fin du fichier : la lecture groupée est incomplète et chaque portion est relue
+    std::vector<ReadRange> ranges;
+    ranges.push_back(range(1, CPPUNIT_FILE_CONTEXT_SIZE - 50, 100));
+    ranges.push_back(range(1, CPPUNIT_FILE_CONTEXT_SIZE - 1000, 500));
+    ranges.push_back(range(1, CPPUNIT_FILE_CONTEXT_SIZE - 400, 300));
+    ranges.push_back(range(2, 0, 10));
+
+    CPPUNIT_ASSERT ( ! context->read_ranges(ranges) );
+    CPPUNIT_ASSERT_EQUAL ( -1, ranges.at(0).read_size );
+    CPPUNIT_ASSERT ( check(ranges.at(1), 1) );
+    CPPUNIT_ASSERT ( check(ranges.at(2), 1) );
+    // Fichier absent
+    CPPUNIT_ASSERT_EQUAL ( -1, ranges.at(3).read_size );
+
+    // Une seule portion
+    std::vector<ReadRange> single;
+    single.push_back(range(1, CPPUNIT_FILE_CONTEXT_SIZE - 5, 10));
+    CPPUNIT_ASSERT ( ! context->read_ranges(single) );
+    CPPUNIT_ASSERT_EQUAL ( -1, single.at(0).read_size );
+}
+
+void CppUnitFileContext::preadv_fallback() {
+    // Portions chevauchantes sur deux fichiers : chacune forme son groupe, plus nombreux qu'un lot io_uring
+    FileContext::set_uring_enabled(false);
+    std::vector<ReadRange> ranges;
+    for (int i = 0; i < 2 * ROK4_FILE_IOURING_DEPTH; i++) {
+        ranges.push_back(range(i % 2, (i % 10) * 1000, 1500));
+    }
+    ranges.push_back(range(0, CPPUNIT_FILE_CONTEXT_SIZE - 10, 20));
+
+    bool ok = context->read_ranges(ranges);
+    FileContext::set_uring_enabled(true);
+
+    CPPUNIT_ASSERT ( ! ok );
+    for (int i = 0; i < 2 * ROK4_FILE_IOURING_DEPTH; i++) {
+        CPPUNIT_ASSERT_MESSAGE ( "Range " + std::to_string(i) + " badly read", check(ranges.at(i), i % 2) );
+    }
+    CPPUNIT_ASSERT_EQUAL ( -1, ranges.back().read_size );
+}
+
+void CppUnitFileContext::read_view() {
+    std::shared_ptr<void> owner;
+    CPPUNIT_ASSERT_MESSAGE ( "View available without mapping", context->read_view(owner, 0, 10, file_name(0)) == NULL );
+
+    MappedFileCache::set_size(10);
+
+    const uint8_t* view = context->read_view(owner, 1000, 100, file_name(0));
+    CPPUNIT_ASSERT_MESSAGE ( "View not available", view != NULL );
+    CPPUNIT_ASSERT_MESSAGE ( "View's owner not given", owner != NULL );
+    for (int i = 0; i < 100; i++) CPPUNIT_ASSERT_EQUAL ( expected(0, 1000 + i), view[i] );
+
+    // Dernier octet du fichier
+    std::shared_ptr<void> last_owner;
+    view = context->read_view(last_owner, CPPUNIT_FILE_CONTEXT_SIZE - 1, 1, file_name(0));
+    CPPUNIT_ASSERT ( view != NULL );
+    CPPUNIT_ASSERT_EQUAL ( expected(0, CPPUNIT_FILE_CONTEXT_SIZE - 1), view[0] );
+
+    // Portions hors du fichier
+    std::shared_ptr<void> out_owner;
+    CPPUNIT_ASSERT ( context->read_view(out_owner, CPPUNIT_FILE_CONTEXT_SIZE - 50, 100, file_name(0)) == NULL );
+    CPPUNIT_ASSERT ( context->read_view(out_owner, CPPUNIT_FILE_CONTEXT_SIZE, 1, file_name(0)) == NULL );
+    CPPUNIT_ASSERT ( context->read_view(out_owner, -10, 20, file_name(0)) == NULL );
+    CPPUNIT_ASSERT ( context->read_view(out_owner, 0, -1, file_name(0)) == NULL );
+    CPPUNIT_ASSERT ( context->read_view(out_owner, 0, 10, file_name(2)) == NULL );
+    CPPUNIT_ASSERT ( out_owner == NULL );
+
+    // La vue reste valide une fois la projection sortie du cache
+    view = context->read_view(owner, 1000, 100, file_name(0));
+    MappedFileCache::clean_mappings();
+    for (int i = 0; i < 100; i++) CPPUNIT_ASSERT_EQUAL ( expected(0, 1000 + i), view[i] );
+}
+
+void CppUnitFileContext::tearDown() {
+    MappedFileCache::clean_mappings();
+    MappedFileCache::set_size(0);
+    for (int i = 0; i < buffers.size(); i++) delete[] buffers.at(i);
+    buffers.clear();
+    delete context;
+    FileDescriptorCache::clean_descriptors();
+    remove(("/tmp/" + file_name(0)).c_str());
+    remove(("/tmp/" + file_name(1)).c_str());
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "rok4/utils/FileDescriptorCache.h"
+
+class CppUnitFileDescriptorCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitFileDescriptorCache );
+
+    CPPUNIT_TEST ( reuse );
+    CPPUNIT_TEST ( replaced_file );
+    CPPUNIT_TEST ( eviction );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string file1;
+    std::string file2;
+
+    void write_file(std::string path, std::string content) {
+        std::ofstream ofs(path, std::ios::trunc | std::ios::binary);
+        ofs << content;
+    }
+
+    std::string read_all(std::shared_ptr<FileDescriptor> fd, int size) {
+        std::string content(size, '\0');
+        ssize_t r = pread(fd->fd, &content[0], size, 0);
+        if (r != size) return "";
+        return content;
+    }
+
+public:
+    void setUp();
+    void reuse();
+    void replaced_file();
+    void eviction();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitFileDescriptorCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitFileDescriptorCache, "CppUnitFileDescriptorCache" );
+
+void CppUnitFileDescriptorCache::setUp() {
+    file1 = "/tmp/CppUnitFileDescriptorCache_1.bin";
+    file2 = "/tmp/CppUnitFileDescriptorCache_2.bin";
+    write_file(file1, "first");
+    write_file(file2, "second");
+    FileDescriptorCache::clean_descriptors();
+    FileDescriptorCache::set_size(100);
+    FileDescriptorCache::set_validity(10);
+}
+
+void CppUnitFileDescriptorCache::reuse() {
+    std::shared_ptr<FileDescriptor> fd1 = FileDescriptorCache::get_descriptor(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "File cannot be opened", fd1 != NULL );
+    std::shared_ptr<FileDescriptor> fd2 = FileDescriptorCache::get_descriptor(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "Descriptor is not reused", fd1 == fd2 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), read_all(fd2, 5) );
+
+    CPPUNIT_ASSERT_MESSAGE ( "Missing file is opened", FileDescriptorCache::get_descriptor("/tmp/CppUnitFileDescriptorCache_missing.bin") == NULL );
+
+    FileDescriptorCache::invalidate(file1);
+    std::shared_ptr<FileDescriptor> fd3 = FileDescriptorCache::get_descriptor(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "Descriptor is reused after invalidation", fd3 != fd1 );
+}
+
+void CppUnitFileDescriptorCache::replaced_file() {
+    FileDescriptorCache::set_validity(0);
+    std::shared_ptr<FileDescriptor> fd1 = FileDescriptorCache::get_descriptor(file1);
+
+    // Le fichier est remplacé par un autre (nouvel inode), comme lors d'une mise à jour atomique
+    std::string tmp = file1 + ".tmp";
+    write_file(tmp, "FIRST");
+    rename(tmp.c_str(), file1.c_str());
+    sleep(1);
+
+    std::shared_ptr<FileDescriptor> fd2 = FileDescriptorCache::get_descriptor(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "Replaced file's descriptor is reused", fd1 != fd2 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("FIRST"), read_all(fd2, 5) );
+    // L'ancien descripteur reste utilisable tant qu'il est détenu
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), read_all(fd1, 5) );
+}
+
+void CppUnitFileDescriptorCache::eviction() {
+    FileDescriptorCache::set_size(1);
+    std::shared_ptr<FileDescriptor> fd1 = FileDescriptorCache::get_descriptor(file1);
+    std::shared_ptr<FileDescriptor> fd2 = FileDescriptorCache::get_descriptor(file2);
+
+    // file1 est sorti du cache mais son descripteur est toujours valide
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), read_all(fd1, 5) );
+    CPPUNIT_ASSERT_MESSAGE ( "Evicted descriptor is reused", FileDescriptorCache::get_descriptor(file1) != fd1 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("second"), read_all(fd2, 6) );
+}
+
+void CppUnitFileDescriptorCache::tearDown() {
+    FileDescriptorCache::clean_descriptors();
+    remove(file1.c_str());
+    remove(file2.c_str());
+}
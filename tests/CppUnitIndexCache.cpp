@@ -0,0 +1,377 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include "rok4/utils/IndexCache.h"
+#include "rok4/enums/Format.h"
+#include "storage/FileContext.h"
+#include "rok4/utils/StoragePool.h"
+
+// Stockage en erreur : ni la lecture ni le test d'existence ne permettent de conclure
+class CppUnitIndexCacheFailingContext : public FileContext {
+public:
+    CppUnitIndexCacheFailingContext() : FileContext("/tmp/") { }
+    int read(uint8_t* data, int offset, int size, std::string name) { return -1; }
+    int check_existence(std::string name) { return -1; }
+};
+
+class CppUnitIndexCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitIndexCache );
+
+    CPPUNIT_TEST ( add_and_get );
+    CPPUNIT_TEST ( validity );
+    CPPUNIT_TEST ( size_limit );
+    CPPUNIT_TEST ( memory_budget );
+    CPPUNIT_TEST ( missing_slab );
+    CPPUNIT_TEST ( stale_refresh );
+    CPPUNIT_TEST ( refresh_missing );
+    CPPUNIT_TEST ( snapshot );
+    CPPUNIT_TEST ( concurrency );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    uint32_t offsets[4];
+    uint32_t sizes[4];
+
+    void write_slab(std::string path, uint32_t first_offset) {
+        std::vector<uint8_t> slab (ROK4_IMAGE_HEADER_SIZE + 2 * 4 * 4, 0);
+        for (int i = 0; i < 4; i++) {
+            uint32_t o = first_offset + i * 100;
+            memcpy(slab.data() + ROK4_IMAGE_HEADER_SIZE + 4 * i, &o, 4);
+            memcpy(slab.data() + ROK4_IMAGE_HEADER_SIZE + 4 * 4 + 4 * i, &(sizes[i]), 4);
+        }
+        std::ofstream ofs(path, std::ios::trunc | std::ios::binary);
+        ofs.write((char*) slab.data(), slab.size());
+    }
+
+public:
+    void setUp();
+    void add_and_get();
+    void validity();
+    void size_limit();
+    void memory_budget();
+    void missing_slab();
+    void stale_refresh();
+    void refresh_missing();
+    void snapshot();
+    void concurrency();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitIndexCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitIndexCache, "CppUnitIndexCache" );
+
+void CppUnitIndexCache::setUp() {
+    for (int i = 0; i < 4; i++) {
+        offsets[i] = 2048 + i * 100;
+        sizes[i] = 10 + i;
+    }
+    IndexCache::clean_indexes();
+    IndexCache::setCacheSize(100);
+    IndexCache::set_validity(300);
+    IndexCache::set_missing_validity(60);
+    IndexCache::set_memory_budget(0);
+}
+
+void CppUnitIndexCache::add_and_get() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    CPPUNIT_ASSERT_MESSAGE ( "Empty cache returns an element", ! IndexCache::get_slab_infos("/pyr/slab", 0, &c, &name, &offset, &size) );
+
+    IndexCache::add_slab_infos("/pyr/slab", NULL, "/pyr/target", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/slab", 2, &c, &name, &offset, &size) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("/pyr/target"), name );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 2248, offset );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 12, size );
+
+    CPPUNIT_ASSERT_MESSAGE ( "Out of range tile is found", ! IndexCache::get_slab_infos("/pyr/slab", 4, &c, &name, &offset, &size) );
+
+    // Un nouvel ajout remplace l'élément
+    sizes[2] = 99;
+    IndexCache::add_slab_infos("/pyr/slab", NULL, "/pyr/other", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/slab", 2, &c, &name, &offset, &size) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("/pyr/other"), name );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 99, size );
+}
+
+void CppUnitIndexCache::validity() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    IndexCache::add_slab_infos("/pyr/slab", NULL, "/pyr/slab", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    IndexCache::set_validity(-1);
+    CPPUNIT_ASSERT_MESSAGE ( "Expired element is returned", ! IndexCache::get_slab_infos("/pyr/slab", 0, &c, &name, &offset, &size) );
+}
+
+void CppUnitIndexCache::size_limit() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    // Tailles non multiples du nombre de partitions, dont une inférieure à ce nombre
+    int cache_sizes[3] = { 10, 100, 1000 };
+    for (int s = 0; s < 3; s++) {
+        IndexCache::setCacheSize(cache_sizes[s]);
+        for (int i = 0; i < 10 * cache_sizes[s]; i++) {
+            IndexCache::add_slab_infos("/pyr/slab" + std::to_string(i), NULL, "/pyr/slab", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+        }
+
+        int found = 0;
+        for (int i = 0; i < 10 * cache_sizes[s]; i++) {
+            if (IndexCache::get_slab_infos("/pyr/slab" + std::to_string(i), 0, &c, &name, &offset, &size)) found++;
+        }
+        // Chaque partition est pleine : le cache contient exactement sa taille
+        CPPUNIT_ASSERT_EQUAL ( cache_sizes[s], found );
+
+        // Les derniers ajoutés sont présents
+        CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/slab" + std::to_string(10 * cache_sizes[s] - 1), 0, &c, &name, &offset, &size) );
+    }
+}
+
+void CppUnitIndexCache::memory_budget() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    // Un index de 4096 tuiles occupe au moins 32 Ko : le budget permet d'en garder une seule par partition
+    std::vector<uint32_t> big (2 * 4096, 0);
+    IndexCache::set_memory_budget(ROK4_INDEX_CACHE_SHARDS * 50000);
+    for (int i = 0; i < 4 * ROK4_INDEX_CACHE_SHARDS; i++) {
+        IndexCache::add_slab_infos("/pyr/big" + std::to_string(i), NULL, "/pyr/big", 4096, (uint8_t*) big.data(), (uint8_t*) (big.data() + 4096));
+    }
+
+    int found = 0;
+    for (int i = 0; i < 4 * ROK4_INDEX_CACHE_SHARDS; i++) {
+        if (IndexCache::get_slab_infos("/pyr/big" + std::to_string(i), 0, &c, &name, &offset, &size)) found++;
+    }
+    CPPUNIT_ASSERT_MESSAGE ( "Cache exceeds its memory budget", found <= ROK4_INDEX_CACHE_SHARDS );
+    CPPUNIT_ASSERT_MESSAGE ( "Cache is empty", found > 0 );
+
+    // Avec le même budget, les petits index sont bien plus nombreux
+    for (int i = 0; i < 4 * ROK4_INDEX_CACHE_SHARDS; i++) {
+        IndexCache::add_slab_infos("/pyr/small" + std::to_string(i), NULL, "/pyr/small", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    }
+    found = 0;
+    for (int i = 0; i < 4 * ROK4_INDEX_CACHE_SHARDS; i++) {
+        if (IndexCache::get_slab_infos("/pyr/small" + std::to_string(i), 0, &c, &name, &offset, &size)) found++;
+    }
+    CPPUNIT_ASSERT_EQUAL ( 4 * ROK4_INDEX_CACHE_SHARDS, found );
+
+    IndexCache::set_memory_budget(0);
+}
+
+void CppUnitIndexCache::missing_slab() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+    bool missing;
+
+    CPPUNIT_ASSERT ( ! IndexCache::get_slab_infos("/pyr/missing", 0, &c, &name, &offset, &size, &missing) );
+    CPPUNIT_ASSERT_MESSAGE ( "Unknown slab is reported as missing", ! missing );
+
+    IndexCache::add_missing_slab("/pyr/missing");
+    CPPUNIT_ASSERT ( ! IndexCache::get_slab_infos("/pyr/missing", 0, &c, &name, &offset, &size, &missing) );
+    CPPUNIT_ASSERT_MESSAGE ( "Missing slab is not reported", missing );
+
+    IndexCache::set_missing_validity(-1);
+    CPPUNIT_ASSERT ( ! IndexCache::get_slab_infos("/pyr/missing", 0, &c, &name, &offset, &size, &missing) );
+    CPPUNIT_ASSERT_MESSAGE ( "Expired missing slab is reported", ! missing );
+
+    // La dalle est créée : l'index ajouté remplace l'élément négatif
+    IndexCache::add_slab_infos("/pyr/missing", NULL, "/pyr/missing", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/missing", 0, &c, &name, &offset, &size, &missing) );
+}
+
+void CppUnitIndexCache::stale_refresh() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    FileContext context ("/tmp/");
+    context.connection();
+    write_slab("/tmp/CppUnitIndexCache_slab.tif", 2048);
+    IndexCache::add_slab_infos("/tmp/CppUnitIndexCache_slab.tif", &context, "CppUnitIndexCache_slab.tif", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+
+    // La dalle est mise à jour, l'élément est périmé mais toujours servi
+    write_slab("/tmp/CppUnitIndexCache_slab.tif", 8192);
+    IndexCache::set_validity(-1);
+    IndexCache::set_stale_validity(3600);
+    IndexCache::set_refresh_hits(2);
+
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_slab.tif", 0, &c, &name, &offset, &size) );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 2048, offset );
+
+    // Le deuxième accès déclenche le rafraîchissement en tâche de fond
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_slab.tif", 0, &c, &name, &offset, &size) );
+
+    std::chrono::steady_clock::time_point limit = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (offset != 8192 && std::chrono::steady_clock::now() < limit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_slab.tif", 0, &c, &name, &offset, &size) );
+    }
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 8192, offset );
+
+    IndexCache::stop_refresher();
+    IndexCache::set_stale_validity(0);
+    IndexCache::set_refresh_hits(10);
+    remove("/tmp/CppUnitIndexCache_slab.tif");
+}
+
+void CppUnitIndexCache::refresh_missing() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+    bool missing = false;
+
+    IndexCache::set_validity(-1);
+    IndexCache::set_stale_validity(3600);
+    IndexCache::set_refresh_hits(1);
+
+    // Une erreur du stockage ne rend pas la dalle absente : l'élément périmé reste servi
+    CppUnitIndexCacheFailingContext failing;
+    IndexCache::add_slab_infos("/tmp/CppUnitIndexCache_failing.tif", &failing, "CppUnitIndexCache_failing.tif", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_failing.tif", 0, &c, &name, &offset, &size) );
+
+    // Dalle supprimée : l'absence est certaine et mémorisée
+    FileContext context ("/tmp/");
+    context.connection();
+    IndexCache::add_slab_infos("/tmp/CppUnitIndexCache_deleted.tif", &context, "CppUnitIndexCache_deleted.tif", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_deleted.tif", 0, &c, &name, &offset, &size) );
+
+    std::chrono::steady_clock::time_point limit = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (! missing && std::chrono::steady_clock::now() < limit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_deleted.tif", 0, &c, &name, &offset, &size, &missing);
+    }
+    CPPUNIT_ASSERT_MESSAGE ( "Deleted slab is not reported as missing", missing );
+
+    // Les rafraîchissements sont traités dans l'ordre : celui de la dalle en erreur est terminé
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/tmp/CppUnitIndexCache_failing.tif", 0, &c, &name, &offset, &size, &missing) );
+    CPPUNIT_ASSERT_MESSAGE ( "Slab on failing storage is reported as missing", ! missing );
+
+    IndexCache::stop_refresher();
+    IndexCache::set_stale_validity(0);
+    IndexCache::set_refresh_hits(10);
+}
+
+void CppUnitIndexCache::snapshot() {
+    Context* c;
+    std::string name;
+    uint32_t offset, size;
+
+    Context* file_context = StoragePool::get_context(ContextType::FILECONTEXT, "");
+    CPPUNIT_ASSERT ( file_context != NULL );
+
+    IndexCache::add_slab_infos("/pyr/hot", file_context, "/pyr/target", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    IndexCache::add_slab_infos("/pyr/cold", file_context, "/pyr/cold", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+    IndexCache::add_missing_slab("/pyr/missing");
+    // Élément dont le contexte n'est pas dans le StoragePool
+    IndexCache::add_slab_infos("/pyr/orphan", NULL, "/pyr/orphan", 4, (uint8_t*) offsets, (uint8_t*) sizes);
+
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/hot", 0, &c, &name, &offset, &size) );
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/hot", 1, &c, &name, &offset, &size) );
+
+    CPPUNIT_ASSERT_EQUAL ( 1, IndexCache::save_snapshot("/tmp/CppUnitIndexCache.snapshot", 2) );
+    CPPUNIT_ASSERT_EQUAL ( 2, IndexCache::save_snapshot("/tmp/CppUnitIndexCache.snapshot") );
+
+    IndexCache::clean_indexes();
+    CPPUNIT_ASSERT ( ! IndexCache::get_slab_infos("/pyr/hot", 3, &c, &name, &offset, &size) );
+
+    CPPUNIT_ASSERT_EQUAL ( 2, IndexCache::load_snapshot("/tmp/CppUnitIndexCache.snapshot") );
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/hot", 3, &c, &name, &offset, &size) );
+    CPPUNIT_ASSERT ( c == file_context );
+    CPPUNIT_ASSERT_EQUAL ( std::string("/pyr/target"), name );
+    CPPUNIT_ASSERT_EQUAL ( offsets[3], offset );
+    CPPUNIT_ASSERT_EQUAL ( sizes[3], size );
+    CPPUNIT_ASSERT ( IndexCache::get_slab_infos("/pyr/cold", 0, &c, &name, &offset, &size) );
+
+    // Les éléments définitivement périmés ne sont pas chargés
+    IndexCache::clean_indexes();
+    IndexCache::set_validity(-1);
+    CPPUNIT_ASSERT_EQUAL ( 0, IndexCache::load_snapshot("/tmp/CppUnitIndexCache.snapshot") );
+
+    CPPUNIT_ASSERT ( IndexCache::load_snapshot("/tmp/CppUnitIndexCache_missing.snapshot") < 0 );
+
+    remove("/tmp/CppUnitIndexCache.snapshot");
+    StoragePool::clean_storages();
+}
+
+void CppUnitIndexCache::concurrency() {
+    std::vector<std::thread> threads;
+    bool consistent = true;
+
+    for (int t = 0; t < 8; t++) {
+        threads.push_back(std::thread([this, t, &consistent]() {
+            Context* c;
+            std::string name;
+            uint32_t offset, size;
+            for (int i = 0; i < 1000; i++) {
+                std::string key = "/pyr/slab" + std::to_string((i * 7 + t) % 150);
+                if (IndexCache::get_slab_infos(key, 1, &c, &name, &offset, &size)) {
+                    if (name != key || offset != offsets[1] || size != sizes[1]) consistent = false;
+                } else {
+                    IndexCache::add_slab_infos(key, NULL, key, 4, (uint8_t*) offsets, (uint8_t*) sizes);
+                }
+            }
+        }));
+    }
+    for (int t = 0; t < threads.size(); t++) threads.at(t).join();
+
+    CPPUNIT_ASSERT_MESSAGE ( "Inconsistent element read during concurrent updates", consistent );
+}
+
+void CppUnitIndexCache::tearDown() {
+    IndexCache::stop_refresher();
+    IndexCache::clean_indexes();
+    IndexCache::setCacheSize(100);
+    IndexCache::set_validity(300);
+    IndexCache::set_missing_validity(60);
+    IndexCache::set_memory_budget(0);
+}
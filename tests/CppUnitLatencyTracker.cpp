@@ -0,0 +1,105 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "rok4/utils/LatencyTracker.h"
+
+class CppUnitLatencyTracker : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitLatencyTracker );
+
+    CPPUNIT_TEST ( percentile );
+    CPPUNIT_TEST ( hedge_delay );
+    CPPUNIT_TEST ( sliding_window );
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void percentile();
+    void hedge_delay();
+    void sliding_window();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitLatencyTracker );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitLatencyTracker, "CppUnitLatencyTracker" );
+
+void CppUnitLatencyTracker::percentile() {
+    LatencyTracker tracker;
+
+    // Pas assez de mesures
+    for (int i = 1; i < ROK4_LATENCY_TRACKER_MIN_SAMPLES; i++) tracker.add(i);
+    CPPUNIT_ASSERT_EQUAL ( -1, tracker.get_percentile(50) );
+
+    for (int i = ROK4_LATENCY_TRACKER_MIN_SAMPLES; i <= 101; i++) tracker.add(i);
+    CPPUNIT_ASSERT_EQUAL ( 101, tracker.get_count() );
+    CPPUNIT_ASSERT_EQUAL ( 51, tracker.get_percentile(50) );
+    CPPUNIT_ASSERT_EQUAL ( 96, tracker.get_percentile(95) );
+    CPPUNIT_ASSERT_EQUAL ( 101, tracker.get_percentile(100) );
+    CPPUNIT_ASSERT_EQUAL ( 101, tracker.get_percentile(150) );
+}
+
+void CppUnitLatencyTracker::hedge_delay() {
+    LatencyTracker tracker;
+    CPPUNIT_ASSERT_EQUAL ( -1, tracker.get_hedge_delay(95, 10) );
+
+    for (int i = 1; i <= 100; i++) tracker.add(i);
+
+    // Doublement désactivé
+    CPPUNIT_ASSERT_EQUAL ( -1, tracker.get_hedge_delay(0, 10) );
+
+    CPPUNIT_ASSERT_EQUAL ( 95, tracker.get_hedge_delay(95, 10) );
+    CPPUNIT_ASSERT_EQUAL ( 200, tracker.get_hedge_delay(95, 200) );
+}
+
+void CppUnitLatencyTracker::sliding_window() {
+    LatencyTracker tracker;
+
+    for (int i = 0; i < ROK4_LATENCY_TRACKER_CAPACITY; i++) tracker.add(10);
+    CPPUNIT_ASSERT_EQUAL ( 10, tracker.get_percentile(90) );
+
+    // Les requêtes ralentissent : les anciennes mesures sont remplacées et le percentile est recalculé
+    for (int i = 0; i < ROK4_LATENCY_TRACKER_CAPACITY; i++) tracker.add(100);
+    CPPUNIT_ASSERT_EQUAL ( ROK4_LATENCY_TRACKER_CAPACITY, tracker.get_count() );
+    CPPUNIT_ASSERT_EQUAL ( 100, tracker.get_percentile(98) );
+
+    // Le percentile n'est recalculé qu'après assez de nouvelles mesures
+    for (int i = 0; i < ROK4_LATENCY_TRACKER_REFRESH - 1; i++) tracker.add(1000);
+    CPPUNIT_ASSERT_EQUAL ( 100, tracker.get_percentile(98) );
+    tracker.add(1000);
+    CPPUNIT_ASSERT_EQUAL ( 1000, tracker.get_percentile(98) );
+}
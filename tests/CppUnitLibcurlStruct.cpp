@@ -0,0 +1,117 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "rok4/utils/LibcurlStruct.h"
+
+class CppUnitLibcurlStruct : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitLibcurlStruct );
+
+    CPPUNIT_TEST ( buffer_fits );
+    CPPUNIT_TEST ( buffer_overflow );
+    CPPUNIT_TEST ( transfer_overflow );
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void buffer_fits();
+    void buffer_overflow();
+    void transfer_overflow();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitLibcurlStruct );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitLibcurlStruct, "CppUnitLibcurlStruct" );
+
+void CppUnitLibcurlStruct::buffer_fits() {
+    uint8_t data[10];
+    BufferStruct buffer(data, 10);
+
+    char first[] = "01234";
+    char second[] = "56789";
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 5, buffer_callback(first, 1, 5, &buffer) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 5, buffer_callback(second, 5, 1, &buffer) );
+
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, buffer.size );
+    CPPUNIT_ASSERT ( ! buffer.overflow );
+    CPPUNIT_ASSERT_EQUAL ( std::string("0123456789"), std::string((char*) data, 10) );
+}
+
+void CppUnitLibcurlStruct::buffer_overflow() {
+    uint8_t data[8];
+    memset(data, 'x', 8);
+    BufferStruct buffer(data, 6);
+
+    char first[] = "0123";
+    char second[] = "4567";
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 4, buffer_callback(first, 1, 4, &buffer) );
+
+    // Au delà de la capacité : on remplit ce qui peut l'être et on demande l'interruption du transfert
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 0, buffer_callback(second, 1, 4, &buffer) );
+    CPPUNIT_ASSERT ( buffer.overflow );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 6, buffer.size );
+    CPPUNIT_ASSERT_EQUAL ( std::string("012345xx"), std::string((char*) data, 8) );
+}
+
+void CppUnitLibcurlStruct::transfer_overflow() {
+    std::string path = "/tmp/rok4_cppunit_libcurlstruct_" + std::to_string(getpid());
+    std::ofstream out(path.c_str());
+    out << std::string(100000, 'a');
+    out.close();
+
+    uint8_t data[1000];
+    BufferStruct buffer(data, 1000);
+
+    CURL* curl = curl_easy_init();
+    curl_easy_setopt(curl, CURLOPT_URL, ("file://" + path).c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffer);
+
+    // Le transfert est interrompu dès le dépassement, sans lire le reste de la réponse
+    CPPUNIT_ASSERT_EQUAL ( CURLE_WRITE_ERROR, curl_easy_perform(curl) );
+    CPPUNIT_ASSERT ( buffer.overflow );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1000, buffer.size );
+
+    curl_easy_cleanup(curl);
+    unlink(path.c_str());
+}
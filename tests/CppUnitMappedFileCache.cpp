@@ -0,0 +1,161 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "rok4/utils/MappedFileCache.h"
+
+class CppUnitMappedFileCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitMappedFileCache );
+
+    CPPUNIT_TEST ( reuse );
+    CPPUNIT_TEST ( replaced_file );
+    CPPUNIT_TEST ( resized_file );
+    CPPUNIT_TEST ( eviction );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string file1;
+    std::string file2;
+
+    void write_file(std::string path, std::string content, bool append = false) {
+        std::ofstream ofs(path, (append ? std::ios::app : std::ios::trunc) | std::ios::binary);
+        ofs << content;
+    }
+
+    static std::string content(std::shared_ptr<MappedFile> mf) {
+        return std::string((const char*) mf->data, mf->size);
+    }
+
+public:
+    void setUp();
+    void reuse();
+    void replaced_file();
+    void resized_file();
+    void eviction();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitMappedFileCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitMappedFileCache, "CppUnitMappedFileCache" );
+
+void CppUnitMappedFileCache::setUp() {
+    file1 = "/tmp/CppUnitMappedFileCache_1.bin";
+    file2 = "/tmp/CppUnitMappedFileCache_2.bin";
+    write_file(file1, "first");
+    write_file(file2, "second");
+    MappedFileCache::clean_mappings();
+    MappedFileCache::set_size(100);
+    MappedFileCache::set_validity(10);
+}
+
+void CppUnitMappedFileCache::reuse() {
+    std::shared_ptr<MappedFile> mf1 = MappedFileCache::get_mapping(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "File cannot be mapped", mf1 != NULL );
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), content(mf1) );
+    CPPUNIT_ASSERT_MESSAGE ( "Mapping is not reused", MappedFileCache::get_mapping(file1) == mf1 );
+
+    CPPUNIT_ASSERT_MESSAGE ( "Missing file is mapped", MappedFileCache::get_mapping("/tmp/CppUnitMappedFileCache_missing.bin") == NULL );
+
+    MappedFileCache::invalidate(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "Mapping is reused after invalidation", MappedFileCache::get_mapping(file1) != mf1 );
+
+    MappedFileCache::set_size(0);
+    CPPUNIT_ASSERT_MESSAGE ( "File is mapped with a disabled cache", MappedFileCache::get_mapping(file1) == NULL );
+}
+
+void CppUnitMappedFileCache::replaced_file() {
+    MappedFileCache::set_validity(0);
+    std::shared_ptr<MappedFile> mf1 = MappedFileCache::get_mapping(file1);
+
+    // Le fichier est remplacé par un autre de même taille (nouvel inode), comme lors d'une mise à jour atomique
+    std::string tmp = file1 + ".tmp";
+    write_file(tmp, "FIRST");
+    rename(tmp.c_str(), file1.c_str());
+    sleep(1);
+
+    std::shared_ptr<MappedFile> mf2 = MappedFileCache::get_mapping(file1);
+    CPPUNIT_ASSERT_MESSAGE ( "Replaced file's mapping is reused", mf1 != mf2 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("FIRST"), content(mf2) );
+    // L'ancienne projection reste lisible tant qu'elle est détenue
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), content(mf1) );
+}
+
+void CppUnitMappedFileCache::resized_file() {
+    MappedFileCache::set_validity(0);
+    std::shared_ptr<MappedFile> mf1 = MappedFileCache::get_mapping(file1);
+    ino_t inode = mf1->inode;
+
+    // Même inode, taille différente
+    write_file(file1, "_more", true);
+    sleep(1);
+
+    std::shared_ptr<MappedFile> mf2 = MappedFileCache::get_mapping(file1);
+    CPPUNIT_ASSERT_EQUAL ( inode, mf2->inode );
+    CPPUNIT_ASSERT_MESSAGE ( "Resized file's mapping is reused", mf1 != mf2 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("first_more"), content(mf2) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 5, mf1->size );
+}
+
+void CppUnitMappedFileCache::eviction() {
+    MappedFileCache::set_size(1);
+    std::shared_ptr<MappedFile> mf1 = MappedFileCache::get_mapping(file1);
+    std::shared_ptr<MappedFile> mf2 = MappedFileCache::get_mapping(file2);
+
+    // file1 est sorti du cache mais sa projection est toujours valide
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), content(mf1) );
+    CPPUNIT_ASSERT_MESSAGE ( "Evicted mapping is reused", MappedFileCache::get_mapping(file1) != mf1 );
+    CPPUNIT_ASSERT_EQUAL ( std::string("second"), content(mf2) );
+
+    // Vider le cache ne libère pas les projections détenues
+    MappedFileCache::clean_mappings();
+    CPPUNIT_ASSERT_EQUAL ( std::string("first"), content(mf1) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("second"), content(mf2) );
+}
+
+void CppUnitMappedFileCache::tearDown() {
+    MappedFileCache::clean_mappings();
+    MappedFileCache::set_size(0);
+    remove(file1.c_str());
+    remove(file2.c_str());
+}
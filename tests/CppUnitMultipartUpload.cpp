@@ -0,0 +1,212 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "storage/MultipartUpload.h"
+
+class CppUnitMultipartUpload : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitMultipartUpload );
+
+    CPPUNIT_TEST ( first_part_hold );
+    CPPUNIT_TEST ( padding );
+    CPPUNIT_TEST ( already_sent );
+    CPPUNIT_TEST ( last_part );
+    CPPUNIT_TEST ( not_started );
+    CPPUNIT_TEST ( pending_bound );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    uint8_t data[64];
+
+public:
+    void setUp();
+
+    void first_part_hold();
+    void padding();
+    void already_sent();
+    void last_part();
+    void not_started();
+    void pending_bound();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitMultipartUpload );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitMultipartUpload, "CppUnitMultipartUpload" );
+
+void CppUnitMultipartUpload::setUp() {
+    for (int i = 0; i < 64; i++) data[i] = i;
+}
+
+void CppUnitMultipartUpload::first_part_hold() {
+    MultipartUpload upload(10);
+
+    CPPUNIT_ASSERT ( upload.write(data, 0, 15) );
+    CPPUNIT_ASSERT ( ! upload.has_full_part() );
+    CPPUNIT_ASSERT ( upload.write(data + 15, 15, 10) );
+    CPPUNIT_ASSERT ( upload.has_full_part() );
+
+    // La première partie est conservée, la suivante est disponible dès qu'elle est complète
+    int number = 0;
+    std::shared_ptr<std::vector<char> > part = upload.pop_part(number);
+    CPPUNIT_ASSERT_EQUAL ( 2, number );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, part->size() );
+    for (int i = 0; i < 10; i++) CPPUNIT_ASSERT_EQUAL ( (char) (10 + i), part->at(i) );
+    CPPUNIT_ASSERT ( upload.is_started() );
+    CPPUNIT_ASSERT ( ! upload.has_full_part() );
+
+    // L'en-tête est écrit en dernier, dans la première partie
+    CPPUNIT_ASSERT ( upload.write(data + 40, 0, 4) );
+    std::shared_ptr<std::vector<char> > first = upload.pop_first();
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, first->size() );
+    for (int i = 0; i < 4; i++) CPPUNIT_ASSERT_EQUAL ( (char) (40 + i), first->at(i) );
+    for (int i = 4; i < 10; i++) CPPUNIT_ASSERT_EQUAL ( (char) i, first->at(i) );
+}
+
+void CppUnitMultipartUpload::padding() {
+    MultipartUpload upload(10);
+
+    // Écriture au delà de la première partie : les trous sont comblés par des zéros
+    CPPUNIT_ASSERT ( upload.write(data, 0, 3) );
+    CPPUNIT_ASSERT ( upload.write(data + 12, 12, 8) );
+    CPPUNIT_ASSERT ( upload.has_full_part() );
+
+    int number = 0;
+    std::shared_ptr<std::vector<char> > part = upload.pop_part(number);
+    CPPUNIT_ASSERT_EQUAL ( 2, number );
+    CPPUNIT_ASSERT_EQUAL ( (char) 0, part->at(0) );
+    CPPUNIT_ASSERT_EQUAL ( (char) 0, part->at(1) );
+    for (int i = 2; i < 10; i++) CPPUNIT_ASSERT_EQUAL ( (char) (10 + i), part->at(i) );
+
+    std::shared_ptr<std::vector<char> > first = upload.pop_first();
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, first->size() );
+    for (int i = 0; i < 3; i++) CPPUNIT_ASSERT_EQUAL ( (char) i, first->at(i) );
+    for (int i = 3; i < 10; i++) CPPUNIT_ASSERT_EQUAL ( (char) 0, first->at(i) );
+}
+
+void CppUnitMultipartUpload::already_sent() {
+    MultipartUpload upload(10);
+
+    CPPUNIT_ASSERT ( upload.write(data, 0, 25) );
+    int number = 0;
+    upload.pop_part(number);
+
+    // Les données de la partie envoyée ne peuvent plus être modifiées, celles de la première si
+    CPPUNIT_ASSERT ( ! upload.write(data, 15, 2) );
+    CPPUNIT_ASSERT ( ! upload.write(data, 5, 10) );
+    CPPUNIT_ASSERT ( upload.write(data, 5, 5) );
+    CPPUNIT_ASSERT ( upload.write(data, 20, 5) );
+    CPPUNIT_ASSERT ( ! upload.write_full(data, 10) );
+}
+
+void CppUnitMultipartUpload::last_part() {
+    MultipartUpload upload(10);
+
+    CPPUNIT_ASSERT ( upload.write(data, 0, 34) );
+    int number = 0;
+    upload.pop_part(number);
+    CPPUNIT_ASSERT ( upload.has_full_part() );
+    upload.pop_part(number);
+    CPPUNIT_ASSERT_EQUAL ( 3, number );
+
+    // La dernière partie peut être incomplète
+    std::shared_ptr<std::vector<char> > last = upload.pop_last(number);
+    CPPUNIT_ASSERT_EQUAL ( 4, number );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 4, last->size() );
+    for (int i = 0; i < 4; i++) CPPUNIT_ASSERT_EQUAL ( (char) (30 + i), last->at(i) );
+
+    last = upload.pop_last(number);
+    CPPUNIT_ASSERT_EQUAL ( 5, number );
+    CPPUNIT_ASSERT ( last->empty() );
+}
+
+void CppUnitMultipartUpload::not_started() {
+    MultipartUpload upload(10);
+
+    CPPUNIT_ASSERT ( upload.write(data, 0, 25) );
+    CPPUNIT_ASSERT ( upload.write_full(data + 30, 12) );
+    CPPUNIT_ASSERT ( ! upload.is_started() );
+
+    // Aucune partie envoyée : l'objet est écrit en une fois
+    std::vector<char>* all = upload.pop_all();
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 12, all->size() );
+    for (int i = 0; i < 12; i++) CPPUNIT_ASSERT_EQUAL ( (char) (30 + i), all->at(i) );
+    delete all;
+}
+
+void CppUnitMultipartUpload::pending_bound() {
+    MultipartUpload upload(10);
+
+    std::vector<std::promise<std::string> > promises(ROK4_MULTIPART_MAX_PENDING + 1);
+    for (int i = 0; i < ROK4_MULTIPART_MAX_PENDING; i++) {
+        upload.add_result(i + 2, 10, promises.at(i).get_future().share());
+    }
+
+    // Trop d'envois en cours : l'ajout attend la fin du plus ancien
+    std::future<void> added = std::async(std::launch::async, [&upload, &promises]() {
+        upload.add_result(ROK4_MULTIPART_MAX_PENDING + 2, 4, promises.at(ROK4_MULTIPART_MAX_PENDING).get_future().share());
+    });
+    CPPUNIT_ASSERT ( added.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout );
+
+    promises.at(0).set_value("part-2");
+    CPPUNIT_ASSERT ( added.wait_for(std::chrono::seconds(5)) == std::future_status::ready );
+    added.get();
+
+    for (int i = 1; i <= ROK4_MULTIPART_MAX_PENDING; i++) {
+        promises.at(i).set_value(i == 2 ? "" : "part-" + std::to_string(i + 2));
+    }
+
+    // Identifiants dans l'ordre des parties, échec si un envoi a échoué
+    std::vector<std::pair<int, std::string> > identifiers;
+    CPPUNIT_ASSERT ( ! upload.wait_results(identifiers) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) ROK4_MULTIPART_MAX_PENDING + 1, identifiers.size() );
+    for (int i = 0; i <= ROK4_MULTIPART_MAX_PENDING; i++) CPPUNIT_ASSERT_EQUAL ( i + 2, identifiers.at(i).first );
+    CPPUNIT_ASSERT_EQUAL ( std::string("part-2"), identifiers.at(0).second );
+    CPPUNIT_ASSERT_EQUAL ( std::string(""), identifiers.at(2).second );
+
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, upload.get_part_size(2) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 4, upload.get_part_size(ROK4_MULTIPART_MAX_PENDING + 2) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 0, upload.get_part_size(42) );
+}
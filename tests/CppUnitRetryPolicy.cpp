@@ -0,0 +1,168 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <thread>
+#include "rok4/storage/RetryPolicy.h"
+
+class CppUnitRetryPolicy : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitRetryPolicy );
+
+    CPPUNIT_TEST ( retryable );
+    CPPUNIT_TEST ( delays );
+    CPPUNIT_TEST ( attempts_and_deadline );
+    CPPUNIT_TEST ( breaker );
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void retryable();
+    void delays();
+    void attempts_and_deadline();
+    void breaker();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitRetryPolicy );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitRetryPolicy, "CppUnitRetryPolicy" );
+
+void CppUnitRetryPolicy::setUp() {
+    RetryPolicy::reset_breakers();
+}
+
+void CppUnitRetryPolicy::retryable() {
+    RetryPolicy policy(10, 100, 0);
+
+    CPPUNIT_ASSERT ( policy.is_retryable(0) );
+    CPPUNIT_ASSERT ( policy.is_retryable(500) );
+    CPPUNIT_ASSERT ( policy.is_retryable(503) );
+    CPPUNIT_ASSERT ( policy.is_retryable(429) );
+    CPPUNIT_ASSERT ( policy.is_retryable(408) );
+    CPPUNIT_ASSERT ( ! policy.is_retryable(404) );
+    CPPUNIT_ASSERT ( ! policy.is_retryable(403) );
+    CPPUNIT_ASSERT ( ! policy.is_retryable(400) );
+}
+
+void CppUnitRetryPolicy::delays() {
+    RetryPolicy policy(10, 100, 0);
+
+    // Gigue décorrélée : chaque délai est entre le délai de base et trois fois le précédent, borné par le maximum
+    for (int n = 0; n < 100; n++) {
+        RetryPolicy::State state;
+        int previous = 10;
+        for (int i = 0; i < 10; i++) {
+            int delay = policy.get_delay(state);
+            CPPUNIT_ASSERT ( delay >= 10 );
+            CPPUNIT_ASSERT ( delay <= 100 );
+            CPPUNIT_ASSERT ( delay <= previous * 3 );
+            CPPUNIT_ASSERT_EQUAL ( delay, state.delay );
+            previous = delay;
+        }
+    }
+
+    // Délai constant (comportement historique en secondes)
+    RetryPolicy constant(2000, 2000, 0);
+    RetryPolicy::State state;
+    CPPUNIT_ASSERT_EQUAL ( 2000, constant.get_delay(state) );
+    CPPUNIT_ASSERT_EQUAL ( 2000, constant.get_delay(state) );
+}
+
+void CppUnitRetryPolicy::attempts_and_deadline() {
+    RetryPolicy policy(10, 20, 0);
+    RetryPolicy::State state;
+
+    CPPUNIT_ASSERT ( policy.next_delay(1, 3, 503, state) >= 10 );
+    CPPUNIT_ASSERT ( policy.next_delay(2, 3, 0, state) >= 10 );
+    // Tentatives épuisées
+    CPPUNIT_ASSERT_EQUAL ( -1, policy.next_delay(3, 3, 503, state) );
+    // Échec définitif
+    CPPUNIT_ASSERT_EQUAL ( -1, policy.next_delay(1, 3, 404, state) );
+
+    // Échéance : pas de nouvelle tentative qui la dépasserait
+    RetryPolicy bounded(10, 20, 50);
+    RetryPolicy::State bounded_state;
+    CPPUNIT_ASSERT ( bounded.next_delay(1, 10, 503, bounded_state) >= 0 );
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    CPPUNIT_ASSERT_EQUAL ( -1, bounded.next_delay(2, 10, 503, bounded_state) );
+}
+
+void CppUnitRetryPolicy::breaker() {
+    RetryPolicy policy(10, 20, 0, 3, 100);
+
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+    policy.record("cluster", 503, false);
+    policy.record("cluster", 0, false);
+    // Une réussite remet le compte à zéro
+    policy.record("cluster", 200, true);
+    policy.record("cluster", 503, false);
+    policy.record("cluster", 503, false);
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+
+    // Les erreurs définitives montrent que le cluster répond
+    policy.record("cluster", 404, false);
+    policy.record("cluster", 503, false);
+    policy.record("cluster", 503, false);
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+
+    policy.record("cluster", 503, false);
+    CPPUNIT_ASSERT ( ! policy.is_available("cluster") );
+    // Les autres clusters ne sont pas concernés
+    CPPUNIT_ASSERT ( policy.is_available("other") );
+
+    // Après le temps de repos, une seule requête d'essai
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+    CPPUNIT_ASSERT ( ! policy.is_available("cluster") );
+
+    // L'essai échoue : le disjoncteur reste ouvert
+    policy.record("cluster", 503, false);
+    CPPUNIT_ASSERT ( ! policy.is_available("cluster") );
+
+    // L'essai réussit : le disjoncteur est refermé
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+    policy.record("cluster", 206, true);
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+    CPPUNIT_ASSERT ( policy.is_available("cluster") );
+
+    // Disjoncteur désactivé
+    RetryPolicy disabled(10, 20, 0);
+    for (int i = 0; i < 10; i++) disabled.record("cluster2", 503, false);
+    CPPUNIT_ASSERT ( disabled.is_available("cluster2") );
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "rok4/utils/SingleFlight.h"
+
+/**
+ * Contexte de test : lecture lente d'un contenu déterministe, avec comptage des lectures
+ */
+class SlowContext : public Context {
+public:
+    std::atomic<int> reads;
+    ContextType::eContextType type;
+
+    SlowContext(ContextType::eContextType t) : Context(), reads(0), type(t) { connected = true; }
+
+    bool connection() { return true; }
+    bool exists(std::string name) { return true; }
+    int read(uint8_t* data, int offset, int size, std::string name) {
+        reads++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        for (int i = 0; i < size; i++) data[i] = (uint8_t) (offset + i);
+        return size;
+    }
+    uint8_t* read_full(int& size, std::string name) { size = -1; return NULL; }
+    bool write(uint8_t* data, int offset, int size, std::string name) { return false; }
+    bool write_full(uint8_t* data, int size, std::string name) { return false; }
+    bool open_to_write(std::string name) { return false; }
+    bool close_to_write(std::string name) { return false; }
+    ContextType::eContextType get_type() { return type; }
+    std::string get_type_string() { return "SLOWCONTEXT"; }
+    std::string get_tray() { return ""; }
+    std::string get_path(std::string racine, int x, int y, int pathDepth = 2) { return racine; }
+    std::string get_path(std::string name) { return name; }
+    void print() { }
+    std::string to_string() { return "SLOWCONTEXT"; }
+    void close_connection() { }
+};
+
+class CppUnitSingleFlight : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitSingleFlight );
+
+    CPPUNIT_TEST ( concurrent_reads );
+    CPPUNIT_TEST ( same_batch );
+    CPPUNIT_TEST ( disabled );
+    CPPUNIT_TEST ( file_context );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    SlowContext* context;
+
+    void read_in_threads(int threads_number, std::atomic<int>& valid) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threads_number; t++) {
+            threads.push_back(std::thread([this, &valid] {
+                uint8_t buffer[16];
+                std::vector<ReadRange> ranges;
+                ranges.push_back(ReadRange("slab", buffer, 100, 16));
+                SingleFlight::read_ranges(context, ranges);
+                if (ranges.at(0).read_size == 16 && buffer[0] == 100 && buffer[15] == 115) valid++;
+            }));
+        }
+        for (int t = 0; t < threads_number; t++) threads.at(t).join();
+    }
+
+public:
+    void setUp();
+    void concurrent_reads();
+    void same_batch();
+    void disabled();
+    void file_context();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitSingleFlight );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitSingleFlight, "CppUnitSingleFlight" );
+
+void CppUnitSingleFlight::setUp() {
+    context = new SlowContext(ContextType::S3CONTEXT);
+    SingleFlight::set_enabled(true);
+}
+
+void CppUnitSingleFlight::concurrent_reads() {
+    std::atomic<int> valid(0);
+    read_in_threads(8, valid);
+
+    CPPUNIT_ASSERT_EQUAL ( 8, (int) valid );
+    // Toutes les lectures démarrent pendant la première (200 ms), une seule est effectuée
+    CPPUNIT_ASSERT_EQUAL ( 1, (int) context->reads );
+
+    // Une fois la lecture terminée, une nouvelle demande relit la donnée
+    uint8_t buffer[16];
+    std::vector<ReadRange> ranges;
+    ranges.push_back(ReadRange("slab", buffer, 100, 16));
+    CPPUNIT_ASSERT ( SingleFlight::read_ranges(context, ranges) );
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) context->reads );
+}
+
+void CppUnitSingleFlight::same_batch() {
+    uint8_t buffer1[8], buffer2[8], buffer3[8];
+    std::vector<ReadRange> ranges;
+    ranges.push_back(ReadRange("slab", buffer1, 10, 8));
+    ranges.push_back(ReadRange("slab", buffer2, 10, 8));
+    ranges.push_back(ReadRange("other", buffer3, 10, 8));
+    CPPUNIT_ASSERT ( SingleFlight::read_ranges(context, ranges) );
+
+    CPPUNIT_ASSERT_EQUAL ( 2, (int) context->reads );
+    CPPUNIT_ASSERT_EQUAL ( 8, ranges.at(1).read_size );
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 17, buffer2[7] );
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 10, buffer3[0] );
+}
+
+void CppUnitSingleFlight::disabled() {
+    SingleFlight::set_enabled(false);
+    std::atomic<int> valid(0);
+    read_in_threads(4, valid);
+
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) valid );
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) context->reads );
+}
+
+void CppUnitSingleFlight::file_context() {
+    // Lectures de fichiers : pas de mise en commun
+    delete context;
+    context = new SlowContext(ContextType::FILECONTEXT);
+    std::atomic<int> valid(0);
+    read_in_threads(4, valid);
+
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) valid );
+    CPPUNIT_ASSERT_EQUAL ( 4, (int) context->reads );
+}
+
+void CppUnitSingleFlight::tearDown() {
+    SingleFlight::set_enabled(true);
+    delete context;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <atomic>
+#include <unistd.h>
+#include "rok4/utils/SlabPrefixCache.h"
+#include "rok4/utils/IndexCache.h"
+#include "datasource/StoreDataSource.h"
+#include "rok4/enums/Format.h"
+#include "storage/FileContext.h"
+
+#define PREFIX_TEST_TILES 16
+#define PREFIX_TEST_TILE_SIZE 1000
+
+// Dalle en mémoire sur un stockage objet simulé : en-tête, index puis tuiles de 1000 octets
+class PrefixSlabContext : public Context {
+public:
+    std::atomic<int> reads;
+    std::vector<uint8_t> slab;
+
+    PrefixSlabContext() : Context(), reads(0) {
+        connected = true;
+        int data_start = ROK4_IMAGE_HEADER_SIZE + 2 * 4 * PREFIX_TEST_TILES;
+        slab.resize(data_start + PREFIX_TEST_TILES * PREFIX_TEST_TILE_SIZE, 0);
+        for (int i = 0; i < PREFIX_TEST_TILES; i++) {
+            uint32_t offset = data_start + i * PREFIX_TEST_TILE_SIZE;
+            uint32_t size = PREFIX_TEST_TILE_SIZE;
+            memcpy(slab.data() + ROK4_IMAGE_HEADER_SIZE + 4 * i, &offset, 4);
+            memcpy(slab.data() + ROK4_IMAGE_HEADER_SIZE + 4 * PREFIX_TEST_TILES + 4 * i, &size, 4);
+            memset(slab.data() + offset, i + 1, size);
+        }
+    }
+
+    bool connection() { return true; }
+    bool exists(std::string name) { return true; }
+    int read(uint8_t* data, int offset, int size, std::string name) {
+        reads++;
+        if (offset >= slab.size()) return -1;
+        int s = std::min(size, (int) slab.size() - offset);
+        memcpy(data, slab.data() + offset, s);
+        return s;
+    }
+    uint8_t* read_full(int& size, std::string name) { size = -1; return NULL; }
+    bool write(uint8_t* data, int offset, int size, std::string name) { return false; }
+    bool write_full(uint8_t* data, int size, std::string name) { return false; }
+    bool open_to_write(std::string name) { return false; }
+    bool close_to_write(std::string name) { return false; }
+    ContextType::eContextType get_type() { return ContextType::S3CONTEXT; }
+    std::string get_type_string() { return "PREFIXSLABCONTEXT"; }
+    std::string get_tray() { return "bucket"; }
+    std::string get_path(std::string racine, int x, int y, int pathDepth = 2) { return racine; }
+    std::string get_path(std::string name) { return "bucket/" + name; }
+    void print() { }
+    std::string to_string() { return "PREFIXSLABCONTEXT"; }
+    void close_connection() { }
+};
+
+class CppUnitSlabPrefixCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitSlabPrefixCache );
+
+    CPPUNIT_TEST ( read_size );
+    CPPUNIT_TEST ( validity_and_capacity );
+    CPPUNIT_TEST ( cold_slab );
+    CPPUNIT_TEST ( disabled );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    PrefixSlabContext* context;
+
+    // Lecture d'une tuile de la dalle, dont on vérifie le contenu
+    void read_tile(std::string name, int tile) {
+        StoreDataSource source (tile, PREFIX_TEST_TILES, name, context, "image/jpeg", "");
+        size_t size;
+        const uint8_t* data = source.get_data(size);
+        CPPUNIT_ASSERT ( data != NULL );
+        CPPUNIT_ASSERT_EQUAL ( (size_t) PREFIX_TEST_TILE_SIZE, size );
+        CPPUNIT_ASSERT_EQUAL ( (uint8_t) (tile + 1), data[0] );
+        CPPUNIT_ASSERT_EQUAL ( (uint8_t) (tile + 1), data[size - 1] );
+    }
+
+public:
+    void setUp();
+    void read_size();
+    void validity_and_capacity();
+    void cold_slab();
+    void disabled();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitSlabPrefixCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitSlabPrefixCache, "CppUnitSlabPrefixCache" );
+
+void CppUnitSlabPrefixCache::setUp() {
+    context = new PrefixSlabContext();
+    IndexCache::clean_indexes();
+    SlabPrefixCache::clean_prefixes();
+    // En-tête, index et 5 premières tuiles
+    SlabPrefixCache::set_prefix_size(ROK4_IMAGE_HEADER_SIZE + 2 * 4 * PREFIX_TEST_TILES + 5 * PREFIX_TEST_TILE_SIZE);
+    SlabPrefixCache::set_validity(10);
+    SlabPrefixCache::set_capacity(64);
+}
+
+void CppUnitSlabPrefixCache::read_size() {
+    CPPUNIT_ASSERT_EQUAL ( ROK4_IMAGE_HEADER_SIZE + 2 * 4 * PREFIX_TEST_TILES + 5 * PREFIX_TEST_TILE_SIZE, SlabPrefixCache::get_read_size(context, 2176) );
+
+    // Index plus grand que la lecture spéculative
+    CPPUNIT_ASSERT_EQUAL ( 100000, SlabPrefixCache::get_read_size(context, 100000) );
+
+    // Pas de lecture spéculative sur fichier
+    FileContext file_context ("");
+    CPPUNIT_ASSERT_EQUAL ( 2176, SlabPrefixCache::get_read_size(&file_context, 2176) );
+}
+
+void CppUnitSlabPrefixCache::validity_and_capacity() {
+    SlabPrefixCache::set_capacity(2);
+    SlabPrefixCache::add_prefix(context, "slab1", new uint8_t[10], 10);
+    SlabPrefixCache::add_prefix(context, "slab2", new uint8_t[10], 10);
+    CPPUNIT_ASSERT ( SlabPrefixCache::get_prefix(context, "slab1") );
+
+    // Le moins récemment utilisé sort du cache
+    std::shared_ptr<SlabPrefix> kept = SlabPrefixCache::add_prefix(context, "slab3", new uint8_t[10], 10);
+    CPPUNIT_ASSERT_EQUAL ( 2, SlabPrefixCache::get_count() );
+    CPPUNIT_ASSERT ( ! SlabPrefixCache::get_prefix(context, "slab2") );
+    CPPUNIT_ASSERT ( SlabPrefixCache::get_prefix(context, "slab1") );
+
+    SlabPrefixCache::set_validity(0);
+    sleep(1);
+    CPPUNIT_ASSERT_MESSAGE ( "Expired prefix is served", ! SlabPrefixCache::get_prefix(context, "slab3") );
+    // La donnée reste valide pour ses détenteurs
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 10, kept->size );
+}
+
+void CppUnitSlabPrefixCache::cold_slab() {
+    // Dalle froide : en-tête, index et première tuile en une seule lecture
+    read_tile("slab", 0);
+    CPPUNIT_ASSERT_EQUAL ( 1, context->reads.load() );
+    CPPUNIT_ASSERT_EQUAL ( 1, SlabPrefixCache::get_count() );
+
+    // Tuile contenue dans le début de dalle : pas de nouvelle lecture
+    read_tile("slab", 4);
+    CPPUNIT_ASSERT_EQUAL ( 1, context->reads.load() );
+
+    // Tuile au-delà
+    read_tile("slab", 5);
+    CPPUNIT_ASSERT_EQUAL ( 2, context->reads.load() );
+}
+
+void CppUnitSlabPrefixCache::disabled() {
+    SlabPrefixCache::set_prefix_size(0);
+    read_tile("slab", 0);
+    CPPUNIT_ASSERT_EQUAL ( 2, context->reads.load() );
+    CPPUNIT_ASSERT_EQUAL ( 0, SlabPrefixCache::get_count() );
+}
+
+void CppUnitSlabPrefixCache::tearDown() {
+    SlabPrefixCache::clean_prefixes();
+    IndexCache::clean_indexes();
+    SlabPrefixCache::set_prefix_size(0);
+    delete context;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <thread>
+#include <vector>
+
+#include "rok4/utils/StoragePool.h"
+
+class CppUnitStoragePool : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitStoragePool );
+
+    CPPUNIT_TEST ( same_context );
+    CPPUNIT_TEST ( concurrent_creation );
+    CPPUNIT_TEST ( snapshot );
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void same_context();
+    void concurrent_creation();
+    void snapshot();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitStoragePool );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitStoragePool, "CppUnitStoragePool" );
+
+void CppUnitStoragePool::tearDown() {
+    StoragePool::clean_storages();
+}
+
+void CppUnitStoragePool::same_context() {
+    Context* first = StoragePool::get_context(ContextType::FILECONTEXT, "/tmp");
+    CPPUNIT_ASSERT ( first != NULL );
+    CPPUNIT_ASSERT ( StoragePool::get_context(ContextType::FILECONTEXT, "/tmp") == first );
+    CPPUNIT_ASSERT ( StoragePool::get_context(ContextType::FILECONTEXT, "/var") != first );
+
+    int file_count, s3_count, ceph_count, swift_count;
+    StoragePool::get_storages_count(file_count, s3_count, ceph_count, swift_count);
+    CPPUNIT_ASSERT_EQUAL ( 2, file_count );
+}
+
+void CppUnitStoragePool::concurrent_creation() {
+    const int threads_count = 16;
+    std::vector<Context*> contexts (threads_count, NULL);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threads_count; i++) {
+        threads.push_back(std::thread([&contexts, i]() {
+            contexts.at(i) = StoragePool::get_context(ContextType::FILECONTEXT, "/tmp");
+        }));
+    }
+    for (int i = 0; i < threads_count; i++) threads.at(i).join();
+
+    // Un seul contexte est créé, partagé par tous les threads
+    CPPUNIT_ASSERT ( contexts.at(0) != NULL );
+    for (int i = 1; i < threads_count; i++) {
+        CPPUNIT_ASSERT ( contexts.at(i) == contexts.at(0) );
+    }
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, StoragePool::get_pool()->size() );
+}
+
+void CppUnitStoragePool::snapshot() {
+    Context* context = StoragePool::get_context(ContextType::FILECONTEXT, "/tmp");
+    std::shared_ptr<const std::map<std::pair<ContextType::eContextType,std::string>,Context*> > before = StoragePool::get_pool();
+
+    // Les ajouts publient un nouvel instantané, celui déjà obtenu n'est pas modifié
+    StoragePool::get_context(ContextType::FILECONTEXT, "/var");
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1, before->size() );
+    CPPUNIT_ASSERT ( before->at(std::make_pair(ContextType::FILECONTEXT, std::string("/tmp"))) == context );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 2, StoragePool::get_pool()->size() );
+}
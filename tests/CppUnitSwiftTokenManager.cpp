@@ -0,0 +1,179 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <chrono>
+#include <future>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "storage/SwiftTokenManager.h"
+
+class CppUnitSwiftTokenManager : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitSwiftTokenManager );
+
+    CPPUNIT_TEST ( shared_token );
+    CPPUNIT_TEST ( already_renewed );
+    CPPUNIT_TEST ( failed_renewal );
+    CPPUNIT_TEST ( asynchronous );
+    CPPUNIT_TEST ( no_wait_during_renewal );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    SwiftCredentials credentials;
+
+public:
+    void setUp();
+    void tearDown();
+
+    void shared_token();
+    void already_renewed();
+    void failed_renewal();
+    void asynchronous();
+    void no_wait_during_renewal();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitSwiftTokenManager );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitSwiftTokenManager, "CppUnitSwiftTokenManager" );
+
+void CppUnitSwiftTokenManager::setUp() {
+    // Service d'authentification injoignable : aucune authentification ne peut réussir
+    credentials.auth_url = "http://127.0.0.1:1/auth/v1.0";
+    credentials.user_account = "account";
+    credentials.user_name = "user";
+    credentials.user_passwd = "password";
+    credentials.timeout = 1;
+}
+
+void CppUnitSwiftTokenManager::tearDown() {
+    SwiftTokenManager::stop();
+}
+
+void CppUnitSwiftTokenManager::shared_token() {
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: first");
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: first"), SwiftTokenManager::get_token(credentials) );
+
+    // Un jeton déjà connu n'est pas remplacé
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: second");
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: first"), SwiftTokenManager::get_token(credentials) );
+
+    // D'autres identifiants ont leur propre jeton
+    SwiftCredentials other = credentials;
+    other.user_name = "other";
+    SwiftTokenManager::set_token(other, "X-Auth-Token: other");
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: other"), SwiftTokenManager::get_token(other) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: first"), SwiftTokenManager::get_token(credentials) );
+}
+
+void CppUnitSwiftTokenManager::already_renewed() {
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: current");
+
+    // Le jeton refusé a déjà été remplacé : le courant est retourné sans authentification
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: current"), SwiftTokenManager::renew_token(credentials, "X-Auth-Token: old") );
+}
+
+void CppUnitSwiftTokenManager::failed_renewal() {
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: current");
+
+    // Le jeton courant est refusé et l'authentification échoue : il n'est plus proposé
+    CPPUNIT_ASSERT_EQUAL ( std::string(""), SwiftTokenManager::renew_token(credentials, "X-Auth-Token: current") );
+    CPPUNIT_ASSERT_EQUAL ( std::string(""), SwiftTokenManager::get_token(credentials) );
+}
+
+void CppUnitSwiftTokenManager::asynchronous() {
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: current");
+
+    // Jeton utilisable : la fonction est appelée immédiatement, dans le thread appelant
+    std::thread::id caller;
+    SwiftTokenManager::get_token_async(credentials, "", [&caller](std::string token) {
+        CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: current"), token );
+        caller = std::this_thread::get_id();
+    });
+    CPPUNIT_ASSERT ( caller == std::this_thread::get_id() );
+
+    // Jeton refusé : l'authentification (en échec) est faite par un autre thread, l'appelant n'attend pas
+    std::shared_ptr<std::promise<std::string> > result = std::make_shared<std::promise<std::string> >();
+    std::shared_ptr<std::promise<std::thread::id> > worker = std::make_shared<std::promise<std::thread::id> >();
+    SwiftTokenManager::get_token_async(credentials, "X-Auth-Token: current", [result, worker](std::string token) {
+        worker->set_value(std::this_thread::get_id());
+        result->set_value(token);
+    });
+    CPPUNIT_ASSERT_EQUAL ( std::string(""), result->get_future().get() );
+    CPPUNIT_ASSERT ( worker->get_future().get() != std::this_thread::get_id() );
+}
+
+void CppUnitSwiftTokenManager::no_wait_during_renewal() {
+    // Service d'authentification qui accepte les connexions sans jamais répondre : l'authentification dure jusqu'au délai maximal
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    bind(server, (struct sockaddr*) &addr, sizeof(addr));
+    listen(server, 16);
+    socklen_t len = sizeof(addr);
+    getsockname(server, (struct sockaddr*) &addr, &len);
+    credentials.auth_url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/auth/v1.0";
+    credentials.timeout = 2;
+
+    SwiftTokenManager::set_token(credentials, "X-Auth-Token: current");
+
+    // Un demandeur dont le jeton a été refusé lance un renouvellement
+    std::future<std::string> renewal = std::async(std::launch::async, [this]() {
+        return SwiftTokenManager::renew_token(credentials, "X-Auth-Token: current");
+    });
+    CPPUNIT_ASSERT ( renewal.wait_for(std::chrono::milliseconds(300)) == std::future_status::timeout );
+
+    // Pendant ce temps, le jeton courant, ni expiré ni refusé par les autres, est rendu sans attente
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: current"), SwiftTokenManager::get_token(credentials) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("X-Auth-Token: current"), SwiftTokenManager::renew_token(credentials, "X-Auth-Token: old") );
+    CPPUNIT_ASSERT ( std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500) );
+    CPPUNIT_ASSERT ( renewal.wait_for(std::chrono::seconds(0)) == std::future_status::timeout );
+
+    // Le demandeur du renouvellement, lui, en attend le résultat (échec)
+    CPPUNIT_ASSERT_EQUAL ( std::string(""), renewal.get() );
+    close(server);
+}
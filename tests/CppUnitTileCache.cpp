@@ -0,0 +1,183 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <unistd.h>
+#include "rok4/utils/TileCache.h"
+#include "rok4/utils/ShardedLruCache.h"
+#include "storage/FileContext.h"
+
+// Élément minimal pour le cache générique
+struct TileCacheTestElement {
+    size_t size;
+    std::time_t date;
+    int version;
+
+    TileCacheTestElement(size_t s, int v) : size(s), date(std::time(NULL)), version(v) {}
+};
+
+// Politique d'admission refusant tout nouvel élément qui demande une éviction
+struct TileCacheRefuseAll {
+    void record_access(size_t /* hash */) {}
+    bool admit(size_t /* candidate */, size_t /* victim */) { return false; }
+    void clear() {}
+};
+
+class CppUnitTileCache : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitTileCache );
+
+    CPPUNIT_TEST ( hit_and_miss );
+    CPPUNIT_TEST ( validity );
+    CPPUNIT_TEST ( scan_resistance );
+    CPPUNIT_TEST ( replace_cached );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    FileContext* context;
+
+    // Lecture simulée d'une tuile de 1000 octets : consultation du cache puis ajout
+    std::shared_ptr<TileCacheElement> read_tile(std::string name) {
+        std::shared_ptr<TileCacheElement> elem = TileCache::get_tile(context, name, 2048, 1000);
+        if (elem) return elem;
+        uint8_t* data = new uint8_t[1000];
+        memset(data, name.size(), 1000);
+        return TileCache::add_tile(context, name, 2048, 1000, data, 1000);
+    }
+
+public:
+    void setUp();
+    void hit_and_miss();
+    void validity();
+    void scan_resistance();
+    void replace_cached();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitTileCache );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitTileCache, "CppUnitTileCache" );
+
+void CppUnitTileCache::setUp() {
+    context = new FileContext("");
+    TileCache::clean_tiles();
+    TileCache::set_memory_budget(1000000);
+    TileCache::set_validity(300);
+}
+
+void CppUnitTileCache::hit_and_miss() {
+    std::shared_ptr<TileCacheElement> first = read_tile("slab");
+    CPPUNIT_ASSERT_EQUAL ( 0L, TileCache::get_hits() );
+    CPPUNIT_ASSERT_EQUAL ( 1L, TileCache::get_misses() );
+
+    std::shared_ptr<TileCacheElement> second = read_tile("slab");
+    CPPUNIT_ASSERT_EQUAL ( 1L, TileCache::get_hits() );
+    CPPUNIT_ASSERT_MESSAGE ( "Cached data is not shared", first->data.get() == second->data.get() );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1000, TileCache::get_memory() );
+
+    // Même dalle, autre tuile
+    CPPUNIT_ASSERT ( ! TileCache::get_tile(context, "slab", 3048, 1000) );
+    CPPUNIT_ASSERT_EQUAL ( 2L, TileCache::get_misses() );
+
+    // Cache désactivé
+    TileCache::set_memory_budget(0);
+    CPPUNIT_ASSERT ( ! TileCache::get_tile(context, "slab", 2048, 1000) );
+}
+
+void CppUnitTileCache::validity() {
+    read_tile("slab");
+    TileCache::set_validity(0);
+    sleep(1);
+    CPPUNIT_ASSERT_MESSAGE ( "Expired tile is served", ! TileCache::get_tile(context, "slab", 2048, 1000) );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 0, TileCache::get_memory() );
+}
+
+void CppUnitTileCache::scan_resistance() {
+    // Une seule tuile par partition
+    TileCache::set_memory_budget(1000 * ROK4_TILE_CACHE_SHARDS);
+
+    for (int i = 0; i < 5; i++) read_tile("popular");
+    std::shared_ptr<TileCacheElement> popular = read_tile("popular");
+
+    // Moissonnage : de nombreuses tuiles demandées une seule fois
+    for (int i = 0; i < 500; i++) read_tile("scan_" + std::to_string(i));
+
+    long hits = TileCache::get_hits();
+    std::shared_ptr<TileCacheElement> again = TileCache::get_tile(context, "popular", 2048, 1000);
+    CPPUNIT_ASSERT_MESSAGE ( "Popular tile evicted by a scan", again );
+    CPPUNIT_ASSERT_EQUAL ( hits + 1, TileCache::get_hits() );
+    CPPUNIT_ASSERT ( TileCache::get_memory() <= 1000 * ROK4_TILE_CACHE_SHARDS );
+
+    // Une donnée sortie du cache reste valide pour qui la détient
+    TileCache::clean_tiles();
+    CPPUNIT_ASSERT_EQUAL ( (uint8_t) 7, popular->data[999] );
+}
+
+void CppUnitTileCache::replace_cached() {
+    ShardedLruCache<std::string, TileCacheTestElement, 1, TileCacheRefuseAll> cache(3000, 300);
+
+    CPPUNIT_ASSERT ( cache.add("a", std::make_shared<TileCacheTestElement>(1000, 1)) );
+    CPPUNIT_ASSERT ( cache.add("b", std::make_shared<TileCacheTestElement>(1000, 1)) );
+    CPPUNIT_ASSERT ( cache.add("c", std::make_shared<TileCacheTestElement>(1000, 1)) );
+
+    // Cache plein : un nouvel élément est refusé par l'admission, sans toucher aux présents
+    CPPUNIT_ASSERT ( ! cache.add("d", std::make_shared<TileCacheTestElement>(1000, 1)) );
+    CPPUNIT_ASSERT ( cache.get("a") && cache.get("b") && cache.get("c") );
+
+    // Un élément déjà en cache est remplacé sur place, même plus grand, les moins récents faisant la place
+    cache.get("b");
+    CPPUNIT_ASSERT ( cache.add("a", std::make_shared<TileCacheTestElement>(1500, 2)) );
+    std::shared_ptr<TileCacheTestElement> a = cache.get("a");
+    CPPUNIT_ASSERT ( a );
+    CPPUNIT_ASSERT_EQUAL ( 2, a->version );
+    CPPUNIT_ASSERT ( ! cache.get("c") );
+    CPPUNIT_ASSERT ( cache.get("b") );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 2500, cache.get_memory() );
+
+    // Remplacement par un élément plus petit
+    CPPUNIT_ASSERT ( cache.add("a", std::make_shared<TileCacheTestElement>(500, 3)) );
+    CPPUNIT_ASSERT_EQUAL ( 3, cache.get("a")->version );
+    CPPUNIT_ASSERT_EQUAL ( (size_t) 1500, cache.get_memory() );
+}
+
+void CppUnitTileCache::tearDown() {
+    TileCache::clean_tiles();
+    TileCache::set_memory_budget(0);
+    delete context;
+}
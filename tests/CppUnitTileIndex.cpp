@@ -0,0 +1,140 @@
+/*
+ * Copyright © (2011) Institut national de l'information
+ *                    géographique et forestière
+ *
+ * Géoportail SAV <contact.geoservices@ign.fr>
+ *
+ * This software is a computer program whose purpose is to publish geographic
+ * data using OGC WMS and WMTS protocol.
+ *
+ * This software is governed by the CeCILL-C license under French law and
+ * abiding by the rules of distribution of free software.  You can  use,
+ * modify and/ or redistribute the software under the terms of the CeCILL-C
+ * license as circulated by CEA, CNRS and INRIA at the following URL
+ * "http://www.cecill.info".
+ *
+ * As a counterpart to the access to the source code and  rights to copy,
+ * modify and redistribute granted by the license, users are provided only
+ * with a limited warranty  and the software's author,  the holder of the
+ * economic rights,  and the successive licensors  have only  limited
+ * liability.
+ *
+ * In this respect, the user's attention is drawn to the risks associated
+ * with loading,  using,  modifying and/or developing or reproducing the
+ * software by the user in light of its specific status of free software,
+ * that may mean  that it is complicated to manipulate,  and  that  also
+ * therefore means  that it is reserved for developers  and  experienced
+ * professionals having in-depth computer knowledge. Users are therefore
+ * encouraged to load and test the software's suitability as regards their
+ * requirements in conditions enabling the security of their systems and/or
+ * data to be ensured and,  more generally, to use and operate it in the
+ * same conditions as regards security.
+ *
+ * The fact that you are presently reading this means that you have had
+ *
+ * knowledge of the CeCILL-C license and that you accept its terms.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include "rok4/utils/TileIndex.h"
+#include "storage/FileContext.h"
+
+class CppUnitTileIndex : public CPPUNIT_NS::TestFixture {
+
+    CPPUNIT_TEST_SUITE ( CppUnitTileIndex );
+
+    CPPUNIT_TEST ( build_and_get );
+    CPPUNIT_TEST ( write_and_load );
+    CPPUNIT_TEST ( invalid_file );
+
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    std::string index_path;
+    FileContext* context;
+
+    // Dalle de 2x2 tuiles, la dernière étant absente
+    uint32_t offsets[4] = { 2080, 2180, 2280, 0 };
+    uint32_t sizes[4] = { 100, 100, 50, 0 };
+
+public:
+    void setUp();
+    void build_and_get();
+    void write_and_load();
+    void invalid_file();
+    void tearDown();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( CppUnitTileIndex );
+CPPUNIT_TEST_SUITE_NAMED_REGISTRATION ( CppUnitTileIndex, "CppUnitTileIndex" );
+
+void CppUnitTileIndex::setUp() {
+    index_path = "/tmp/CppUnitTileIndex.idx";
+    context = new FileContext("");
+}
+
+void CppUnitTileIndex::build_and_get() {
+    TileIndex ti (10, 20, 4, 4);
+    ti.add_slab("slab_A", 10, 20, 2, 2, offsets, sizes);
+    // Dalle débordant de l'emprise indexée
+    ti.add_slab("slab_B", 13, 23, 2, 2, offsets, sizes);
+
+    CPPUNIT_ASSERT_EQUAL ( 2, ti.get_slabs_count() );
+
+    std::string slab;
+    uint32_t offset, size;
+    CPPUNIT_ASSERT ( ti.get_tile(11, 21, slab, offset, size) == false );
+    CPPUNIT_ASSERT ( ti.get_tile(10, 21, slab, offset, size) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("slab_A"), slab );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 2280, offset );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 50, size );
+
+    CPPUNIT_ASSERT ( ti.get_tile(13, 23, slab, offset, size) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("slab_B"), slab );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 2080, offset );
+
+    CPPUNIT_ASSERT ( ti.get_tile(12, 22, slab, offset, size) == false );
+    CPPUNIT_ASSERT ( ti.get_tile(14, 23, slab, offset, size) == false );
+    CPPUNIT_ASSERT ( ti.get_tile(9, 20, slab, offset, size) == false );
+}
+
+void CppUnitTileIndex::write_and_load() {
+    TileIndex ti (0, 0, 4, 2);
+    ti.add_slab("dir/slab_0_0", 0, 0, 2, 2, offsets, sizes);
+    ti.add_slab("dir/slab_1_0", 2, 0, 2, 2, offsets, sizes);
+    CPPUNIT_ASSERT ( ti.write(context, index_path) );
+
+    TileIndex* loaded = TileIndex::load(context, index_path);
+    CPPUNIT_ASSERT_MESSAGE ( "Tile index cannot be loaded", loaded != NULL );
+    CPPUNIT_ASSERT_EQUAL ( 2, loaded->get_slabs_count() );
+
+    std::string slab;
+    uint32_t offset, size;
+    CPPUNIT_ASSERT ( loaded->get_tile(3, 0, slab, offset, size) );
+    CPPUNIT_ASSERT_EQUAL ( std::string("dir/slab_1_0"), slab );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 2180, offset );
+    CPPUNIT_ASSERT_EQUAL ( (uint32_t) 100, size );
+    CPPUNIT_ASSERT ( loaded->get_tile(1, 1, slab, offset, size) == false );
+
+    delete loaded;
+}
+
+void CppUnitTileIndex::invalid_file() {
+    std::string invalid_path = "/tmp/CppUnitTileIndex_invalid.idx";
+    std::ofstream ofs(invalid_path, std::ios::trunc | std::ios::binary);
+    ofs << "NOTANINDEX, but long enough to contain an header";
+    ofs.close();
+
+    CPPUNIT_ASSERT ( TileIndex::load(context, invalid_path) == NULL );
+    remove(invalid_path.c_str());
+    CPPUNIT_ASSERT ( TileIndex::load(context, "/tmp/CppUnitTileIndex_missing.idx") == NULL );
+}
+
+void CppUnitTileIndex::tearDown() {
+    delete context;
+    remove(index_path.c_str());
+}